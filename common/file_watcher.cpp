@@ -1,198 +1,389 @@
 #include "file_watcher.h"
 
-#include <atomic>
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
-#ifdef __has_include
-#if __has_include(<pthread.h>)
-#include <pthread.h>
-#define POSIX_THREADS 1
-#endif
-#else
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <thread>
-#define POSIX_THREADS 0
+#include <tuple>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 #endif
-#include <immintrin.h>
 
 #include "min_windows.h"
 
-struct thread_args
+using Clock = std::chrono::steady_clock;
+
+// Saving a file is usually several writes, and tools often replace it through a temporary one. Changes are held back
+// until the directories have been quiet this long, so they're reported once and only after the file is complete.
+static constexpr auto DEBOUNCE_INTERVAL = std::chrono::milliseconds(100);
+
+struct Watch
 {
-    std::string path;
-    void *(* callback)(void *);
+    std::filesystem::path path;
+    FileWatcherCallback callback;
     void *arg;
-};
+    std::set<std::string> changedFiles;
 
-#ifdef POSIX_THREADS
-static pthread_t fileWatcherThread;
-#else
-static HANDLE fileWatcherHandle;
+#ifdef _WIN32
+    HANDLE directory;
+    OVERLAPPED overlapped;
+    alignas(DWORD) uint8_t buffer[16384];
+#elif defined(__linux__)
+    int descriptor;
 #endif
+};
 
-static thread_args threadArgs{};
-static bool fileWatcherRunning = false;
+// Guards watches, the watcher thread reads them while new directories are added
+static std::mutex watchesMutex;
+static std::vector<std::unique_ptr<Watch>> watches;
+static std::thread watcherThread;
+static Clock::time_point lastChange{};
+static bool hasChanges = false;
 
-static HANDLE hDir;
-// static OVERLAPPED overlapped;
+#ifdef _WIN32
+// stopEvent ends the thread, wakeEvent has it pick up newly added directories
+static HANDLE stopEvent;
+static HANDLE wakeEvent;
+#elif defined(__linux__)
+static int inotifyFd = -1;
+static int epollFd = -1;
+// Written to stop the thread, so nothing is closed while it's blocked on it
+static int stopFd = -1;
+#endif
 
-void fileWatcherInit(thread_args *args)
+static void recordChange(Watch &watch, const std::filesystem::path &name)
 {
-    const auto [pathStr, callback, arg] = *args;
-    const auto path = pathStr.c_str();
-    hDir = FindFirstChangeNotification(path, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_CREATION);
-    if (hDir == INVALID_HANDLE_VALUE)
-    {
-        fprintf(stderr, "Failed to open directory \"%s\" with error code: %x\n", path, HRESULT_FROM_WIN32(GetLastError()));
-        return;
-    }
+    watch.changedFiles.insert((watch.path / name).string());
+    lastChange = Clock::now();
+    hasChanges = true;
+}
 
-    printf("Watching directory \"%s\"\n", path);
-
-    // hDir = CreateFileW(path,
-    //     FILE_LIST_DIRECTORY,
-    //     FILE_SHARE_READ,
-    //     nullptr,
-    //     OPEN_EXISTING,
-    //     FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
-    //     nullptr
-    // );
-    //
-    // if (hDir == INVALID_HANDLE_VALUE)
-    // {
-    //     fprintf(stderr, "Failed to open directory \"%ls\"\n", path);
-    //     return;
-    // }
-    //
-    // FILE_NOTIFY_INFORMATION buffer[1024];
-    // DWORD bytesReturned;
-    //
-    // ZeroMemory(&overlapped, sizeof(overlapped));
-    // overlapped.hEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    // if (overlapped.hEvent == nullptr)
-    // {
-    //     fprintf(stderr, "Failed to create event\n");
-    //     CloseHandle(hDir);
-    //     return;
-    // }
-
-    while (fileWatcherRunning)
+static void flushChanges()
+{
+    std::vector<std::tuple<FileWatcherCallback, void *, std::vector<std::string>>> ready;
     {
-        switch (WaitForSingleObject(hDir, INFINITE))
+        std::lock_guard lock(watchesMutex);
+        for (const auto &watch : watches)
         {
-            case WAIT_OBJECT_0:
-            case WAIT_OBJECT_0 + 1:
-                callback(arg);
-                break;
-            default:
-                fprintf(stderr, "Failed to wait for file \"%s\"\n", path);
-                break;
-        }
+            if (watch->changedFiles.empty())
+                continue;
 
-        FindNextChangeNotification(hDir);
-        // WINBOOL success = ReadDirectoryChangesW(
-        //     hDir,
-        //     buffer,
-        //     sizeof(buffer),
-        //     TRUE,
-        //     FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_CREATION,
-        //     &bytesReturned,
-        //     &overlapped,
-        //     nullptr
-        // );
-        // convert LPCWSTR to LPCSTR
-
-        // if (!success)
-        // {
-        //     fprintf(stderr, "Failed to read directory changes: %d\n", GetLastError());
-        //     break;
-        // }
-
-        // if (GetOverlappedResultEx(&hDir, &overlapped, &bytesReturned, INFINITE, FALSE))
-        // {
-        //     uint32_t offset = 0;
-        //     PFILE_NOTIFY_INFORMATION info;
-        //     do
-        //     {
-        //         info = &buffer[offset];
-        //         printf("File changed: %ls\n", info->FileName);
-        //         offset += info->NextEntryOffset;
-        //     } while (info->NextEntryOffset != 0);
-        //
-        //     callback(arg);
-        //     ResetEvent(overlapped.hEvent);
-        // }
-        // else
-        // {
-        //     fprintf(stderr, "Wait for event failed: %x\n", HRESULT_FROM_WIN32(GetLastError()));
-        // }
+            ready.emplace_back(watch->callback, watch->arg, std::vector(watch->changedFiles.begin(), watch->changedFiles.end()));
+            watch->changedFiles.clear();
+        }
     }
 
-    // CloseHandle(overlapped.hEvent);
-    CloseHandle(hDir);
+    hasChanges = false;
+
+    // Outside the lock, so a callback can add another directory
+    for (const auto &[callback, arg, changedFiles] : ready)
+        callback(changedFiles, arg);
 }
 
-void addFileWatcher(std::string path, void *(*callback)(void *), void *arg)
+// How long the thread may block before the pending changes are due, in ms
+static int debounceTimeout()
 {
-#ifdef POSIX_THREADS
-    if (fileWatcherThread) return;
+    if (!hasChanges)
+        return -1;
 
-    threadArgs.path = path;
-    threadArgs.callback = callback;
-    threadArgs.arg = arg;
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(lastChange + DEBOUNCE_INTERVAL - Clock::now());
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+}
 
-    fileWatcherRunning = true;
-    pthread_create(&fileWatcherThread, nullptr, reinterpret_cast<void *(*)(void *)>(fileWatcherInit), &threadArgs);
-#else
-    if (fileWatcherHandle) return;
+#ifdef _WIN32
+static bool readChanges(Watch &watch)
+{
+    ResetEvent(watch.overlapped.hEvent);
+    return ReadDirectoryChangesW(
+        watch.directory,
+        watch.buffer,
+        sizeof(watch.buffer),
+        FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_CREATION,
+        nullptr,
+        &watch.overlapped,
+        nullptr
+    );
+}
+
+static void fileWatcherLoop()
+{
+    std::vector<HANDLE> handles;
+    std::vector<Watch *> handleWatches;
+
+    while (true)
+    {
+        handles = {stopEvent, wakeEvent};
+        handleWatches.clear();
+        {
+            std::lock_guard lock(watchesMutex);
+            for (const auto &watch : watches)
+            {
+                handles.push_back(watch->overlapped.hEvent);
+                handleWatches.push_back(watch.get());
+            }
+        }
+
+        const int timeout = debounceTimeout();
+        const DWORD result = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, timeout < 0 ? INFINITE : static_cast<DWORD>(timeout));
 
-    threadArgs.path = path;
-    threadArgs.callback = callback;
-    threadArgs.arg = arg;
+        if (result == WAIT_TIMEOUT)
+        {
+            flushChanges();
+            continue;
+        }
+
+        if (result == WAIT_OBJECT_0)
+            break;
+
+        if (result == WAIT_OBJECT_0 + 1)
+            continue;
 
-    fileWatcherRunning = true;
+        if (result == WAIT_FAILED || result >= WAIT_OBJECT_0 + handles.size())
+        {
+            fprintf(stderr, "Failed to wait for directory changes: %x\n", HRESULT_FROM_WIN32(GetLastError()));
+            break;
+        }
 
-    fileWatcherHandle = CreateThread(
+        auto &watch = *handleWatches[result - WAIT_OBJECT_0 - 2];
+
+        DWORD bytesReturned;
+        if (GetOverlappedResult(watch.directory, &watch.overlapped, &bytesReturned, FALSE))
+        {
+            std::lock_guard lock(watchesMutex);
+
+            // Zero bytes means the buffer overflowed and the changes were dropped
+            if (bytesReturned == 0)
+                recordChange(watch, "");
+
+            for (DWORD offset = 0; bytesReturned != 0;)
+            {
+                const auto *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(watch.buffer + offset);
+                recordChange(watch, std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+
+                if (info->NextEntryOffset == 0)
+                    break;
+
+                offset += info->NextEntryOffset;
+            }
+        }
+
+        if (!readChanges(watch))
+            fprintf(stderr, "Failed to read changes of \"%s\": %x\n", watch.path.string().c_str(), HRESULT_FROM_WIN32(GetLastError()));
+    }
+}
+
+void addFileWatcher(const std::string &path, FileWatcherCallback callback, void *arg)
+{
+    if (!watcherThread.joinable())
+    {
+        stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        watcherThread = std::thread(fileWatcherLoop);
+    }
+
+    auto watch = std::make_unique<Watch>(path, callback, arg);
+    watch->directory = CreateFileA(
+        path.c_str(),
+        FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
         nullptr,
-        0,
-        reinterpret_cast<LPTHREAD_START_ROUTINE>(fileWatcherInit),
-        &threadArgs,
-        0,
-        nullptr);
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+        nullptr
+    );
 
-    if (fileWatcherHandle == nullptr)
+    if (watch->directory == INVALID_HANDLE_VALUE)
     {
-        fprintf(stderr, "Failed to create file watcher thread: %d\n", GetLastError());
+        fprintf(stderr, "Failed to open directory \"%s\" with error code: %x\n", path.c_str(), HRESULT_FROM_WIN32(GetLastError()));
         return;
     }
-#endif
+
+    watch->overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!readChanges(*watch))
+    {
+        fprintf(stderr, "Failed to read changes of \"%s\": %x\n", path.c_str(), HRESULT_FROM_WIN32(GetLastError()));
+        CloseHandle(watch->overlapped.hEvent);
+        CloseHandle(watch->directory);
+        return;
+    }
+
+    {
+        std::lock_guard lock(watchesMutex);
+        watches.push_back(std::move(watch));
+    }
+
+    SetEvent(wakeEvent);
+    printf("Watching directory \"%s\"\n", path.c_str());
 }
 
 void removeFileWatcher()
 {
-    if (!fileWatcherRunning) return;
+    if (!watcherThread.joinable()) return;
+
+    SetEvent(stopEvent);
+    watcherThread.join();
+
+    for (const auto &watch : watches)
+    {
+        // The read has to be cancelled and finished before its buffer goes away
+        DWORD bytesReturned;
+        CancelIoEx(watch->directory, &watch->overlapped);
+        GetOverlappedResult(watch->directory, &watch->overlapped, &bytesReturned, TRUE);
 
-    fileWatcherRunning = false;
+        CloseHandle(watch->overlapped.hEvent);
+        CloseHandle(watch->directory);
+    }
+
+    watches.clear();
+    hasChanges = false;
 
-    // CancelIoEx(hDir, &overlapped);
-    // if (overlapped.hEvent != INVALID_HANDLE_VALUE)
-    // {
-    //     CloseHandle(overlapped.hEvent);
-    //     overlapped.hEvent = INVALID_HANDLE_VALUE;
-    // }
+    CloseHandle(stopEvent);
+    CloseHandle(wakeEvent);
+}
+#elif defined(__linux__)
+static void fileWatcherLoop()
+{
+    alignas(inotify_event) char buffer[16384];
 
-    if (hDir != INVALID_HANDLE_VALUE)
+    while (true)
     {
-        CloseHandle(hDir);
-        hDir = INVALID_HANDLE_VALUE;
+        epoll_event events[2];
+        const int count = epoll_wait(epollFd, events, 2, debounceTimeout());
+
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "Failed to wait for directory changes: %d\n", errno);
+            break;
+        }
+
+        if (count == 0)
+        {
+            flushChanges();
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.fd == stopFd)
+                return;
+
+            // Drained until it would block, the descriptor is non-blocking
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                std::lock_guard lock(watchesMutex);
+                for (const char *event = buffer; event < buffer + length;)
+                {
+                    const auto *info = reinterpret_cast<const inotify_event *>(event);
+                    event += sizeof(inotify_event) + info->len;
+
+                    // A directory can be watched for more than one caller, they share the descriptor
+                    for (const auto &watch : watches)
+                    {
+                        if (watch->descriptor == info->wd || info->mask & IN_Q_OVERFLOW)
+                            recordChange(*watch, info->len ? info->name : "");
+                    }
+                }
+            }
+        }
     }
+}
 
-#ifdef POSIX_THREADS
-    pthread_join(fileWatcherThread, nullptr);
-#else
-    WaitForSingleObject(fileWatcherHandle, INFINITE);
-    CloseHandle(fileWatcherHandle);
-    fileWatcherHandle = nullptr;
-#endif
+// Closing the inotify descriptor removes its watches
+static void closeDescriptors()
+{
+    for (const int fd : {inotifyFd, epollFd, stopFd})
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    inotifyFd = epollFd = stopFd = -1;
+}
+
+void addFileWatcher(const std::string &path, FileWatcherCallback callback, void *arg)
+{
+    if (!watcherThread.joinable())
+    {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        stopFd = eventfd(0, EFD_CLOEXEC);
+
+        if (inotifyFd < 0 || epollFd < 0 || stopFd < 0)
+        {
+            fprintf(stderr, "Failed to create the file watcher: %d\n", errno);
+            closeDescriptors();
+            return;
+        }
+
+        // Without either the thread never wakes up for changes or never stops
+        epoll_event event{EPOLLIN};
+        event.data.fd = inotifyFd;
+        bool registered = epoll_ctl(epollFd, EPOLL_CTL_ADD, inotifyFd, &event) == 0;
+        event.data.fd = stopFd;
+        registered = registered && epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &event) == 0;
+
+        if (!registered)
+        {
+            fprintf(stderr, "Failed to set up the file watcher: %d\n", errno);
+            closeDescriptors();
+            return;
+        }
+
+        watcherThread = std::thread(fileWatcherLoop);
+    }
+
+    // Written files are reported once closed rather than on every write
+    const int descriptor = inotify_add_watch(inotifyFd, path.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    if (descriptor < 0)
+    {
+        fprintf(stderr, "Failed to open directory \"%s\" with error code: %d\n", path.c_str(), errno);
+        return;
+    }
+
+    auto watch = std::make_unique<Watch>(path, callback, arg);
+    watch->descriptor = descriptor;
+    {
+        std::lock_guard lock(watchesMutex);
+        watches.push_back(std::move(watch));
+    }
+
+    printf("Watching directory \"%s\"\n", path.c_str());
 }
 
+void removeFileWatcher()
+{
+    if (!watcherThread.joinable()) return;
+
+    constexpr uint64_t stop = 1;
+    if (write(stopFd, &stop, sizeof(stop)) < 0)
+        fprintf(stderr, "Failed to stop the file watcher: %d\n", errno);
+    watcherThread.join();
 
+    closeDescriptors();
+
+    watches.clear();
+    hasChanges = false;
+}
+#else
+void addFileWatcher(const std::string &path, FileWatcherCallback, void *)
+{
+    fprintf(stderr, "No file watcher on this platform, \"%s\" isn't watched\n", path.c_str());
+}
+
+void removeFileWatcher() {}
+#endif
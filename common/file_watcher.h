@@ -2,8 +2,16 @@
 #define FILE_WATCHER_H
 
 #include <string>
+#include <vector>
 
-void addFileWatcher(std::string path, void *(* callback)(void *), void *arg);
+// Runs on the watcher thread once a directory has been quiet for a moment, with the full path of every file in it that
+// was written, created, renamed or removed since the last call. When the system dropped events, the directory itself is
+// reported in their place.
+using FileWatcherCallback = void (*)(const std::vector<std::string> &changedFiles, void *arg);
+
+// Watches the files directly inside path, can be called for several directories
+void addFileWatcher(const std::string &path, FileWatcherCallback callback, void *arg);
+// Stops watching every directory
 void removeFileWatcher();
 
 #endif
@@ -0,0 +1,97 @@
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <immintrin.h>
+
+#include "min_windows.h"
+
+FramePacer::FramePacer() {
+#ifdef _WIN32
+    timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    // Before Windows 10 1803 only the regular timer exists
+    if (!timer)
+        timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+#endif
+    SetTargetFrameRate(targetFrameRate);
+    nextFrame = lastFrame = Clock::now();
+}
+
+FramePacer::~FramePacer() {
+#ifdef _WIN32
+    if (timer)
+        CloseHandle(timer);
+#endif
+}
+
+void FramePacer::SetTargetFrameRate(const uint16_t fps) {
+    targetFrameRate = fps;
+    period = fps ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps)) : Clock::duration::zero();
+}
+
+float FramePacer::Wait() {
+    if (targetFrameRate) {
+        if (Clock::now() > nextFrame + period)
+            nextFrame = Clock::now();
+        else
+            SleepUntil(nextFrame);
+
+        nextFrame += period;
+    }
+
+    const auto now = Clock::now();
+    const float frameTime = std::chrono::duration<float, std::milli>(now - lastFrame).count();
+    lastFrame = now;
+
+    frameTimes[frameTimeIndex] = frameTime;
+    frameTimeIndex = (frameTimeIndex + 1) % FRAME_TIME_WINDOW;
+    frameTimeCount = std::min(frameTimeCount + 1, FRAME_TIME_WINDOW);
+
+    return frameTime;
+}
+
+float FramePacer::FrameTimeMean() const {
+    if (!frameTimeCount)
+        return 0.0f;
+
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < frameTimeCount; i++)
+        sum += frameTimes[i];
+
+    return sum / static_cast<float>(frameTimeCount);
+}
+
+float FramePacer::FrameTimeDeviation() const {
+    if (!frameTimeCount)
+        return 0.0f;
+
+    const float mean = FrameTimeMean();
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < frameTimeCount; i++)
+        sum += (frameTimes[i] - mean) * (frameTimes[i] - mean);
+
+    return std::sqrt(sum / static_cast<float>(frameTimeCount));
+}
+
+void FramePacer::SleepUntil(const Clock::time_point deadline) {
+    const auto wake = deadline - sleepOvershoot;
+    if (const auto now = Clock::now(); wake > now) {
+#ifdef _WIN32
+        // Relative due time in 100ns units
+        const LARGE_INTEGER dueTime{.QuadPart = -std::max<LONGLONG>(std::chrono::duration_cast<std::chrono::nanoseconds>(wake - now).count() / 100, 1)};
+        if (timer && SetWaitableTimerEx(timer, &dueTime, 0, nullptr, nullptr, nullptr, 0))
+            WaitForSingleObject(timer, INFINITE);
+        else
+            std::this_thread::sleep_until(wake);
+#else
+        std::this_thread::sleep_until(wake);
+#endif
+        // Slowly forgets a bad wake up, so one descheduled sleep doesn't leave the pacer spinning for good
+        const auto overshoot = std::max(Clock::now() - wake, Clock::duration::zero());
+        sleepOvershoot = std::max(overshoot, sleepOvershoot - sleepOvershoot / 16);
+    }
+
+    while (Clock::now() < deadline)
+        _mm_pause();
+}
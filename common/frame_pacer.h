@@ -0,0 +1,52 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Holds each frame back until its slot in a fixed schedule comes up. Most of the wait is slept, the last stretch is spun
+// on the clock since a sleep can overshoot by more than a millisecond. How much is left to spin follows the overshoot
+// the sleeps actually had. A frame that ran long moves the schedule instead of having the next ones rush to catch up.
+class FramePacer {
+public:
+    FramePacer();
+    ~FramePacer();
+    FramePacer(const FramePacer &) = delete;
+    FramePacer &operator=(const FramePacer &) = delete;
+
+    // 0 leaves the frame rate to presentation
+    void SetTargetFrameRate(uint16_t fps);
+    [[nodiscard]] uint16_t TargetFrameRate() const { return targetFrameRate; }
+
+    // Blocks until the next frame is due and returns the time since the previous one was, in ms. Input should be
+    // sampled right after, so it's as fresh as possible by the time the frame is submitted.
+    float Wait();
+
+    // Over the last FRAME_TIME_WINDOW frames, in ms
+    [[nodiscard]] float FrameTimeMean() const;
+    [[nodiscard]] float FrameTimeDeviation() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr uint32_t FRAME_TIME_WINDOW = 120;
+
+    void SleepUntil(Clock::time_point deadline);
+
+    uint16_t targetFrameRate = 60;
+    Clock::duration period{};
+    Clock::time_point nextFrame{};
+    Clock::time_point lastFrame{};
+    Clock::duration sleepOvershoot{std::chrono::milliseconds(1)};
+
+    std::array<float, FRAME_TIME_WINDOW> frameTimes{};
+    uint32_t frameTimeIndex = 0;
+    uint32_t frameTimeCount = 0;
+
+#ifdef _WIN32
+    // High resolution waitable timer, Sleep is tied to the system timer resolution
+    void *timer{};
+#endif
+};
+
+#endif //FRAME_PACER_H
@@ -0,0 +1,16 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <string_view>
+
+static constexpr uint64_t FNV1A_OFFSET_BASIS = 0xCBF29CE484222325;
+
+// FNV-1a. Passing the previous result as hash continues it, so several pieces hash as if they were one.
+constexpr uint64_t HashFnv1a(const std::string_view data, uint64_t hash = FNV1A_OFFSET_BASIS) {
+    for (const char c : data)
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3;
+    return hash;
+}
+
+#endif //HASH_H
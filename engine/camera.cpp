@@ -25,10 +25,19 @@ glm::mat4 Camera::ViewMatrix() const {
 }
 
 glm::mat4 Camera::ProjectionMatrix() {
+    // Shifts clip space x and y by the jitter times w, so NDC moves by the jitter at every depth
+    auto jittered = UnjitteredProjectionMatrix();
+    jittered[2][0] -= jitter.x;
+    jittered[2][1] -= jitter.y;
+    return jittered;
+}
+
+glm::mat4 Camera::UnjitteredProjectionMatrix() {
     if (needsUpdate) {
         projectionMatrix = glm::perspective(glm::radians(fov), aspectRatio, nearPlane, farPlane);
         projectionMatrix[1][1] *= -1;
         needsUpdate = false;
+        projectionVersion++;
     }
 
     return projectionMatrix;
@@ -77,6 +86,21 @@ void Camera::ProcessMouseInput(double xpos, double ypos) {
     UpdateVectors();
 }
 
+void Camera::ProcessCursorPosition(const double xpos, const double ypos) {
+    if (!hasCursor) {
+        lastCursor = {xpos, ypos};
+        hasCursor = true;
+    }
+
+    const double xOffset = xpos - lastCursor.x;
+    const double yOffset = lastCursor.y - ypos;
+
+    lastCursor = {xpos, ypos};
+
+    if (xOffset != 0.0 || yOffset != 0.0)
+        ProcessMouseInput(xOffset, yOffset);
+}
+
 void Camera::UpdateVectors() {
     // position += glm::vec3(RotationMatrix() * glm::vec4(velocity * 0.5f, 0.f));
     front = normalize(glm::vec3(cos(glm::radians(yaw)) * cos(glm::radians(pitch)), sin(glm::radians(pitch)), sin(glm::radians(yaw)) * cos(glm::radians(pitch))));
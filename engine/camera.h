@@ -10,11 +10,22 @@ public:
     Camera(float posX, float posY, float posZ);
 
     [[nodiscard]] glm::mat4 ViewMatrix() const;
+    // Offset by the jitter, for everything that rasterizes or traces the scene
     [[nodiscard]] glm::mat4 ProjectionMatrix();
+    // For what has to stay put from frame to frame, like the light clusters, shadow cascades and motion vectors
+    [[nodiscard]] glm::mat4 UnjitteredProjectionMatrix();
     [[nodiscard]] float Fov() const { return fov; }
+    // Bumped every time the projection matrix is rebuilt
+    [[nodiscard]] uint32_t ProjectionVersion() const { return projectionVersion; }
+    // Sub-pixel offset of the projection in NDC, a new one every frame doesn't count as a projection change
+    [[nodiscard]] glm::vec2 Jitter() const { return jitter; }
+    void SetJitter(const glm::vec2 &offset) { jitter = offset; }
 
     void ProcessKeyboardInput(int key, int action, float deltaTime);
     void ProcessMouseInput(double xpos, double ypos);
+    // Turns cursor positions into ProcessMouseInput offsets. The cursor callback and the renderer's late latch share it,
+    // so movement one of them already applied isn't applied again by the other.
+    void ProcessCursorPosition(double xpos, double ypos);
     void UpdateVectors();
 
     void UpdateAspectRatio(float newWidth, float newHeight);
@@ -26,6 +37,11 @@ public:
         fov = newFov;
         needsUpdate = true;
     }
+    void setClipPlanes(float newNear, float newFar) {
+        nearPlane = newNear;
+        farPlane = newFar;
+        needsUpdate = true;
+    }
 
     double pitch{0.};
     double yaw{180.};
@@ -40,11 +56,15 @@ public:
     float farPlane{1000.f};
 private:
     glm::mat4 projectionMatrix;
+    glm::vec2 jitter{};
+    glm::dvec2 lastCursor{};
+    bool hasCursor{false};
 
     float fov{90.f};
     float aspectRatio{16.f / 9.f};
 
     bool needsUpdate{true};
+    uint32_t projectionVersion{};
 
     std::vector<std::function<void()>> onUpdateCallbacks;
 };
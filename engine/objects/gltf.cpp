@@ -176,13 +176,13 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
 
     fastgltf::Asset gltf = std::move(load.get());
 
+    // A single bindless set holds every material of the scene
     static constexpr DescriptorAllocator::PoolSizeRatio sizes[] = {
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VkGLTFMetallic_Roughness::MAX_BINDLESS_TEXTURES},
         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}
     };
 
-    scene.descriptorAllocator.InitPool(renderer->device, gltf.materials.size(), sizes);
+    scene.descriptorAllocator.InitPool(renderer->device, 1, sizes);
 
     scene.samplers.reserve(gltf.samplers.size());
     for (const auto &[magFilter, minFilter, wrapS, wrapT, name] : gltf.samplers) {
@@ -235,7 +235,7 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
 
     scene.materialDataBuffer = renderer->memoryManager.createManagedBuffer(
             {sizeof(VkGLTFMetallic_Roughness::MaterialConstants) * gltf.materials.size(),
-             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
              VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
     VkGLTFMetallic_Roughness::MaterialConstants *materialConstants;
@@ -244,6 +244,12 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
     int dataIndex = 0;
 
     auto device = renderer->device;
+    if (!renderer->useRaytracing)
+    {
+        const VkDescriptorSetLayout setLayouts[] = {renderer->metalRoughMaterial.materialLayout};
+        scene.materialSet = scene.descriptorAllocator.Allocate(device, setLayouts);
+    }
+
     for (auto &material : gltf.materials) {
         GLTFMaterial newMaterial{};
 
@@ -253,8 +259,6 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
         constants.metalRoughFactors.x = material.pbrData.metallicFactor;
         constants.metalRoughFactors.y = material.pbrData.roughnessFactor;
 
-        memcpy(materialConstants + dataIndex, &constants, sizeof(VkGLTFMetallic_Roughness::MaterialConstants));
-
         auto passType = material.alphaMode == fastgltf::AlphaMode::Blend ? MaterialPass::Transparent : MaterialPass::MainColor;
 
         VkGLTFMetallic_Roughness::MaterialResources materialResources{};
@@ -277,10 +281,8 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
         materialResources.metalRoughImage = renderer->defaultImage;
         materialResources.metalRoughSampler = renderer->textureSamplerLinear;
 
-        materialResources.dataBuffer = scene.materialDataBuffer.buffer;
-        materialResources.offset = dataIndex * sizeof(VkGLTFMetallic_Roughness::MaterialConstants);
-
-        newMaterial.data = renderer->metalRoughMaterial.writeMaterial(renderer->useRaytracing, device, passType, materialResources, scene.descriptorAllocator, dataIndex);
+        newMaterial.data = renderer->metalRoughMaterial.writeMaterial(renderer->useRaytracing, passType, materialResources, constants, scene.materialSet, dataIndex);
+        memcpy(materialConstants + dataIndex, &constants, sizeof(VkGLTFMetallic_Roughness::MaterialConstants));
         if (renderer->useRaytracing)
         {
             renderer->rayTracing.textureInfo.emplace_back(materialResources.colorSampler,
@@ -293,6 +295,9 @@ std::optional<LoadedGLTF> LoadGLTF(VkRenderer *renderer, bool multithread, const
 
     renderer->memoryManager.unmapBuffer(scene.materialDataBuffer);
 
+    if (!renderer->useRaytracing)
+        renderer->metalRoughMaterial.writeMaterialSet(device, scene.materialSet, scene.materialDataBuffer.buffer, gltf.materials.size());
+
     std::vector<uint32_t> indices;
     std::vector<VkVertex> vertices;
 
@@ -11,6 +11,7 @@ struct LoadedGLTF {
     std::vector<VkSampler> samplers;
 
     DescriptorAllocator descriptorAllocator;
+    VkDescriptorSet materialSet{VK_NULL_HANDLE};
     VulkanBuffer materialDataBuffer;
 };
 
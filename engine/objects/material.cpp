@@ -1,9 +1,15 @@
 #include "material.h"
+#include <algorithm>
+#include <ranges>
 #include "common/file.h"
 #include "graphics/vk_renderer.h"
 #include "graphics/vk/vk_pipeline_builder.h"
+#include "graphics/vk/vk_pipeline_compiler.h"
+
+void VkGLTFMetallic_Roughness::buildPipelines(const VkRenderer *renderer, VkPipelineCompiler &compiler) {
+    this->renderer = renderer;
+    reloader = compiler.Reloader();
 
-void VkGLTFMetallic_Roughness::buildPipelines(const VkRenderer *renderer) {
     const auto device = renderer->device;
     if (renderer->useRaytracing)
     {
@@ -28,10 +34,9 @@ void VkGLTFMetallic_Roughness::buildPipelines(const VkRenderer *renderer) {
             &pushConstantRange
         };
 
-        VkPipelineLayout pipelineLayout;
         VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, VK_NULL_HANDLE, &pipelineLayout));
 
-        opaquePipeline.layout = pipelineLayout;
+        rayTracedPipeline.layout = pipelineLayout;
 
         VkGraphicsPipelineBuilder builder{};
         builder.SetPipelineLayout(pipelineLayout);
@@ -42,129 +47,192 @@ void VkGLTFMetallic_Roughness::buildPipelines(const VkRenderer *renderer) {
         builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
         builder.EnableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
+        builder.AddVelocityAttachment(renderer->velocityFormat);
         builder.SetColorAttachmentFormat(renderer->surfaceFormat.format);
         builder.SetDepthFormat(renderer->depthImage.format);
 
-        opaquePipeline.pipeline = builder.Build(true, device, renderer->pipelineCache);
+        builder.Build(compiler, &rayTracedPipeline.pipeline, true);
 
-        builder.DestroyShaderModules(device);
+        builder.DestroyShaderModules(compiler);
     }
     else
     {
-        constexpr VkPushConstantRange pushConstantRange{
+        constexpr VkPushConstantRange vertexPushConstantRange{
             VK_SHADER_STAGE_VERTEX_BIT,
             0,
             sizeof(MeshPushConstants)
         };
 
         constexpr VkPushConstantRange meshShaderPushConstantRange {
-            VK_SHADER_STAGE_MESH_BIT_EXT,
+            VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
             0,
             sizeof(MeshShaderPushConstants)
         };
 
-        const VkPushConstantRange fragmentPushConstantRange{
-            VK_SHADER_STAGE_FRAGMENT_BIT,
-            static_cast<uint32_t>(renderer->meshShader ? sizeof(MeshShaderPushConstants) : sizeof(MeshPushConstants)),
-            sizeof(FragmentPushConstants)
-        };
-
         DescriptorLayoutBuilder layoutBuilder;
 
-        layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT);
-        layoutBuilder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-        layoutBuilder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+        layoutBuilder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+        layoutBuilder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, MAX_BINDLESS_TEXTURES);
 
-        materialLayout = layoutBuilder.Build(device);
+        static constexpr VkDescriptorBindingFlags bindingFlags[] = {
+            0,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+        };
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            VK_NULL_HANDLE,
+            2,
+            bindingFlags
+        };
+
+        materialLayout = layoutBuilder.Build(device, &bindingFlagsCreateInfo, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
 
-        std::array setLayouts = {renderer->sceneDescriptorSetLayout, materialLayout, renderer->mainDescriptorSetLayout};
-        const std::array pushConstantRanges = { renderer->meshShader ? meshShaderPushConstantRange : pushConstantRange, fragmentPushConstantRange};
+        setLayouts = {renderer->sceneDescriptorSetLayout, materialLayout, renderer->mainDescriptorSetLayout};
+        pushConstantRange = renderer->meshShader ? meshShaderPushConstantRange : vertexPushConstantRange;
         const VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
             VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             VK_NULL_HANDLE,
             0,
             setLayouts.size(),
             setLayouts.data(),
-            pushConstantRanges.size(),
-            pushConstantRanges.data(),
+            1,
+            &pushConstantRange,
         };
 
-        VkPipelineLayout pipelineLayout;
         VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, VK_NULL_HANDLE, &pipelineLayout));
+        const VkShaderStageFlags optionalStages = (renderer->geometryShader ? VK_SHADER_STAGE_GEOMETRY_BIT : 0) |
+                                                  (renderer->meshShader ? VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT : 0);
+        shaderObjectCache.Init(optionalStages, reloader);
 
-        opaquePipeline.layout = pipelineLayout;
-        transparentPipeline.layout = pipelineLayout;
+        features = {
+            .cascadeCount = SHADOW_MAP_CASCADE_COUNT,
+            .vertexFormat = renderer->meshShader ? VertexFormat::Meshlets : VertexFormat::Pulled
+        };
 
-        VkGraphicsPipelineBuilder builder{.isMeshShader = renderer->meshShader};
-        builder.SetPipelineLayout(pipelineLayout);
+        // Compiled with everything else at startup, anything else a scene asks for is created when it does
+        QueuePipeline(features, compiler);
+        QueuePipeline(features.With(AlphaMode::Blend), compiler);
+        if (!renderer->meshShader)
+            QueuePipeline(features.With(AlphaMode::Opaque, true), compiler);
+    }
+}
 
-        if (builder.isMeshShader) {
-            builder.CreateShaderModules(device, "shaders/meshshader.mesh.spv", "shaders/meshshader.frag.spv", "shaders/meshshader.task.spv");
-        } else {
-            builder.CreateShaderModules(device, "shaders/mesh.vert.spv", "shaders/lighting.frag.spv");
-        }
+const VkMaterialPipeline *VkGLTFMetallic_Roughness::Pipeline(const ShaderFeatures &key) {
+    if (const auto it = pipelines.find(key); it != pipelines.end())
+        return &it->second;
 
-        builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-        builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
-        builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-        builder.EnableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    VkPipelineCompiler compiler{renderer->device, renderer->pipelineCache, reloader};
+    const auto *pipeline = QueuePipeline(key, compiler);
+    compiler.Compile();
 
-        static constexpr std::array<VkSpecializationMapEntry, 2> entries = {{
-             {0, 0, sizeof(uint32_t)},
-             {1, sizeof(uint32_t), sizeof(uint32_t)}
-        }};
+    return pipeline;
+}
 
-        static constexpr uint32_t data[] = {1, SHADOW_MAP_CASCADE_COUNT};
+VkMaterialPipeline *VkGLTFMetallic_Roughness::QueuePipeline(const ShaderFeatures &key, VkPipelineCompiler &compiler) {
+    auto &entry = pipelines[key];
+    entry.layout = pipelineLayout;
 
-        VkSpecializationInfo specializationInfo{
-                entries.size(),
-                entries.data(),
-                sizeof(uint32_t) * 2,
-                data
-        };
+    VkGraphicsPipelineBuilder builder{.isMeshShader = key.vertexFormat == VertexFormat::Meshlets};
+    builder.SetPipelineLayout(pipelineLayout);
 
-        bool dynamicRendering = renderer->dynamicRendering;
-        if (dynamicRendering) {
-             builder.SetColorAttachmentFormat(renderer->surfaceFormat.format);
-             builder.SetDepthFormat(renderer->depthImage.format);
-        }
+    if (builder.isMeshShader) {
+        builder.SetShaders("shaders/meshshader.mesh.spv", "shaders/meshshader.frag.spv", "shaders/meshshader.task.spv");
+    } else {
+        builder.SetShaders("shaders/mesh.vert.spv", "shaders/lighting.frag.spv");
+    }
 
-        opaquePipeline.pipeline = builder.Build(dynamicRendering, device, renderer->pipelineCache, renderer->renderPass, {VK_SHADER_STAGE_FRAGMENT_BIT, specializationInfo});
+    builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
 
+    if (key.alphaMode == AlphaMode::Blend) {
+        // Blended surfaces keep the motion of whatever is behind them
         builder.EnableBlendingAlphaBlend();
         builder.EnableDepthTest(false, VK_COMPARE_OP_LESS_OR_EQUAL);
-        transparentPipeline.pipeline = builder.Build(dynamicRendering, device, renderer->pipelineCache, renderer->renderPass, {VK_SHADER_STAGE_FRAGMENT_BIT, specializationInfo});
+        builder.AddVelocityAttachment(renderer->velocityFormat, false);
+    } else {
+        builder.EnableDepthTest(!key.depthEqual, key.depthEqual ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS_OR_EQUAL);
+        builder.AddVelocityAttachment(renderer->velocityFormat);
+    }
+
+    const bool dynamicRendering = renderer->dynamicRendering;
+    if (dynamicRendering) {
+        builder.SetColorAttachmentFormat(renderer->surfaceFormat.format);
+        builder.SetDepthFormat(renderer->depthImage.format);
+    }
+
+    const auto specialization = key.Specialization();
+    if (renderer->shaderObjects) {
+        // Created right away, only the shaders this permutation doesn't share with an earlier one
+        builder.BuildShaderObjects(shaderObjectCache, &entry.shaderObjects, renderer->device, setLayouts, {&pushConstantRange, 1}, specialization.Info(VK_SHADER_STAGE_FRAGMENT_BIT));
+        return &entry;
+    }
 
-        builder.DestroyShaderModules(device);
+    if (renderer->pipelineLibraries) {
+        // Only parts no earlier permutation had are compiled, the rest is a link
+        builder.Build(compiler, &entry.pipeline, dynamicRendering, renderer->renderPass, specialization.Info(VK_SHADER_STAGE_FRAGMENT_BIT), &pipelineLibraries);
+        return &entry;
     }
+
+    if (!builder.CreateShaderModules(renderer->device))
+        throw std::runtime_error("Failed to create the material shader modules");
+    builder.Build(compiler, &entry.pipeline, dynamicRendering, renderer->renderPass, specialization.Info(VK_SHADER_STAGE_FRAGMENT_BIT));
+
+    builder.DestroyShaderModules(compiler);
+
+    return &entry;
 }
 
 void VkGLTFMetallic_Roughness::clearResources(const VkDevice &device) const {
     vkDestroyDescriptorSetLayout(device, materialLayout, VK_NULL_HANDLE);
-    vkDestroyPipelineLayout(device, opaquePipeline.layout, VK_NULL_HANDLE);
+    vkDestroyPipelineLayout(device, pipelineLayout, VK_NULL_HANDLE);
+
+    vkDestroyPipeline(device, rayTracedPipeline.pipeline, VK_NULL_HANDLE);
+    for (const auto &[pipeline, layout, shaderObjects] : pipelines | std::views::values)
+        vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
 
-    vkDestroyPipeline(device, opaquePipeline.pipeline, VK_NULL_HANDLE);
-    vkDestroyPipeline(device, transparentPipeline.pipeline, VK_NULL_HANDLE);
+    shaderObjectCache.Destroy(device);
+    pipelineLibraries.Destroy(device);
 }
 
-VkMaterialInstance VkGLTFMetallic_Roughness::writeMaterial(const bool raytracing, VkDevice &device, const MaterialPass pass, const MaterialResources &resources, DescriptorAllocator &allocator, const uint32_t textureIndex) {
-    const VkDescriptorSetLayout setLayouts[] = {materialLayout};
-    VkMaterialInstance matData{
-        .pipeline = pass == MaterialPass::Transparent ? transparentPipeline : opaquePipeline,
-        .descriptorSet = allocator.Allocate(device, setLayouts),
+VkMaterialInstance VkGLTFMetallic_Roughness::writeMaterial(const bool raytracing, const MaterialPass pass, const MaterialResources &resources, MaterialConstants &constants, VkDescriptorSet materialSet, const uint32_t materialIndex) {
+    const VkMaterialInstance matData{
+        .pipeline = raytracing ? &rayTracedPipeline : Pipeline(features.With(pass == MaterialPass::Transparent ? AlphaMode::Blend : AlphaMode::Opaque)),
+        .descriptorSet = materialSet,
         .pass = pass,
-        .textureIndex = textureIndex
+        .materialIndex = materialIndex,
+        .textureIndex = materialIndex
     };
 
     if (raytracing)
         return matData;
 
+    constants.colorTextureIndex = AddTexture(resources.colorImage.imageView, resources.colorSampler);
+    constants.metalRoughTextureIndex = AddTexture(resources.metalRoughImage.imageView, resources.metalRoughSampler);
+
+    return matData;
+}
+
+void VkGLTFMetallic_Roughness::writeMaterialSet(VkDevice &device, VkDescriptorSet &materialSet, VkBuffer materialBuffer, const size_t materialCount) {
     descriptorWriter.Clear();
-    descriptorWriter.WriteBuffer(0, resources.dataBuffer, resources.offset, sizeof(MaterialConstants), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    descriptorWriter.WriteImage(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    descriptorWriter.WriteImage(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    descriptorWriter.WriteBuffer(0, materialBuffer, 0, sizeof(MaterialConstants) * materialCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    descriptorWriter.WriteImages(1, textureInfos);
+    descriptorWriter.UpdateSet(device, materialSet);
+}
 
-    descriptorWriter.UpdateSet(device, matData.descriptorSet);
+uint32_t VkGLTFMetallic_Roughness::AddTexture(VkImageView imageView, VkSampler sampler) {
+    // Materials share a lot of textures, only add each image/sampler pair once
+    const auto it = std::ranges::find_if(textureInfos, [&](const VkDescriptorImageInfo &info) {
+        return info.imageView == imageView && info.sampler == sampler;
+    });
 
-    return matData;
+    if (it != textureInfos.end())
+        return static_cast<uint32_t>(it - textureInfos.begin());
+
+    if (textureInfos.size() >= MAX_BINDLESS_TEXTURES) [[unlikely]]
+        throw std::runtime_error("Exceeded the maximum number of bindless textures");
+
+    textureInfos.emplace_back(sampler, imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    return static_cast<uint32_t>(textureInfos.size() - 1);
 }
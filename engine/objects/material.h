@@ -6,9 +6,15 @@
 #include <wrl/client.h>
 #endif
 
+#include <unordered_map>
 #include "graphics/vk/vk_descriptor_layout.h"
+#include "graphics/vk/vk_pipeline_library.h"
+#include "graphics/vk/vk_shader_features.h"
+#include "graphics/vk/vk_shader_object.h"
 
 class VkRenderer;
+class VkPipelineCompiler;
+class VkShaderReloader;
 
 enum class MaterialPass : uint8_t {
     MainColor,
@@ -19,6 +25,8 @@ enum class MaterialPass : uint8_t {
 struct VkMaterialPipeline {
     VkPipeline pipeline;
     VkPipelineLayout layout;
+    // Bound instead of the pipeline when the renderer uses shader objects
+    VkShaderObjectPipeline shaderObjects{};
 
     bool operator==(const VkMaterialPipeline &other) const {
         return pipeline == other.pipeline && layout == other.layout;
@@ -26,10 +34,13 @@ struct VkMaterialPipeline {
 };
 
 struct VkMaterialInstance {
-    VkMaterialPipeline pipeline;
+    // Points at the material's pipeline, so instances follow it when it's rebuilt
+    const VkMaterialPipeline *pipeline;
     VkDescriptorSet descriptorSet;
     MaterialPass pass;
 
+    // Index into the material buffer
+    uint32_t materialIndex;
     // For ray tracing
     uint32_t textureIndex;
 
@@ -52,9 +63,15 @@ struct D3D12MaterialInstance {
 #endif
 
 struct VkGLTFMetallic_Roughness {
-    struct alignas(256) MaterialConstants {
+    static constexpr uint32_t MAX_BINDLESS_TEXTURES = 1024;
+
+    // Laid out for std430, one entry per material in the material storage buffer
+    struct MaterialConstants {
         glm::vec4 colorFactors;
         glm::vec4 metalRoughFactors;
+        uint32_t colorTextureIndex;
+        uint32_t metalRoughTextureIndex;
+        uint32_t padding[2];
     };
 
     struct MaterialResources {
@@ -62,19 +79,43 @@ struct VkGLTFMetallic_Roughness {
         VkSampler colorSampler;
         VulkanImage metalRoughImage;
         VkSampler metalRoughSampler;
-        VkBuffer dataBuffer;
-        uint32_t offset;
     };
 
-    VkMaterialPipeline opaquePipeline{VK_NULL_HANDLE};
-    VkMaterialPipeline transparentPipeline{VK_NULL_HANDLE};
+    // Shared by every permutation
+    VkPipelineLayout pipelineLayout{VK_NULL_HANDLE};
+    // Composites the ray traced radiance, the only pipeline when ray tracing
+    VkMaterialPipeline rayTracedPipeline{VK_NULL_HANDLE};
+    // What every permutation has in common, set from the renderer. Materials only pick the alpha mode.
+    ShaderFeatures features{};
     VkDescriptorSetLayout materialLayout{VK_NULL_HANDLE};
     DescriptorWriter descriptorWriter{};
+    // Every texture referenced by a material, indexed by MaterialConstants
+    std::vector<VkDescriptorImageInfo> textureInfos;
 
-    void buildPipelines(const VkRenderer *renderer);
+    // Queues the permutations the renderer is known to need, they exist once the compiler has run
+    void buildPipelines(const VkRenderer *renderer, VkPipelineCompiler &compiler);
     void clearResources(const VkDevice &device) const;
 
-    VkMaterialInstance writeMaterial(bool raytracing, VkDevice &device, MaterialPass pass, const MaterialResources &resources, DescriptorAllocator &allocator, uint32_t textureIndex);
+    // Created on first use, the pointer stays valid for the material's lifetime
+    const VkMaterialPipeline *Pipeline(const ShaderFeatures &key);
+
+    VkMaterialInstance writeMaterial(bool raytracing, MaterialPass pass, const MaterialResources &resources, MaterialConstants &constants, VkDescriptorSet materialSet, uint32_t materialIndex);
+    void writeMaterialSet(VkDevice &device, VkDescriptorSet &materialSet, VkBuffer materialBuffer, size_t materialCount);
+
+private:
+    VkMaterialPipeline *QueuePipeline(const ShaderFeatures &key, VkPipelineCompiler &compiler);
+    uint32_t AddTexture(VkImageView imageView, VkSampler sampler);
+
+    // Node based, so material instances can point at entries while more are added
+    std::unordered_map<ShaderFeatures, VkMaterialPipeline> pipelines;
+    // Needed to create permutations after startup
+    const VkRenderer *renderer{nullptr};
+    VkShaderReloader *reloader{nullptr};
+    // What shader objects are created against, the same as the pipeline layout
+    std::array<VkDescriptorSetLayout, 3> setLayouts{};
+    VkPushConstantRange pushConstantRange{};
+    VkShaderObjectCache shaderObjectCache;
+    VkPipelineLibraryCache pipelineLibraries;
 };
 
 #endif //MATERIAL_H
@@ -22,6 +22,9 @@ struct VkRenderObject {
     VkDeviceAddress indexBufferAddress{0};
 
     VkMaterialInstance *materialInstance{nullptr};
+
+    // Re-rendered into the shadow map on every cascade update instead of living in the static shadow cache
+    bool isDynamic{false};
 };
 
 struct VkDrawContext {
@@ -44,6 +47,9 @@ struct Node {
     NodeType type;
     MeshAsset meshAsset;
 
+    // Set for nodes moved at runtime, their surfaces are kept out of cached shadow depth
+    bool isDynamic{false};
+
     void RefreshTransform(const glm::mat4 &parentTransform) {
         worldTransform = parentTransform * localTransform;
         for (const auto &c : children) {
@@ -59,10 +65,10 @@ struct Node {
                 for (auto &[startIndex, indexCount, vertexCount, bounds, material]: meshAsset.surfaces) {
                     switch (material.data.pass) {
                         case MaterialPass::MainColor:
-                            ctx.opaqueSurfaces.emplace_back(indexCount, vertexCount, startIndex, bounds, nodeMatrix, meshAsset.mesh.indexBuffer, meshAsset.mesh.vertexBufferDeviceAddress, meshAsset.mesh.indexBufferDeviceAddress, &material.data);
+                            ctx.opaqueSurfaces.emplace_back(indexCount, vertexCount, startIndex, bounds, nodeMatrix, meshAsset.mesh.indexBuffer, meshAsset.mesh.vertexBufferDeviceAddress, meshAsset.mesh.indexBufferDeviceAddress, &material.data, isDynamic);
                             break;
                         case MaterialPass::Transparent:
-                            ctx.transparentSurfaces.emplace_back(indexCount, vertexCount, startIndex, bounds, nodeMatrix, meshAsset.mesh.indexBuffer, meshAsset.mesh.vertexBufferDeviceAddress, meshAsset.mesh.indexBufferDeviceAddress, &material.data);
+                            ctx.transparentSurfaces.emplace_back(indexCount, vertexCount, startIndex, bounds, nodeMatrix, meshAsset.mesh.indexBuffer, meshAsset.mesh.vertexBufferDeviceAddress, meshAsset.mesh.indexBufferDeviceAddress, &material.data, isDynamic);
                             break;
                         default:
                             break;
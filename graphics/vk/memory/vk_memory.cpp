@@ -366,6 +366,82 @@ VulkanImage VkMemoryManager::createUnmanagedImage(const VulkanImageCreateInfo &i
     return untrackedImage;
 }
 
+VkImage VkMemoryManager::createUnboundImage(const VulkanImageCreateInfo &info) const {
+    const VkImageCreateInfo imageCreateInfo{
+        VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        VK_NULL_HANDLE,
+        info.createFlags,
+        VK_IMAGE_TYPE_2D,
+        info.imageFormat,
+        info.imageExtent,
+        info.mipmapped ? static_cast<uint32_t>(std::floor(std::log2(std::max(info.imageExtent.width, info.imageExtent.height)))) : 1,
+        info.imageViewCreateInfo ? info.imageViewCreateInfo->subresourceRange.layerCount : 1,
+        VK_SAMPLE_COUNT_1_BIT,
+        info.imageTiling,
+        info.imageUsage,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        VK_NULL_HANDLE,
+        info.imageLayout
+    };
+
+    VkImage image;
+    VK_CHECK(vkCreateImage(device, &imageCreateInfo, nullptr, &image));
+    return image;
+}
+
+VmaAllocation VkMemoryManager::allocateImageMemory(const VkMemoryRequirements &requirements, const bool lazilyAllocated) const {
+    VmaAllocationCreateInfo allocationCreateInfo{
+        0,
+        lazilyAllocated ? VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED : VMA_MEMORY_USAGE_UNKNOWN,
+        lazilyAllocated ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    };
+
+    allocationCreateInfo.pool = pool;
+    allocationCreateInfo.priority = 1.0f;
+
+    VmaAllocation allocation;
+    VK_CHECK(vmaAllocateMemory(allocator, &requirements, &allocationCreateInfo, &allocation, nullptr));
+    return allocation;
+}
+
+bool VkMemoryManager::hasLazilyAllocatedMemory(const uint32_t memoryTypeBits) const {
+    constexpr VmaAllocationCreateInfo allocationCreateInfo{
+        0,
+        VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED,
+        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT
+    };
+
+    uint32_t memoryTypeIndex;
+    return vmaFindMemoryTypeIndex(allocator, memoryTypeBits, &allocationCreateInfo, &memoryTypeIndex) == VK_SUCCESS;
+}
+
+void VkMemoryManager::bindImageMemory(VkImage image, VmaAllocation allocation) const {
+    VK_CHECK(vmaBindImageMemory(allocator, allocation, image));
+}
+
+VkImageView VkMemoryManager::createImageView(VkImage image, const ImageViewCreateInfo &info) const {
+    auto [flags, viewType, format, components, subresourceRange] = info;
+    const VkImageViewCreateInfo createInfo{
+        VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        VK_NULL_HANDLE,
+        flags,
+        image,
+        viewType,
+        format,
+        components,
+        subresourceRange
+    };
+
+    VkImageView imageView;
+    VK_CHECK(vkCreateImageView(device, &createInfo, nullptr, &imageView));
+    return imageView;
+}
+
+void VkMemoryManager::freeMemory(VmaAllocation allocation) const {
+    vmaFreeMemory(allocator, allocation);
+}
+
 #ifdef _WIN32
 VulkanExternalImage VkMemoryManager::createExternalImage(const VkImageCreateInfo &imageCreateInfo, VkPhysicalDeviceMemoryProperties &properties, ID3D12Device *d3d12Device, ID3D12Resource *deviceHandle)
 {
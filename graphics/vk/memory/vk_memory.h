@@ -78,6 +78,14 @@ public:
 
     VulkanImage createUnmanagedImage(const VulkanImageCreateInfo &info);
 
+    // For images placed by hand, several of them can be bound to the same allocation
+    VkImage createUnboundImage(const VulkanImageCreateInfo &info) const;
+    VmaAllocation allocateImageMemory(const VkMemoryRequirements &requirements, bool lazilyAllocated) const;
+    [[nodiscard]] bool hasLazilyAllocatedMemory(uint32_t memoryTypeBits) const;
+    void bindImageMemory(VkImage image, VmaAllocation allocation) const;
+    VkImageView createImageView(VkImage image, const ImageViewCreateInfo &info) const;
+    void freeMemory(VmaAllocation allocation) const;
+
 #ifdef _WIN32
     VulkanExternalImage createExternalImage(const VkImageCreateInfo &imageCreateInfo, VkPhysicalDeviceMemoryProperties &properties, ID3D12Device *d3d12Device, ID3D12Resource *deviceHandle);
     void destroyExternalImageMemory(const VkImage &image, const VkDeviceMemory &memory);
@@ -0,0 +1,53 @@
+#include "vk_ring_buffer.h"
+#include <cstring>
+#include <stdexcept>
+
+void VkRingBuffer::Init(VkDevice device, VkMemoryManager &memoryManager, const VkDeviceSize frameSize, const uint32_t frameCount, const VkDeviceSize alignment, const VkBufferUsageFlags usage) {
+    this->alignment = alignment;
+    this->frameSize = (frameSize + alignment - 1) & ~(alignment - 1);
+
+    buffer = memoryManager.createUnmanagedBuffer({
+        this->frameSize * frameCount,
+        usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        VMA_MEMORY_USAGE_AUTO,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    });
+
+    memoryManager.mapBuffer(buffer, reinterpret_cast<void **>(&mapped));
+
+    const VkBufferDeviceAddressInfo addressInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, VK_NULL_HANDLE, buffer.buffer};
+    deviceAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+
+    BeginFrame(0);
+}
+
+void VkRingBuffer::Destroy(VkMemoryManager &memoryManager) {
+    memoryManager.unmapBuffer(buffer);
+    memoryManager.destroyBuffer(buffer, false);
+    mapped = nullptr;
+}
+
+void VkRingBuffer::BeginFrame(const uint32_t frameIndex) {
+    head = frameSize * frameIndex;
+    frameEnd = head + frameSize;
+}
+
+uint32_t VkRingBuffer::Allocate(const VkDeviceSize size, void **data) {
+    const auto offset = head;
+    head = (head + size + alignment - 1) & ~(alignment - 1);
+
+    if (head > frameEnd) [[unlikely]] {
+        throw std::runtime_error("Frame ring buffer out of memory");
+    }
+
+    *data = mapped + offset;
+    return static_cast<uint32_t>(offset);
+}
+
+uint32_t VkRingBuffer::Push(const void *data, const VkDeviceSize size) {
+    void *destination;
+    const auto offset = Allocate(size, &destination);
+    memcpy(destination, data, size);
+    return offset;
+}
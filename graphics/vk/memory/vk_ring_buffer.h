@@ -0,0 +1,36 @@
+#ifndef VK_RING_BUFFER_H
+#define VK_RING_BUFFER_H
+
+#include "vk_memory.h"
+
+// Linear allocator over a single persistently mapped buffer, split into one segment per frame in flight.
+// Allocations live until the same frame index comes around again, so BeginFrame must only be called after
+// the frame that last used the segment has retired.
+class VkRingBuffer {
+public:
+    void Init(VkDevice device, VkMemoryManager &memoryManager, VkDeviceSize frameSize, uint32_t frameCount, VkDeviceSize alignment, VkBufferUsageFlags usage);
+    void Destroy(VkMemoryManager &memoryManager);
+
+    void BeginFrame(uint32_t frameIndex);
+
+    // Returned offsets are relative to the start of the buffer and can be used directly as dynamic offsets
+    uint32_t Allocate(VkDeviceSize size, void **data);
+    uint32_t Push(const void *data, VkDeviceSize size);
+
+    template<typename T>
+    uint32_t Push(const T &data) {
+        return Push(&data, sizeof(T));
+    }
+
+    VulkanBuffer buffer{};
+    VkDeviceAddress deviceAddress{};
+
+private:
+    uint8_t *mapped{};
+    VkDeviceSize frameSize{};
+    VkDeviceSize alignment{};
+    VkDeviceSize head{};
+    VkDeviceSize frameEnd{};
+};
+
+#endif //VK_RING_BUFFER_H
@@ -0,0 +1,164 @@
+#include "vk_transient_image_pool.h"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+using ImageLifetime = VkRenderGraph::ImageLifetime;
+
+// Images the graph never saw this frame aren't alive at all and fit anywhere
+static const ImageLifetime *FindLifetime(const std::span<const ImageLifetime> lifetimes, VkImage image) {
+    const auto lifetime = std::ranges::find(lifetimes, image, &ImageLifetime::image);
+    return lifetime != lifetimes.end() ? &*lifetime : nullptr;
+}
+
+static bool Overlaps(const ImageLifetime *a, const ImageLifetime *b) {
+    return a && b && a->firstPass <= b->lastPass && b->firstPass <= a->lastPass;
+}
+
+void VkTransientImagePool::Add(VkDevice device, const VkMemoryManager &memoryManager, VulkanImage &image, const VulkanImageCreateInfo &info) {
+    // Bound images can't be moved to new memory, so changing the set starts the placement over
+    if (allocated)
+        Release(device, memoryManager);
+
+    auto entry = std::ranges::find(entries, &image, &Entry::image);
+    if (entry == entries.end()) {
+        entries.push_back({&image});
+        entry = entries.end() - 1;
+    } else if (image.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device, image.image, nullptr);
+        image.image = VK_NULL_HANDLE;
+    }
+
+    entry->info = info;
+    entry->hasView = info.imageViewCreateInfo != nullptr;
+    if (entry->hasView)
+        entry->viewInfo = *info.imageViewCreateInfo;
+
+    CreateImages(memoryManager);
+}
+
+void VkTransientImagePool::Reset(VkDevice device, const VkMemoryManager &memoryManager) {
+    Release(device, memoryManager);
+    CreateImages(memoryManager);
+}
+
+// Creates whichever images don't exist yet
+void VkTransientImagePool::CreateImages(const VkMemoryManager &memoryManager) {
+    for (auto &e : entries) {
+        if (e.image->image != VK_NULL_HANDLE)
+            continue;
+
+        auto createInfo = e.info;
+        createInfo.imageViewCreateInfo = e.hasView ? &e.viewInfo : nullptr;
+        e.image->image = memoryManager.createUnboundImage(createInfo);
+        e.image->extent = createInfo.imageExtent;
+        e.image->format = createInfo.imageFormat;
+    }
+}
+
+void VkTransientImagePool::Allocate(VkDevice device, const VkMemoryManager &memoryManager, const std::span<const ImageLifetime> lifetimes) {
+    struct Block {
+        VkMemoryRequirements requirements;
+        bool lazilyAllocated;
+        std::vector<const ImageLifetime *> lifetimes;
+    };
+
+    std::vector<VkMemoryRequirements> requirements(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        vkGetImageMemoryRequirements(device, entries[i].image->image, &requirements[i]);
+
+    // Largest first, smaller images then slot in behind the ones they don't overlap with
+    std::vector<uint32_t> order(entries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::sort(order, std::greater{}, [&](const uint32_t i) { return requirements[i].size; });
+
+    std::vector<Block> placed;
+    VkDeviceSize dedicatedSize = 0;
+    for (const auto index : order) {
+        auto &entry = entries[index];
+        const auto &imageRequirements = requirements[index];
+        const auto lifetime = FindLifetime(lifetimes, entry.image->image);
+        // Lazily allocated memory is only backed when a render pass has to spill the attachment, there is nothing to share
+        const bool lazilyAllocated = entry.info.imageUsage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT && memoryManager.hasLazilyAllocatedMemory(imageRequirements.memoryTypeBits);
+
+        auto block = std::ranges::find_if(placed, [&](const Block &b) {
+            return !lazilyAllocated && !b.lazilyAllocated && b.requirements.memoryTypeBits & imageRequirements.memoryTypeBits &&
+                   std::ranges::none_of(b.lifetimes, [&](const ImageLifetime *other) { return Overlaps(lifetime, other); });
+        });
+
+        if (block == placed.end()) {
+            placed.push_back({imageRequirements, lazilyAllocated});
+            block = placed.end() - 1;
+        } else {
+            block->requirements.size = std::max(block->requirements.size, imageRequirements.size);
+            block->requirements.alignment = std::max(block->requirements.alignment, imageRequirements.alignment);
+            block->requirements.memoryTypeBits &= imageRequirements.memoryTypeBits;
+        }
+
+        block->lifetimes.push_back(lifetime);
+        entry.block = static_cast<uint32_t>(block - placed.begin());
+
+        if (!lazilyAllocated)
+            dedicatedSize += imageRequirements.size;
+    }
+
+    VkDeviceSize placedSize = 0;
+    blocks.clear();
+    for (const auto &block : placed) {
+        blocks.push_back(memoryManager.allocateImageMemory(block.requirements, block.lazilyAllocated));
+        if (!block.lazilyAllocated)
+            placedSize += block.requirements.size;
+    }
+
+    for (auto &entry : entries) {
+        entry.image->allocation = blocks[entry.block];
+        memoryManager.bindImageMemory(entry.image->image, entry.image->allocation);
+
+        if (entry.hasView)
+            entry.image->imageView = memoryManager.createImageView(entry.image->image, entry.viewInfo);
+    }
+
+    allocated = true;
+    printf("Transient images: %zu in %zu allocations, %.1f MB instead of %.1f MB\n", entries.size(), blocks.size(),
+           static_cast<double>(placedSize) / (1024.0 * 1024.0), static_cast<double>(dedicatedSize) / (1024.0 * 1024.0));
+}
+
+bool VkTransientImagePool::Fits(const std::span<const ImageLifetime> lifetimes) const {
+    if (!allocated)
+        return true;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const auto lifetime = FindLifetime(lifetimes, entries[i].image->image);
+        for (size_t j = i + 1; j < entries.size(); j++) {
+            if (entries[i].block == entries[j].block && Overlaps(lifetime, FindLifetime(lifetimes, entries[j].image->image)))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void VkTransientImagePool::Release(VkDevice device, const VkMemoryManager &memoryManager) {
+    for (const auto &entry : entries) {
+        if (entry.image->imageView != VK_NULL_HANDLE)
+            vkDestroyImageView(device, entry.image->imageView, nullptr);
+
+        if (entry.image->image != VK_NULL_HANDLE)
+            vkDestroyImage(device, entry.image->image, nullptr);
+
+        entry.image->image = VK_NULL_HANDLE;
+        entry.image->imageView = VK_NULL_HANDLE;
+        entry.image->allocation = VK_NULL_HANDLE;
+    }
+
+    for (const auto &block : blocks)
+        memoryManager.freeMemory(block);
+
+    blocks.clear();
+    allocated = false;
+}
+
+void VkTransientImagePool::Destroy(VkDevice device, const VkMemoryManager &memoryManager) {
+    Release(device, memoryManager);
+    entries.clear();
+}
@@ -0,0 +1,46 @@
+#ifndef VK_TRANSIENT_IMAGE_POOL_H
+#define VK_TRANSIENT_IMAGE_POOL_H
+
+#include <span>
+#include <vector>
+#include "vk_memory.h"
+#include "graphics/vk/vk_render_graph.h"
+
+// Images whose contents never outlive a frame. They are created without memory and placed once the render graph has
+// shown when each of them is alive: images whose lifetimes never overlap share one allocation, and attachment-only
+// images (VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) get lazily allocated memory where the device offers it.
+// The pool only owns images and views, samplers stay with whoever created them.
+class VkTransientImagePool {
+public:
+    // Creates the image unbound, it has no view until Allocate. Adding an image again replaces it, and since bound images
+    // can't be moved every other image is recreated unbound as well. The device must be idle.
+    void Add(VkDevice device, const VkMemoryManager &memoryManager, VulkanImage &image, const VulkanImageCreateInfo &info);
+    void Allocate(VkDevice device, const VkMemoryManager &memoryManager, std::span<const VkRenderGraph::ImageLifetime> lifetimes);
+    // Frees the memory and recreates every image unbound, for when the lifetimes change and they have to be placed again.
+    // Nothing may still use the images.
+    void Reset(VkDevice device, const VkMemoryManager &memoryManager);
+    void Destroy(VkDevice device, const VkMemoryManager &memoryManager);
+
+    [[nodiscard]] bool IsAllocated() const { return allocated; }
+    // Whether a frame's lifetimes still fit the placement, images sharing memory must never be alive at the same time
+    [[nodiscard]] bool Fits(std::span<const VkRenderGraph::ImageLifetime> lifetimes) const;
+
+private:
+    struct Entry {
+        VulkanImage *image;
+        // The view info is kept here, info.imageViewCreateInfo is pointed at it whenever the image is created
+        VulkanImageCreateInfo info;
+        ImageViewCreateInfo viewInfo;
+        bool hasView;
+        uint32_t block;
+    };
+
+    void Release(VkDevice device, const VkMemoryManager &memoryManager);
+    void CreateImages(const VkMemoryManager &memoryManager);
+
+    std::vector<Entry> entries;
+    std::vector<VmaAllocation> blocks;
+    bool allocated = false;
+};
+
+#endif //VK_TRANSIENT_IMAGE_POOL_H
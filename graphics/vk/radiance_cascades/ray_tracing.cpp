@@ -1,14 +1,14 @@
 #include "ray_tracing.h"
-#include "common/file.h"
 #include "engine/camera.h"
 #include "graphics/vk_renderer.h"
+#include "graphics/vk/vk_shader_compiler.h"
 
 constexpr size_t blasAlignment = 256;
 
-struct RaygenPushConstants
+struct alignas(16) RaygenPushConstants
 {
-    glm::mat4 viewInverse;
     glm::mat4 projectionInverse;
+    VkDeviceAddress camera;
 };
 
 struct MeshData
@@ -33,7 +33,7 @@ inline VkDeviceAddress GetBufferAddress(VkDevice device, VkBuffer buffer)
 }
 
 void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDevice physicalDevice,
-                      VkMemoryManager &memoryManager, const VkExtent2D &swapChainExtent)
+                      VkMemoryManager &memoryManager, VkTransientImagePool &transientImages, const VkExtent2D &swapChainExtent)
 {
 #pragma region Function Pointer Initialization
     vkGetAccelerationStructureBuildSizesKHR = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(
@@ -54,15 +54,8 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
 #pragma endregion
 #pragma region Descriptor Set Layout Creation
     {
-        static constexpr DescriptorAllocator::PoolSizeRatio sizes[] = {
-            // {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
-            {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1},
-            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2},
-            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100}
-        };
-
-        allocator.InitPool(device, 1, sizes);
+        useDescriptorBuffer = renderer->descriptorBuffer;
+        const VkDescriptorSetLayoutCreateFlags layoutFlags = useDescriptorBuffer ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
 
         DescriptorLayoutBuilder builder;
         // builder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
@@ -72,21 +65,45 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
         builder.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
         builder.AddBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR, 100);
         builder.AddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
-        rayTracingDescriptorSetLayout = builder.Build(device, VK_NULL_HANDLE, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+        rayTracingDescriptorSetLayout = builder.Build(device, VK_NULL_HANDLE, layoutFlags);
 
         builder.Clear();
         builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
         builder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
         builder.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
-        accumulatedDescriptorSetLayout = builder.Build(device, VK_NULL_HANDLE, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+        accumulatedDescriptorSetLayout = builder.Build(device, VK_NULL_HANDLE, layoutFlags);
+
+        if (useDescriptorBuffer) {
+            // Room for every set with plenty to spare, the 100 textures dominate
+            descriptorBuffer.Init(device, physicalDevice, memoryManager, 64 * 1024);
+
+            for (auto &set : rayTracingBufferSets)
+                set = descriptorBuffer.Allocate(device, rayTracingDescriptorSetLayout);
+
+            for (auto &set : accumulatedBufferSets)
+                set = descriptorBuffer.Allocate(device, accumulatedDescriptorSetLayout);
+        }
+    }
+
+    if (!useDescriptorBuffer)
+    {
+        static constexpr DescriptorAllocator::PoolSizeRatio sizes[] = {
+            // {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+            {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 100}
+        };
+
+        allocator.InitPool(device, 1, sizes);
 
         const VkDescriptorSetLayout rayTracingLayout[] = {rayTracingDescriptorSetLayout};
         const VkDescriptorSetLayout accumulatedLayout[] = {accumulatedDescriptorSetLayout};
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-        {
-            rayTracingDescriptorSets[i] = allocator.Allocate(device, rayTracingLayout);
-            accumulatedDescriptorSets[i] = allocator.Allocate(device, accumulatedLayout);
-        }
+        for (auto &descriptorSet : rayTracingDescriptorSets)
+            descriptorSet = allocator.Allocate(device, rayTracingLayout);
+
+        for (auto &descriptorSet : accumulatedDescriptorSets)
+            descriptorSet = allocator.Allocate(device, accumulatedLayout);
     }
 #pragma endregion
 #pragma region Pipeline Layout
@@ -140,33 +157,33 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
 #pragma endregion
 #pragma region Shader Modules and Pipeline Creation
     {
-        const auto raygenShaderCode = ReadFile<uint32_t>("shaders/raygen.rgen.spv");
-        const auto missShaderCode = ReadFile<uint32_t>("shaders/miss.rmiss.spv");
-        const auto shadowMissShaderCode = ReadFile<uint32_t>("shaders/rtShadow.rmiss.spv");
-        const auto closestHitShaderCode = ReadFile<uint32_t>("shaders/closesthit.rchit.spv");
+        const auto raygenShaderCode = RequireShader("shaders/raygen.rgen.spv");
+        const auto missShaderCode = RequireShader("shaders/miss.rmiss.spv");
+        const auto shadowMissShaderCode = RequireShader("shaders/rtShadow.rmiss.spv");
+        const auto closestHitShaderCode = RequireShader("shaders/closesthit.rchit.spv");
 
         VkShaderModule shaderModules[4]{};
         VkShaderModuleCreateInfo createInfo{
             VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
             VK_NULL_HANDLE,
             0,
-            raygenShaderCode.size(),
+            raygenShaderCode.size() * sizeof(uint32_t),
             raygenShaderCode.data()
         };
 
         VK_CHECK(vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, &shaderModules[0]));
 
-        createInfo.codeSize = missShaderCode.size();
+        createInfo.codeSize = missShaderCode.size() * sizeof(uint32_t);
         createInfo.pCode = missShaderCode.data();
 
         VK_CHECK(vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, &shaderModules[1]));
 
-        createInfo.codeSize = shadowMissShaderCode.size();
+        createInfo.codeSize = shadowMissShaderCode.size() * sizeof(uint32_t);
         createInfo.pCode = shadowMissShaderCode.data();
 
         VK_CHECK(vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, &shaderModules[2]));
 
-        createInfo.codeSize = closestHitShaderCode.size();
+        createInfo.codeSize = closestHitShaderCode.size() * sizeof(uint32_t);
         createInfo.pCode = closestHitShaderCode.data();
 
         VK_CHECK(vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, &shaderModules[3]));
@@ -224,7 +241,7 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
         VkRayTracingPipelineCreateInfoKHR pipelineCreateInfo{
             VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
             VK_NULL_HANDLE,
-            0,
+            useDescriptorBuffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
             4,
             shaderStages,
             4,
@@ -249,13 +266,13 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
     }
 
     {
-        const auto accumulatedShaderCode = ReadFile<uint32_t>("shaders/temporalAccumulation.comp.spv");
+        const auto accumulatedShaderCode = RequireShader("shaders/temporalAccumulation.comp.spv");
 
         const VkShaderModuleCreateInfo createInfo{
             VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
             VK_NULL_HANDLE,
             0,
-            accumulatedShaderCode.size(),
+            accumulatedShaderCode.size() * sizeof(uint32_t),
             accumulatedShaderCode.data()
         };
 
@@ -265,7 +282,7 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
         VkComputePipelineCreateInfo pipelineCreateInfo{
             VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
             VK_NULL_HANDLE,
-            0,
+            useDescriptorBuffer ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
             {
                 VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 VK_NULL_HANDLE,
@@ -408,7 +425,8 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
         &radianceImageCreateInfo
     };
 
-    radianceImage = memoryManager.createUnmanagedImage(createInfo);
+    // Radiance is traced from scratch every frame, the accumulated images carry history and keep their own memory
+    transientImages.Add(device, memoryManager, radianceImage, createInfo);
     for (auto &accumulatedImage : accumulatedImages)
     {
         accumulatedImage = memoryManager.createUnmanagedImage(createInfo);
@@ -416,10 +434,6 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
 
     renderer->ImmediateSubmit([&](auto commandBuffer)
     {
-        TransitionImage(commandBuffer, radianceImage, VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_NONE,
-                        VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_GENERAL);
-
         for (auto &accumulatedImage : accumulatedImages)
         {
             TransitionImage(commandBuffer, accumulatedImage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_NONE,
@@ -455,7 +469,7 @@ void RayTracing::Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDev
         vkCreateSampler(device, &samplerCreateInfo, VK_NULL_HANDLE, &accumulatedImage.sampler);
 
     hitUniformBuffer = memoryManager.createUnmanagedBuffer({
-        sizeof(LightData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+        sizeof(LightData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
     });
 
@@ -484,13 +498,15 @@ void RayTracing::Destroy(VkDevice device, VkMemoryManager &memoryManager)
     memoryManager.destroyBuffer(sbtBuffer, false);
     memoryManager.destroyBuffer(tlasBuffer, false);
 
-    memoryManager.destroyImage(radianceImage, false);
+    vkDestroySampler(device, radianceImage.sampler, nullptr);
     for (auto &accumulatedImage : accumulatedImages)
         memoryManager.destroyImage(accumulatedImage, false);
     memoryManager.destroyBuffer(meshAddressesBuffer, false);
     memoryManager.destroyBuffer(hitUniformBuffer, false);
 
     allocator.Destroy(device);
+    if (useDescriptorBuffer)
+        descriptorBuffer.Destroy(memoryManager);
     vkDestroyDescriptorSetLayout(device, rayTracingDescriptorSetLayout, nullptr);
     vkDestroyPipelineLayout(device, rayTracingPipelineLayout, nullptr);
     vkDestroyPipeline(device, rayTracingPipeline, nullptr);
@@ -502,6 +518,12 @@ void RayTracing::Destroy(VkDevice device, VkMemoryManager &memoryManager)
 
 void RayTracing::UpdateDescriptorSets(VkDevice device, const uint32_t frameIndex)
 {
+    if (useDescriptorBuffer)
+    {
+        WriteDescriptorBuffer(device, frameIndex);
+        return;
+    }
+
     writer.Clear();
     writer.WriteAccelerationStructure(0, &tlas);
     // TODO: Replace this with radiance cascades
@@ -516,12 +538,34 @@ void RayTracing::UpdateDescriptorSets(VkDevice device, const uint32_t frameIndex
     writer.WriteImage(0, radianceImage.imageView, radianceImage.sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.WriteImage(1, accumulatedImages[frameIndex & 1].imageView, accumulatedImages[frameIndex & 1].sampler, VK_IMAGE_LAYOUT_GENERAL,
                       VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.WriteImage(2, accumulatedImages[(frameIndex + 1) % MAX_FRAMES_IN_FLIGHT].imageView,
-        accumulatedImages[(frameIndex + 1) % MAX_FRAMES_IN_FLIGHT].sampler,
+    writer.WriteImage(2, accumulatedImages[(frameIndex + 1) & 1].imageView,
+        accumulatedImages[(frameIndex + 1) & 1].sampler,
         VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
     writer.UpdateSet(device, accumulatedDescriptorSets[frameIndex & 1]);
 }
 
+void RayTracing::WriteDescriptorBuffer(VkDevice device, const uint32_t frameIndex)
+{
+    const auto &rayTracingSet = rayTracingBufferSets[frameIndex];
+    descriptorBuffer.WriteAccelerationStructure(device, rayTracingSet, 0, tlasAddress);
+    descriptorBuffer.WriteImage(device, rayTracingSet, 1, radianceImage.imageView, radianceImage.sampler, VK_IMAGE_LAYOUT_GENERAL,
+                                VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    // Descriptor buffers take no VK_WHOLE_SIZE
+    descriptorBuffer.WriteBuffer(device, rayTracingSet, 2, GetBufferAddress(device, meshAddressesBuffer.buffer), meshAddressesSize,
+                                 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    descriptorBuffer.WriteImages(device, rayTracingSet, 3, textureInfo);
+    descriptorBuffer.WriteBuffer(device, rayTracingSet, 4, GetBufferAddress(device, hitUniformBuffer.buffer), sizeof(LightData),
+                                 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+    const auto &accumulatedSet = accumulatedBufferSets[frameIndex & 1];
+    descriptorBuffer.WriteImage(device, accumulatedSet, 0, radianceImage.imageView, radianceImage.sampler, VK_IMAGE_LAYOUT_GENERAL,
+                                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    descriptorBuffer.WriteImage(device, accumulatedSet, 1, accumulatedImages[frameIndex & 1].imageView, accumulatedImages[frameIndex & 1].sampler,
+                                VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    descriptorBuffer.WriteImage(device, accumulatedSet, 2, accumulatedImages[(frameIndex + 1) & 1].imageView,
+                                accumulatedImages[(frameIndex + 1) & 1].sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+}
+
 void RayTracing::AddLight(const glm::vec4 lightPosition, glm::vec4 lightColor, const LightType lightType)
 {
     if (lightData.lightCount >= maxLights)
@@ -549,17 +593,20 @@ void RayTracing::UpdateBuffers(const VkMemoryManager &memoryManager)
 }
 
 void RayTracing::TraceRay(const VkCommandBuffer commandBuffer,
-                          const uint32_t frameIndex, const glm::mat4 & viewInverse,
+                          const uint32_t frameIndex, const VkDeviceAddress camera,
                           const glm::mat4 &projectionInverse, const glm::vec3 &cameraPosition,
-                          const VkExtent2D &swapChainExtent)
+                          const VkExtent2D &renderExtent)
 {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipelineLayout, 0, 1,
-                            &rayTracingDescriptorSets[frameIndex], 0, nullptr);
+    if (useDescriptorBuffer)
+        descriptorBuffer.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipelineLayout, 0, rayTracingBufferSets[frameIndex]);
+    else
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, rayTracingPipelineLayout, 0, 1,
+                                &rayTracingDescriptorSets[frameIndex], 0, nullptr);
 
     const RaygenPushConstants raygenPushConstants{
-        viewInverse,
-        projectionInverse
+        projectionInverse,
+        camera
     };
 
     const HitPushConstants hitPushConstants{cameraPosition};
@@ -574,7 +621,7 @@ void RayTracing::TraceRay(const VkCommandBuffer commandBuffer,
                       &missSBT,
                       &hitSBT,
                       &callableSBT, // Callable SBT
-                      swapChainExtent.width, swapChainExtent.height, 1); // Width, Height, Depth
+                      renderExtent.width, renderExtent.height, 1); // Width, Height, Depth
 }
 
 void RayTracing::TransitionAccumulatedImages(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 oldStage, VkPipelineStageFlags2 newStage)
@@ -603,8 +650,11 @@ void RayTracing::TransitionAccumulatedImages(VkCommandBuffer commandBuffer, VkPi
 void RayTracing::AccumulateRadiance(VkCommandBuffer commandBuffer, const uint32_t updateFrameIndex, const VkExtent2D &swapChainExtent)
 {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, accumulatedPipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, accumulatedPipelineLayout, 0, 1,
-                            &accumulatedDescriptorSets[updateFrameIndex % MAX_FRAMES_IN_FLIGHT], 0, nullptr);
+    if (useDescriptorBuffer)
+        descriptorBuffer.Bind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, accumulatedPipelineLayout, 0, accumulatedBufferSets[updateFrameIndex & 1]);
+    else
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, accumulatedPipelineLayout, 0, 1,
+                                &accumulatedDescriptorSets[updateFrameIndex & 1], 0, nullptr);
 
     // const AccumulatedComputePushConstants pushConstants{frameIndex};
     vkCmdPushConstants(commandBuffer, accumulatedPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(AccumulatedComputePushConstants), &computePushConstants);
@@ -801,7 +851,8 @@ void RayTracing::BuildBLAS(VkRenderer *renderer, const std::vector<VkRenderObjec
         meshAddresses[i].firstIndex = renderObjects[i].firstIndex;
     }
 
-    meshAddressesBuffer = memoryManager.createUnmanagedBuffer({renderObjects.size() * sizeof(MeshData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    meshAddressesSize = renderObjects.size() * sizeof(MeshData);
+    meshAddressesBuffer = memoryManager.createUnmanagedBuffer({meshAddressesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
     const auto mappedMemoryTask = [&](void *data)
     {
@@ -987,6 +1038,13 @@ void RayTracing::BuildTLAS(VkRenderer *renderer,
 
     VK_CHECK(vkCreateAccelerationStructureKHR(device, &accelInfo, VK_NULL_HANDLE, &tlas));
 
+    const VkAccelerationStructureDeviceAddressInfoKHR tlasAddressInfo{
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        VK_NULL_HANDLE,
+        tlas
+    };
+    tlasAddress = vkGetAccelerationStructureDeviceAddressKHR(device, &tlasAddressInfo);
+
     buildGeometryInfos.srcAccelerationStructure = tlas;
     buildGeometryInfos.dstAccelerationStructure = tlas;
     buildGeometryInfos.scratchData.deviceAddress = GetBufferAddress(device, tlasScratchBuffer.buffer);
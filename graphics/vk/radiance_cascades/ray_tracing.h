@@ -6,6 +6,8 @@
 #include "radiance_cascades.h"
 #include "engine/objects/render_object.h"
 #include "graphics/vk/memory/vk_memory.h"
+#include "graphics/vk/memory/vk_transient_image_pool.h"
+#include "graphics/vk/vk_descriptor_buffer.h"
 
 class VkMemoryManager;
 class VkRenderer;
@@ -20,7 +22,7 @@ public:
     };
 
     RayTracing() = default;
-    void Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryManager &memoryManager, const VkExtent2D &swapChainExtent);
+    void Init(const VkRenderer *renderer, VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryManager &memoryManager, VkTransientImagePool &transientImages, const VkExtent2D &swapChainExtent);
     void Destroy(VkDevice device, VkMemoryManager &memoryManager);
     void UpdateDescriptorSets(VkDevice device, uint32_t frameIndex);
     void AddLight(glm::vec4 lightPosition, glm::vec4 lightColor, LightType lightType);
@@ -29,10 +31,12 @@ public:
     void TraceRay(
         VkCommandBuffer commandBuffer,
         uint32_t frameIndex,
-        const glm::mat4 & viewInverse,
+        // CameraData, the view is read when the rays are traced
+        VkDeviceAddress camera,
         const glm::mat4 & projectionInverse,
         const glm::vec3 & cameraPosition,
-        const VkExtent2D &swapChainExtent
+        // Rays are traced into the top left corner of the radiance image
+        const VkExtent2D &renderExtent
     );
     void TransitionAccumulatedImages(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 oldStage, VkPipelineStageFlags2 newStage);
     void AccumulateRadiance(VkCommandBuffer commandBuffer, uint32_t updateFrameIndex, const VkExtent2D &swapChainExtent);
@@ -56,11 +60,13 @@ private:
     } lightData;
 
     VkDeviceAddress getBlasDeviceAddress(VkDevice, uint32_t);
+    // UpdateDescriptorSets for the descriptor buffer, writes the same descriptors into the frame's regions
+    void WriteDescriptorBuffer(VkDevice device, uint32_t frameIndex);
 
     DescriptorAllocator allocator;
     DescriptorWriter writer;
     VkDescriptorSetLayout rayTracingDescriptorSetLayout;
-    std::array<VkDescriptorSet, 2> rayTracingDescriptorSets;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> rayTracingDescriptorSets;
     VkPipelineLayout rayTracingPipelineLayout;
     VkPipeline rayTracingPipeline;
 
@@ -69,6 +75,13 @@ private:
     VkPipelineLayout accumulatedPipelineLayout;
     VkPipeline accumulatedPipeline;
 
+    // Take the place of the sets above when the renderer has descriptor buffers enabled, every frame's descriptors are
+    // then written straight into mapped memory
+    bool useDescriptorBuffer{false};
+    DescriptorBuffer descriptorBuffer;
+    std::array<DescriptorBuffer::Set, MAX_FRAMES_IN_FLIGHT> rayTracingBufferSets{};
+    std::array<DescriptorBuffer::Set, 2> accumulatedBufferSets{};
+
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties;
 
     VkStridedDeviceAddressRegionKHR rgenSBT{};
@@ -94,6 +107,9 @@ private:
     VulkanBuffer hitUniformBuffer;
 
     VkAccelerationStructureKHR tlas;
+    // Descriptor buffers take addresses and exact sizes instead of handles
+    VkDeviceAddress tlasAddress{};
+    VkDeviceSize meshAddressesSize{};
     std::vector<VkAccelerationStructureKHR> blas;
     std::vector<VulkanBuffer> blasScratchBuffers;
 
@@ -0,0 +1,12 @@
+// CameraData in the frame ring, written right before the frame is submitted so it holds the latest camera rotation
+layout(buffer_reference, std430) readonly buffer CameraBuffer {
+    mat4 view;
+    mat4 inverseView;
+    mat4 reprojection; // view space to the previous frame's unjittered clip space
+    vec4 front;
+    vec4 right;
+    vec4 up;
+    vec4 previousFront;
+    vec4 previousRight;
+    vec4 previousUp;
+};
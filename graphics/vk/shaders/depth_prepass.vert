@@ -1,18 +1,13 @@
 #version 460
 
 #extension GL_EXT_buffer_reference : require
+#extension GL_ARB_shader_viewport_layer_array : require
 
 struct Vertex {
-    vec3 position;
-    vec3 normal;
-    vec3 color;
-    vec2 uv;
+    vec4 position; // x, y, z, u (texcoord)
+    vec4 normal; // x, y, z, v (texcoord)
 };
 
-layout(set = 0, binding = 0) uniform SceneData {
-    mat4 worldMatrix;
-} sceneData;
-
 layout(constant_id = 0) const uint MAX_CASCADES = 4;
 
 layout(set = 0, binding = 1) uniform CascadeData {
@@ -23,12 +18,42 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer {
     Vertex vertices[];
 };
 
-layout(push_constant) uniform PushConstants {
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
+    mat4 worldMatrix;
     VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+// One entry per (draw, cascade) pair that survived culling, indexed by gl_InstanceIndex
+struct ShadowInstance {
+    uint drawIndex;
     uint cascadeIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer ShadowInstanceBuffer {
+    ShadowInstance instances[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
+    ShadowInstanceBuffer shadowInstances;
 } pushConstants;
 
 void main() {
-    Vertex v = pushConstants.vertexBuffer.vertices[gl_VertexIndex];
-    gl_Position = cascadeData.viewProjectionMatrix[pushConstants.cascadeIndex] * vec4(v.position, 1.0);
+    ShadowInstance instance = pushConstants.shadowInstances.instances[gl_InstanceIndex];
+    DrawData draw = pushConstants.drawData.draws[instance.drawIndex];
+    Vertex v = draw.vertexBuffer.vertices[gl_VertexIndex];
+
+    gl_Position = cascadeData.viewProjectionMatrix[instance.cascadeIndex] * draw.worldMatrix * vec4(v.position.xyz, 1.0);
+    gl_Layer = int(instance.cascadeIndex);
 }
\ No newline at end of file
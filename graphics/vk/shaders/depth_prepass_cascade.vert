@@ -0,0 +1,58 @@
+#version 460
+
+#extension GL_EXT_buffer_reference : require
+
+struct Vertex {
+    vec4 position; // x, y, z, u (texcoord)
+    vec4 normal; // x, y, z, v (texcoord)
+};
+
+layout(constant_id = 0) const uint MAX_CASCADES = 4;
+
+layout(set = 0, binding = 1) uniform CascadeData {
+    mat4 viewProjectionMatrix[MAX_CASCADES];
+} cascadeData;
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+    Vertex vertices[];
+};
+
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
+    mat4 worldMatrix;
+    VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+// One entry per (draw, cascade) pair that survived culling, indexed by gl_InstanceIndex
+struct ShadowInstance {
+    uint drawIndex;
+    uint cascadeIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer ShadowInstanceBuffer {
+    ShadowInstance instances[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
+    ShadowInstanceBuffer shadowInstances;
+} pushConstants;
+
+// depth_prepass.vert without gl_Layer, for devices without shaderOutputLayer where each pass renders one cascade layer
+void main() {
+    ShadowInstance instance = pushConstants.shadowInstances.instances[gl_InstanceIndex];
+    DrawData draw = pushConstants.drawData.draws[instance.drawIndex];
+    Vertex v = draw.vertexBuffer.vertices[gl_VertexIndex];
+
+    gl_Position = cascadeData.viewProjectionMatrix[instance.cascadeIndex] * draw.worldMatrix * vec4(v.position.xyz, 1.0);
+}
\ No newline at end of file
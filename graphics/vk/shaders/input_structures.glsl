@@ -1,11 +1,21 @@
 layout(set = 0, binding = 0) uniform SceneData{
     mat4 worldMatrix;
+    vec4 cameraPosition;
+    ivec2 viewportSize;
+    vec4 cascadeSplits;
+    mat4 previousWorldMatrix; // unjittered
+    vec4 jitter; // xy = NDC offset of this frame's projection
 } sceneData;
 
-layout(set = 1, binding = 0) uniform GLTFMaterialData{
+struct MaterialData {
     vec4 colorFactors;
     vec4 metalRoughFactors;
-} materialData;
+    uint colorTextureIndex;
+    uint metalRoughTextureIndex;
+};
 
-layout(set = 1, binding = 1) uniform sampler2D colorTexture;
-layout(set = 1, binding = 2) uniform sampler2D metalRoughTexture;
\ No newline at end of file
+layout(std430, set = 1, binding = 0) readonly buffer MaterialBuffer {
+    MaterialData materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
\ No newline at end of file
@@ -0,0 +1,106 @@
+// Shadow and tiled light evaluation shared by the forward and visibility buffer paths.
+// Expects sceneData and the enablePCF, MAX_CASCADES and LIGHT_MODEL specialization constants to be declared before
+// inclusion. Branches on them are folded when the pipeline is created, none are left in the light loop.
+
+layout(set = 0, binding = 1) uniform readonly CascadeData {
+    mat4 viewProjectionMatrix[MAX_CASCADES];
+} cascadeData;
+
+layout(set = 0, binding = 2) uniform sampler2DArray shadowMap;
+
+layout(set = 2, binding = 0) buffer readonly lightBuffer {
+    uint lightNum;
+    Light lights[];
+};
+
+layout(std430, set = 2, binding = 1) buffer readonly clusterBuffer {
+    vec4 sliceParams;
+    vec4 tileSize;
+    vec4 depthParams;
+    ClusterAABB clusters[];
+};
+
+layout(std430, set = 2, binding = 2) buffer readonly lightGridBuffer {
+    uint lightIndexCount;
+    vec4 viewDepthRow;
+    uvec2 lightGrid[];
+};
+
+layout(set = 2, binding = 3) buffer readonly lightIndexBuffer {
+    uint lightIndices[];
+};
+
+const float ambient = 0.1f;
+const mat4 biasMat = mat4(
+        0.5, 0.0, 0.0, 0.0,
+        0.0, 0.5, 0.0, 0.0,
+        0.0, 0.0, 1.0, 0.0,
+        0.5, 0.5, 0.0, 1.0
+);
+
+float textureProjection(vec4 shadowCoord, vec2 offset, uint cascadeIndex) {
+    const float shadow = 1.0f;
+    const float bias = 0.005f;
+    float dist = texture(shadowMap, vec3(shadowCoord.st + offset, cascadeIndex)).r;
+
+    return shadowCoord.z > -1.0f && shadowCoord.z < 1.0f && shadowCoord.w > 0.0f && dist < shadowCoord.z - bias ? ambient : shadow;
+}
+
+float filterPCF(vec4 shadowCoord, uint cascadeIndex) {
+    vec2 textureDim = textureSize(shadowMap, 0).xy;
+    const float scale = 0.75f;
+    vec2 diff = vec2(scale / textureDim.x, scale / textureDim.y);
+
+    float shadowFactor = 0.0f;
+    uint count = 0;
+    const int range = 1;
+
+    for (int x = -range; x <= range; x++) {
+        for (int y = -range; y <= range; y++) {
+            vec2 offset = vec2(x, y) * diff;
+            shadowFactor += textureProjection(shadowCoord, offset, cascadeIndex);
+            count++;
+        }
+    }
+
+    return shadowFactor / count;
+}
+
+vec3 computeLighting(vec3 fragPos, vec3 normal) {
+    uint cascadeIndex = 0;
+    for (uint i = 0; i < MAX_CASCADES - 1; i++) {
+        cascadeIndex += uint(fragPos.z < sceneData.cascadeSplits[i]);
+    }
+
+    vec4 shadowCoord = biasMat * cascadeData.viewProjectionMatrix[cascadeIndex] * vec4(fragPos, 1.0f);
+
+    float viewDepth = -dot(viewDepthRow, vec4(fragPos, 1.0f));
+    uint zTile = uint(clamp(log(max(viewDepth, sliceParams.z)) * sliceParams.x + sliceParams.y, 0.0f, TILE_Z - 1));
+    uvec2 xyTile = min(uvec2(gl_FragCoord.xy / tileSize.xy), uvec2(TILE_X - 1, TILE_Y - 1));
+    uvec2 cluster = lightGrid[xyTile.x + xyTile.y * TILE_X + zTile * TILE_X * TILE_Y];
+
+    vec3 diffuse = vec3(ambient);
+
+    float shadow = enablePCF == 1 ? filterPCF(shadowCoord / shadowCoord.w, cascadeIndex) : textureProjection(shadowCoord / shadowCoord.w, vec2(0.0f), cascadeIndex);
+    for (uint i = 0; i < cluster.y; i++) {
+        Light light = lights[lightIndices[cluster.x + i]];
+
+        vec3 lightPosition = light.position.xyz;
+        vec4 lightColor = light.color;
+
+        float lightDist = distance(lightPosition, fragPos);
+        vec3 lightDir = (lightPosition - fragPos) / lightDist;
+
+        float lambertian = max(dot(normal, lightDir), 0.0f);
+        float attenuation = lightAttenuation(lightDist, light.position.w);
+        float specular = 0.0f;
+        if (LIGHT_MODEL == LIGHT_MODEL_BLINN_PHONG) {
+            vec3 halfDist = normalize(lightDir + normalize(lightPosition));
+            specular = pow(clamp(dot(normal, halfDist), 0.0f, 1.0f), 32.0f);
+        }
+
+        diffuse += (lambertian * (1 - shadow) + specular) * lightColor.rgb * lightColor.w * attenuation;
+    }
+
+    return diffuse;
+}
\ No newline at end of file
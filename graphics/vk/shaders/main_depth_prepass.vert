@@ -0,0 +1,40 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+
+// Only the position is fetched, the rest of DrawData is kept so the layout matches mesh.vert
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+    vec4 positions[]; // x, y, z, u with the normal interleaved
+};
+
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
+    mat4 worldMatrix;
+    VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
+} pushConstants;
+
+invariant gl_Position;
+
+void main() {
+    DrawData draw = pushConstants.drawData.draws[gl_InstanceIndex];
+    vec4 pos = draw.worldMatrix * vec4(draw.vertexBuffer.positions[gl_VertexIndex * 2].xyz, 1.0);
+
+    gl_Position = sceneData.worldMatrix * pos;
+}
\ No newline at end of file
@@ -1,15 +1,24 @@
 #version 460
 
 #extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
 
 layout(set = 0, binding = 0) uniform sampler2D radianceImage;
 layout(set = 0, binding = 1) uniform sampler2D accumulatedImage;
 
+#include "camera.glsl"
+#include "velocity.glsl"
+
+// The scene only covers the top left corner of the radiance image when it's rendered below full resolution
 layout(push_constant) uniform PushConstants {
-    vec2 viewportSize;
+    CameraBuffer camera;
+    vec4 projection; // xy = projection scale, zw = NDC jitter
+    vec2 radianceSize;
+    vec2 renderSize;
 } pc;
 
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
 
 void main() {
     // vec4 radiance = texture(radianceImage, uv);
@@ -17,5 +26,12 @@ void main() {
 
     // float alpha = 1.0 / float(pc.frameIndex + 1);
     // outColor = mix(accumulated, radiance, alpha);
-    outColor = texture(radianceImage, gl_FragCoord.xy / pc.viewportSize);
+    vec4 radiance = texture(radianceImage, gl_FragCoord.xy / pc.radianceSize);
+    outColor = vec4(radiance.rgb, 1.0);
+
+    // Alpha holds the distance to the primary hit, rays that missed are reprojected as directions
+    vec2 ndc = gl_FragCoord.xy / pc.renderSize * 2.0 - 1.0 - pc.projection.zw;
+    vec3 direction = normalize(vec3(ndc / pc.projection.xy, -1.0));
+    vec4 position = radiance.a > 0.0 ? vec4(direction * radiance.a, 1.0) : vec4(direction, 0.0);
+    outVelocity = velocity(vec4(ndc, 0.0, 1.0), pc.camera.reprojection * position);
 }
\ No newline at end of file
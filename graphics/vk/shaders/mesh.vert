@@ -6,10 +6,8 @@
 #include "input_structures.glsl"
 
 struct Vertex {
-    vec3 position;
-    vec3 normal;
-    vec3 color;
-    vec2 uv;
+    vec4 position; // x, y, z, u (texcoord)
+    vec4 normal; // x, y, z, v (texcoord)
 };
 
 layout(buffer_reference, std430) readonly buffer VertexBuffer {
@@ -20,24 +18,52 @@ layout(set = 0, binding = 3) uniform ViewMatrix {
     mat4 viewMatrix;
 };
 
-layout(push_constant) uniform PushConstants {
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
     mat4 worldMatrix;
     VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
 } pushConstants;
 
 layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragUV;
 layout(location = 2) out vec3 fragPos;
 layout(location = 3) out vec3 fragViewPos;
+layout(location = 4) flat out uint fragMaterialIndex;
+layout(location = 5) out vec4 fragCurrentPosition;
+layout(location = 6) out vec4 fragPreviousPosition;
+
+// Must match main_depth_prepass.vert bit for bit so the EQUAL depth test passes
+invariant gl_Position;
 
 void main() {
-    Vertex v = pushConstants.vertexBuffer.vertices[gl_VertexIndex];
-    vec4 pos = pushConstants.worldMatrix * vec4(v.position, 1.0);
+    DrawData draw = pushConstants.drawData.draws[gl_InstanceIndex];
+    Vertex v = draw.vertexBuffer.vertices[gl_VertexIndex];
+    vec4 pos = draw.worldMatrix * vec4(v.position.xyz, 1.0);
 
     gl_Position = sceneData.worldMatrix * pos;
 
     fragPos = pos.xyz;
-    fragNormal = v.normal;
-    fragUV = v.uv;
-    fragViewPos = (viewMatrix * vec4(v.position, 1.0)).xyz;
+    fragNormal = v.normal.xyz;
+    fragUV = vec2(v.position.w, v.normal.w);
+    fragViewPos = (viewMatrix * vec4(v.position.xyz, 1.0)).xyz;
+    fragMaterialIndex = draw.materialIndex;
+
+    // Motion is measured between unjittered positions, the jitter would otherwise show up as movement
+    fragCurrentPosition = gl_Position;
+    fragCurrentPosition.xy -= sceneData.jitter.xy * gl_Position.w;
+    fragPreviousPosition = sceneData.previousWorldMatrix * pos;
 }
\ No newline at end of file
@@ -5,6 +5,13 @@
 
 #include "../tiled_shading.glsl"
 
+layout(set = 0, binding = 0) uniform SceneData{
+    mat4 worldMatrix;
+    vec4 cameraPosition;
+    ivec2 viewportSize;
+    vec4 cascadeSplits;
+} sceneData;
+
 layout(set = 0, binding = 1) uniform CascadeData {
     mat4 viewProjectionMatrix[4];
 } cascadeData;
@@ -17,45 +24,51 @@ layout(set = 2, binding = 0) buffer readonly lightBuffer {
     Light lights[];
 };
 
-layout(std430, set = 2, binding = 1) buffer readonly visibilityBuffer {
-    FrustumAABB frustumAABB;
-    LightVisibility visibilities[];
+layout(std430, set = 2, binding = 1) buffer readonly clusterBuffer {
+    vec4 sliceParams;
+    vec4 tileSize;
+    vec4 depthParams;
+    ClusterAABB clusters[];
 };
 
-layout(set = 2, binding = 2) buffer readonly lightCount {
-    uint16_t lightCounts[MAX_LIGHTS_VISIBLE];
+layout(std430, set = 2, binding = 2) buffer readonly lightGridBuffer {
+    uint lightIndexCount;
+    vec4 viewDepthRow;
+    uvec2 lightGrid[];
 };
 
-layout(push_constant) uniform PushConstants {
-    // layout(offset = 64) vec3 cameraPosition;
-    // layout(offset = 80) ivec2 viewportSize;
-    // layout(offset = 96) vec4 cascadeSplits;
-    layout(offset = 80) vec3 cameraPosition;
-    layout(offset = 96) ivec2 viewportSize;
-    layout(offset = 112) vec4 cascadeSplits;
-} pushConstants;
+layout(set = 2, binding = 3) buffer readonly lightIndexBuffer {
+    uint lightIndices[];
+};
 
 layout(location = 0) in VertexInput {
     vec3 inNormal;
     vec3 fragPos;
+    vec4 currentPosition;
+    vec4 previousPosition;
 };
 
+layout(constant_id = 2) const uint LIGHT_MODEL = LIGHT_MODEL_BLINN_PHONG;
+
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
+
+#include "../velocity.glsl"
 
 precision mediump float;
 
 void main() {
-    uint zTile = uint(TILE_Z * log((-gl_FragCoord.z - Z_NEAR) / (Z_FAR / Z_NEAR)));
-    uvec3 tile = uvec3(gl_FragCoord.xy / (pushConstants.viewportSize / vec2(TILE_X, TILE_Y)), zTile);
-    uint tileIndex = tile.x + tile.y * TILE_X + tile.z * TILE_X * TILE_Y;
-    uint16_t numLightsInTile = lightCounts[tileIndex];
+    float viewDepth = -dot(viewDepthRow, vec4(fragPos, 1.0f));
+    uint zTile = uint(clamp(log(max(viewDepth, sliceParams.z)) * sliceParams.x + sliceParams.y, 0.0f, TILE_Z - 1));
+    uvec2 xyTile = min(uvec2(gl_FragCoord.xy / tileSize.xy), uvec2(TILE_X - 1, TILE_Y - 1));
+    uvec2 cluster = lightGrid[xyTile.x + xyTile.y * TILE_X + zTile * TILE_X * TILE_Y];
 
     vec3 diffuse = vec3(0.05f);
-    vec3 viewDir = normalize(pushConstants.cameraPosition - inNormal);
+    vec3 viewDir = normalize(sceneData.cameraPosition.xyz - inNormal);
 
-    for (uint i = 0; i < numLightsInTile; i++) 
+    for (uint i = 0; i < cluster.y; i++)
     {
-        Light light = lights[visibilities[tileIndex].indices[i]];
+        Light light = lights[lightIndices[cluster.x + i]];
 
         vec3 lightPosition = light.position.xyz;
         vec4 lightColor = light.color;
@@ -64,12 +77,16 @@ void main() {
         vec3 lightDir = (lightPosition - fragPos) / lightDist;
 
         float lambertian = max(dot(inNormal, lightDir), 0.0f);
-        float attenuation = clamp(1.0f / dot(lightDist, lightDist), 0.0f, 1.0f);
-        vec3 halfDist = normalize(lightDir + viewDir);
-        float specular = pow(clamp(dot(inNormal, halfDist), 0.0f, 1.0f), 32.0f);
+        float attenuation = lightAttenuation(lightDist, light.position.w);
+        float specular = 0.0f;
+        if (LIGHT_MODEL == LIGHT_MODEL_BLINN_PHONG) {
+            vec3 halfDist = normalize(lightDir + viewDir);
+            specular = pow(clamp(dot(inNormal, halfDist), 0.0f, 1.0f), 32.0f);
+        }
 
         diffuse += (lambertian + specular) * lightColor.xyz * lightColor.w * attenuation;
     }
 
     outColor = vec4(inNormal, 1.0);
+    outVelocity = velocity(currentPosition, previousPosition);
 }
\ No newline at end of file
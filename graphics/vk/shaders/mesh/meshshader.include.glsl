@@ -5,6 +5,15 @@ struct Meshlet {
     uint triangle_count;
 };
 
+struct MeshletCluster {
+    vec4 bounds;
+    vec4 parentBounds;
+    float error;
+    float parentError;
+    uint level;
+    uint padding;
+};
+
 struct Payload {
     uint meshletPrimitives[32];
 };
\ No newline at end of file
@@ -3,8 +3,13 @@
 layout(binding = 0) uniform samplerCube skybox;
 
 layout(location = 0) in vec3 fragUVW;
+layout(location = 1) in vec2 fragPosition;
+layout(location = 2) noperspective in vec3 fragPreviousPosition;
+
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
 
 void main() {
     outColor = texture(skybox, fragUVW);
+    outVelocity = (fragPosition - fragPreviousPosition.xy / fragPreviousPosition.z) * 0.5;
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
 #version 460
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "camera.glsl"
 
 const vec3 screenQuadVertices[6] = vec3[](
     vec3(-1.0, -1.0, 0.0),
@@ -10,15 +14,24 @@ const vec3 screenQuadVertices[6] = vec3[](
 );
 
 layout(push_constant) uniform PushConstants {
-    vec3 front;
-    vec3 right;
-    vec3 up;
+    CameraBuffer camera;
+    vec2 jitter;
 } pushConstants;
 
 layout(location = 0) out vec3 fragUVW;
+layout(location = 1) out vec2 fragPosition;
+layout(location = 2) noperspective out vec3 fragPreviousPosition;
 
 void main() {
     vec2 pos = screenQuadVertices[gl_VertexIndex].xy;
     gl_Position = vec4(pos, 0.0, 1.0);
-    fragUVW = normalize(pushConstants.front + pushConstants.right * pos.x - pushConstants.up * pos.y).xyz;
+
+    // The quad stays put, the jitter moves the directions looked up behind it instead
+    CameraBuffer camera = pushConstants.camera;
+    vec2 view = pos - pushConstants.jitter;
+    vec3 direction = camera.front.xyz + camera.right.xyz * view.x - camera.up.xyz * view.y;
+    fragUVW = normalize(direction);
+    fragPosition = view;
+    // Same direction in the previous camera's basis, divided by z per pixel
+    fragPreviousPosition = vec3(dot(direction, camera.previousRight.xyz), -dot(direction, camera.previousUp.xyz), dot(direction, camera.previousFront.xyz));
 }
\ No newline at end of file
@@ -1,28 +1,27 @@
+// Must match the cluster grid defines in vk_renderer.h
 #define TILE_X 16
 #define TILE_Y 9
 #define TILE_Z 24
-#define MAX_LIGHTS_VISIBLE 256
+#define MAX_LIGHTS_PER_CLUSTER 256
+#define MAX_LIGHT_INDICES (TILE_X * TILE_Y * TILE_Z * 64)
 
-#define Z_NEAR 0.1f
-#define Z_FAR 1000.0f
-
-#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
-#extension GL_EXT_shader_16bit_storage : require
+// Must match LightModel in vk_shader_features.h
+const uint LIGHT_MODEL_BLINN_PHONG = 0;
+const uint LIGHT_MODEL_LAMBERT = 1;
 
 struct Light {
     vec4 position; // xyz: position, w: radius
     vec4 color; // xyz: color, w: intensity
 };
 
-struct FrustumAABB {
+struct ClusterAABB {
     vec4 minPoint;
     vec4 maxPoint;
 };
 
-struct LightCount {
-    uint16_t count;
-};
-
-struct LightVisibility {
-    uint16_t indices[MAX_LIGHTS_VISIBLE];
-};
\ No newline at end of file
+// Windowed inverse square falloff, reaches zero at the radius the lights are culled with
+float lightAttenuation(float lightDist, float radius) {
+    float ratio = lightDist / radius;
+    float window = clamp(1.0f - ratio * ratio * ratio * ratio, 0.0f, 1.0f);
+    return window * window * clamp(1.0f / (lightDist * lightDist), 0.0f, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,4 @@
+// Screen space motion between two clip space positions of the same point, in UV units from the previous frame to this one
+highp vec2 velocity(highp vec4 currentPosition, highp vec4 previousPosition) {
+    return (currentPosition.xy / currentPosition.w - previousPosition.xy / previousPosition.w) * 0.5;
+}
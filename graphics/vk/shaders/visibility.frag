@@ -0,0 +1,11 @@
+#version 460
+
+layout(location = 0) flat in uint drawIndex;
+
+layout(location = 0) out uvec2 outVisibility;
+
+layout(early_fragment_tests) in;
+
+void main() {
+    outVisibility = uvec2(drawIndex, gl_PrimitiveID);
+}
\ No newline at end of file
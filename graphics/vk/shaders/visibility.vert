@@ -0,0 +1,45 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+
+struct Vertex {
+    vec4 position; // x, y, z, u (texcoord)
+    vec4 normal; // x, y, z, v (texcoord)
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+    Vertex vertices[];
+};
+
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
+    mat4 worldMatrix;
+    VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
+} pushConstants;
+
+layout(location = 0) flat out uint drawIndex;
+
+void main() {
+    DrawData draw = pushConstants.drawData.draws[gl_InstanceIndex];
+    vec3 position = draw.vertexBuffer.vertices[gl_VertexIndex].position.xyz;
+
+    gl_Position = sceneData.worldMatrix * draw.worldMatrix * vec4(position, 1.0);
+    drawIndex = gl_InstanceIndex;
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#version 460
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+#extension GL_EXT_shader_16bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int16 : require
+#extension GL_EXT_nonuniform_qualifier : require
+
+#include "tiled_shading.glsl"
+#include "input_structures.glsl"
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 outVelocity;
+
+layout(constant_id = 0) const uint enablePCF = 1;
+layout(constant_id = 1) const uint MAX_CASCADES = 4;
+layout(constant_id = 2) const uint LIGHT_MODEL = LIGHT_MODEL_BLINN_PHONG;
+
+#include "lighting.glsl"
+#include "velocity.glsl"
+
+layout(set = 0, binding = 11) uniform usampler2D visibilityImage;
+
+struct Vertex {
+    vec4 position; // x, y, z, u (texcoord)
+    vec4 normal; // x, y, z, v (texcoord)
+};
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer {
+    Vertex vertices[];
+};
+
+layout(buffer_reference, std430) readonly buffer IndexBuffer {
+    uint indices[];
+};
+
+struct DrawData {
+    mat4 worldMatrix;
+    VertexBuffer vertexBuffer;
+    IndexBuffer indexBuffer;
+    uint materialIndex;
+    uint firstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer DrawDataBuffer {
+    DrawData draws[];
+};
+
+layout(push_constant) uniform PushConstants {
+    DrawDataBuffer drawData;
+} pushConstants;
+
+const uint INVALID_DRAW = 0xFFFFFFFFu;
+
+// Perspective correct barycentrics of the pixel along with their screen space derivatives,
+// which stand in for the implicit derivatives a full screen pass doesn't have
+void computeBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 ndc, vec2 screenSize, out vec3 lambda, out vec3 ddx, out vec3 ddy) {
+    vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+
+    vec2 ndc0 = clip0.xy * invW.x;
+    vec2 ndc1 = clip1.xy * invW.y;
+    vec2 ndc2 = clip2.xy * invW.z;
+
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+
+    float ddxSum = dot(ddx, vec3(1.0));
+    float ddySum = dot(ddy, vec3(1.0));
+
+    vec2 delta = ndc - ndc0;
+    float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+    float interpW = 1.0 / interpInvW;
+
+    lambda = interpW * (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy);
+
+    // Step one pixel in each direction
+    ddx *= 2.0 / screenSize.x;
+    ddy *= 2.0 / screenSize.y;
+    ddxSum *= 2.0 / screenSize.x;
+    ddySum *= 2.0 / screenSize.y;
+
+    ddx = (1.0 / (interpInvW + ddxSum)) * (lambda * interpInvW + ddx) - lambda;
+    ddy = (1.0 / (interpInvW + ddySum)) * (lambda * interpInvW + ddy) - lambda;
+}
+
+void main() {
+    uvec2 visibility = texelFetch(visibilityImage, ivec2(gl_FragCoord.xy), 0).xy;
+    if (visibility.x == INVALID_DRAW) {
+        discard;
+    }
+
+    DrawData draw = pushConstants.drawData.draws[visibility.x];
+
+    uint index = draw.firstIndex + visibility.y * 3;
+    Vertex v0 = draw.vertexBuffer.vertices[draw.indexBuffer.indices[index + 0]];
+    Vertex v1 = draw.vertexBuffer.vertices[draw.indexBuffer.indices[index + 1]];
+    Vertex v2 = draw.vertexBuffer.vertices[draw.indexBuffer.indices[index + 2]];
+
+    vec4 world0 = draw.worldMatrix * vec4(v0.position.xyz, 1.0);
+    vec4 world1 = draw.worldMatrix * vec4(v1.position.xyz, 1.0);
+    vec4 world2 = draw.worldMatrix * vec4(v2.position.xyz, 1.0);
+
+    vec2 screenSize = vec2(sceneData.viewportSize);
+    vec2 ndc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+
+    vec3 lambda, ddx, ddy;
+    computeBarycentrics(sceneData.worldMatrix * world0, sceneData.worldMatrix * world1, sceneData.worldMatrix * world2, ndc, screenSize, lambda, ddx, ddy);
+
+    vec3 fragPos = mat3(world0.xyz, world1.xyz, world2.xyz) * lambda;
+    vec3 normal = normalize(mat3(v0.normal.xyz, v1.normal.xyz, v2.normal.xyz) * lambda);
+
+    mat3x2 uvs = mat3x2(
+        vec2(v0.position.w, v0.normal.w),
+        vec2(v1.position.w, v1.normal.w),
+        vec2(v2.position.w, v2.normal.w)
+    );
+
+    MaterialData material = materials[draw.materialIndex];
+    vec4 texColor = textureGrad(textures[nonuniformEXT(material.colorTextureIndex)], uvs * lambda, uvs * ddx, uvs * ddy);
+
+    outColor = vec4(computeLighting(fragPos, normal), 1.0f) * texColor;
+    outVelocity = velocity(vec4(ndc - sceneData.jitter.xy, 0.0, 1.0), sceneData.previousWorldMatrix * vec4(fragPos, 1.0));
+}
\ No newline at end of file
@@ -24,6 +24,9 @@
 #define VK_CHECK(x) x
 #endif
 
+// Upper bound for everything duplicated per frame, the renderer can run with fewer at runtime
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
 struct Mesh {
     VkBuffer indexBuffer;
     VkBuffer vertexBuffer;
@@ -32,13 +35,22 @@ struct Mesh {
 };
 
 struct MeshPushConstants {
-    alignas(16) glm::mat4 worldMatrix;
-    alignas(16) VkDeviceAddress vertexBufferDeviceAddress;
+    VkDeviceAddress drawDataBufferDeviceAddress;
 };
 
+// Reprojects the primary hit of each pixel into the previous frame for the temporal upscaler
 struct RtMeshPushConstants
 {
-    glm::vec2 viewportSize;
+    VkDeviceAddress camera; // CameraData
+    alignas(16) glm::vec4 projection; // xy = projection scale, zw = NDC jitter
+    glm::vec2 radianceSize;
+    glm::vec2 renderSize;
+};
+
+// The camera basis of this frame and the last comes from CameraData, the sky's motion is the change in rotation alone
+struct SkyboxPushConstants {
+    VkDeviceAddress camera;
+    glm::vec2 jitter;
 };
 
 struct alignas(16) MeshShaderPushConstants {
@@ -46,12 +58,6 @@ struct alignas(16) MeshShaderPushConstants {
     glm::uvec4 meshOffsets;
 };
 
-struct FragmentPushConstants {
-    alignas(16) glm::vec3 cameraPosition;
-    alignas(16) glm::ivec2 viewportSize;
-    alignas(16) glm::vec4 cascadeSplits;
-};
-
 struct VulkanImage {
     VkImage image;
     VkImageView imageView;
@@ -132,6 +138,27 @@ inline void TransitionImage(VkCommandBuffer commandBuffer, VulkanImage image, Vk
     vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
 }
 
+inline void GlobalBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+    const VkMemoryBarrier2 memoryBarrier{
+        VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        VK_NULL_HANDLE,
+        srcStageMask,
+        srcAccessMask,
+        dstStageMask,
+        dstAccessMask
+    };
+
+    const VkDependencyInfo dependencyInfo{
+        VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &memoryBarrier
+    };
+
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
 inline void BlitImage(const VkCommandBuffer &commandBuffer, const VulkanImage &srcImage, const VulkanImage &dstImage, VkImageLayout srcLayout, VkImageLayout dstLayout, VkImageAspectFlags aspectFlags) {
     VkImageBlit2 blitRegion{VK_STRUCTURE_TYPE_IMAGE_BLIT_2};
 
@@ -0,0 +1,156 @@
+#include "vk_descriptor_buffer.h"
+
+#include <stdexcept>
+
+PFN_vkGetDescriptorSetLayoutSizeEXT fn_vkGetDescriptorSetLayoutSizeEXT = nullptr;
+PFN_vkGetDescriptorSetLayoutBindingOffsetEXT fn_vkGetDescriptorSetLayoutBindingOffsetEXT = nullptr;
+PFN_vkGetDescriptorEXT fn_vkGetDescriptorEXT = nullptr;
+PFN_vkCmdBindDescriptorBuffersEXT fn_vkCmdBindDescriptorBuffersEXT = nullptr;
+PFN_vkCmdSetDescriptorBufferOffsetsEXT fn_vkCmdSetDescriptorBufferOffsetsEXT = nullptr;
+
+static constexpr VkBufferUsageFlags DESCRIPTOR_BUFFER_USAGE = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+
+void LoadDescriptorBufferFunctions(const VkDevice device) {
+    fn_vkGetDescriptorSetLayoutSizeEXT = reinterpret_cast<PFN_vkGetDescriptorSetLayoutSizeEXT>(vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutSizeEXT"));
+    fn_vkGetDescriptorSetLayoutBindingOffsetEXT = reinterpret_cast<PFN_vkGetDescriptorSetLayoutBindingOffsetEXT>(vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutBindingOffsetEXT"));
+    fn_vkGetDescriptorEXT = reinterpret_cast<PFN_vkGetDescriptorEXT>(vkGetDeviceProcAddr(device, "vkGetDescriptorEXT"));
+    fn_vkCmdBindDescriptorBuffersEXT = reinterpret_cast<PFN_vkCmdBindDescriptorBuffersEXT>(vkGetDeviceProcAddr(device, "vkCmdBindDescriptorBuffersEXT"));
+    fn_vkCmdSetDescriptorBufferOffsetsEXT = reinterpret_cast<PFN_vkCmdSetDescriptorBufferOffsetsEXT>(vkGetDeviceProcAddr(device, "vkCmdSetDescriptorBufferOffsetsEXT"));
+}
+
+void DescriptorBuffer::Init(const VkDevice device, const VkPhysicalDevice physicalDevice, VkMemoryManager &memoryManager, const VkDeviceSize size) {
+    VkPhysicalDeviceProperties2 properties2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &properties};
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+    this->size = size;
+    head = 0;
+
+    buffer = memoryManager.createUnmanagedBuffer({
+        size,
+        DESCRIPTOR_BUFFER_USAGE | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        VMA_MEMORY_USAGE_AUTO,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    });
+
+    memoryManager.mapBuffer(buffer, reinterpret_cast<void **>(&mapped));
+
+    const VkBufferDeviceAddressInfo addressInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, VK_NULL_HANDLE, buffer.buffer};
+    deviceAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
+void DescriptorBuffer::Destroy(VkMemoryManager &memoryManager) {
+    memoryManager.unmapBuffer(buffer);
+    memoryManager.destroyBuffer(buffer, false);
+    mapped = nullptr;
+}
+
+DescriptorBuffer::Set DescriptorBuffer::Allocate(const VkDevice device, const VkDescriptorSetLayout layout) {
+    VkDeviceSize layoutSize;
+    fn_vkGetDescriptorSetLayoutSizeEXT(device, layout, &layoutSize);
+
+    const auto alignment = properties.descriptorBufferOffsetAlignment;
+    const auto offset = (head + alignment - 1) & ~(alignment - 1);
+    if (offset + layoutSize > size) [[unlikely]]
+        throw std::runtime_error("Descriptor buffer out of memory");
+
+    head = offset + layoutSize;
+    return {layout, offset};
+}
+
+void DescriptorBuffer::WriteImage(const VkDevice device, const Set &set, const uint32_t binding, const VkImageView image, const VkSampler sampler, const VkImageLayout layout, const VkDescriptorType type) const {
+    const VkDescriptorImageInfo imageInfo{sampler, image, layout};
+
+    VkDescriptorGetInfoEXT info{VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT, VK_NULL_HANDLE, type};
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+            info.data.pCombinedImageSampler = &imageInfo;
+            break;
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+            info.data.pSampledImage = &imageInfo;
+            break;
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+            info.data.pStorageImage = &imageInfo;
+            break;
+        default:
+            throw std::runtime_error("Unsupported image descriptor type");
+    }
+
+    Write(device, set, binding, 0, info);
+}
+
+void DescriptorBuffer::WriteImages(const VkDevice device, const Set &set, const uint32_t binding, const std::span<const VkDescriptorImageInfo> imageInfos) const {
+    VkDescriptorGetInfoEXT info{VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT, VK_NULL_HANDLE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+    for (uint32_t i = 0; i < imageInfos.size(); i++) {
+        info.data.pCombinedImageSampler = &imageInfos[i];
+        Write(device, set, binding, i, info);
+    }
+}
+
+void DescriptorBuffer::WriteBuffer(const VkDevice device, const Set &set, const uint32_t binding, const VkDeviceAddress address, const VkDeviceSize range, const VkDescriptorType type) const {
+    const VkDescriptorAddressInfoEXT addressInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT, VK_NULL_HANDLE, address, range, VK_FORMAT_UNDEFINED};
+
+    VkDescriptorGetInfoEXT info{VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT, VK_NULL_HANDLE, type};
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+            info.data.pUniformBuffer = &addressInfo;
+            break;
+        case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+            info.data.pStorageBuffer = &addressInfo;
+            break;
+        default:
+            throw std::runtime_error("Unsupported buffer descriptor type");
+    }
+
+    Write(device, set, binding, 0, info);
+}
+
+void DescriptorBuffer::WriteAccelerationStructure(const VkDevice device, const Set &set, const uint32_t binding, const VkDeviceAddress accelerationStructure) const {
+    VkDescriptorGetInfoEXT info{VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT, VK_NULL_HANDLE, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR};
+    info.data.accelerationStructure = accelerationStructure;
+
+    Write(device, set, binding, 0, info);
+}
+
+void DescriptorBuffer::Bind(const VkCommandBuffer commandBuffer, const VkPipelineBindPoint bindPoint, const VkPipelineLayout pipelineLayout, const uint32_t firstSet, const Set &set) const {
+    const VkDescriptorBufferBindingInfoEXT bindingInfo{
+        VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+        VK_NULL_HANDLE,
+        deviceAddress,
+        DESCRIPTOR_BUFFER_USAGE
+    };
+
+    fn_vkCmdBindDescriptorBuffersEXT(commandBuffer, 1, &bindingInfo);
+
+    static constexpr uint32_t bufferIndex = 0;
+    fn_vkCmdSetDescriptorBufferOffsetsEXT(commandBuffer, bindPoint, pipelineLayout, firstSet, 1, &bufferIndex, &set.offset);
+}
+
+void DescriptorBuffer::Write(const VkDevice device, const Set &set, const uint32_t binding, const uint32_t arrayElement, const VkDescriptorGetInfoEXT &info) const {
+    VkDeviceSize bindingOffset;
+    fn_vkGetDescriptorSetLayoutBindingOffsetEXT(device, set.layout, binding, &bindingOffset);
+
+    const auto descriptorSize = DescriptorSize(info.type);
+    fn_vkGetDescriptorEXT(device, &info, descriptorSize, mapped + set.offset + bindingOffset + arrayElement * descriptorSize);
+}
+
+size_t DescriptorBuffer::DescriptorSize(const VkDescriptorType type) const {
+    switch (type) {
+        case VK_DESCRIPTOR_TYPE_SAMPLER:
+            return properties.samplerDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+            return properties.combinedImageSamplerDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+            return properties.sampledImageDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+            return properties.storageImageDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+            return properties.uniformBufferDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+            return properties.storageBufferDescriptorSize;
+        case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+            return properties.accelerationStructureDescriptorSize;
+        default:
+            throw std::runtime_error("Unsupported descriptor type");
+    }
+}
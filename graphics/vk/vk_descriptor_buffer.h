@@ -0,0 +1,53 @@
+#ifndef VK_DESCRIPTOR_BUFFER_H
+#define VK_DESCRIPTOR_BUFFER_H
+
+#include <span>
+#include "graphics/vk/memory/vk_memory.h"
+
+extern PFN_vkGetDescriptorSetLayoutSizeEXT fn_vkGetDescriptorSetLayoutSizeEXT;
+extern PFN_vkGetDescriptorSetLayoutBindingOffsetEXT fn_vkGetDescriptorSetLayoutBindingOffsetEXT;
+extern PFN_vkGetDescriptorEXT fn_vkGetDescriptorEXT;
+extern PFN_vkCmdBindDescriptorBuffersEXT fn_vkCmdBindDescriptorBuffersEXT;
+extern PFN_vkCmdSetDescriptorBufferOffsetsEXT fn_vkCmdSetDescriptorBufferOffsetsEXT;
+
+// The device needs VK_EXT_descriptor_buffer enabled
+void LoadDescriptorBufferFunctions(VkDevice device);
+
+// Descriptor sets as plain memory with VK_EXT_descriptor_buffer. Every set is a region of one persistently mapped
+// buffer, descriptors are written straight into it and the set is bound by its offset, so there are no pools to grow
+// and no vkUpdateDescriptorSets. Layouts need VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT and pipelines
+// VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT. Like sets, a region must not be rewritten while a frame still reads it.
+class DescriptorBuffer {
+public:
+    struct Set {
+        VkDescriptorSetLayout layout;
+        VkDeviceSize offset;
+    };
+
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryManager &memoryManager, VkDeviceSize size);
+    void Destroy(VkMemoryManager &memoryManager);
+
+    // Lives as long as the buffer
+    [[nodiscard]] Set Allocate(VkDevice device, VkDescriptorSetLayout layout);
+
+    void WriteImage(VkDevice device, const Set &set, uint32_t binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type) const;
+    // Combined image samplers from element 0 on
+    void WriteImages(VkDevice device, const Set &set, uint32_t binding, std::span<const VkDescriptorImageInfo> imageInfos) const;
+    void WriteBuffer(VkDevice device, const Set &set, uint32_t binding, VkDeviceAddress address, VkDeviceSize range, VkDescriptorType type) const;
+    void WriteAccelerationStructure(VkDevice device, const Set &set, uint32_t binding, VkDeviceAddress accelerationStructure) const;
+
+    void Bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t firstSet, const Set &set) const;
+
+private:
+    void Write(VkDevice device, const Set &set, uint32_t binding, uint32_t arrayElement, const VkDescriptorGetInfoEXT &info) const;
+    [[nodiscard]] size_t DescriptorSize(VkDescriptorType type) const;
+
+    VulkanBuffer buffer{};
+    VkDeviceAddress deviceAddress{};
+    uint8_t *mapped{};
+    VkDeviceSize size{};
+    VkDeviceSize head{};
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT};
+};
+
+#endif //VK_DESCRIPTOR_BUFFER_H
@@ -1,11 +1,11 @@
 #include "vk_gui.h"
 
-#include <chrono>
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_vulkan.h>
 
 #include "common/file_watcher.h"
 #include "graphics/vk_renderer.h"
+#include "graphics/vk/vk_shader_compiler.h"
 
 static constexpr uint32_t MIN_IMAGE_COUNT = 2;
 
@@ -32,6 +32,17 @@ namespace ImGui {
             setter(newValue);
         }
     }
+
+    void Checkbox(const char *label, const std::function<bool()> &getter, const std::function<void(bool)> &setter) {
+        const bool temp = getter();
+        bool newValue = temp;
+
+        Checkbox(label, &newValue);
+
+        if (newValue != temp) {
+            setter(newValue);
+        }
+    }
 }
 
 // #ifdef _WIN32
@@ -63,12 +74,13 @@ namespace ImGui {
 // }
 // #else
 
-static void reloadShaderCallback(void *arg)
+static void reloadShaderCallback(const std::vector<std::string> &changedFiles, void *arg)
 {
-    static_cast<VkRenderer *>(arg)->isShaderInvalidated = true;
+    // The reloader picks out the files pipelines were built from, anything else that changed is ignored
+    static_cast<VkRenderer *>(arg)->shaderReloader.RequestReload(changedFiles);
 }
 
-VkGui::VkGui(const int width, const int height, const bool dynamicRendering, const bool asyncCompute) : imguiDescriptorPool(VK_NULL_HANDLE) {
+VkGui::VkGui(const int width, const int height, const bool dynamicRendering, const bool asyncCompute, const bool shaderObjects, const bool pipelineLibraries, const bool descriptorBuffer) : imguiDescriptorPool(VK_NULL_HANDLE) {
     // GLFW initialization
     glfwSetErrorCallback(errorCallback);
     if (!glfwInit()) [[unlikely]]
@@ -111,7 +123,7 @@ VkGui::VkGui(const int width, const int height, const bool dynamicRendering, con
 
     // VkRenderer initialization
     // renderer = VkRenderer(window, &camera, dynamicRendering, asyncCompute, false);
-    renderer.Initialize(window, &camera, dynamicRendering, asyncCompute, false);
+    renderer.Initialize(window, &camera, dynamicRendering, asyncCompute, false, shaderObjects, pipelineLibraries, descriptorBuffer);
 
     const auto instance = renderer.instance;
     const auto physicalDevice = renderer.physicalDevice;
@@ -119,14 +131,15 @@ VkGui::VkGui(const int width, const int height, const bool dynamicRendering, con
     const auto pipelineCache = renderer.pipelineCache;
     const auto queue = renderer.graphicsQueue;
     const auto format = renderer.surfaceFormat.format;
-    const auto renderPass = renderer.renderPass;
-    const auto depthFormat = renderer.depthImage.format;
+    const auto renderPass = renderer.uiRenderPass;
     const auto queueFamily = renderer.queueFamilyIndices.graphicsFamily.value();
 
     constexpr auto msaaSamples = VkRenderer::msaaSamples;
 
     const auto fullPath = std::filesystem::absolute("shaders/").string();
-    addFileWatcher(fullPath, reinterpret_cast<void *(*)(void *)>(reloadShaderCallback), &renderer);
+    addFileWatcher(fullPath, reloadShaderCallback, &renderer);
+    for (const auto &sourceDirectory : ShaderSourceDirectories())
+        addFileWatcher(sourceDirectory.string(), reloadShaderCallback, &renderer);
 
     CreateImGuiDescriptorPool();
 
@@ -159,7 +172,6 @@ VkGui::VkGui(const int width, const int height, const bool dynamicRendering, con
             .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
             .colorAttachmentCount = 1,
             .pColorAttachmentFormats = &format,
-            .depthAttachmentFormat = depthFormat,
         };
     }
 
@@ -170,6 +182,9 @@ VkGui::VkGui(const int width, const int height, const bool dynamicRendering, con
 
 void VkGui::Loop() {
     while (!glfwWindowShouldClose(window)) {
+        renderer.WaitForFrame(stats);
+        deltaTime = stats.frameTime;
+
         glfwPollEvents();
 
         if (renderer.framebufferResized) {
@@ -181,8 +196,6 @@ void VkGui::Loop() {
             camera.ProcessKeyboardInput(pressedKeys, GLFW_PRESS, deltaTime);
         }
 
-        auto start = std::chrono::high_resolution_clock::now();
-
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplGlfw_NewFrame();
 
@@ -192,18 +205,31 @@ void VkGui::Loop() {
             ImGui::Begin("Title or whatever");
             ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
             ImGui::SameLine();
-            ImGui::Text("Frame time: %.2f ms", stats.frameTime);
+            ImGui::Text("Frame time: %.2f ms (deviation %.2f ms)", stats.frameTime, stats.frameTimeDeviation);
             ImGui::Text("Mesh Draw Time: %.2f ms", stats.meshDrawTime);
             ImGui::Text("Draw call count: %d", stats.drawCallCount);
             ImGui::SameLine();
             ImGui::Text("Triangle count: %d", stats.triangleCount);
+            ImGui::Text("GPU Time: %.2f ms at %.0f%% resolution", stats.gpuTime, stats.renderScale * 100.f);
 
             const auto position = camera.position;
             ImGui::Text("Camera Position: %.2f, %.2f, %.2f", position.x, position.y, position.z);
             ImGui::Text("Camera Pitch: %.2f, Yaw: %.2f", camera.pitch, camera.yaw);
 
             ImGui::SliderFloat("FOV", [&] { return camera.Fov(); }, [&](const float &newValue){ camera.setFov(newValue); }, 30.f, 120.f, "%.1f", ImGuiSliderFlags_AlwaysClamp);
-            ImGui::SliderInt("FPS Limit", [&] { return renderer.GetFPSLimit(); }, [&](const uint16_t &fps) { renderer.SetFPSLimit(fps); }, 1, 240);
+            ImGui::SliderInt("FPS Limit", [&] { return renderer.GetFPSLimit(); }, [&](const uint16_t &fps) { renderer.SetFPSLimit(fps); }, 0, 240, "%d (0 is off)");
+            ImGui::SliderInt("Frames In Flight", [&] { return static_cast<int>(renderer.GetFramesInFlight()); }, [&](const int count) { renderer.SetFramesInFlight(count); }, 1, MAX_FRAMES_IN_FLIGHT);
+            ImGui::Checkbox("Dynamic Resolution", [&] { return renderer.renderScale.enabled; }, [&](const bool value) { renderer.renderScale.enabled = value; });
+            if (renderer.renderScale.enabled) {
+                ImGui::SliderFloat("Target GPU Time", [&] { return renderer.renderScale.targetFrameTime; }, [&](const float &value) { renderer.renderScale.targetFrameTime = value; }, 4.f, 33.3f, "%.1f ms", ImGuiSliderFlags_AlwaysClamp);
+                ImGui::SliderFloat("Minimum Scale", [&] { return renderer.renderScale.minScale; }, [&](const float &value) { renderer.renderScale.minScale = value; }, 0.25f, 1.f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
+            }
+            if (!renderer.useRaytracing && !renderer.meshShader) {
+                if (renderer.geometryShader)
+                    ImGui::Checkbox("Visibility Buffer", [&] { return renderer.visibilityBuffer; }, [&](const bool value) { renderer.visibilityBuffer = value; });
+                if (!renderer.visibilityBuffer)
+                    ImGui::Checkbox("Depth Prepass", [&] { return renderer.mainDepthPrepass; }, [&](const bool value) { renderer.mainDepthPrepass = value; });
+            }
             // ImGui::Checkbox("Display Shadow Map", &renderer.displayShadowMap);
             // if (renderer.displayShadowMap) {
             //     ImGui::SliderInt("Cascade Index", &renderer.cascadeIndex, 0, SHADOW_MAP_CASCADE_COUNT - 1);
@@ -218,10 +244,6 @@ void VkGui::Loop() {
         ImGui::Render();
 
         renderer.Render(stats);
-
-        const auto end = std::chrono::high_resolution_clock::now();
-        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-        stats.frameTime = deltaTime = static_cast<float>(elapsed) / 1000.f;
     }
 }
 
@@ -273,19 +295,11 @@ void VkGui::MouseButtonCallback(GLFWwindow *window, int button, int action, int
 }
 
 void VkGui::MouseCursorCallback(GLFWwindow *window, double xpos, double ypos) {
-    static double lastX = xpos;
-    static double lastY = ypos;
     const auto gui = static_cast<VkGui *>(glfwGetWindowUserPointer(window));
 
     // if (!gui->mouseHeldDown) return;
 
-    const double xOffset = xpos - lastX;
-    const double yOffset = lastY - ypos;
-
-    lastX = xpos;
-    lastY = ypos;
-
-    gui->camera.ProcessMouseInput(xOffset, yOffset);
+    gui->camera.ProcessCursorPosition(xpos, ypos);
 }
 
 bool mouseDisabled = true;
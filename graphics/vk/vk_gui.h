@@ -15,15 +15,19 @@ class VkRenderer;
 typedef VkDescriptorPool_T * VkDescriptorPool;
 
 struct EngineStats {
+    // Time between frame starts, and its standard deviation over the frame pacer's window
     float frameTime;
+    float frameTimeDeviation;
     uint32_t triangleCount;
     uint32_t drawCallCount;
     float meshDrawTime;
+    float gpuTime;
+    float renderScale;
 };
 
 class VkGui {
 public:
-    explicit VkGui(int width, int height, bool dynamicRendering = true, bool asyncCompute = true);
+    explicit VkGui(int width, int height, bool dynamicRendering = true, bool asyncCompute = true, bool shaderObjects = false, bool pipelineLibraries = false, bool descriptorBuffer = false);
     ~VkGui() = default;
 
     void Loop();
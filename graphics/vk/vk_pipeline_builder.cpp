@@ -1,11 +1,208 @@
 #include "vk_pipeline_builder.h"
 
-#include "common/file.h"
+#include "graphics/vk/vk_pipeline_compiler.h"
+#include "graphics/vk/vk_pipeline_library.h"
+#include "graphics/vk/vk_shader_compiler.h"
+#include "graphics/vk/vk_shader_object.h"
+#include "graphics/vk/vk_shader_reloader.h"
+
+// Owns a copy of what a SpecializationInfoHelper points to, queued pipelines outlive the caller's data
+struct SpecializationCopy {
+    explicit SpecializationCopy(const SpecializationInfoHelper &info)
+        : stageFlags(info.stageFlags),
+          mapEntries(info.specializationInfo.pMapEntries, info.specializationInfo.pMapEntries + info.specializationInfo.mapEntryCount),
+          data(static_cast<const uint8_t *>(info.specializationInfo.pData), static_cast<const uint8_t *>(info.specializationInfo.pData) + info.specializationInfo.dataSize) {}
+
+    [[nodiscard]] SpecializationInfoHelper Info() const {
+        return {
+            stageFlags,
+            {
+                static_cast<uint32_t>(mapEntries.size()),
+                mapEntries.data(),
+                data.size(),
+                data.data()
+            }
+        };
+    }
+
+    VkPipelineStageFlags stageFlags;
+    std::vector<VkSpecializationMapEntry> mapEntries;
+    std::vector<uint8_t> data;
+};
 
-VkPipeline VkGraphicsPipelineBuilder::Build(const bool dynamicRendering, const VkDevice &device, const VkPipelineCache &pipelineCache, const VkRenderPass &renderPass, const SpecializationInfoHelper &info) {
+void VkGraphicsPipelineBuilder::Build(VkPipelineCompiler &compiler, VkPipeline *target, const bool dynamicRendering, const VkRenderPass &renderPass, const SpecializationInfoHelper &info, VkPipelineLibraryCache *libraries) const {
     if (!dynamicRendering && !renderPass)
         throw std::runtime_error("Render pass must be provided if not using dynamic rendering.");
 
+    if (libraries) {
+        BuildLibraries(*libraries, compiler, target, dynamicRendering, renderPass, info);
+        return;
+    }
+
+    compiler.Add(target, [builder = *this, specialization = SpecializationCopy{info}, dynamicRendering, renderPass](const VkDevice device, const VkPipelineCache pipelineCache) {
+        return builder.Create(dynamicRendering, device, pipelineCache, renderPass, specialization.Info());
+    });
+
+    auto *reloader = compiler.Reloader();
+    if (!reloader)
+        return;
+
+    std::vector shaderPaths{vertexOrMeshShaderPath};
+    if (!fragmentShaderPath.empty())
+        shaderPaths.push_back(fragmentShaderPath);
+    if (!taskShaderPath.empty())
+        shaderPaths.push_back(taskShaderPath);
+
+    // Same description, with modules of its own read from the files as they are by then
+    reloader->Register(target, std::move(shaderPaths), [builder = *this, specialization = SpecializationCopy{info}, dynamicRendering, renderPass](const VkDevice device, const VkPipelineCache pipelineCache) {
+        auto reloaded = builder;
+        // One that doesn't compile leaves the current pipeline in place
+        if (!reloaded.CreateShaderModules(device))
+            return VkPipeline{VK_NULL_HANDLE};
+
+        const auto pipeline = reloaded.Create(dynamicRendering, device, pipelineCache, renderPass, specialization.Info());
+
+        reloaded.DestroyShaderModules(device);
+        return pipeline;
+    });
+}
+
+void VkGraphicsPipelineBuilder::BuildLibraries(VkPipelineLibraryCache &libraries, VkPipelineCompiler &compiler, VkPipeline *target, const bool dynamicRendering, const VkRenderPass renderPass, const SpecializationInfoHelper &info) const {
+    auto *reloader = compiler.Reloader();
+
+    std::vector<const VkPipeline *> parts;
+    const auto queuePart = [&](const VkGraphicsPipelineLibraryFlagsEXT libraryPart, const VkShaderStageFlags stages, std::vector<std::string> &&shaderPaths) {
+        bool isNew;
+        auto *part = libraries.Get(LibraryKey(libraryPart, dynamicRendering, renderPass, info), isNew);
+        parts.push_back(part);
+
+        if (!isNew)
+            return;
+
+        // Each part reads the modules of its own stages on the worker thread it's compiled on
+        auto create = [builder = *this, specialization = SpecializationCopy{info}, libraryPart, stages, dynamicRendering, renderPass](const VkDevice device, const VkPipelineCache pipelineCache) {
+            auto withModules = builder;
+            if (!withModules.CreateShaderModules(device, stages))
+                return VkPipeline{VK_NULL_HANDLE};
+
+            const auto pipeline = withModules.Create(dynamicRendering, device, pipelineCache, renderPass, specialization.Info(), libraryPart);
+
+            withModules.DestroyShaderModules(device);
+            return pipeline;
+        };
+
+        // A changed shader recompiles only the part it's in, the pipelines using the part are relinked. Registered once
+        // compiled, a rebuild running meanwhile would otherwise read the part while it's written.
+        if (reloader && !shaderPaths.empty()) {
+            compiler.AfterCompile([reloader, part, shaderPaths = std::move(shaderPaths), create]() mutable {
+                reloader->Register(part, std::move(shaderPaths), std::move(create));
+            });
+        }
+
+        compiler.Add(part, std::move(create));
+    };
+
+    if (!isMeshShader)
+        queuePart(VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT, 0, {});
+
+    std::vector preRasterizationPaths{vertexOrMeshShaderPath};
+    if (!taskShaderPath.empty())
+        preRasterizationPaths.push_back(taskShaderPath);
+
+    queuePart(VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, std::move(preRasterizationPaths));
+    queuePart(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT, VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShaderPath.empty() ? std::vector<std::string>{} : std::vector{fragmentShaderPath});
+    queuePart(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT, 0, {});
+
+    compiler.AddLink(target, [parts, layout = pipelineLayout](const VkDevice device, const VkPipelineCache pipelineCache) {
+        std::vector<VkPipeline> handles;
+        for (const auto *part : parts) {
+            // A part that didn't compile has nothing to link
+            if (*part == VK_NULL_HANDLE)
+                return VkPipeline{VK_NULL_HANDLE};
+
+            handles.push_back(*part);
+        }
+
+        return VkPipelineLibraryCache::Link(device, pipelineCache, handles, layout);
+    });
+
+    if (reloader) {
+        compiler.AfterCompile([reloader, target, parts = std::move(parts), layout = pipelineLayout]() mutable {
+            reloader->RegisterLink(target, std::move(parts), [layout](const VkDevice device, const VkPipelineCache pipelineCache, const std::span<const VkPipeline> handles) {
+                return VkPipelineLibraryCache::Link(device, pipelineCache, handles, layout);
+            });
+        });
+    }
+}
+
+std::string VkGraphicsPipelineBuilder::LibraryKey(const VkGraphicsPipelineLibraryFlagsEXT libraryPart, const bool dynamicRendering, const VkRenderPass renderPass, const SpecializationInfoHelper &info) const {
+    std::string key;
+    const auto append = [&key](const std::initializer_list<uint64_t> values) {
+        key.append(reinterpret_cast<const char *>(std::data(values)), values.size() * sizeof(uint64_t));
+    };
+
+    const auto appendSpecialization = [&](const VkShaderStageFlags stages) {
+        if (!(info.stageFlags & stages))
+            return;
+
+        const auto &specialization = info.specializationInfo;
+        key.append(reinterpret_cast<const char *>(specialization.pMapEntries), specialization.mapEntryCount * sizeof(VkSpecializationMapEntry));
+        key.append(static_cast<const char *>(specialization.pData), specialization.dataSize);
+    };
+
+    append({libraryPart, dynamicRendering, reinterpret_cast<uint64_t>(dynamicRendering ? VK_NULL_HANDLE : renderPass), renderingCreateInfo.viewMask});
+
+    switch (libraryPart) {
+        case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT:
+            append({static_cast<uint64_t>(inputAssemblyCreateInfo.topology), inputAssemblyCreateInfo.primitiveRestartEnable});
+            break;
+        case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT:
+            key.append(vertexOrMeshShaderPath).push_back('\0');
+            key.append(taskShaderPath).push_back('\0');
+            append({
+                isMeshShader,
+                reinterpret_cast<uint64_t>(pipelineLayout),
+                rasterizerCreateInfo.depthClampEnable,
+                static_cast<uint64_t>(rasterizerCreateInfo.polygonMode),
+                rasterizerCreateInfo.cullMode,
+                static_cast<uint64_t>(rasterizerCreateInfo.frontFace)
+            });
+            appendSpecialization(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT);
+            break;
+        case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT:
+            key.append(fragmentShaderPath).push_back('\0');
+            append({
+                reinterpret_cast<uint64_t>(pipelineLayout),
+                depthStencilCreateInfo.depthTestEnable,
+                depthStencilCreateInfo.depthWriteEnable,
+                static_cast<uint64_t>(depthStencilCreateInfo.depthCompareOp),
+                static_cast<uint64_t>(renderingCreateInfo.depthAttachmentFormat)
+            });
+            appendSpecialization(VK_SHADER_STAGE_FRAGMENT_BIT);
+            break;
+        default:
+            append({hasVelocityAttachment, static_cast<uint64_t>(renderingCreateInfo.depthAttachmentFormat)});
+            for (uint32_t i = 0; i < (hasVelocityAttachment ? 2u : 1u); i++) {
+                const auto &attachment = i == 0 ? colorBlendAttachment : velocityBlendAttachment;
+                append({
+                    static_cast<uint64_t>(colorAttachmentFormats[i]),
+                    attachment.blendEnable,
+                    static_cast<uint64_t>(attachment.srcColorBlendFactor),
+                    static_cast<uint64_t>(attachment.dstColorBlendFactor),
+                    static_cast<uint64_t>(attachment.colorBlendOp),
+                    static_cast<uint64_t>(attachment.srcAlphaBlendFactor),
+                    static_cast<uint64_t>(attachment.dstAlphaBlendFactor),
+                    static_cast<uint64_t>(attachment.alphaBlendOp),
+                    attachment.colorWriteMask
+                });
+            }
+            break;
+    }
+
+    return key;
+}
+
+VkPipeline VkGraphicsPipelineBuilder::Create(const bool dynamicRendering, const VkDevice &device, const VkPipelineCache &pipelineCache, const VkRenderPass &renderPass, const SpecializationInfoHelper &info, const VkGraphicsPipelineLibraryFlagsEXT libraryPart) const {
     const VkPipelineShaderStageCreateInfo vertexShaderStageInfo{
         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         VK_NULL_HANDLE,
@@ -35,7 +232,13 @@ VkPipeline VkGraphicsPipelineBuilder::Build(const bool dynamicRendering, const V
         "main"
     };
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertexShaderStageInfo, fragmentShaderStageInfo, taskShaderStageInfo};
+    // Libraries are only given the stages of their part
+    VkPipelineShaderStageCreateInfo shaderStages[3];
+    uint32_t stageCount = 0;
+    for (const auto &stage : {vertexShaderStageInfo, fragmentShaderStageInfo, taskShaderStageInfo}) {
+        if (stage.module != VK_NULL_HANDLE)
+            shaderStages[stageCount++] = stage;
+    }
 
     static constexpr VkPipelineVertexInputStateCreateInfo vertexInputInfo{
         VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
@@ -64,14 +267,16 @@ VkPipeline VkGraphicsPipelineBuilder::Build(const bool dynamicRendering, const V
         VK_SAMPLE_COUNT_1_BIT
     };
 
+    const VkPipelineColorBlendAttachmentState colorBlendAttachments[] = {colorBlendAttachment, velocityBlendAttachment};
+
     VkPipelineColorBlendStateCreateInfo colorBlending{
         VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
         VK_NULL_HANDLE,
         0,
         VK_FALSE,
         VK_LOGIC_OP_COPY,
-        1,
-        &colorBlendAttachment
+        hasVelocityAttachment ? 2u : 1u,
+        colorBlendAttachments
     };
 
     static constexpr VkDynamicState dynamicStates[] = {
@@ -87,11 +292,22 @@ VkPipeline VkGraphicsPipelineBuilder::Build(const bool dynamicRendering, const V
         dynamicStates
     };
 
+    // A copied builder still points at the formats of the one it was copied from
+    VkPipelineRenderingCreateInfo rendering = renderingCreateInfo;
+    rendering.pColorAttachmentFormats = colorAttachmentFormats.data();
+
+    const VkGraphicsPipelineLibraryCreateInfoEXT libraryCreateInfo{
+        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+        dynamicRendering ? &rendering : VK_NULL_HANDLE,
+        libraryPart
+    };
+
+    const void *next = dynamicRendering ? &rendering : VK_NULL_HANDLE;
     VkGraphicsPipelineCreateInfo pipelineInfo{
         VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        dynamicRendering ? &renderingCreateInfo : VK_NULL_HANDLE,
-        0,
-        3u - (fragmentShaderModule == VK_NULL_HANDLE) - (taskShaderModule == VK_NULL_HANDLE),
+        libraryPart ? &libraryCreateInfo : next,
+        libraryPart ? VK_PIPELINE_CREATE_LIBRARY_BIT_KHR : 0u,
+        stageCount,
         shaderStages,
         isMeshShader ? VK_NULL_HANDLE : &vertexInputInfo,
         isMeshShader ? VK_NULL_HANDLE : &inputAssemblyCreateInfo,
@@ -106,61 +322,148 @@ VkPipeline VkGraphicsPipelineBuilder::Build(const bool dynamicRendering, const V
         dynamicRendering ? VK_NULL_HANDLE : renderPass
     };
 
-    VkPipeline pipeline;
+    VkPipeline pipeline{VK_NULL_HANDLE};
     VK_CHECK(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, VK_NULL_HANDLE, &pipeline));
 
     return pipeline;
 }
 
+void VkGraphicsPipelineBuilder::BuildShaderObjects(VkShaderObjectCache &cache, VkShaderObjectPipeline *target, const VkDevice &device, const std::span<const VkDescriptorSetLayout> setLayouts, const std::span<const VkPushConstantRange> pushConstantRanges, const SpecializationInfoHelper &info) const {
+    const auto describe = [&](const std::string &path, const VkShaderStageFlagBits stage, const VkShaderStageFlags nextStage, const VkShaderCreateFlagsEXT flags) {
+        VkShaderObjectDescription description{
+            path,
+            stage,
+            nextStage,
+            flags,
+            {setLayouts.begin(), setLayouts.end()},
+            {pushConstantRanges.begin(), pushConstantRanges.end()}
+        };
+
+        if (info.stageFlags & stage) {
+            const auto &specialization = info.specializationInfo;
+            const auto *data = static_cast<const uint8_t *>(specialization.pData);
+            description.specializationEntries.assign(specialization.pMapEntries, specialization.pMapEntries + specialization.mapEntryCount);
+            description.specializationData.assign(data, data + specialization.dataSize);
+        }
+
+        return cache.Get(device, std::move(description));
+    };
+
+    auto &pipeline = *target;
+    pipeline = {};
+    pipeline.isMeshShader = isMeshShader;
+    pipeline.optionalStages = cache.OptionalStages();
+
+    if (isMeshShader) {
+        // Without a task shader the mesh shader is launched by the draw directly
+        const VkShaderCreateFlagsEXT meshFlags = taskShaderPath.empty() ? VK_SHADER_CREATE_NO_TASK_SHADER_BIT_EXT : 0;
+        pipeline.vertexOrMeshShader = describe(vertexOrMeshShaderPath, VK_SHADER_STAGE_MESH_BIT_EXT, VK_SHADER_STAGE_FRAGMENT_BIT, meshFlags);
+        if (!taskShaderPath.empty())
+            pipeline.taskShader = describe(taskShaderPath, VK_SHADER_STAGE_TASK_BIT_EXT, VK_SHADER_STAGE_MESH_BIT_EXT, 0);
+    } else {
+        pipeline.vertexOrMeshShader = describe(vertexOrMeshShaderPath, VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+    }
+
+    if (!fragmentShaderPath.empty())
+        pipeline.fragmentShader = describe(fragmentShaderPath, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 0);
+
+    pipeline.topology = inputAssemblyCreateInfo.topology;
+    pipeline.polygonMode = rasterizerCreateInfo.polygonMode;
+    pipeline.cullMode = rasterizerCreateInfo.cullMode;
+    pipeline.frontFace = rasterizerCreateInfo.frontFace;
+    pipeline.depthClampEnable = rasterizerCreateInfo.depthClampEnable;
+    pipeline.depthTestEnable = depthStencilCreateInfo.depthTestEnable;
+    pipeline.depthWriteEnable = depthStencilCreateInfo.depthWriteEnable;
+    pipeline.depthCompareOp = depthStencilCreateInfo.depthCompareOp;
+
+    const VkPipelineColorBlendAttachmentState *attachments[] = {&colorBlendAttachment, &velocityBlendAttachment};
+    pipeline.attachmentCount = hasVelocityAttachment ? 2 : 1;
+    for (uint32_t i = 0; i < pipeline.attachmentCount; i++) {
+        const auto &attachment = *attachments[i];
+        pipeline.blendEnables[i] = attachment.blendEnable;
+        pipeline.blendEquations[i] = {
+            attachment.srcColorBlendFactor,
+            attachment.dstColorBlendFactor,
+            attachment.colorBlendOp,
+            attachment.srcAlphaBlendFactor,
+            attachment.dstAlphaBlendFactor,
+            attachment.alphaBlendOp
+        };
+        pipeline.colorWriteMasks[i] = attachment.colorWriteMask;
+    }
+}
+
 void VkGraphicsPipelineBuilder::Clear() {
     inputAssemblyCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
     rasterizerCreateInfo = {.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO, .lineWidth = 1.0f};
     depthStencilCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
     colorBlendAttachment = {.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
+    velocityBlendAttachment = {};
     renderingCreateInfo = {VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
-    colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+    colorAttachmentFormats = {};
+    hasVelocityAttachment = false;
 }
 
-void VkGraphicsPipelineBuilder::CreateShaderModules(const VkDevice &device, const std::string &vertexOrMeshShaderFilePath, const std::string &fragmentShaderFilePath, const std::string &taskShaderFilePath) {
-    const auto vertexShaderCode = ReadFile<uint32_t>(vertexOrMeshShaderFilePath);
+void VkGraphicsPipelineBuilder::SetShaders(const std::string &vertexOrMeshShaderFilePath, const std::string &fragmentShaderFilePath, const std::string &taskShaderFilePath) {
+    vertexOrMeshShaderPath = vertexOrMeshShaderFilePath;
+    fragmentShaderPath = fragmentShaderFilePath;
+    taskShaderPath = taskShaderFilePath;
 
-    const VkShaderModuleCreateInfo vertShaderModuleCreateInfo{
-        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        VK_NULL_HANDLE,
-        0,
-        vertexShaderCode.size(),
-        vertexShaderCode.data()
-    };
+    if (!taskShaderFilePath.empty())
+        isMeshShader = true;
+}
 
-    VK_CHECK(vkCreateShaderModule(device, &vertShaderModuleCreateInfo, VK_NULL_HANDLE, &vertexOrMeshShaderModule));
+void VkGraphicsPipelineBuilder::CreateShaderModules(const VkDevice &device, const std::string &vertexOrMeshShaderFilePath, const std::string &fragmentShaderFilePath, const std::string &taskShaderFilePath) {
+    SetShaders(vertexOrMeshShaderFilePath, fragmentShaderFilePath, taskShaderFilePath);
+    if (!CreateShaderModules(device))
+        throw std::runtime_error("Failed to create shader modules for \"" + vertexOrMeshShaderFilePath + '"');
+}
 
-    if (!fragmentShaderFilePath.empty()) {
-        const auto fragmentShaderCode = ReadFile<uint32_t>(fragmentShaderFilePath);
-        const VkShaderModuleCreateInfo fragShaderModuleCreateInfo{
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            VK_NULL_HANDLE,
-            0,
-            fragmentShaderCode.size(),
-            fragmentShaderCode.data()
-        };
+bool VkGraphicsPipelineBuilder::CreateShaderModules(const VkDevice &device, const VkShaderStageFlags stages) {
+    // Otherwise a stage left out here keeps the previous pipeline's module
+    vertexOrMeshShaderModule = VK_NULL_HANDLE;
+    fragmentShaderModule = VK_NULL_HANDLE;
+    taskShaderModule = VK_NULL_HANDLE;
 
-        VK_CHECK(vkCreateShaderModule(device, &fragShaderModuleCreateInfo, VK_NULL_HANDLE, &fragmentShaderModule));
+    bool created = true;
+    if (stages & (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT)) {
+        vertexOrMeshShaderModule = CreateShaderModule(device, LoadShader(vertexOrMeshShaderPath));
+        created = vertexOrMeshShaderModule != VK_NULL_HANDLE;
     }
 
-    if (!taskShaderFilePath.empty()) {
-        isMeshShader = true;
+    if (created && stages & VK_SHADER_STAGE_FRAGMENT_BIT && !fragmentShaderPath.empty()) {
+        fragmentShaderModule = CreateShaderModule(device, LoadShader(fragmentShaderPath));
+        created = fragmentShaderModule != VK_NULL_HANDLE;
+    }
 
-        const auto taskShaderCode = ReadFile<uint32_t>(taskShaderFilePath);
-        const VkShaderModuleCreateInfo taskShaderModuleCreateInfo{
-            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            VK_NULL_HANDLE,
-            0,
-            taskShaderCode.size(),
-            taskShaderCode.data()
-        };
+    if (created && stages & VK_SHADER_STAGE_TASK_BIT_EXT && !taskShaderPath.empty()) {
+        taskShaderModule = CreateShaderModule(device, LoadShader(taskShaderPath));
+        created = taskShaderModule != VK_NULL_HANDLE;
+    }
 
-        VK_CHECK(vkCreateShaderModule(device, &taskShaderModuleCreateInfo, VK_NULL_HANDLE, &taskShaderModule));
+    if (!created) {
+        DestroyShaderModules(device);
+        vertexOrMeshShaderModule = fragmentShaderModule = taskShaderModule = VK_NULL_HANDLE;
     }
+
+    return created;
+}
+
+VkShaderModule VkGraphicsPipelineBuilder::CreateShaderModule(const VkDevice device, const std::vector<uint32_t> &code) {
+    if (code.empty())
+        return VK_NULL_HANDLE;
+
+    const VkShaderModuleCreateInfo createInfo{
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        code.size() * sizeof(uint32_t),
+        code.data()
+    };
+
+    VkShaderModule shaderModule;
+    VK_CHECK(vkCreateShaderModule(device, &createInfo, VK_NULL_HANDLE, &shaderModule));
+    return shaderModule;
 }
 
 void VkGraphicsPipelineBuilder::DestroyShaderModules(const VkDevice &device) const {
@@ -173,6 +476,12 @@ void VkGraphicsPipelineBuilder::DestroyShaderModules(const VkDevice &device) con
         vkDestroyShaderModule(device, taskShaderModule, VK_NULL_HANDLE);
 }
 
+void VkGraphicsPipelineBuilder::DestroyShaderModules(VkPipelineCompiler &compiler) const {
+    compiler.DestroyAfterCompile(vertexOrMeshShaderModule);
+    compiler.DestroyAfterCompile(fragmentShaderModule);
+    compiler.DestroyAfterCompile(taskShaderModule);
+}
+
 void VkGraphicsPipelineBuilder::SetPipelineLayout(VkPipelineLayout pipelineLayout) {
     this->pipelineLayout = pipelineLayout;
 }
@@ -222,10 +531,19 @@ void VkGraphicsPipelineBuilder::EnableBlendingAlphaBlend() {
 }
 
 void VkGraphicsPipelineBuilder::SetColorAttachmentFormat(const VkFormat format) {
-    colorAttachmentFormat = format;
+    colorAttachmentFormats[0] = format;
+
+    renderingCreateInfo.colorAttachmentCount = hasVelocityAttachment ? 2 : 1;
+    renderingCreateInfo.pColorAttachmentFormats = colorAttachmentFormats.data();
+}
+
+void VkGraphicsPipelineBuilder::AddVelocityAttachment(const VkFormat format, const bool write) {
+    hasVelocityAttachment = true;
+    colorAttachmentFormats[1] = format;
+    velocityBlendAttachment.colorWriteMask = write ? VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT : 0;
 
-    renderingCreateInfo.colorAttachmentCount = 1;
-    renderingCreateInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+    renderingCreateInfo.colorAttachmentCount = 2;
+    renderingCreateInfo.pColorAttachmentFormats = colorAttachmentFormats.data();
 }
 
 void VkGraphicsPipelineBuilder::SetDepthFormat(const VkFormat format) {
@@ -1,20 +1,60 @@
 #ifndef VK_PIPELINE_BUILDER_H
 #define VK_PIPELINE_BUILDER_H
 
+#include <array>
+#include <span>
 #include <string>
+#include <vector>
 #include "graphics/vk/vk_common.h"
 
+class VkPipelineCompiler;
+class VkShaderObjectCache;
+class VkPipelineLibraryCache;
+struct VkShaderObjectPipeline;
+
 struct SpecializationInfoHelper {
     VkPipelineStageFlags stageFlags;
     VkSpecializationInfo specializationInfo;
 };
 
+// Specialization constants with ids 0 to N - 1, in that order
+template<size_t N>
+struct SpecializationConstants {
+    explicit constexpr SpecializationConstants(const std::array<uint32_t, N> &values) : data(values) {
+        for (uint32_t i = 0; i < N; i++)
+            entries[i] = {i, static_cast<uint32_t>(i * sizeof(uint32_t)), sizeof(uint32_t)};
+    }
+
+    // Points into this, which has to outlive the call it's passed to
+    [[nodiscard]] SpecializationInfoHelper Info(const VkShaderStageFlags stageFlags) const {
+        return {stageFlags, {static_cast<uint32_t>(N), entries.data(), sizeof(data), data.data()}};
+    }
+
+    std::array<uint32_t, N> data;
+    std::array<VkSpecializationMapEntry, N> entries{};
+};
+
 struct VkGraphicsPipelineBuilder {
-    VkPipeline Build(bool dynamicRendering, const VkDevice &device, const VkPipelineCache &pipelineCache, const VkRenderPass &renderPass = VK_NULL_HANDLE, const SpecializationInfoHelper &info = {});
+    // Queues the pipeline as currently described, the builder can be changed or cleared for the next one right after.
+    // The specialization info is copied too, target is written when the compiler runs. With libraries the pipeline is
+    // linked from library parts instead, only the parts not in the cache yet are compiled and no modules are needed.
+    void Build(VkPipelineCompiler &compiler, VkPipeline *target, bool dynamicRendering, const VkRenderPass &renderPass = VK_NULL_HANDLE, const SpecializationInfoHelper &info = {}, VkPipelineLibraryCache *libraries = nullptr) const;
+    // libraryPart creates only that part of the pipeline as a library, from the modules of its stages
+    VkPipeline Create(bool dynamicRendering, const VkDevice &device, const VkPipelineCache &pipelineCache, const VkRenderPass &renderPass, const SpecializationInfoHelper &info, VkGraphicsPipelineLibraryFlagsEXT libraryPart = 0) const;
+    // The same description as shader objects and the state to bind with them, for dynamic rendering only. Needs the
+    // shader paths but no modules.
+    void BuildShaderObjects(VkShaderObjectCache &cache, VkShaderObjectPipeline *target, const VkDevice &device, std::span<const VkDescriptorSetLayout> setLayouts, std::span<const VkPushConstantRange> pushConstantRanges, const SpecializationInfoHelper &info = {}) const;
     void Clear();
 
+    void SetShaders(const std::string &vertexOrMeshShaderFilePath, const std::string &fragmentShaderFilePath, const std::string &taskShaderFilePath = "");
+    // Throws if a shader doesn't compile
     void CreateShaderModules(const VkDevice &device, const std::string &vertexOrMeshShaderFilePath, const std::string &fragmentShaderFilePath, const std::string &taskShaderFilePath = "");
+    // From the paths given to SetShaders, only for the stages asked for. False if one of them doesn't compile, the
+    // modules that were created are destroyed then.
+    [[nodiscard]] bool CreateShaderModules(const VkDevice &device, VkShaderStageFlags stages = VK_SHADER_STAGE_ALL);
     void DestroyShaderModules(const VkDevice &device) const;
+    // Hands the modules over to the compiler, they are destroyed once the pipelines queued with them are compiled
+    void DestroyShaderModules(VkPipelineCompiler &compiler) const;
     void SetPipelineLayout(VkPipelineLayout pipelineLayout);
     void SetTopology(VkPrimitiveTopology topology);
     void SetPolygonMode(VkPolygonMode polygonMode);
@@ -27,20 +67,36 @@ struct VkGraphicsPipelineBuilder {
     // Dynamic rendering stuff
     void SetColorAttachmentFormat(VkFormat format);
     void SetDepthFormat(VkFormat format);
+    // Second color attachment of the main pass, motion vectors for the temporal upscaler. Needed with render passes
+    // too, pipelines that don't write motion of their own leave it alone.
+    void AddVelocityAttachment(VkFormat format, bool write = true);
 
     VkShaderModule vertexOrMeshShaderModule{VK_NULL_HANDLE};
     VkShaderModule taskShaderModule{VK_NULL_HANDLE};
     VkShaderModule fragmentShaderModule{VK_NULL_HANDLE};
+    // What the modules were created from, reloads create them again
+    std::string vertexOrMeshShaderPath;
+    std::string fragmentShaderPath;
+    std::string taskShaderPath;
     VkPipelineLayout pipelineLayout{VK_NULL_HANDLE};
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
     VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo{.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO, .lineWidth = 1.0f};
     VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
     VkPipelineColorBlendAttachmentState colorBlendAttachment{.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT};
+    VkPipelineColorBlendAttachmentState velocityBlendAttachment{};
 
     VkPipelineRenderingCreateInfo renderingCreateInfo{VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
 
-    VkFormat colorAttachmentFormat{VK_FORMAT_UNDEFINED};
+    std::array<VkFormat, 2> colorAttachmentFormats{};
+    bool hasVelocityAttachment{false};
     bool isMeshShader{false};
+
+private:
+    // Null if the code is empty
+    static VkShaderModule CreateShaderModule(VkDevice device, const std::vector<uint32_t> &code);
+    void BuildLibraries(VkPipelineLibraryCache &libraries, VkPipelineCompiler &compiler, VkPipeline *target, bool dynamicRendering, VkRenderPass renderPass, const SpecializationInfoHelper &info) const;
+    // Everything that goes into the part, parts with the same key are interchangeable
+    [[nodiscard]] std::string LibraryKey(VkGraphicsPipelineLibraryFlagsEXT libraryPart, bool dynamicRendering, VkRenderPass renderPass, const SpecializationInfoHelper &info) const;
 };
 
 #endif //VK_PIPELINE_BUILDER_H
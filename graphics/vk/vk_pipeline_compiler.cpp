@@ -0,0 +1,104 @@
+#include "vk_pipeline_compiler.h"
+
+#include <thread>
+#include "graphics/vk/vk_shader_compiler.h"
+#include "graphics/vk/vk_shader_reloader.h"
+
+void VkPipelineCompiler::Add(VkPipeline *target, std::function<VkPipeline(VkDevice, VkPipelineCache)> &&create) {
+    jobs.emplace_back(target, std::move(create));
+}
+
+void VkPipelineCompiler::AddCompute(VkPipeline *target, const VkComputePipelineCreateInfo &createInfo, const std::string &shaderPath) {
+    DestroyAfterCompile(createInfo.stage.module);
+
+    Add(target, [createInfo](const VkDevice device, const VkPipelineCache pipelineCache) {
+        VkPipeline pipeline{VK_NULL_HANDLE};
+        VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, VK_NULL_HANDLE, &pipeline));
+        return pipeline;
+    });
+
+    if (!reloader)
+        return;
+
+    reloader->Register(target, {shaderPath}, [createInfo, shaderPath](const VkDevice device, const VkPipelineCache pipelineCache) {
+        const auto shaderCode = LoadShader(shaderPath);
+        // One that doesn't compile leaves the current pipeline in place
+        if (shaderCode.empty())
+            return VkPipeline{VK_NULL_HANDLE};
+
+        const VkShaderModuleCreateInfo shaderModuleCreateInfo{
+            VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            VK_NULL_HANDLE,
+            0,
+            shaderCode.size() * sizeof(uint32_t),
+            shaderCode.data()
+        };
+
+        auto reloadedInfo = createInfo;
+        VK_CHECK(vkCreateShaderModule(device, &shaderModuleCreateInfo, VK_NULL_HANDLE, &reloadedInfo.stage.module));
+
+        VkPipeline pipeline{VK_NULL_HANDLE};
+        VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &reloadedInfo, VK_NULL_HANDLE, &pipeline));
+
+        vkDestroyShaderModule(device, reloadedInfo.stage.module, VK_NULL_HANDLE);
+        return pipeline;
+    });
+}
+
+void VkPipelineCompiler::AddLink(VkPipeline *target, std::function<VkPipeline(VkDevice, VkPipelineCache)> &&link) {
+    links.emplace_back(target, std::move(link));
+}
+
+void VkPipelineCompiler::DestroyAfterCompile(const VkShaderModule shaderModule) {
+    if (shaderModule != VK_NULL_HANDLE)
+        shaderModules.push_back(shaderModule);
+}
+
+void VkPipelineCompiler::AfterCompile(std::function<void()> &&callback) {
+    afterCompile.push_back(std::move(callback));
+}
+
+void VkPipelineCompiler::Compile() {
+    auto error = Run(jobs);
+    // Links would be given the parts that failed
+    if (error)
+        links.clear();
+    else
+        error = Run(links);
+
+    for (const auto shaderModule : shaderModules)
+        vkDestroyShaderModule(device, shaderModule, VK_NULL_HANDLE);
+
+    shaderModules.clear();
+
+    if (error) {
+        afterCompile.clear();
+        std::rethrow_exception(error);
+    }
+
+    for (const auto &callback : afterCompile)
+        callback();
+
+    afterCompile.clear();
+}
+
+std::exception_ptr VkPipelineCompiler::Run(std::vector<Job> &queued) const {
+    const auto size = static_cast<int>(queued.size());
+    std::exception_ptr error;
+
+    // Compile times vary a lot between pipelines, the ubershaders would hold up a static split
+#pragma omp parallel for schedule(dynamic) num_threads(std::thread::hardware_concurrency())
+    for (int i = 0; i < size; i++) {
+        try {
+            *queued[i].target = queued[i].create(device, pipelineCache);
+        } catch (...) {
+            *queued[i].target = VK_NULL_HANDLE;
+#pragma omp critical(pipelineCompilerError)
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    queued.clear();
+    return error;
+}
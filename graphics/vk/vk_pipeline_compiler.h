@@ -0,0 +1,56 @@
+#ifndef VK_PIPELINE_COMPILER_H
+#define VK_PIPELINE_COMPILER_H
+
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+#include "graphics/vk/vk_common.h"
+
+class VkShaderReloader;
+
+// Pipelines are queued here instead of created where they're described, Compile then creates all of them at once spread
+// over worker threads. Drivers compile on the calling thread, so a cold start otherwise waits on every pipeline in turn.
+// The pipeline cache is internally synchronized and shared by all of them.
+class VkPipelineCompiler {
+public:
+    // Pipelines queued with a reloader are also registered with it, so they can be rebuilt when their shaders change
+    VkPipelineCompiler(VkDevice device, VkPipelineCache pipelineCache, VkShaderReloader *reloader = nullptr) : device(device), pipelineCache(pipelineCache), reloader(reloader) {}
+
+    // create runs on a worker thread, anything it points to has to outlive Compile
+    void Add(VkPipeline *target, std::function<VkPipeline(VkDevice, VkPipelineCache)> &&create);
+    // The stage's module is destroyed after compiling, the create info can't have any other pointers. The module is
+    // created from shaderPath again when reloading.
+    void AddCompute(VkPipeline *target, const VkComputePipelineCreateInfo &createInfo, const std::string &shaderPath);
+    // Runs after everything queued with Add, so it can link pipeline libraries they create
+    void AddLink(VkPipeline *target, std::function<VkPipeline(VkDevice, VkPipelineCache)> &&link);
+    // Shader modules have to stay alive until every pipeline using them is created
+    void DestroyAfterCompile(VkShaderModule shaderModule);
+    // Runs on the calling thread once Compile has written every target, for handing them to something else to read
+    void AfterCompile(std::function<void()> &&callback);
+
+    // Blocks until every queued pipeline is written to its target. If any of them threw, the first exception is rethrown
+    // once the others are done, the ones that failed are left as VK_NULL_HANDLE and nothing is linked.
+    void Compile();
+
+    [[nodiscard]] VkShaderReloader *Reloader() const { return reloader; }
+
+private:
+    struct Job {
+        VkPipeline *target;
+        std::function<VkPipeline(VkDevice, VkPipelineCache)> create;
+    };
+
+    // Returns the first exception a job threw, it can't leave the parallel region
+    std::exception_ptr Run(std::vector<Job> &queued) const;
+
+    VkDevice device;
+    VkPipelineCache pipelineCache;
+    VkShaderReloader *reloader;
+    std::vector<Job> jobs;
+    std::vector<Job> links;
+    std::vector<VkShaderModule> shaderModules;
+    std::vector<std::function<void()>> afterCompile;
+};
+
+#endif //VK_PIPELINE_COMPILER_H
@@ -0,0 +1,34 @@
+#include "vk_pipeline_library.h"
+
+#include <ranges>
+
+VkPipeline *VkPipelineLibraryCache::Get(const std::string &key, bool &isNew) {
+    const auto [it, inserted] = libraries.try_emplace(key, VK_NULL_HANDLE);
+    isNew = inserted;
+    return &it->second;
+}
+
+void VkPipelineLibraryCache::Destroy(const VkDevice device) const {
+    for (const auto library : libraries | std::views::values)
+        vkDestroyPipeline(device, library, VK_NULL_HANDLE);
+}
+
+VkPipeline VkPipelineLibraryCache::Link(const VkDevice device, const VkPipelineCache pipelineCache, const std::span<const VkPipeline> libraries, const VkPipelineLayout pipelineLayout) {
+    const VkPipelineLibraryCreateInfoKHR libraryCreateInfo{
+        VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+        VK_NULL_HANDLE,
+        static_cast<uint32_t>(libraries.size()),
+        libraries.data()
+    };
+
+    const VkGraphicsPipelineCreateInfo pipelineInfo{
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = &libraryCreateInfo,
+        .layout = pipelineLayout
+    };
+
+    VkPipeline pipeline{VK_NULL_HANDLE};
+    VK_CHECK(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, VK_NULL_HANDLE, &pipeline));
+
+    return pipeline;
+}
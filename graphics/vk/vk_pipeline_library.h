@@ -0,0 +1,25 @@
+#ifndef VK_PIPELINE_LIBRARY_H
+#define VK_PIPELINE_LIBRARY_H
+
+#include <span>
+#include <string>
+#include <unordered_map>
+#include "graphics/vk/vk_common.h"
+
+// Graphics pipeline library parts by the state that goes into them. Every pipeline built in library mode is fast linked
+// from its vertex input, pre-rasterization, fragment shader and fragment output parts, each of which is compiled once
+// no matter how many pipelines share it.
+class VkPipelineLibraryCache {
+public:
+    // The part stored under key, isNew when the caller has to queue its creation
+    VkPipeline *Get(const std::string &key, bool &isNew);
+    void Destroy(VkDevice device) const;
+
+    // Without link time optimization, so it only copies the already compiled parts together
+    static VkPipeline Link(VkDevice device, VkPipelineCache pipelineCache, std::span<const VkPipeline> libraries, VkPipelineLayout pipelineLayout);
+
+private:
+    std::unordered_map<std::string, VkPipeline> libraries;
+};
+
+#endif //VK_PIPELINE_LIBRARY_H
@@ -0,0 +1,286 @@
+#include "vk_render_graph.h"
+#include <algorithm>
+#include <bit>
+#include <ranges>
+
+VkRenderGraph::PassBuilder &VkRenderGraph::PassBuilder::Read(const Resource resource, const Usage &usage) {
+    graph.passes[pass].uses.push_back({resource, usage, false, false});
+    return *this;
+}
+
+VkRenderGraph::PassBuilder &VkRenderGraph::PassBuilder::Write(const Resource resource, const Usage &usage) {
+    graph.passes[pass].uses.push_back({resource, usage, true, false});
+    return *this;
+}
+
+VkRenderGraph::PassBuilder &VkRenderGraph::PassBuilder::Discard(const Resource resource, const Usage &usage) {
+    graph.passes[pass].uses.push_back({resource, usage, true, true});
+    return *this;
+}
+
+VkRenderGraph::PassBuilder &VkRenderGraph::PassBuilder::SideEffect() {
+    graph.passes[pass].sideEffect = true;
+    return *this;
+}
+
+VkRenderGraph::Resource VkRenderGraph::ImportImage(const VulkanImage &image, const VkImageAspectFlags aspect, const bool transient, const VkImageLayout initialLayout) {
+    // Nothing is known about earlier work on an untracked image, so its first use waits on everything
+    return Import({std::bit_cast<uint64_t>(image.image), 0}, image.image, aspect, transient,
+                  {initialLayout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT},
+                  transient ? std::bit_cast<uint64_t>(image.allocation) : 0);
+}
+
+VkRenderGraph::Resource VkRenderGraph::ImportBuffer(VkBuffer buffer, const VkDeviceSize offset, const bool transient) {
+    return Import({std::bit_cast<uint64_t>(buffer), offset}, VK_NULL_HANDLE, 0, transient,
+                  {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_WRITE_BIT});
+}
+
+VkRenderGraph::Resource VkRenderGraph::ImportSwapChainImage(VkImage image, const VkPipelineStageFlags2 waitStage) {
+    const auto resource = Import({std::bit_cast<uint64_t>(image), 0}, image, VK_IMAGE_ASPECT_COLOR_BIT, true, {});
+    resources[resource].state = {VK_IMAGE_LAYOUT_UNDEFINED, waitStage};
+    return resource;
+}
+
+VkRenderGraph::Resource VkRenderGraph::Import(const ResourceKey key, VkImage image, const VkImageAspectFlags aspect, const bool transient, const ResourceState &untrackedState, const uint64_t memory) {
+    const auto tracked = trackedStates.find(key);
+    resources.push_back({key, image, aspect, transient, tracked != trackedStates.end() ? tracked->second : untrackedState, memory});
+    return static_cast<Resource>(resources.size() - 1);
+}
+
+VkRenderGraph::PassBuilder VkRenderGraph::AddPass(const RenderGraphQueue queue, std::function<void(VkCommandBuffer)> &&execute) {
+    passes.push_back({queue, std::move(execute)});
+    return {*this, static_cast<uint32_t>(passes.size() - 1)};
+}
+
+void VkRenderGraph::Compile(const bool asyncCompute) {
+    // Walking backwards, a pass survives if it has side effects or writes something that outlives the frame or is read later
+    std::vector<bool> needed(resources.size());
+    for (auto &pass : std::ranges::reverse_view(passes)) {
+        pass.culled = !pass.sideEffect && std::ranges::none_of(pass.uses, [&](const ResourceUse &use) {
+            return use.write && (!resources[use.resource].transient || needed[use.resource]);
+        });
+
+        if (pass.culled)
+            continue;
+
+        // Earlier writers of a discarded resource are only needed if something before this pass reads them
+        for (const auto &use : pass.uses) {
+            if (use.discard)
+                needed[use.resource] = false;
+        }
+
+        for (const auto &use : pass.uses) {
+            if (!use.discard)
+                needed[use.resource] = true;
+        }
+    }
+
+    // Async compute passes can't wait on graphics work from the same frame, those fall back to the graphics queue.
+    // Aliased memory changes hands on the graphics queue only, so images placed in it keep their passes there too.
+    std::vector<bool> touchedByGraphics(resources.size());
+    std::vector<bool> touchedByCompute(resources.size());
+    asyncWaitStages = VK_PIPELINE_STAGE_2_NONE;
+
+    for (auto &pass : passes) {
+        if (pass.culled)
+            continue;
+
+        if (pass.queue == RenderGraphQueue::AsyncCompute && (!asyncCompute || std::ranges::any_of(pass.uses, [&](const ResourceUse &use) {
+            return touchedByGraphics[use.resource] || resources[use.resource].memory;
+        })))
+            pass.queue = RenderGraphQueue::Graphics;
+
+        for (const auto &use : pass.uses) {
+            if (pass.queue == RenderGraphQueue::AsyncCompute) {
+                touchedByCompute[use.resource] = true;
+            } else {
+                if (touchedByCompute[use.resource] && !touchedByGraphics[use.resource])
+                    asyncWaitStages |= use.usage.stage;
+
+                touchedByGraphics[use.resource] = true;
+            }
+        }
+    }
+
+    // Each queue only sees its own earlier work, whatever crossed over is covered by a semaphore wait.
+    // Compute goes first, graphics waits on it before its first use of anything compute touched.
+    const auto beginQueue = [&](const RenderGraphQueue queue) {
+        for (size_t i = 0; i < resources.size(); i++) {
+            const bool otherQueue = queue == RenderGraphQueue::AsyncCompute ? touchedByCompute[i] : touchedByCompute[i] && touchedByGraphics[i];
+            if (otherQueue) {
+                auto &state = resources[i].state;
+                state = {state.layout};
+            }
+        }
+
+        for (auto &pass : passes) {
+            if (!pass.culled && pass.queue == queue)
+                AddBarriers(pass);
+        }
+    };
+
+    beginQueue(RenderGraphQueue::AsyncCompute);
+    beginQueue(RenderGraphQueue::Graphics);
+
+    // The compute queue runs alongside all of graphics, so an image it touches can't share memory with anything in the frame
+    transientLifetimes.clear();
+    std::vector<uint32_t> lifetimeIndices(resources.size(), UINT32_MAX);
+    const auto lastPass = static_cast<uint32_t>(passes.size() - 1);
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (passes[i].culled)
+            continue;
+
+        const bool wholeFrame = passes[i].queue == RenderGraphQueue::AsyncCompute;
+        for (const auto &use : passes[i].uses) {
+            const auto &resource = resources[use.resource];
+            if (!resource.transient || resource.image == VK_NULL_HANDLE)
+                continue;
+
+            auto &index = lifetimeIndices[use.resource];
+            if (index == UINT32_MAX) {
+                index = static_cast<uint32_t>(transientLifetimes.size());
+                transientLifetimes.push_back({resource.image, wholeFrame ? 0 : i, wholeFrame ? lastPass : i});
+            } else {
+                transientLifetimes[index].lastPass = wholeFrame ? lastPass : std::max(transientLifetimes[index].lastPass, i);
+            }
+        }
+    }
+
+    for (const auto &resource : resources)
+        trackedStates[resource.key] = resource.state;
+}
+
+void VkRenderGraph::AddBarriers(Pass &pass) {
+    pass.memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    pass.imageBarriers.clear();
+
+    for (const auto &[resourceIndex, usage, write, discard] : pass.uses) {
+        const auto &resource = resources[resourceIndex];
+        auto &state = resources[resourceIndex].state;
+
+        VkPipelineStageFlags2 aliasStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 aliasAccess = VK_ACCESS_2_NONE;
+        if (resource.memory) {
+            auto &memoryState = memoryStates[resource.memory];
+            if (memoryState.owner != resource.key) {
+                // Another image used the memory last, its accesses have to finish and this image's contents are gone
+                aliasStages = memoryState.stages;
+                aliasAccess = memoryState.writeAccess;
+                state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                memoryState = {resource.key};
+            }
+
+            if (write) {
+                memoryState.stages = usage.stage;
+                memoryState.writeAccess = usage.access;
+            } else {
+                memoryState.stages |= usage.stage;
+            }
+        }
+
+        const bool transition = resource.image != VK_NULL_HANDLE && usage.layout != VK_IMAGE_LAYOUT_UNDEFINED && usage.layout != state.layout;
+
+        VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+        if (write || transition) {
+            // Writes and layout transitions wait for every access since the last write
+            srcStages = state.writeStages | state.readStages;
+            srcAccess = state.writeAccess;
+        } else if (usage.stage & ~state.visibleStages || usage.access & ~state.visibleAccess) {
+            srcStages = state.writeStages;
+            srcAccess = state.writeAccess;
+        }
+
+        srcStages |= aliasStages;
+        srcAccess |= aliasAccess;
+
+        if (transition) {
+            pass.imageBarriers.push_back({
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                VK_NULL_HANDLE,
+                srcStages,
+                srcAccess,
+                usage.stage,
+                usage.access,
+                discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout,
+                usage.layout,
+                VK_QUEUE_FAMILY_IGNORED,
+                VK_QUEUE_FAMILY_IGNORED,
+                resource.image,
+                {resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}
+            });
+        } else if (srcStages != VK_PIPELINE_STAGE_2_NONE) {
+            // Everything without a layout change shares one global barrier per pass
+            pass.memoryBarrier.srcStageMask |= srcStages;
+            pass.memoryBarrier.srcAccessMask |= srcAccess;
+            pass.memoryBarrier.dstStageMask |= usage.stage;
+            pass.memoryBarrier.dstAccessMask |= usage.access;
+        }
+
+        if (write || transition) {
+            // A layout transition counts as a write, later readers in other stages still have to wait for it
+            state.writeStages = usage.stage;
+            state.writeAccess = write ? usage.access : VK_ACCESS_2_NONE;
+            state.readStages = write ? VK_PIPELINE_STAGE_2_NONE : usage.stage;
+            state.visibleStages = usage.stage;
+            state.visibleAccess = usage.access;
+        } else {
+            state.readStages |= usage.stage;
+            if (srcStages != VK_PIPELINE_STAGE_2_NONE) {
+                state.visibleStages |= usage.stage;
+                state.visibleAccess |= usage.access;
+            }
+        }
+
+        if (usage.layout != VK_IMAGE_LAYOUT_UNDEFINED)
+            state.layout = usage.layout;
+
+        // The render pass transitioned the image on its way out, which again counts as a write by this pass
+        if (usage.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED && usage.finalLayout != state.layout) {
+            state = {usage.finalLayout, usage.stage, usage.access};
+        }
+    }
+}
+
+void VkRenderGraph::Execute(const RenderGraphQueue queue, VkCommandBuffer commandBuffer) const {
+    for (const auto &pass : passes) {
+        if (pass.culled || pass.queue != queue)
+            continue;
+
+        const bool hasMemoryBarrier = pass.memoryBarrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE;
+        if (hasMemoryBarrier || !pass.imageBarriers.empty()) {
+            const VkDependencyInfo dependencyInfo{
+                VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                VK_NULL_HANDLE,
+                0,
+                hasMemoryBarrier ? 1u : 0u,
+                &pass.memoryBarrier,
+                0,
+                VK_NULL_HANDLE,
+                static_cast<uint32_t>(pass.imageBarriers.size()),
+                pass.imageBarriers.data()
+            };
+
+            vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+        }
+
+        pass.execute(commandBuffer);
+    }
+}
+
+bool VkRenderGraph::HasWork(const RenderGraphQueue queue) const {
+    return std::ranges::any_of(passes, [&](const Pass &pass) { return !pass.culled && pass.queue == queue; });
+}
+
+void VkRenderGraph::Clear() {
+    resources.clear();
+    passes.clear();
+    transientLifetimes.clear();
+    asyncWaitStages = VK_PIPELINE_STAGE_2_NONE;
+}
+
+void VkRenderGraph::Reset() {
+    Clear();
+    trackedStates.clear();
+    memoryStates.clear();
+}
@@ -0,0 +1,140 @@
+#ifndef VK_RENDER_GRAPH_H
+#define VK_RENDER_GRAPH_H
+
+#include <functional>
+#include <map>
+#include <vector>
+#include "graphics/vk/vk_common.h"
+
+enum class RenderGraphQueue : uint8_t {
+    Graphics,
+    // Runs on the compute queue unless something it touches was already used by a graphics pass this frame
+    AsyncCompute
+};
+
+// Rebuilt every frame. Passes declare how they use each resource, Compile drops passes nobody consumes, picks a queue
+// for the async compute ones and works out one batched barrier per pass. The state of every resource is carried over
+// to the next frame, so the first use in a frame only waits on what actually touched the resource last.
+class VkRenderGraph {
+public:
+    using Resource = uint32_t;
+
+    struct Usage {
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+        // UNDEFINED leaves the layout alone, for buffers and for render passes that transition from UNDEFINED themselves
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // Layout a render pass leaves the image in, UNDEFINED if it stays in layout
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    // First and last pass touching a transient image this frame, images used on the compute queue are alive the whole frame
+    struct ImageLifetime {
+        VkImage image;
+        uint32_t firstPass;
+        uint32_t lastPass;
+    };
+
+    class PassBuilder {
+    public:
+        PassBuilder &Read(Resource resource, const Usage &usage);
+        PassBuilder &Write(Resource resource, const Usage &usage);
+        // Write that doesn't need the previous contents, images are transitioned from UNDEFINED
+        PassBuilder &Discard(Resource resource, const Usage &usage);
+        // Never culled, for passes whose result leaves the graph
+        PassBuilder &SideEffect();
+
+    private:
+        friend class VkRenderGraph;
+        PassBuilder(VkRenderGraph &graph, const uint32_t pass) : graph(graph), pass(pass) {}
+
+        VkRenderGraph &graph;
+        uint32_t pass;
+    };
+
+    // Each resource is imported once per frame. Transient ones only matter within the frame, a pass writing nothing
+    // but transient resources is culled unless a later pass reads them. initialLayout is used until the graph has seen the image.
+    // Transient images sharing an allocation alias each other, the first use after another image had the memory starts from UNDEFINED.
+    Resource ImportImage(const VulkanImage &image, VkImageAspectFlags aspect, bool transient = false, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+    // Per-frame slices of one buffer are tracked separately
+    Resource ImportBuffer(VkBuffer buffer, VkDeviceSize offset = 0, bool transient = false);
+    // Handed over by a semaphore wait at waitStage, the first use chains onto it
+    Resource ImportSwapChainImage(VkImage image, VkPipelineStageFlags2 waitStage);
+
+    PassBuilder AddPass(RenderGraphQueue queue, std::function<void(VkCommandBuffer)> &&execute);
+
+    // Work from earlier frames on the other queue has to be ordered by the caller's semaphores
+    void Compile(bool asyncCompute);
+    void Execute(RenderGraphQueue queue, VkCommandBuffer commandBuffer) const;
+
+    [[nodiscard]] bool HasWork(RenderGraphQueue queue) const;
+    // Graphics stages that consume async compute results, the graphics submit waits on the compute queue there
+    [[nodiscard]] VkPipelineStageFlags2 AsyncWaitStages() const { return asyncWaitStages; }
+    // Only images used by a pass that survived culling are listed
+    [[nodiscard]] const std::vector<ImageLifetime> &TransientLifetimes() const { return transientLifetimes; }
+
+    // Drops the frame's passes and resources, tracked states are kept
+    void Clear();
+    // Forgets tracked states, needed whenever imported images are recreated
+    void Reset();
+
+private:
+    struct ResourceState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+        // Stages that read since the last write, the next write waits on them
+        VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;
+        // Where the last write has already been made visible
+        VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+    };
+
+    using ResourceKey = std::pair<uint64_t, VkDeviceSize>;
+
+    // Last image to use a piece of aliased memory and the accesses made through it since its last write
+    struct MemoryState {
+        ResourceKey owner;
+        VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+    };
+
+    struct ImportedResource {
+        ResourceKey key;
+        VkImage image;
+        VkImageAspectFlags aspect;
+        bool transient;
+        ResourceState state;
+        // Allocation of a transient image, other images may be placed in it too
+        uint64_t memory;
+    };
+
+    struct ResourceUse {
+        Resource resource;
+        Usage usage;
+        bool write;
+        bool discard;
+    };
+
+    struct Pass {
+        RenderGraphQueue queue;
+        std::function<void(VkCommandBuffer)> execute;
+        std::vector<ResourceUse> uses;
+        bool sideEffect;
+        bool culled;
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        VkMemoryBarrier2 memoryBarrier;
+    };
+
+    Resource Import(ResourceKey key, VkImage image, VkImageAspectFlags aspect, bool transient, const ResourceState &untrackedState, uint64_t memory = 0);
+    void AddBarriers(Pass &pass);
+
+    std::vector<ImportedResource> resources;
+    std::vector<Pass> passes;
+    std::map<ResourceKey, ResourceState> trackedStates;
+    std::map<uint64_t, MemoryState> memoryStates;
+    std::vector<ImageLifetime> transientLifetimes;
+    VkPipelineStageFlags2 asyncWaitStages = VK_PIPELINE_STAGE_2_NONE;
+};
+
+#endif //VK_RENDER_GRAPH_H
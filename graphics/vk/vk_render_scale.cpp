@@ -0,0 +1,55 @@
+#include "vk_render_scale.h"
+#include <algorithm>
+#include <cmath>
+
+// Scales are kept on this grid, so noise in the timings can't keep nudging the resolution
+static constexpr float SCALE_STEP = 0.05f;
+// Weight of the newest frame in the running average
+static constexpr float SMOOTHING = 0.1f;
+// Scaling up aims this far below the budget, otherwise the scale would bounce between two steps around it
+static constexpr float HEADROOM = 0.9f;
+
+bool VkRenderScale::Update(const float gpuTime) {
+    if (!enabled)
+        return SetScale(maxScale);
+
+    if (settleFrames > 0) {
+        settleFrames--;
+        return false;
+    }
+
+    if (gpuTime <= 0.0f)
+        return false;
+
+    smoothedTime = smoothedTime > 0.0f ? std::lerp(smoothedTime, gpuTime, SMOOTHING) : gpuTime;
+
+    const float budget = smoothedTime > targetFrameTime ? targetFrameTime : targetFrameTime * HEADROOM;
+    const float ideal = std::floor(scale * std::sqrt(budget / smoothedTime) / SCALE_STEP) * SCALE_STEP;
+
+    // Over budget the scale drops right away, under it the scale climbs a step at a time
+    if (ideal < scale - SCALE_STEP * 0.5f)
+        return SetScale(ideal);
+
+    if (ideal > scale + SCALE_STEP * 0.5f)
+        return SetScale(scale + SCALE_STEP);
+
+    return false;
+}
+
+VkExtent2D VkRenderScale::Apply(const VkExtent2D extent) const {
+    return {
+        std::max(1u, static_cast<uint32_t>(std::lround(static_cast<float>(extent.width) * scale))),
+        std::max(1u, static_cast<uint32_t>(std::lround(static_cast<float>(extent.height) * scale)))
+    };
+}
+
+bool VkRenderScale::SetScale(float value) {
+    value = std::clamp(value, minScale, maxScale);
+    if (value == scale)
+        return false;
+
+    scale = value;
+    smoothedTime = 0.0f;
+    settleFrames = MAX_FRAMES_IN_FLIGHT;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef VK_RENDER_SCALE_H
+#define VK_RENDER_SCALE_H
+
+#include "graphics/vk/vk_common.h"
+
+// Fraction of the swap chain resolution the scene is rendered at. Fed the GPU time of every frame, it lowers the scale
+// when frames run over targetFrameTime and raises it again once there is room. GPU time is taken to grow with the
+// pixel count, so a frame that takes twice the budget is answered with a scale about 1/sqrt(2) of the current one.
+class VkRenderScale {
+public:
+    // Returns whether the scale changed
+    bool Update(float gpuTime);
+    // Render extent for the current scale, never smaller than a pixel
+    [[nodiscard]] VkExtent2D Apply(VkExtent2D extent) const;
+
+    [[nodiscard]] float Scale() const { return scale; }
+
+    float targetFrameTime = 1000.0f / 60.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    // Off pins the scale to maxScale
+    bool enabled = true;
+
+private:
+    bool SetScale(float value);
+
+    float scale = 1.0f;
+    float smoothedTime = 0.0f;
+    // Frames still in flight were recorded at the old scale, their timings are skipped after a change
+    uint32_t settleFrames = 0;
+};
+
+#endif //VK_RENDER_SCALE_H
@@ -0,0 +1,215 @@
+#include "vk_shader_compiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <ranges>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include "common/file.h"
+#include "common/hash.h"
+
+#ifdef RUNTIME_SHADER_COMPILER
+#include <shaderc/shaderc.hpp>
+#endif
+
+static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+static std::vector<uint32_t> ReadSpirv(const std::filesystem::path &path) {
+    auto code = ReadFile<uint32_t>(path);
+    // ReadFile sizes the vector in bytes whatever the element type
+    code.resize(code.size() / sizeof(uint32_t));
+    return code;
+}
+
+#ifdef RUNTIME_SHADER_COMPILER
+// Bumped whenever the compile options change, so entries compiled differently are never picked up. A different compiler
+// is told apart by SHADER_COMPILER_ID, the SDK version and a hash of the shaderc library from the build.
+static constexpr uint32_t SHADER_CACHE_VERSION = 1;
+
+static std::filesystem::path shaderCacheDirectory;
+// Source of every build time SPIR-V by its file name, filled before any shader is loaded and only read after
+static std::unordered_map<std::string, std::filesystem::path> shaderSources;
+
+static std::string ReadText(const std::filesystem::path &path) {
+    const auto text = ReadFile<char>(path);
+    return {text.begin(), text.end()};
+}
+
+// Every file a source pulls in, in the order the includes appear. The shaders only use the quoted form relative to the
+// including file, which is all this follows.
+static void CollectIncludes(const std::filesystem::path &path, std::vector<std::filesystem::path> &files) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        const auto start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            continue;
+
+        const auto open = line.find('"', start);
+        const auto close = line.find('"', open + 1);
+        if (open == std::string::npos || close == std::string::npos)
+            continue;
+
+        auto include = (path.parent_path() / line.substr(open + 1, close - open - 1)).lexically_normal();
+        if (std::ranges::find(files, include) != files.end())
+            continue;
+
+        files.push_back(include);
+        CollectIncludes(include, files);
+    }
+}
+
+static shaderc_shader_kind ShaderKind(const std::filesystem::path &source) {
+    static const std::unordered_map<std::string, shaderc_shader_kind> kinds{
+        {".vert", shaderc_vertex_shader},
+        {".frag", shaderc_fragment_shader},
+        {".comp", shaderc_compute_shader},
+        {".task", shaderc_task_shader},
+        {".mesh", shaderc_mesh_shader},
+        {".rgen", shaderc_raygen_shader},
+        {".rchit", shaderc_closesthit_shader},
+        {".rmiss", shaderc_miss_shader}
+    };
+
+    const auto kind = kinds.find(source.extension().string());
+    return kind != kinds.end() ? kind->second : shaderc_glsl_infer_from_source;
+}
+
+class ShaderIncluder final : public shaderc::CompileOptions::IncluderInterface {
+public:
+    shaderc_include_result *GetInclude(const char *requestedSource, shaderc_include_type, const char *requestingSource, size_t) override {
+        auto *include = new Include;
+        include->path = (std::filesystem::path(requestingSource).parent_path() / requestedSource).lexically_normal().string();
+        include->content = ReadText(include->path);
+
+        // An empty name is how a failed include is reported, the content is the error then
+        if (include->content.empty()) {
+            include->content = "Failed to open " + include->path;
+            include->path.clear();
+        }
+
+        include->result = {include->path.c_str(), include->path.size(), include->content.c_str(), include->content.size(), include};
+        return &include->result;
+    }
+
+    void ReleaseInclude(shaderc_include_result *data) override {
+        delete static_cast<Include *>(data->user_data);
+    }
+
+private:
+    struct Include {
+        std::string path;
+        std::string content;
+        shaderc_include_result result;
+    };
+};
+
+// Empty if it doesn't compile
+static std::vector<uint32_t> CompileShader(const std::filesystem::path &source, const std::span<const ShaderDefine> defines) {
+    const auto text = ReadText(source);
+    std::vector<std::filesystem::path> includes;
+    CollectIncludes(source, includes);
+
+    uint64_t hash = HashFnv1a(source.extension().string());
+    hash = HashFnv1a(text, hash);
+    for (const auto &include : includes)
+        hash = HashFnv1a(ReadText(include), hash);
+    for (const auto &[name, value] : defines)
+        hash = HashFnv1a("#define " + name + ' ' + value + '\n', hash);
+    hash = HashFnv1a(std::to_string(SHADER_CACHE_VERSION) + ' ' + SHADER_COMPILER_ID, hash);
+
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "%016llx.spv", static_cast<unsigned long long>(hash));
+    const auto cachePath = shaderCacheDirectory / fileName;
+
+    std::error_code error;
+    if (std::filesystem::exists(cachePath, error)) {
+        if (auto code = ReadSpirv(cachePath); !code.empty() && code[0] == SPIRV_MAGIC)
+            return code;
+    }
+
+    const shaderc::Compiler compiler;
+    shaderc::CompileOptions options;
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
+    options.SetTargetSpirv(shaderc_spirv_version_1_6);
+    options.SetGenerateDebugInfo();
+    options.SetIncluder(std::make_unique<ShaderIncluder>());
+    for (const auto &[name, value] : defines)
+        options.AddMacroDefinition(name, value);
+
+    const auto sourceName = source.string();
+    const auto result = compiler.CompileGlslToSpv(text, ShaderKind(source), sourceName.c_str(), options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        fprintf(stderr, "Failed to compile \"%s\":\n%s", sourceName.c_str(), result.GetErrorMessage().c_str());
+        return {};
+    }
+
+    std::vector code(result.cbegin(), result.cend());
+
+    // Written under a name of its own first, another thread compiling the same shader would otherwise read half of it
+    auto temporaryPath = cachePath;
+    temporaryPath += '.' + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    WriteFile(temporaryPath, code.data(), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+    std::filesystem::rename(temporaryPath, cachePath, error);
+
+    return code;
+}
+#endif
+
+void InitShaderCompiler([[maybe_unused]] const std::filesystem::path &cacheDirectory) {
+#ifdef RUNTIME_SHADER_COMPILER
+    shaderCacheDirectory = cacheDirectory;
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(SHADER_SOURCE_DIR, error)) {
+        if (entry.is_regular_file() && entry.path().extension() != ".glsl")
+            shaderSources.emplace(entry.path().filename().string(), entry.path());
+    }
+
+    printf("Compiling shaders from \"%s\"\n", SHADER_SOURCE_DIR);
+#endif
+}
+
+std::vector<uint32_t> LoadShader(const std::filesystem::path &spirvPath, [[maybe_unused]] const std::span<const ShaderDefine> defines) {
+#ifdef RUNTIME_SHADER_COMPILER
+    if (const auto source = shaderSources.find(spirvPath.stem().string()); source != shaderSources.end())
+        return CompileShader(source->second, defines);
+#endif
+
+    return ReadSpirv(spirvPath);
+}
+
+std::vector<uint32_t> RequireShader(const std::filesystem::path &spirvPath, const std::span<const ShaderDefine> defines) {
+    auto code = LoadShader(spirvPath, defines);
+    if (code.empty())
+        throw std::runtime_error("Failed to load shader \"" + spirvPath.string() + '"');
+
+    return code;
+}
+
+std::vector<std::filesystem::path> ShaderDependencies(const std::filesystem::path &spirvPath) {
+#ifdef RUNTIME_SHADER_COMPILER
+    if (const auto source = shaderSources.find(spirvPath.stem().string()); source != shaderSources.end()) {
+        std::vector files{source->second};
+        CollectIncludes(source->second, files);
+        return files;
+    }
+#endif
+
+    return {spirvPath};
+}
+
+std::vector<std::filesystem::path> ShaderSourceDirectories() {
+    std::set<std::filesystem::path> directories;
+#ifdef RUNTIME_SHADER_COMPILER
+    for (const auto &source : shaderSources | std::views::values)
+        directories.insert(source.parent_path());
+#endif
+
+    return {directories.begin(), directories.end()};
+}
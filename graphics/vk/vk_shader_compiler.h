@@ -0,0 +1,32 @@
+#ifndef VK_SHADER_COMPILER_H
+#define VK_SHADER_COMPILER_H
+
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+// Defined for the compile as #define name value
+struct ShaderDefine {
+    std::string name;
+    std::string value;
+};
+
+// Shaders are loaded by the path of their build time SPIR-V, like "shaders/lighting.frag.spv". Built with
+// RUNTIME_SHADER_COMPILER, the source next to it in the repository is compiled instead, and the result is kept in
+// cacheDirectory under a hash of the source, everything it includes, the defines and the compiler build.
+// Loading an unchanged shader then only reads and hashes its sources.
+void InitShaderCompiler(const std::filesystem::path &cacheDirectory);
+
+// Safe to call from several threads. Defines need a source, the build time SPIR-V is loaded as is. Empty when the source
+// doesn't compile, the build time SPIR-V is only for shaders without one so a broken edit never brings back an old build.
+std::vector<uint32_t> LoadShader(const std::filesystem::path &spirvPath, std::span<const ShaderDefine> defines = {});
+// LoadShader for shaders the renderer can't go without, throws when there is no code
+std::vector<uint32_t> RequireShader(const std::filesystem::path &spirvPath, std::span<const ShaderDefine> defines = {});
+
+// The SPIR-V file, or the source and every file it includes when compiling at runtime
+std::vector<std::filesystem::path> ShaderDependencies(const std::filesystem::path &spirvPath);
+// Where the sources are, for watching them. Empty without a runtime compiler.
+std::vector<std::filesystem::path> ShaderSourceDirectories();
+
+#endif //VK_SHADER_COMPILER_H
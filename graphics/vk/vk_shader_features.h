@@ -0,0 +1,65 @@
+#ifndef VK_SHADER_FEATURES_H
+#define VK_SHADER_FEATURES_H
+
+#include <utility>
+#include "graphics/vk/vk_pipeline_builder.h"
+
+// Values match the LIGHT_MODEL_* constants in tiled_shading.glsl
+enum class LightModel : uint8_t {
+    BlinnPhong,
+    Lambert
+};
+
+// How vertices reach the rasterizer, picks the shaders
+enum class VertexFormat : uint8_t {
+    // Pulled from the draw data by mesh.vert
+    Pulled,
+    // Meshlets expanded by the task and mesh shaders
+    Meshlets
+};
+
+enum class AlphaMode : uint8_t {
+    Opaque,
+    Blend
+};
+
+// One permutation of the material shaders. The shading features are passed as specialization constants, which the
+// driver folds when the pipeline is created, so the branches they guard are compiled out rather than taken at runtime.
+// The rest picks the shaders and fixed function state.
+struct ShaderFeatures {
+    bool pcf = true;
+    uint8_t cascadeCount = 4;
+    LightModel lightModel = LightModel::BlinnPhong;
+    VertexFormat vertexFormat = VertexFormat::Pulled;
+    AlphaMode alphaMode = AlphaMode::Opaque;
+    // Opaque shading after a depth prepass, tests EQUAL against the laid down depth and never writes it
+    bool depthEqual = false;
+
+    [[nodiscard]] constexpr uint32_t Packed() const {
+        return static_cast<uint32_t>(pcf) | cascadeCount << 8 | std::to_underlying(lightModel) << 16 |
+               std::to_underlying(vertexFormat) << 20 | std::to_underlying(alphaMode) << 24 | static_cast<uint32_t>(depthEqual) << 28;
+    }
+
+    // In constant_id order of lighting.frag and visibility_resolve.frag
+    [[nodiscard]] constexpr SpecializationConstants<3> Specialization() const {
+        return SpecializationConstants<3>{{pcf, cascadeCount, std::to_underlying(lightModel)}};
+    }
+
+    [[nodiscard]] constexpr ShaderFeatures With(const AlphaMode mode, const bool depthPrepass = false) const {
+        auto features = *this;
+        features.alphaMode = mode;
+        features.depthEqual = depthPrepass;
+        return features;
+    }
+
+    constexpr bool operator==(const ShaderFeatures &other) const = default;
+};
+
+template<>
+struct std::hash<ShaderFeatures> {
+    std::size_t operator()(const ShaderFeatures &features) const noexcept {
+        return features.Packed();
+    }
+};
+
+#endif //VK_SHADER_FEATURES_H
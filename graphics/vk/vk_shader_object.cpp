@@ -0,0 +1,169 @@
+#include "vk_shader_object.h"
+
+#include <ranges>
+#include <stdexcept>
+#include "graphics/vk/vk_shader_compiler.h"
+#include "graphics/vk/vk_shader_reloader.h"
+
+PFN_vkCreateShadersEXT fn_vkCreateShadersEXT = nullptr;
+PFN_vkDestroyShaderEXT fn_vkDestroyShaderEXT = nullptr;
+PFN_vkCmdBindShadersEXT fn_vkCmdBindShadersEXT = nullptr;
+PFN_vkCmdSetVertexInputEXT fn_vkCmdSetVertexInputEXT = nullptr;
+PFN_vkCmdSetPolygonModeEXT fn_vkCmdSetPolygonModeEXT = nullptr;
+PFN_vkCmdSetRasterizationSamplesEXT fn_vkCmdSetRasterizationSamplesEXT = nullptr;
+PFN_vkCmdSetSampleMaskEXT fn_vkCmdSetSampleMaskEXT = nullptr;
+PFN_vkCmdSetAlphaToCoverageEnableEXT fn_vkCmdSetAlphaToCoverageEnableEXT = nullptr;
+PFN_vkCmdSetDepthClampEnableEXT fn_vkCmdSetDepthClampEnableEXT = nullptr;
+PFN_vkCmdSetColorBlendEnableEXT fn_vkCmdSetColorBlendEnableEXT = nullptr;
+PFN_vkCmdSetColorBlendEquationEXT fn_vkCmdSetColorBlendEquationEXT = nullptr;
+PFN_vkCmdSetColorWriteMaskEXT fn_vkCmdSetColorWriteMaskEXT = nullptr;
+
+void LoadShaderObjectFunctions(const VkDevice device) {
+    fn_vkCreateShadersEXT = reinterpret_cast<PFN_vkCreateShadersEXT>(vkGetDeviceProcAddr(device, "vkCreateShadersEXT"));
+    fn_vkDestroyShaderEXT = reinterpret_cast<PFN_vkDestroyShaderEXT>(vkGetDeviceProcAddr(device, "vkDestroyShaderEXT"));
+    fn_vkCmdBindShadersEXT = reinterpret_cast<PFN_vkCmdBindShadersEXT>(vkGetDeviceProcAddr(device, "vkCmdBindShadersEXT"));
+    fn_vkCmdSetVertexInputEXT = reinterpret_cast<PFN_vkCmdSetVertexInputEXT>(vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT"));
+    fn_vkCmdSetPolygonModeEXT = reinterpret_cast<PFN_vkCmdSetPolygonModeEXT>(vkGetDeviceProcAddr(device, "vkCmdSetPolygonModeEXT"));
+    fn_vkCmdSetRasterizationSamplesEXT = reinterpret_cast<PFN_vkCmdSetRasterizationSamplesEXT>(vkGetDeviceProcAddr(device, "vkCmdSetRasterizationSamplesEXT"));
+    fn_vkCmdSetSampleMaskEXT = reinterpret_cast<PFN_vkCmdSetSampleMaskEXT>(vkGetDeviceProcAddr(device, "vkCmdSetSampleMaskEXT"));
+    fn_vkCmdSetAlphaToCoverageEnableEXT = reinterpret_cast<PFN_vkCmdSetAlphaToCoverageEnableEXT>(vkGetDeviceProcAddr(device, "vkCmdSetAlphaToCoverageEnableEXT"));
+    fn_vkCmdSetDepthClampEnableEXT = reinterpret_cast<PFN_vkCmdSetDepthClampEnableEXT>(vkGetDeviceProcAddr(device, "vkCmdSetDepthClampEnableEXT"));
+    fn_vkCmdSetColorBlendEnableEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT"));
+    fn_vkCmdSetColorBlendEquationEXT = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT"));
+    fn_vkCmdSetColorWriteMaskEXT = reinterpret_cast<PFN_vkCmdSetColorWriteMaskEXT>(vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT"));
+}
+
+VkShaderEXT VkShaderObjectDescription::Create(const VkDevice device) const {
+    const auto code = LoadShader(path);
+    if (code.empty())
+        return VK_NULL_HANDLE;
+
+    const VkSpecializationInfo specializationInfo{
+        static_cast<uint32_t>(specializationEntries.size()),
+        specializationEntries.data(),
+        specializationData.size(),
+        specializationData.data()
+    };
+
+    const VkShaderCreateInfoEXT createInfo{
+        VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+        VK_NULL_HANDLE,
+        flags,
+        stage,
+        nextStage,
+        VK_SHADER_CODE_TYPE_SPIRV_EXT,
+        code.size() * sizeof(uint32_t),
+        code.data(),
+        "main",
+        static_cast<uint32_t>(setLayouts.size()),
+        setLayouts.data(),
+        static_cast<uint32_t>(pushConstantRanges.size()),
+        pushConstantRanges.data(),
+        specializationEntries.empty() ? VK_NULL_HANDLE : &specializationInfo
+    };
+
+    VkShaderEXT shader{VK_NULL_HANDLE};
+    VK_CHECK(fn_vkCreateShadersEXT(device, 1, &createInfo, VK_NULL_HANDLE, &shader));
+
+    return shader;
+}
+
+std::string VkShaderObjectDescription::Key() const {
+    const auto append = [](std::string &key, const auto &values) {
+        key.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(values[0]));
+    };
+
+    auto key = path;
+    append(key, std::array{static_cast<uint32_t>(stage), nextStage, flags});
+    append(key, setLayouts);
+    append(key, pushConstantRanges);
+    append(key, specializationEntries);
+    append(key, specializationData);
+
+    return key;
+}
+
+void VkShaderObjectCache::Init(const VkShaderStageFlags optionalStages, VkShaderReloader *reloader) {
+    this->optionalStages = optionalStages;
+    this->reloader = reloader;
+}
+
+const VkShaderEXT *VkShaderObjectCache::Get(const VkDevice device, VkShaderObjectDescription &&description) {
+    auto key = description.Key();
+    if (const auto it = shaders.find(key); it != shaders.end())
+        return &it->second;
+
+    auto &shader = shaders[std::move(key)];
+    shader = description.Create(device);
+    if (shader == VK_NULL_HANDLE)
+        throw std::runtime_error("Failed to create shader object for \"" + description.path + '"');
+
+    if (reloader) {
+        auto path = description.path;
+        reloader->RegisterShader(&shader, std::move(path), [description = std::move(description)](const VkDevice device) {
+            return description.Create(device);
+        });
+    }
+
+    return &shader;
+}
+
+void VkShaderObjectCache::Destroy(const VkDevice device) const {
+    for (const auto &shader : shaders | std::views::values)
+        fn_vkDestroyShaderEXT(device, shader, VK_NULL_HANDLE);
+}
+
+void VkShaderObjectPipeline::Bind(const VkCommandBuffer commandBuffer, const VkViewport &viewport, const VkRect2D &scissor) const {
+    // Every stage the device has enabled is bound, the unused ones to nothing. Stages whose feature is off can't be named.
+    std::array<VkShaderStageFlagBits, 5> stages{};
+    std::array<VkShaderEXT, 5> shaders{};
+    uint32_t stageCount = 0;
+
+    const auto addStage = [&](const VkShaderStageFlagBits stage, const VkShaderEXT shader) {
+        stages[stageCount] = stage;
+        shaders[stageCount++] = shader;
+    };
+
+    addStage(VK_SHADER_STAGE_VERTEX_BIT, isMeshShader ? VK_NULL_HANDLE : *vertexOrMeshShader);
+    addStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader ? *fragmentShader : VK_NULL_HANDLE);
+
+    if (optionalStages & VK_SHADER_STAGE_GEOMETRY_BIT)
+        addStage(VK_SHADER_STAGE_GEOMETRY_BIT, VK_NULL_HANDLE);
+
+    if (optionalStages & VK_SHADER_STAGE_MESH_BIT_EXT) {
+        addStage(VK_SHADER_STAGE_TASK_BIT_EXT, taskShader ? *taskShader : VK_NULL_HANDLE);
+        addStage(VK_SHADER_STAGE_MESH_BIT_EXT, isMeshShader ? *vertexOrMeshShader : VK_NULL_HANDLE);
+    }
+
+    fn_vkCmdBindShadersEXT(commandBuffer, stageCount, stages.data(), shaders.data());
+
+    // Pipelines have a static viewport count, binding one leaves it undefined for shader objects
+    vkCmdSetViewportWithCount(commandBuffer, 1, &viewport);
+    vkCmdSetScissorWithCount(commandBuffer, 1, &scissor);
+    vkCmdSetRasterizerDiscardEnable(commandBuffer, VK_FALSE);
+
+    // Vertices are pulled from buffers by the shaders
+    fn_vkCmdSetVertexInputEXT(commandBuffer, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+    vkCmdSetPrimitiveTopology(commandBuffer, topology);
+    vkCmdSetPrimitiveRestartEnable(commandBuffer, VK_FALSE);
+
+    static constexpr VkSampleMask sampleMask = ~0u;
+    fn_vkCmdSetPolygonModeEXT(commandBuffer, polygonMode);
+    fn_vkCmdSetRasterizationSamplesEXT(commandBuffer, VK_SAMPLE_COUNT_1_BIT);
+    fn_vkCmdSetSampleMaskEXT(commandBuffer, VK_SAMPLE_COUNT_1_BIT, &sampleMask);
+    fn_vkCmdSetAlphaToCoverageEnableEXT(commandBuffer, VK_FALSE);
+    vkCmdSetCullMode(commandBuffer, cullMode);
+    vkCmdSetFrontFace(commandBuffer, frontFace);
+    fn_vkCmdSetDepthClampEnableEXT(commandBuffer, depthClampEnable);
+    vkCmdSetDepthBiasEnable(commandBuffer, VK_FALSE);
+
+    vkCmdSetDepthTestEnable(commandBuffer, depthTestEnable);
+    vkCmdSetDepthWriteEnable(commandBuffer, depthWriteEnable);
+    vkCmdSetDepthCompareOp(commandBuffer, depthCompareOp);
+    vkCmdSetDepthBoundsTestEnable(commandBuffer, VK_FALSE);
+    vkCmdSetStencilTestEnable(commandBuffer, VK_FALSE);
+
+    fn_vkCmdSetColorBlendEnableEXT(commandBuffer, 0, attachmentCount, blendEnables.data());
+    fn_vkCmdSetColorBlendEquationEXT(commandBuffer, 0, attachmentCount, blendEquations.data());
+    fn_vkCmdSetColorWriteMaskEXT(commandBuffer, 0, attachmentCount, colorWriteMasks.data());
+}
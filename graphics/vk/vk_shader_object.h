@@ -0,0 +1,90 @@
+#ifndef VK_SHADER_OBJECT_H
+#define VK_SHADER_OBJECT_H
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "graphics/vk/vk_common.h"
+
+class VkShaderReloader;
+
+extern PFN_vkCreateShadersEXT fn_vkCreateShadersEXT;
+extern PFN_vkDestroyShaderEXT fn_vkDestroyShaderEXT;
+extern PFN_vkCmdBindShadersEXT fn_vkCmdBindShadersEXT;
+extern PFN_vkCmdSetVertexInputEXT fn_vkCmdSetVertexInputEXT;
+extern PFN_vkCmdSetPolygonModeEXT fn_vkCmdSetPolygonModeEXT;
+extern PFN_vkCmdSetRasterizationSamplesEXT fn_vkCmdSetRasterizationSamplesEXT;
+extern PFN_vkCmdSetSampleMaskEXT fn_vkCmdSetSampleMaskEXT;
+extern PFN_vkCmdSetAlphaToCoverageEnableEXT fn_vkCmdSetAlphaToCoverageEnableEXT;
+extern PFN_vkCmdSetDepthClampEnableEXT fn_vkCmdSetDepthClampEnableEXT;
+extern PFN_vkCmdSetColorBlendEnableEXT fn_vkCmdSetColorBlendEnableEXT;
+extern PFN_vkCmdSetColorBlendEquationEXT fn_vkCmdSetColorBlendEquationEXT;
+extern PFN_vkCmdSetColorWriteMaskEXT fn_vkCmdSetColorWriteMaskEXT;
+
+// The device needs VK_EXT_shader_object enabled
+void LoadShaderObjectFunctions(VkDevice device);
+
+// Everything a shader object is created from, kept to create it again when its file changes
+struct VkShaderObjectDescription {
+    // Null if the shader doesn't compile
+    [[nodiscard]] VkShaderEXT Create(VkDevice device) const;
+    // Shaders with the same key are interchangeable
+    [[nodiscard]] std::string Key() const;
+
+    std::string path;
+    VkShaderStageFlagBits stage;
+    VkShaderStageFlags nextStage;
+    VkShaderCreateFlagsEXT flags;
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    std::vector<VkPushConstantRange> pushConstantRanges;
+    std::vector<VkSpecializationMapEntry> specializationEntries;
+    std::vector<uint8_t> specializationData;
+};
+
+// Shader objects by file, stage and specialization. Permutations that only differ in fixed function state share theirs,
+// and a changed file recreates each of its shaders once instead of every pipeline that uses it.
+class VkShaderObjectCache {
+public:
+    // optionalStages are the stages besides vertex and fragment the device has enabled, they have to be bound on every draw
+    void Init(VkShaderStageFlags optionalStages, VkShaderReloader *reloader);
+    // Created on first use, the pointer stays valid and follows reloads
+    const VkShaderEXT *Get(VkDevice device, VkShaderObjectDescription &&description);
+    void Destroy(VkDevice device) const;
+
+    [[nodiscard]] VkShaderStageFlags OptionalStages() const { return optionalStages; }
+
+private:
+    std::unordered_map<std::string, VkShaderEXT> shaders;
+    VkShaderStageFlags optionalStages{0};
+    VkShaderReloader *reloader{nullptr};
+};
+
+// What a graphics pipeline would have baked in, bound as shader objects and dynamic state instead. Bind sets all the
+// state shader objects leave undefined, so it can follow a pipeline in the same command buffer.
+struct VkShaderObjectPipeline {
+    void Bind(VkCommandBuffer commandBuffer, const VkViewport &viewport, const VkRect2D &scissor) const;
+
+    // Point into a VkShaderObjectCache
+    const VkShaderEXT *vertexOrMeshShader{nullptr};
+    const VkShaderEXT *fragmentShader{nullptr};
+    const VkShaderEXT *taskShader{nullptr};
+    bool isMeshShader{false};
+    VkShaderStageFlags optionalStages{0};
+
+    VkPrimitiveTopology topology{};
+    VkPolygonMode polygonMode{};
+    VkCullModeFlags cullMode{};
+    VkFrontFace frontFace{};
+    VkBool32 depthClampEnable{VK_FALSE};
+    VkBool32 depthTestEnable{VK_FALSE};
+    VkBool32 depthWriteEnable{VK_FALSE};
+    VkCompareOp depthCompareOp{};
+
+    uint32_t attachmentCount{1};
+    std::array<VkBool32, 2> blendEnables{};
+    std::array<VkColorBlendEquationEXT, 2> blendEquations{};
+    std::array<VkColorComponentFlags, 2> colorWriteMasks{};
+};
+
+#endif //VK_SHADER_OBJECT_H
@@ -0,0 +1,264 @@
+#include "vk_shader_reloader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include "graphics/vk/vk_pipeline_compiler.h"
+#include "graphics/vk/vk_shader_compiler.h"
+#include "graphics/vk/vk_shader_object.h"
+
+// The watcher reports absolute paths, the pipelines are registered with paths relative to the working directory
+static std::string NormalPath(const std::filesystem::path &path) {
+    std::error_code error;
+    return std::filesystem::absolute(path, error).lexically_normal().string();
+}
+
+void VkShaderReloader::Register(VkPipeline *target, std::vector<std::string> &&shaderPaths, Create &&create) {
+    AddEntry(shaderPaths, {.pipeline = target, .create = std::move(create), .shader = nullptr});
+}
+
+void VkShaderReloader::RegisterShader(VkShaderEXT *target, std::string &&shaderPath, CreateShader &&create) {
+    AddEntry({std::move(shaderPath)}, {.pipeline = nullptr, .shader = target, .createShader = std::move(create)});
+}
+
+void VkShaderReloader::RegisterLink(VkPipeline *target, std::vector<const VkPipeline *> &&libraries, Link &&link) {
+    AddEntry({}, {.pipeline = target, .shader = nullptr, .libraries = std::move(libraries), .link = std::move(link)});
+}
+
+void VkShaderReloader::AddEntry(const std::vector<std::string> &shaderPaths, Entry &&entry) {
+    // Compiled at runtime, a pipeline depends on the sources and what they include rather than the build time SPIR-V
+    for (const auto &shaderPath : shaderPaths) {
+        for (const auto &dependency : ShaderDependencies(shaderPath))
+            entry.dependencies.push_back(NormalPath(dependency));
+    }
+
+    std::lock_guard lock(entriesMutex);
+    for (const auto &path : entry.dependencies) {
+        if (std::ranges::find(shaderFiles, path, &decltype(shaderFiles)::value_type::first) != shaderFiles.end())
+            continue;
+
+        std::error_code error;
+        shaderFiles.emplace_back(path, std::filesystem::last_write_time(path, error));
+    }
+
+    entries.push_back(std::move(entry));
+}
+
+void VkShaderReloader::RequestReload(const bool all) {
+    if (all)
+        reloadAllRequested = true;
+
+    rescanRequested = true;
+    reloadRequested = true;
+}
+
+void VkShaderReloader::RequestReload(const std::span<const std::string> changedFiles) {
+    std::vector<std::string> files;
+    bool rescan = false;
+    for (const auto &file : changedFiles) {
+        std::error_code error;
+        if (std::filesystem::is_directory(file, error))
+            rescan = true;
+        else
+            files.push_back(NormalPath(file));
+    }
+
+    // Editor temporaries and build outputs nothing was created from
+    {
+        std::lock_guard lock(entriesMutex);
+        std::erase_if(files, [&](const std::string &file) {
+            return std::ranges::find(shaderFiles, file, &decltype(shaderFiles)::value_type::first) == shaderFiles.end();
+        });
+    }
+
+    if (rescan) {
+        RequestReload();
+        return;
+    }
+
+    if (files.empty())
+        return;
+
+    {
+        std::lock_guard lock(dirtyFilesMutex);
+        dirtyFiles.insert(dirtyFiles.end(), files.begin(), files.end());
+    }
+
+    reloadRequested = true;
+}
+
+void VkShaderReloader::Update(const VkDevice device, const VkPipelineCache pipelineCache, const uint64_t frameValue, const uint64_t completedValue) {
+    std::erase_if(retired, [&](const Retired &old) {
+        if (old.frameValue > completedValue)
+            return false;
+
+        Destroy(device, old.pipeline, old.shader);
+        return true;
+    });
+
+    if (worker.joinable()) {
+        if (!workerDone)
+            return;
+
+        worker.join();
+
+        for (const auto &[entry, pipeline, shader] : rebuilt) {
+            // Frames up to frameValue may still be using the old one. One that failed to compile stays in place.
+            if (pipeline != VK_NULL_HANDLE) {
+                retired.emplace_back(*entries[entry].pipeline, VK_NULL_HANDLE, frameValue);
+                *entries[entry].pipeline = pipeline;
+            } else if (shader != VK_NULL_HANDLE) {
+                retired.emplace_back(VK_NULL_HANDLE, *entries[entry].shader, frameValue);
+                *entries[entry].shader = shader;
+            }
+        }
+
+        if (!rebuilt.empty()) {
+            const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - rebuildStart).count();
+            printf("Reloaded %zu pipelines and shaders in %lldms\n", rebuilt.size(), static_cast<long long>(elapsedMs));
+        }
+
+        rebuilt.clear();
+    }
+
+    if (!reloadRequested.exchange(false))
+        return;
+
+    std::vector<std::string> files;
+    {
+        std::lock_guard lock(dirtyFilesMutex);
+        files.swap(dirtyFiles);
+    }
+
+    workerDone = false;
+    rebuildStart = std::chrono::steady_clock::now();
+    worker = std::thread(&VkShaderReloader::Rebuild, this, device, pipelineCache, reloadAllRequested.exchange(false), rescanRequested.exchange(false), std::move(files));
+}
+
+void VkShaderReloader::Destroy(const VkDevice device) {
+    if (worker.joinable())
+        worker.join();
+
+    for (const auto &[entry, pipeline, shader] : rebuilt)
+        Destroy(device, pipeline, shader);
+
+    for (const auto &[pipeline, shader, frameValue] : retired)
+        Destroy(device, pipeline, shader);
+
+    rebuilt.clear();
+    retired.clear();
+}
+
+void VkShaderReloader::Destroy(const VkDevice device, const VkPipeline pipeline, const VkShaderEXT shader) {
+    vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
+    if (shader != VK_NULL_HANDLE)
+        fn_vkDestroyShaderEXT(device, shader, VK_NULL_HANDLE);
+}
+
+void VkShaderReloader::Rebuild(const VkDevice device, const VkPipelineCache pipelineCache, const bool all, const bool rescan, const std::vector<std::string> &dirtyFiles) {
+    std::unique_lock lock(entriesMutex);
+
+    std::vector<std::string_view> changed;
+    for (auto &[path, writeTime] : shaderFiles) {
+        // Only what was reported is looked at, unless every file has to be checked
+        const bool isDirty = std::ranges::find(dirtyFiles, path) != dirtyFiles.end();
+        if (!all && !rescan && !isDirty)
+            continue;
+
+        std::error_code error;
+        const auto time = std::filesystem::last_write_time(path, error);
+        // Gone while the compiler rewrites it, the write that follows requests another reload
+        if (error)
+            continue;
+
+        if (all || isDirty || time != writeTime) {
+            writeTime = time;
+            changed.emplace_back(path);
+        }
+    }
+
+    // The compiler writes through pointers into rebuilt
+    rebuilt.reserve(entries.size());
+
+    VkPipelineCompiler compiler{device, pipelineCache};
+    std::vector<std::pair<VkShaderEXT *, CreateShader>> shaders;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const bool isChanged = std::ranges::any_of(entries[i].dependencies, [&](const std::string &path) {
+            return std::ranges::find(changed, path) != changed.end();
+        });
+
+        if (!isChanged)
+            continue;
+
+        auto &[entry, pipeline, shader] = rebuilt.emplace_back(i, VK_NULL_HANDLE, VK_NULL_HANDLE);
+        if (entries[i].create) {
+            auto create = entries[i].create;
+            compiler.Add(&pipeline, std::move(create));
+        } else {
+            shaders.emplace_back(&shader, entries[i].createShader);
+        }
+    }
+
+    // Everything compiled is copied out of entries by now
+    lock.unlock();
+    // Pipelines that failed stay VK_NULL_HANDLE and keep the current ones in place
+    try {
+        compiler.Compile();
+    } catch (const std::exception &e) {
+        printf("Failed to rebuild pipelines, keeping the current ones: %s\n", e.what());
+    }
+
+    // Each is a single stage, quick enough to create one after the other
+    for (const auto &[shader, create] : shaders)
+        *shader = create(device);
+
+    Relink(device, pipelineCache);
+    workerDone = true;
+}
+
+void VkShaderReloader::Relink(const VkDevice device, const VkPipelineCache pipelineCache) {
+    std::unique_lock lock(entriesMutex);
+
+    std::vector<std::pair<const VkPipeline *, VkPipeline>> libraries;
+    for (const auto &[entry, pipeline, shader] : rebuilt) {
+        if (pipeline != VK_NULL_HANDLE)
+            libraries.emplace_back(entries[entry].pipeline, pipeline);
+    }
+
+    std::vector<size_t> links;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const bool isChanged = std::ranges::any_of(entries[i].libraries, [&](const VkPipeline *library) {
+            return std::ranges::find(libraries, library, &decltype(libraries)::value_type::first) != libraries.end();
+        });
+
+        if (isChanged)
+            links.push_back(i);
+    }
+
+    // Only linking, the libraries that didn't change are reused as they are
+    rebuilt.reserve(rebuilt.size() + links.size());
+
+    VkPipelineCompiler compiler{device, pipelineCache};
+    for (const auto i : links) {
+        std::vector<VkPipeline> handles;
+        for (const auto *library : entries[i].libraries) {
+            const auto it = std::ranges::find(libraries, library, &decltype(libraries)::value_type::first);
+            handles.push_back(it != libraries.end() ? it->second : *library);
+        }
+
+        // A part that never compiled has nothing to link yet
+        if (std::ranges::find(handles, VK_NULL_HANDLE) != handles.end())
+            continue;
+
+        auto &[entry, pipeline, shader] = rebuilt.emplace_back(i, VK_NULL_HANDLE, VK_NULL_HANDLE);
+        compiler.Add(&pipeline, [link = entries[i].link, handles = std::move(handles)](const VkDevice device, const VkPipelineCache pipelineCache) {
+            return link(device, pipelineCache, handles);
+        });
+    }
+
+    lock.unlock();
+    try {
+        compiler.Compile();
+    } catch (const std::exception &e) {
+        printf("Failed to relink pipelines, keeping the current ones: %s\n", e.what());
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef VK_SHADER_RELOADER_H
+#define VK_SHADER_RELOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include "graphics/vk/vk_common.h"
+
+// Remembers how every pipeline and shader object was built and which SPIR-V files it was built from. A reload only
+// rebuilds the ones whose files changed since they were last built, on a background thread, and swaps them in between
+// frames. The ones they replace are destroyed once the frames that were recorded with them have retired. Layouts are
+// kept, so a change to a shader's interface still needs a restart.
+class VkShaderReloader {
+public:
+    // Creates the pipeline along with its own shader modules, it runs on a worker thread
+    using Create = std::function<VkPipeline(VkDevice, VkPipelineCache)>;
+    using CreateShader = std::function<VkShaderEXT(VkDevice)>;
+    // Links the libraries, in the order they were registered in, into a complete pipeline
+    using Link = std::function<VkPipeline(VkDevice, VkPipelineCache, std::span<const VkPipeline>)>;
+
+    // shaderPaths are the build time SPIR-V paths the pipeline is created from. Pipelines created after startup can
+    // register while a rebuild runs, it waits for the rebuild to have picked what it compiles.
+    void Register(VkPipeline *target, std::vector<std::string> &&shaderPaths, Create &&create);
+    void RegisterShader(VkShaderEXT *target, std::string &&shaderPath, CreateShader &&create);
+    // libraries are registered pipelines, the linked one is relinked whenever one of them is rebuilt
+    void RegisterLink(VkPipeline *target, std::vector<const VkPipeline *> &&libraries, Link &&link);
+
+    // Safe to call from any thread, the rebuild starts on the next Update. Without all only files that changed on disk
+    // since their pipelines were built are picked up.
+    void RequestReload(bool all = false);
+    // Rebuilds what depends on the registered files among changedFiles, others are ignored and nothing else is checked
+    // on disk. A directory among them stands for changes that weren't reported one by one, every file is checked then.
+    void RequestReload(std::span<const std::string> changedFiles);
+
+    // Called between frames. frameValue is the timeline value of the last submitted frame, completedValue the last one
+    // that retired.
+    void Update(VkDevice device, VkPipelineCache pipelineCache, uint64_t frameValue, uint64_t completedValue);
+    // The device has to be idle
+    void Destroy(VkDevice device);
+
+private:
+    // A pipeline, a shader object or a pipeline linked from libraries
+    struct Entry {
+        std::vector<std::string> dependencies;
+        VkPipeline *pipeline;
+        Create create;
+        VkShaderEXT *shader;
+        CreateShader createShader;
+        std::vector<const VkPipeline *> libraries;
+        Link link;
+    };
+
+    struct Rebuilt {
+        size_t entry;
+        VkPipeline pipeline;
+        VkShaderEXT shader;
+    };
+
+    struct Retired {
+        VkPipeline pipeline;
+        VkShaderEXT shader;
+        uint64_t frameValue;
+    };
+
+    static void Destroy(VkDevice device, VkPipeline pipeline, VkShaderEXT shader);
+    void AddEntry(const std::vector<std::string> &shaderPaths, Entry &&entry);
+    void Rebuild(VkDevice device, VkPipelineCache pipelineCache, bool all, bool rescan, const std::vector<std::string> &dirtyFiles);
+    void Relink(VkDevice device, VkPipelineCache pipelineCache);
+
+    // Guards entries and shaderFiles against pipelines registered while the worker reads them
+    std::mutex entriesMutex;
+    std::vector<Entry> entries;
+    // Write time of every registered file as of the last time its pipelines were built
+    std::vector<std::pair<std::string, std::filesystem::file_time_type>> shaderFiles;
+
+    std::atomic<bool> reloadRequested{false};
+    std::atomic<bool> reloadAllRequested{false};
+    std::atomic<bool> rescanRequested{false};
+    // Reported as changed since the last rebuild started, in the form dependencies are kept in
+    std::mutex dirtyFilesMutex;
+    std::vector<std::string> dirtyFiles;
+
+    // Owns rebuilt while it runs
+    std::thread worker;
+    std::atomic<bool> workerDone{false};
+    std::chrono::steady_clock::time_point rebuildStart{};
+    std::vector<Rebuilt> rebuilt;
+
+    std::vector<Retired> retired;
+};
+
+#endif //VK_SHADER_RELOADER_H
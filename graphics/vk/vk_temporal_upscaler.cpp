@@ -0,0 +1,199 @@
+#include "vk_temporal_upscaler.h"
+#include <algorithm>
+#include <cmath>
+#include "graphics/vk/memory/vk_memory.h"
+#include "graphics/vk/vk_pipeline_compiler.h"
+#include "graphics/vk/vk_shader_compiler.h"
+
+static constexpr uint32_t WORKGROUP_SIZE = 8;
+static constexpr VkFormat HISTORY_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Jitter phases at native resolution, scaled by the pixel ratio below it
+static constexpr uint32_t BASE_PHASE_COUNT = 8;
+
+static float Halton(uint32_t index, const uint32_t base) {
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= static_cast<float>(base);
+        result += fraction * static_cast<float>(index % base);
+        index /= base;
+    }
+    return result;
+}
+
+void VkTemporalUpscaler::Init(const VkDevice device, VkPipelineCompiler &compiler) {
+    static constexpr DescriptorAllocator::PoolSizeRatio sizes[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}
+    };
+
+    allocator.InitPool(device, static_cast<uint32_t>(descriptorSets.size()), sizes);
+
+    DescriptorLayoutBuilder builder;
+    builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+    builder.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+    builder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+    builder.AddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+    descriptorSetLayout = builder.Build(device);
+
+    const VkDescriptorSetLayout layouts[] = {descriptorSetLayout};
+    for (auto &descriptorSet : descriptorSets)
+        descriptorSet = allocator.Allocate(device, layouts);
+
+    constexpr VkPushConstantRange pushConstantRange{
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof(PushConstants)
+    };
+
+    const VkPipelineLayoutCreateInfo layoutCreateInfo{
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &descriptorSetLayout,
+        1,
+        &pushConstantRange
+    };
+
+    VK_CHECK(vkCreatePipelineLayout(device, &layoutCreateInfo, VK_NULL_HANDLE, &pipelineLayout));
+
+    const auto shaderCode = RequireShader("shaders/temporal_upscale.comp.spv");
+
+    const VkShaderModuleCreateInfo shaderModuleCreateInfo{
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        shaderCode.size() * sizeof(uint32_t),
+        shaderCode.data()
+    };
+
+    VkShaderModule shaderModule;
+    VK_CHECK(vkCreateShaderModule(device, &shaderModuleCreateInfo, VK_NULL_HANDLE, &shaderModule));
+
+    const VkComputePipelineCreateInfo pipelineCreateInfo{
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        {
+            VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            VK_NULL_HANDLE,
+            0,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            shaderModule,
+            "main",
+            VK_NULL_HANDLE
+        },
+        pipelineLayout
+    };
+
+    compiler.AddCompute(&pipeline, pipelineCreateInfo, "shaders/temporal_upscale.comp.spv");
+
+    // Scene color and velocity are fetched texel by texel, only the history is filtered
+    constexpr VkSamplerCreateInfo samplerCreateInfo{
+        VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        VK_FILTER_LINEAR,
+        VK_FILTER_LINEAR,
+        VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        0.0f,
+        VK_FALSE,
+        1.0f,
+        VK_FALSE,
+        VK_COMPARE_OP_NEVER,
+        0.0f,
+        0.0f,
+        VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+        VK_FALSE
+    };
+
+    VK_CHECK(vkCreateSampler(device, &samplerCreateInfo, VK_NULL_HANDLE, &sampler));
+}
+
+void VkTemporalUpscaler::Destroy(const VkDevice device, VkMemoryManager &memoryManager) {
+    for (const auto &historyImage : historyImages)
+        memoryManager.destroyImage(historyImage, false);
+
+    vkDestroySampler(device, sampler, VK_NULL_HANDLE);
+    vkDestroyPipeline(device, pipeline, VK_NULL_HANDLE);
+    vkDestroyPipelineLayout(device, pipelineLayout, VK_NULL_HANDLE);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, VK_NULL_HANDLE);
+    allocator.Destroy(device);
+}
+
+void VkTemporalUpscaler::CreateHistory(VkMemoryManager &memoryManager, const VkExtent2D outputExtent) {
+    for (auto &historyImage : historyImages) {
+        if (historyImage.image != VK_NULL_HANDLE)
+            memoryManager.destroyImage(historyImage, false);
+    }
+
+    ImageViewCreateInfo viewCreateInfo{
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = HISTORY_FORMAT,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+    };
+
+    // Outlives the frame, so it keeps its own memory instead of going through the transient pool
+    const VulkanImageCreateInfo createInfo{
+        0,
+        HISTORY_FORMAT,
+        {outputExtent.width, outputExtent.height, 1},
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        0,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        false,
+        &viewCreateInfo
+    };
+
+    for (auto &historyImage : historyImages)
+        historyImage = memoryManager.createUnmanagedImage(createInfo);
+
+    historyValid = false;
+}
+
+void VkTemporalUpscaler::UpdateDescriptorSets(VkDevice device, const VulkanImage &sceneColor, const VulkanImage &velocity) {
+    DescriptorWriter writer;
+    for (uint32_t i = 0; i < descriptorSets.size(); i++) {
+        writer.Clear();
+        writer.WriteImage(0, sceneColor.imageView, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.WriteImage(1, velocity.imageView, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.WriteImage(2, historyImages[i ^ 1].imageView, sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.WriteImage(3, historyImages[i].imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        writer.UpdateSet(device, descriptorSets[i]);
+    }
+}
+
+glm::vec2 VkTemporalUpscaler::NextJitter(const VkExtent2D renderExtent, const VkExtent2D outputExtent) {
+    historyIndex ^= 1;
+
+    const float ratio = static_cast<float>(outputExtent.width) / static_cast<float>(renderExtent.width);
+    const auto phaseCount = std::max(BASE_PHASE_COUNT, static_cast<uint32_t>(std::ceil(static_cast<float>(BASE_PHASE_COUNT) * ratio * ratio)));
+    jitterIndex = (jitterIndex + 1) % phaseCount;
+
+    // The sequence's first point is 0, which would put a sample on the pixel corner
+    jitter = {Halton(jitterIndex + 1, 2) - 0.5f, Halton(jitterIndex + 1, 3) - 0.5f};
+    return {jitter.x * 2.0f / static_cast<float>(renderExtent.width), jitter.y * 2.0f / static_cast<float>(renderExtent.height)};
+}
+
+void VkTemporalUpscaler::Resolve(const VkCommandBuffer commandBuffer, const VkExtent2D renderExtent, const VkExtent2D outputExtent) {
+    const PushConstants pushConstants{
+        jitter,
+        {renderExtent.width, renderExtent.height},
+        {outputExtent.width, outputExtent.height},
+        historyValid ? 0u : 1u
+    };
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[historyIndex], 0, VK_NULL_HANDLE);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (outputExtent.width + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (outputExtent.height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+    historyValid = true;
+}
@@ -0,0 +1,57 @@
+#ifndef VK_TEMPORAL_UPSCALER_H
+#define VK_TEMPORAL_UPSCALER_H
+
+#include <array>
+#include "graphics/vk/vk_common.h"
+#include "graphics/vk/vk_descriptor_layout.h"
+
+class VkMemoryManager;
+class VkPipelineCompiler;
+
+// Reconstructs the swap chain resolution from scenes rendered at a lower one. The projection is shifted by a different
+// sub-pixel offset every frame, and the resolve accumulates those samples over time in a full resolution history that is
+// reprojected with the scene's motion vectors and clamped to the current frame's neighbourhood.
+class VkTemporalUpscaler {
+public:
+    void Init(VkDevice device, VkPipelineCompiler &compiler);
+    void Destroy(VkDevice device, VkMemoryManager &memoryManager);
+    // The history is kept at the output resolution, recreating it drops whatever was accumulated
+    void CreateHistory(VkMemoryManager &memoryManager, VkExtent2D outputExtent);
+    // Scene color and velocity are sampled in the top left corner that was rendered to
+    void UpdateDescriptorSets(VkDevice device, const VulkanImage &sceneColor, const VulkanImage &velocity);
+
+    // Advances to the next frame and returns its projection offset in NDC. The sequence gets longer the further the
+    // render resolution is below the output, so every output pixel still sees a sample land close to it.
+    [[nodiscard]] glm::vec2 NextJitter(VkExtent2D renderExtent, VkExtent2D outputExtent);
+    void Resolve(VkCommandBuffer commandBuffer, VkExtent2D renderExtent, VkExtent2D outputExtent);
+
+    // Last frame's output, read by this frame's resolve
+    [[nodiscard]] const VulkanImage &History() const { return historyImages[historyIndex ^ 1]; }
+    // Written by this frame's resolve and presented
+    [[nodiscard]] const VulkanImage &Output() const { return historyImages[historyIndex]; }
+
+private:
+    struct PushConstants {
+        glm::vec2 jitter; // render pixels
+        glm::uvec2 renderSize;
+        glm::uvec2 outputSize;
+        uint32_t resetHistory;
+    };
+
+    std::array<VulkanImage, 2> historyImages{};
+    uint32_t historyIndex = 0;
+    bool historyValid = false;
+
+    uint32_t jitterIndex = 0;
+    glm::vec2 jitter{};
+
+    DescriptorAllocator allocator{};
+    VkDescriptorSetLayout descriptorSetLayout{};
+    // Set i writes history i and reads the other one
+    std::array<VkDescriptorSet, 2> descriptorSets{};
+    VkPipelineLayout pipelineLayout{};
+    VkPipeline pipeline{};
+    VkSampler sampler{};
+};
+
+#endif //VK_TEMPORAL_UPSCALER_H
@@ -1,4 +1,5 @@
 #include <set>
+#include <cfloat>
 #include <algorithm>
 #include <random>
 #include <ktx.h>
@@ -13,10 +14,15 @@
 
 #include "vk/memory/vk_mesh_assets.h"
 #include "common/file.h"
+#include "common/hash.h"
 #include "vk/vk_gui.h"
 #include "vk/vk_pipeline_builder.h"
+#include "vk/vk_shader_compiler.h"
+#include "vk/vk_shader_object.h"
+#include "vk/vk_descriptor_buffer.h"
 #include "ext/matrix_transform.hpp"
 #include "ext/matrix_clip_space.inl"
+#include "gtc/quaternion.hpp"
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
 #include <d3d12.h>
@@ -27,11 +33,17 @@
 
 static constexpr uint32_t MAX_MESHLET_PRIMITIVES = 124;
 static constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+static constexpr size_t CLUSTER_GROUP_SIZE = 4;
+static constexpr uint32_t MAX_CLUSTER_LEVELS = 16;
+static constexpr size_t TASK_SHADER_WORKGROUP_SIZE = 32;
+static constexpr VkDeviceSize FRAME_RING_SIZE = 4 * 1024 * 1024;
+// The swap chain image is first touched by the blit of the upscaled scene, everything before it runs while presentation still holds the image
+static constexpr VkPipelineStageFlags2 SWAP_CHAIN_WAIT_STAGE = VK_PIPELINE_STAGE_2_BLIT_BIT;
 
 PFN_vkCmdDrawMeshTasksEXT fn_vkCmdDrawMeshTasksEXT = nullptr;
 PFN_vkGetSemaphoreWin32HandleKHR fn_vkGetSemaphoreWin32HandleKHR = nullptr;
 
-void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRendering, bool asyncCompute, bool meshShader)
+void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRendering, bool asyncCompute, bool meshShader, bool shaderObjects, bool pipelineLibraries, bool descriptorBuffer)
 {
     useRaytracing = true;
     this->glfwWindow = window;
@@ -39,6 +51,9 @@ void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRend
     this->dynamicRendering = dynamicRendering;
     this->asyncCompute = asyncCompute;
     this->meshShader = meshShader;
+    this->shaderObjects = shaderObjects;
+    this->pipelineLibraries = pipelineLibraries;
+    this->descriptorBuffer = descriptorBuffer;
 
     InitializeInstance();
 
@@ -65,27 +80,17 @@ void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRend
     if (meshShader)
         fn_vkCmdDrawMeshTasksEXT = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(vkGetInstanceProcAddr(instance, "vkCmdDrawMeshTasksEXT"));
 
+    if (shaderObjects)
+        LoadShaderObjectFunctions(device);
+
+    if (descriptorBuffer)
+        LoadDescriptorBufferFunctions(device);
+
     // memoryManager = new VkMemoryManager{this};
     memoryManager.Initialize(this);
 
-    // Reuse pipeline cache
-    const auto pipelineCacheData = ReadFile<char>("pipeline_cache.bin");
-    if (!pipelineCacheData.empty())
-    {
-        VkPipelineCacheCreateInfo pipelineCacheCreateInfo{
-            VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
-            VK_NULL_HANDLE,
-            0,
-            pipelineCacheData.size(),
-            pipelineCacheData.data()
-        };
-
-        VK_CHECK(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, VK_NULL_HANDLE, &pipelineCache));
-    }
-    else
-    {
-        CreatePipelineCache();
-    }
+    CreatePipelineCache();
+    InitShaderCompiler("shader_cache");
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
     CreateDXGISwapChain();
@@ -93,20 +98,11 @@ void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRend
 #endif
     CreateSwapChain();
     CreateDepthImage();
-
-    viewport = {
-        0.0f,
-        0.0f,
-        static_cast<float>(swapChainExtent.width),
-        static_cast<float>(swapChainExtent.height),
-        0.0f,
-        1.0f
-    };
-
-    scissor = {
-        {0, 0},
-        swapChainExtent
-    };
+    CreateVisibilityImage();
+    CreateSceneColorImage();
+    CreateVelocityImage();
+    CreateHistoryImages();
+    UpdateRenderExtent();
 
     if (!dynamicRendering)
     {
@@ -115,13 +111,11 @@ void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRend
 
     CreateDescriptors();
     CreatePipelineLayout();
-    CreateGraphicsPipeline();
-    CreateComputePipeline();
-
-    if (!dynamicRendering)
-    {
-        CreateFramebuffers();
-    }
+    VkPipelineCompiler pipelineCompiler{device, pipelineCache, &shaderReloader};
+    CreateGraphicsPipeline(pipelineCompiler);
+    CreateComputePipeline(pipelineCompiler);
+    temporalUpscaler.Init(device, pipelineCompiler);
+    pipelineCompiler.Compile();
 
     if (!useRaytracing)
         CreateShadowCascades();
@@ -141,23 +135,15 @@ void VkRenderer::Initialize(GLFWwindow *window, Camera *camera, bool dynamicRend
 
     loadedScene = structureFile.value();
 
-    sceneDataBuffer = memoryManager.createManagedBuffer(
-        {
-            sizeof(SceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        });
+    frameRing.Init(device, memoryManager, FRAME_RING_SIZE, MAX_FRAMES_IN_FLIGHT,
+                   std::max(deviceProperties.limits.minUniformBufferOffsetAlignment, deviceProperties.limits.minStorageBufferOffsetAlignment),
+                   VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
     CreateRandomLights();
     CreateSkybox();
-    ComputeFrustum();
-    rayTracing.Init(this, device, physicalDevice, memoryManager, swapChainExtent);
-    UpdateDescriptorSets();
+    // Framebuffers and descriptor sets wait for the transient images, which get their memory in the first frame
+    rayTracing.Init(this, device, physicalDevice, memoryManager, transientImages, swapChainExtent);
 
-    if (!useRaytracing)
-        UpdateCascades();
     isVkRunning = true;
 }
 
@@ -347,63 +333,103 @@ bool isObjectVisible(const VkRenderObject &obj, const glm::mat4 &viewProjection)
     return min.z < 1.f && max.z > 0.f && min.x < 1.f && max.x > -1.f && min.y < 1.f && max.y > -1.f;
 }
 
+// Cascades are orthographic and rendered with depth clamping, so casters in front of the near plane still land in the map
+bool isCasterInCascade(const VkRenderObject &obj, const glm::mat4 &cascadeViewProjection) {
+    static std::array corners{
+        glm::vec3 {1, 1, 1},
+        glm::vec3 {1, 1, -1},
+        glm::vec3 {1, -1, 1},
+        glm::vec3 {1, -1, -1},
+        glm::vec3 {-1, 1, 1},
+        glm::vec3 {-1, 1, -1},
+        glm::vec3 {-1, -1, 1},
+        glm::vec3 {-1, -1, -1}
+    };
+
+    const glm::mat4 matrix = cascadeViewProjection * obj.transform;
+
+    glm::vec3 min{FLT_MAX};
+    glm::vec3 max = -min;
+
+    for (auto &c : corners) {
+        const glm::vec3 transformed{matrix * glm::vec4{obj.bounds.origin + (c * obj.bounds.extents), 1}};
+
+        min = glm::min(min, transformed);
+        max = glm::max(max, transformed);
+    }
+
+    return min.z < 1.f && min.x < 1.f && max.x > -1.f && min.y < 1.f && max.y > -1.f;
+}
+
 // static std::vector<size_t> drawIndices;
 
 uint16_t VkRenderer::GetFPSLimit() const
 {
-    return 1000 / fpsLimit;
+    return framePacer.TargetFrameRate();
 }
 
 void VkRenderer::SetFPSLimit(const uint16_t fps)
 {
-    fpsLimit = 1000 / fps;
+    framePacer.SetTargetFrameRate(fps);
 }
 
-void VkRenderer::Render(EngineStats &stats) {
-    if (isShaderInvalidated)
-    {
-        ReloadShaders();
-        isShaderInvalidated = false;
+uint32_t VkRenderer::GetFramesInFlight() const {
+    return requestedFramesInFlight;
+}
+
+void VkRenderer::SetFramesInFlight(const uint32_t count) {
+    requestedFramesInFlight = std::clamp(count, 1u, MAX_FRAMES_IN_FLIGHT);
+}
+
+// Both waits come before input is polled, so the time spent blocked here doesn't age the input the frame is built from
+void VkRenderer::WaitForFrame(EngineStats &stats) {
+    // Slots are reassigned when the count changes, so everything in flight has to retire first
+    if (requestedFramesInFlight != framesInFlight) {
+        WaitForTimeline(graphicsTimeline, frameNumber);
+        framesInFlight = requestedFramesInFlight;
+        currentFrame = 0;
     }
 
+    // This slot's resources were last used framesInFlight frames ago
+    const uint64_t frameValue = frameNumber + 1;
+    if (frameValue > framesInFlight)
+        WaitForTimeline(graphicsTimeline, frameValue - framesInFlight);
+
+    stats.frameTime = framePacer.Wait();
+    stats.frameTimeDeviation = framePacer.FrameTimeDeviation();
+}
+
+void VkRenderer::Render(EngineStats &stats) {
+    // Pipelines rebuilt in the background are swapped in before anything is recorded with them
+    uint64_t completedValue;
+    VK_CHECK(vkGetSemaphoreCounterValue(device, graphicsTimeline, &completedValue));
+    shaderReloader.Update(device, pipelineCache, frameNumber, completedValue);
+
     stats.drawCallCount = 0;
     stats.triangleCount = 0;
 
+    // WaitForFrame already retired whatever last used this slot
+    const uint64_t frameValue = frameNumber + 1;
+
+    // The slot's previous frame has retired with its timestamps, the scale picked from them applies from this frame on
+    if (const auto gpuTime = ReadGpuTime()) {
+        stats.gpuTime = *gpuTime;
+        if (renderScale.Update(*gpuTime))
+            UpdateRenderExtent();
+    }
+    stats.renderScale = renderScale.Scale();
+
+    // The GPU is done with this frame's slice of the ring, so it can be rewritten
+    frameRing.BeginFrame(currentFrame);
+    camera->SetJitter(temporalUpscaler.NextJitter(renderExtent, swapChainExtent));
     UpdateScene();
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
-    std::array<VkFence, 3> fences{
-            {
-                frames[currentFrame].inFlightFence,
-                computeFinishedFence,
-                depthPrepassFence
-            }
-    };
-    const auto size = fences.size() - !asyncCompute - meshShader;
-    VK_CHECK(vkWaitForFences(device, size, fences.data(), VK_TRUE, UINT64_MAX));
-
     static uint64_t timelineCounter = 1;
     ThrowIfFailed(sharedFence->Signal(timelineCounter++));
 
     uint32_t imageIndex = d3dSwapChain->GetCurrentBackBufferIndex();
-    VK_CHECK(vkResetFences(device, size, fences.data()));
 #else
-    static std::array<VkFence, 3> fences;
-    fences[0] = frames[currentFrame].inFlightFence;
-
-    if (meshShader && !useRaytracing)
-    {
-        fences[1] = computeFinishedFence;
-    }
-    else
-    {
-        fences[1] = depthPrepassFence;
-        fences[2] = computeFinishedFence;
-    }
-
-    const auto size = useRaytracing ? 1 : fences.size() - !asyncCompute - meshShader;
-    VK_CHECK(vkWaitForFences(device, size, fences.data(), VK_TRUE, UINT64_MAX));
-
     uint32_t imageIndex;
     auto result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frames[currentFrame].imageAvailableSemaphore,
                                         VK_NULL_HANDLE, &imageIndex);
@@ -416,120 +442,129 @@ void VkRenderer::Render(EngineStats &stats) {
     if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) [[unlikely]] {
         throw std::runtime_error("Failed to acquire swap chain image!");
     }
-
-    VK_CHECK(vkResetFences(device, size, fences.data()));
 #endif
-    VK_CHECK(vkResetCommandBuffer(frames[currentFrame].commandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
-    VK_CHECK(vkResetCommandBuffer(depthPrepassCommandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
+    // Only advanced once the frame is sure to be submitted, an abandoned value would never be signalled
+    frameNumber = frameValue;
 
-    if (asyncCompute && !useRaytracing) {
-        VK_CHECK(vkResetCommandBuffer(computeCommandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
+    const auto &frame = frames[currentFrame];
+    VK_CHECK(vkResetCommandBuffer(frame.commandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
 
-        static constexpr VkCommandBufferBeginInfo beginInfo{
-            VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            VK_NULL_HANDLE,
-            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-        };
+    const auto start = std::chrono::high_resolution_clock::now();
 
-        VK_CHECK(vkBeginCommandBuffer(computeCommandBuffer, &beginInfo));
+    // Images that shared memory may now be alive together, so everything is placed again once the old placement retires
+    if (transientImages.IsAllocated() && transientImageSettings != TransientPassSettings())
+        ResetTransientImages();
 
-        vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &mainDescriptorSet,0, VK_NULL_HANDLE);
+    renderGraph.Clear();
+    BuildFrameGraph(imageIndex, stats);
+    renderGraph.Compile(asyncCompute);
 
-        ComputePushConstants pushConstants{
-                camera->ViewMatrix()
-        };
+    // Other than the settings above the passes should be fixed, anything that still moves a lifetime is caught here.
+    // The images are recreated, so the graph that imported them is built again.
+    if (transientImages.IsAllocated() && !transientImages.Fits(renderGraph.TransientLifetimes())) [[unlikely]] {
+        ResetTransientImages();
+        BuildFrameGraph(imageIndex, stats);
+        renderGraph.Compile(asyncCompute);
+    }
 
-        vkCmdPushConstants(computeCommandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants),&pushConstants);
-        vkCmdDispatch(computeCommandBuffer, swapChainExtent.width / 32, swapChainExtent.height / 32, 1);
+    if (!transientImages.IsAllocated())
+        AllocateTransientImages();
 
-        VK_CHECK(vkEndCommandBuffer(computeCommandBuffer));
+    static constexpr VkCommandBufferBeginInfo beginInfo{
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        VK_NULL_HANDLE,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
 
-        VkSubmitInfo submitInfo{
-                VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                VK_NULL_HANDLE,
-                0,
-                VK_NULL_HANDLE,
-                VK_NULL_HANDLE,
-                1,
-                &computeCommandBuffer,
-                1,
-                &computeFinishedSemaphore
-        };
+    // Whatever the graph left on the compute queue, light culling unless it's bounded by this frame's depth
+    const bool asyncCulling = renderGraph.HasWork(RenderGraphQueue::AsyncCompute);
+    if (asyncCulling) {
+        VK_CHECK(vkResetCommandBuffer(frame.computeCommandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
 
-        VK_CHECK(vkQueueSubmit(computeQueue, 1, &submitInfo, computeFinishedFence));
+        VK_CHECK(vkBeginCommandBuffer(frame.computeCommandBuffer, &beginInfo));
+        renderGraph.Execute(RenderGraphQueue::AsyncCompute, frame.computeCommandBuffer);
+        VK_CHECK(vkEndCommandBuffer(frame.computeCommandBuffer));
     }
 
-    const auto start = std::chrono::high_resolution_clock::now();
-
-    // drawIndices.reserve(mainDrawContext.opaqueSurfaces.size());
-    // for (size_t i = 0; i < mainDrawContext.opaqueSurfaces.size(); i++) {
-    //     if (isObjectVisible(mainDrawContext.opaqueSurfaces[i], sceneData.worldMatrix))
-    //         drawIndices.push_back(i);
-    // }
-    //
-    // std::ranges::sort(drawIndices, [&](const uint16_t &a, const uint16_t &b) {
-    //     const auto &surfaceA = mainDrawContext.opaqueSurfaces[a];
-    //     const auto &surfaceB = mainDrawContext.opaqueSurfaces[b];
-    //     if (surfaceA.materialInstance == surfaceB.materialInstance) {
-    //         return surfaceA.indexBuffer < surfaceB.indexBuffer;
-    //     }
-    //
-    //     return surfaceA.materialInstance < surfaceB.materialInstance;
-    // });
-
-    if (meshShader)
-    {
-        DrawMesh(frames[currentFrame].commandBuffer, imageIndex, stats);
-    }
-    else
-    {
-        if (!useRaytracing)
-            DrawDepthPrepass(/*drawIndices*/);
-        Draw(frames[currentFrame].commandBuffer, imageIndex, stats);
+    VK_CHECK(vkBeginCommandBuffer(frame.commandBuffer, &beginInfo));
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(frame.commandBuffer, timestampQueryPool, currentFrame * 2, 2);
+        vkCmdWriteTimestamp2(frame.commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * 2);
+        timestampSlotsWritten |= 1u << currentFrame;
     }
+    renderGraph.Execute(RenderGraphQueue::Graphics, frame.commandBuffer);
+    VK_CHECK(vkEndCommandBuffer(frame.commandBuffer));
+
+    mainDrawContext.opaqueSurfaces.clear();
+    mainDrawContext.transparentSurfaces.clear();
 
     const auto end = std::chrono::high_resolution_clock::now();
     const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
     stats.meshDrawTime = static_cast<float>(elapsed) / 1000.f;
 
-    static constexpr VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT};
-    static std::array<VkSemaphore, 3> waitSemaphores;
-    if (meshShader && !useRaytracing)
-    {
-        waitSemaphores[1] = computeFinishedSemaphore;
-    }
-    else
-    {
-        waitSemaphores[1] = depthPrepassSemaphore;
-        waitSemaphores[2] = computeFinishedSemaphore;
+    // Both command buffers are recorded, the camera they read is filled in from the latest input just before they're submitted
+    LatchCamera();
+
+    if (asyncCulling) {
+        // The light grid has a slice per frame, but the cluster bounds are shared and the previous frame may still be reading them
+        const VkSemaphoreSubmitInfo waitInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, graphicsTimeline, frameValue - 1, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, 0};
+        const VkSemaphoreSubmitInfo signalInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, computeTimeline, frameValue, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, 0};
+        const VkCommandBufferSubmitInfo commandBufferInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO, VK_NULL_HANDLE, frame.computeCommandBuffer, 0};
+
+        const VkSubmitInfo2 submitInfo{
+            VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+            VK_NULL_HANDLE,
+            0,
+            clusterGridDirty ? 1u : 0u,
+            &waitInfo,
+            1,
+            &commandBufferInfo,
+            1,
+            &signalInfo
+        };
+
+        VK_CHECK(vkQueueSubmit2(computeQueue, 1, &submitInfo, VK_NULL_HANDLE));
     }
 
+    // The light culling recorded above rebuilt the grid
+    clusterGridDirty = false;
+
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
-    waitSemaphores[0] = timelineSemaphore;
+    const VkSemaphoreSubmitInfo imageReadyInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, timelineSemaphore, waitValue, SWAP_CHAIN_WAIT_STAGE, 0};
+    const VkSemaphoreSubmitInfo presentReadyInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, timelineSemaphore, signalValue, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0};
+#else
+    const VkSemaphoreSubmitInfo imageReadyInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, frame.imageAvailableSemaphore, 0, SWAP_CHAIN_WAIT_STAGE, 0};
+    const VkSemaphoreSubmitInfo presentReadyInfo{VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, frame.renderFinishedSemaphore, 0, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0};
+#endif
+    const std::array<VkSemaphoreSubmitInfo, 2> waitInfos{
+        imageReadyInfo,
+        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, computeTimeline, frameValue, renderGraph.AsyncWaitStages(), 0}
+    };
 
-    VkTimelineSemaphoreSubmitInfo semaphoreSubmitInfo{
-        VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
-        VK_NULL_HANDLE,
-        static_cast<uint32_t>(waitSemaphores.size() - !asyncCompute - (meshShader | useRaytracing)),
-        &waitValue,
-        1,
-        &signalValue
+    const std::array<VkSemaphoreSubmitInfo, 2> signalInfos{
+        presentReadyInfo,
+        {VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO, VK_NULL_HANDLE, graphicsTimeline, frameValue, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0}
     };
 
-    VkSubmitInfo submitInfo{
-        VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        &semaphoreSubmitInfo,
-        semaphoreSubmitInfo.waitSemaphoreValueCount,
-        waitSemaphores.data(),
-        waitStages,
-        1,
-        &frames[currentFrame].commandBuffer,
+    const VkCommandBufferSubmitInfo commandBufferInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO, VK_NULL_HANDLE, frame.commandBuffer, 0};
+
+    // One graphics submit per frame. The waits only hold back the stages that need the swap chain image and the
+    // compute results, so shadow and depth passes at the front of the command buffer can start right away.
+    const VkSubmitInfo2 submitInfo{
+        VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        VK_NULL_HANDLE,
+        0,
+        asyncCulling ? 2u : 1u,
+        waitInfos.data(),
         1,
-        &timelineSemaphore
+        &commandBufferInfo,
+        static_cast<uint32_t>(signalInfos.size()),
+        signalInfos.data()
     };
 
-    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, frames[currentFrame].inFlightFence));
+    VK_CHECK(vkQueueSubmit2(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+#if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
     ThrowIfFailed(d3dQueue->Wait(sharedFence.Get(), signalValue));
     vkGetSemaphoreCounterValue(device, timelineSemaphore, &timelineCounter);
     timelineCounter++;
@@ -542,26 +577,11 @@ void VkRenderer::Render(EngineStats &stats) {
     waitValue++;
     signalValue++;
 #else
-    waitSemaphores[0] = frames[currentFrame].imageAvailableSemaphore;
-    VkSubmitInfo submitInfo{
-        VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        VK_NULL_HANDLE,
-        static_cast<uint32_t>(useRaytracing ? 1 : waitSemaphores.size() - !asyncCompute - meshShader - useRaytracing),
-        waitSemaphores.data(),
-        waitStages,
-        1,
-        &frames[currentFrame].commandBuffer,
-        1,
-        &frames[currentFrame].renderFinishedSemaphore
-    };
-
-    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, frames[currentFrame].inFlightFence));
-
     VkPresentInfoKHR presentInfo{
         VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         VK_NULL_HANDLE,
         1,
-        &frames[currentFrame].renderFinishedSemaphore,
+        &frame.renderFinishedSemaphore,
         1,
         &swapChain,
         &imageIndex
@@ -575,58 +595,125 @@ void VkRenderer::Render(EngineStats &stats) {
     }
 #endif
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-
-    // std::this_thread::sleep_for(std::chrono::milliseconds(fpsLimit));
-    // Sleep(fpsLimit);
+    currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
-void VkRenderer::DrawObject(const VkCommandBuffer &commandBuffer, const VkRenderObject &draw, VkMaterialPipeline &lastPipeline, VkMaterialInstance &lastMaterialInstance, VkBuffer &lastIndexBuffer) {
-    if (lastMaterialInstance != *draw.materialInstance) {
-        lastMaterialInstance = *draw.materialInstance;
+// Per-draw data for this frame goes into the ring in submission order: opaque surfaces, then transparent ones back to front
+VkDeviceAddress VkRenderer::UploadDrawData() {
+    const auto drawCount = mainDrawContext.opaqueSurfaces.size() + mainDrawContext.transparentSurfaces.size();
+    DrawData *drawData;
+    const auto drawDataOffset = frameRing.Allocate(sizeof(DrawData) * drawCount, reinterpret_cast<void **>(&drawData));
 
-        if (draw.materialInstance->pipeline != lastPipeline) {
-            lastPipeline = lastMaterialInstance.pipeline;
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lastMaterialInstance.pipeline.pipeline);
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, lastMaterialInstance.pipeline.layout, 0, 1, &sceneDescriptorSet, 0, VK_NULL_HANDLE);
-        }
-
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.materialInstance->pipeline.layout, 1, 1, &draw.materialInstance->descriptorSet, 0, VK_NULL_HANDLE);
+    for (const auto &draw : mainDrawContext.opaqueSurfaces) {
+        *drawData++ = {draw.transform, draw.vertexBufferAddress, draw.indexBufferAddress, draw.materialInstance->materialIndex, draw.firstIndex};
+    }
 
+    for (const auto &r : std::ranges::reverse_view(mainDrawContext.transparentSurfaces)) {
+        *drawData++ = {r.transform, r.vertexBufferAddress, r.indexBufferAddress, r.materialInstance->materialIndex, r.firstIndex};
     }
 
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw.materialInstance->pipeline.layout, 2, 1, &mainDescriptorSet, 0, VK_NULL_HANDLE);
+    return frameRing.deviceAddress + drawDataOffset;
+}
+
+// Descriptor sets and the draw data address are bound once per frame in Draw, the draw index reaches the shader as gl_InstanceIndex
+void VkRenderer::DrawObject(const VkCommandBuffer &commandBuffer, const VkRenderObject &draw, const uint32_t drawIndex, const VkMaterialPipeline *&lastPipeline, VkBuffer &lastIndexBuffer) {
+    if (draw.materialInstance->pipeline != lastPipeline) {
+        lastPipeline = draw.materialInstance->pipeline;
+        BindMaterialPipeline(commandBuffer, *lastPipeline);
+    }
 
     if (draw.indexBuffer != lastIndexBuffer) {
         lastIndexBuffer = draw.indexBuffer;
         vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
     }
 
-    MeshPushConstants pushConstants{
-            draw.transform,
-            draw.vertexBufferAddress
+    vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, drawIndex);
+}
+
+void VkRenderer::BindMaterialPipeline(const VkCommandBuffer &commandBuffer, const VkMaterialPipeline &pipeline) const {
+    if (shaderObjects)
+        pipeline.shaderObjects.Bind(commandBuffer, viewport, scissor);
+    else
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+}
+
+// Cascades due this frame are refreshed from shadowCacheImage, which only re-renders static casters when a cascade's
+// matrix moved. Dynamic casters are then drawn on top. Cascades that aren't due keep last update's depth.
+void VkRenderer::DrawDepthPrepass(const VkRenderGraph::Resource shadowCascades, EngineStats &stats) {
+    static constexpr VkRenderGraph::Usage shadowAttachment{
+        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
     };
 
-    FragmentPushConstants fragmentPushConstants{
-            camera->position,
-            {viewport.width, viewport.height},
-            cascadeSplits.vec4
+    uint32_t dynamicMask = 0;
+    const auto addDynamicCaster = [&](const VkRenderObject &draw) {
+        if (!draw.isDynamic)
+            return;
+
+        for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+            if ((cascadeUpdateMask & 1u << i) && isCasterInCascade(draw, cascadeViewProjections[i]))
+                dynamicMask |= 1u << i;
+        }
     };
 
-    vkCmdPushConstants(commandBuffer, draw.materialInstance->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
-    vkCmdPushConstants(commandBuffer, draw.materialInstance->pipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(MeshPushConstants), sizeof(FragmentPushConstants), &fragmentPushConstants);
-    vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, 0);
-}
+    for (const auto &draw : mainDrawContext.opaqueSurfaces)
+        addDynamicCaster(draw);
 
-void VkRenderer::DrawDepthPrepass(/*const std::vector<size_t> &drawIndices*/) {
-    static constexpr VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, VK_NULL_HANDLE, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+    for (const auto &r : mainDrawContext.transparentSurfaces)
+        addDynamicCaster(r);
 
-    VK_CHECK(vkBeginCommandBuffer(depthPrepassCommandBuffer, &beginInfo));
+    const uint32_t rebuildMask = cascadeUpdateMask & ~staticCascadeCacheMask;
+    // A layer that held dynamic casters has to be restored from the cache even if none are left in it
+    const uint32_t refreshMask = cascadeUpdateMask & (rebuildMask | dynamicMask | dynamicCascadeMask);
 
-    static constexpr VkClearValue depthPrepassClearValue{
-        .depthStencil = {1.0f, 0}
-    };
+    if (!rebuildMask && !refreshMask)
+        return;
+
+    const auto shadowCache = renderGraph.ImportImage(shadowCacheImage, VK_IMAGE_ASPECT_DEPTH_BIT, false, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    if (rebuildMask) {
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this, rebuildMask, &stats](const VkCommandBuffer commandBuffer) {
+            RecordShadowCasters(commandBuffer, shadowCacheImage, shadowCacheFramebuffer, shadowCacheLayers, rebuildMask, rebuildMask, false, stats);
+        }).Write(shadowCache, shadowAttachment);
+
+        staticCascadeCacheMask |= rebuildMask;
+    }
+
+    if (refreshMask) {
+        std::array<VkImageCopy, SHADOW_MAP_CASCADE_COUNT> regions{};
+        uint32_t regionCount = 0;
+        for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+            if (refreshMask & 1u << i) {
+                regions[regionCount++] = {
+                    {VK_IMAGE_ASPECT_DEPTH_BIT, 0, i, 1},
+                    {0, 0, 0},
+                    {VK_IMAGE_ASPECT_DEPTH_BIT, 0, i, 1},
+                    {0, 0, 0},
+                    {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}
+                };
+            }
+        }
+
+        // Layers that aren't refreshed keep their depth, so the copy doesn't discard the cascade image
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this, regions, regionCount](const VkCommandBuffer commandBuffer) {
+            vkCmdCopyImage(commandBuffer, shadowCacheImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, shadowCascadeImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions.data());
+        }).Read(shadowCache, {VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL})
+          .Write(shadowCascades, {VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL});
+
+        if (dynamicMask) {
+            renderGraph.AddPass(RenderGraphQueue::Graphics, [this, dynamicMask, &stats](const VkCommandBuffer commandBuffer) {
+                RecordShadowCasters(commandBuffer, shadowCascadeImage, shadowMapFramebuffer, shadowCascadeLayers, dynamicMask, 0, true, stats);
+            }).Write(shadowCascades, shadowAttachment);
+        }
 
+        dynamicCascadeMask = (dynamicCascadeMask & ~refreshMask) | dynamicMask;
+    }
+}
+
+// All layers in layerMask are rendered in one layered pass, each caster is instanced once per cascade its bounds reach.
+// Without layeredShadows every layer gets its own pass over its own view, with the same culled instances.
+void VkRenderer::RecordShadowCasters(const VkCommandBuffer &commandBuffer, const VulkanImage &target, VkFramebuffer framebuffer, const std::array<ShadowLayer, SHADOW_MAP_CASCADE_COUNT> &layers, const uint32_t layerMask, const uint32_t clearMask, const bool dynamicCasters, EngineStats &stats) {
     static constexpr VkViewport depthViewport{
         0.0f,
         0.0f,
@@ -641,167 +728,180 @@ void VkRenderer::DrawDepthPrepass(/*const std::vector<size_t> &drawIndices*/) {
         {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE}
     };
 
-    vkCmdSetViewport(depthPrepassCommandBuffer, 0, 1, &depthViewport);
-    vkCmdSetScissor(depthPrepassCommandBuffer, 0, 1, &depthScissor);
-
-    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
-
-    TransitionImage(depthPrepassCommandBuffer, shadowCascadeImage, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, 0, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, -1, SHADOW_MAP_CASCADE_COUNT);
+    const auto drawCount = mainDrawContext.opaqueSurfaces.size() + mainDrawContext.transparentSurfaces.size();
+    ShadowInstance *shadowInstances;
+    const auto shadowInstanceOffset = frameRing.Allocate(sizeof(ShadowInstance) * drawCount * SHADOW_MAP_CASCADE_COUNT, reinterpret_cast<void **>(&shadowInstances));
 
-    vkCmdBindPipeline(depthPrepassCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
-    VkRenderingAttachmentInfo attachmentInfo{
-        VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
-        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-        VK_RESOLVE_MODE_NONE,
-        VK_NULL_HANDLE,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_ATTACHMENT_LOAD_OP_CLEAR,
-        VK_ATTACHMENT_STORE_OP_STORE,
-        depthPrepassClearValue
+    const DepthPassPushConstants depthPushConstants{
+        drawDataAddress,
+        frameRing.deviceAddress + shadowInstanceOffset
     };
 
-    VkRenderingInfo renderingInfo{
-        VK_STRUCTURE_TYPE_RENDERING_INFO,
-        VK_NULL_HANDLE,
-        {},
-        {0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE},
-        1,
-        0,
-        0,
-        VK_NULL_HANDLE,
-        &attachmentInfo
-    };
+    uint32_t firstInstance = 0;
 
-    for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+    // firstLayer is the cascade the pass's first attachment layer holds
+    const auto recordPass = [&](const VkImageView imageView, const VkFramebuffer passFramebuffer, const uint32_t layerCount, const uint32_t firstLayer, const uint32_t passMask) {
         if (dynamicRendering) {
-            attachmentInfo.imageView = shadowCascades[i].shadowImageView;
-            vkCmdBeginRendering(depthPrepassCommandBuffer, &renderingInfo);
+            VkRenderingAttachmentInfo attachmentInfo{
+                VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                VK_NULL_HANDLE,
+                imageView,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                VK_RESOLVE_MODE_NONE,
+                VK_NULL_HANDLE,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_ATTACHMENT_LOAD_OP_LOAD,
+                VK_ATTACHMENT_STORE_OP_STORE,
+                {}
+            };
+
+            VkRenderingInfo renderingInfo{
+                VK_STRUCTURE_TYPE_RENDERING_INFO,
+                VK_NULL_HANDLE,
+                {},
+                {0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE},
+                layerCount,
+                0,
+                0,
+                VK_NULL_HANDLE,
+                &attachmentInfo
+            };
+
+            vkCmdBeginRendering(commandBuffer, &renderingInfo);
         } else {
             VkRenderPassBeginInfo renderPassInfo{
                     VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
                     VK_NULL_HANDLE,
-                    depthPrepassRenderPass,
-                    shadowCascades[i].shadowMapFramebuffer,
+                    shadowUpdateRenderPass,
+                    passFramebuffer,
                     {{0, 0}, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE}},
-                    1,
-                    &depthPrepassClearValue
+                    0,
+                    VK_NULL_HANDLE
             };
 
-            vkCmdBeginRenderPass(depthPrepassCommandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
         }
 
-        vkCmdBindDescriptorSets(depthPrepassCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipelineLayout, 0, 1, &sceneDescriptorSet, 0, VK_NULL_HANDLE);
+        // Layers that aren't being rebuilt keep their depth, so only the requested ones are cleared
+        if (clearMask & passMask) {
+            static constexpr VkClearAttachment clearAttachment{
+                VK_IMAGE_ASPECT_DEPTH_BIT,
+                0,
+                {.depthStencil = {1.0f, 0}}
+            };
 
-        for (const auto &draw : mainDrawContext.opaqueSurfaces) {
-            if (draw.indexBuffer != lastIndexBuffer) {
-                lastIndexBuffer = draw.indexBuffer;
-                vkCmdBindIndexBuffer(depthPrepassCommandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            std::array<VkClearRect, SHADOW_MAP_CASCADE_COUNT> clearRects{};
+            uint32_t clearRectCount = 0;
+            for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+                if (clearMask & passMask & 1u << i)
+                    clearRects[clearRectCount++] = {depthScissor, i - firstLayer, 1};
             }
 
-            DepthPassPushConstants depthPushConstants{
-                draw.vertexBufferAddress,
-                i
-            };
-
-            vkCmdPushConstants(depthPrepassCommandBuffer, depthPrepassPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DepthPassPushConstants), &depthPushConstants);
-            vkCmdDrawIndexed(depthPrepassCommandBuffer, draw.indexCount, 1, draw.firstIndex, 0, 0);
+            vkCmdClearAttachments(commandBuffer, 1, &clearAttachment, clearRectCount, clearRects.data());
         }
 
-        for (const auto &r : std::ranges::reverse_view(mainDrawContext.transparentSurfaces)) {
-            if (r.indexBuffer != lastIndexBuffer) {
-                lastIndexBuffer = r.indexBuffer;
-                vkCmdBindIndexBuffer(depthPrepassCommandBuffer, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdSetViewport(commandBuffer, 0, 1, &depthViewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &depthScissor);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipelineLayout, 0, 1, &sceneDescriptorSet, SCENE_DYNAMIC_OFFSET_COUNT, dynamicOffsets.data());
+        vkCmdPushConstants(commandBuffer, depthPrepassPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DepthPassPushConstants), &depthPushConstants);
+
+        VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+        uint32_t drawIndex = 0;
+
+        // Draw indices follow the DrawData order, opaque surfaces then transparent ones back to front
+        const auto drawCaster = [&](const VkRenderObject &draw) {
+            const uint32_t currentDrawIndex = drawIndex++;
+            if (draw.isDynamic != dynamicCasters)
+                return;
+
+            uint32_t instanceCount = 0;
+            for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+                if ((passMask & 1u << i) && isCasterInCascade(draw, cascadeViewProjections[i]))
+                    shadowInstances[firstInstance + instanceCount++] = {currentDrawIndex, i};
             }
 
-            DepthPassPushConstants depthPushConstants{
-                r.vertexBufferAddress,
-                i
-            };
+            if (instanceCount == 0)
+                return;
 
-            vkCmdPushConstants(depthPrepassCommandBuffer, depthPrepassPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DepthPassPushConstants), &depthPushConstants);
-            vkCmdDrawIndexed(depthPrepassCommandBuffer, r.indexCount, 1, r.firstIndex, 0, 0);
-        }
+            if (draw.indexBuffer != lastIndexBuffer) {
+                lastIndexBuffer = draw.indexBuffer;
+                vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            }
+
+            vkCmdDrawIndexed(commandBuffer, draw.indexCount, instanceCount, draw.firstIndex, 0, firstInstance);
+            firstInstance += instanceCount;
+
+            stats.drawCallCount++;
+            stats.triangleCount += draw.indexCount / 3 * instanceCount;
+        };
+
+        for (const auto &draw : mainDrawContext.opaqueSurfaces)
+            drawCaster(draw);
+
+        for (const auto &r : std::ranges::reverse_view(mainDrawContext.transparentSurfaces))
+            drawCaster(r);
 
         if (dynamicRendering) {
-            vkCmdEndRendering(depthPrepassCommandBuffer);
+            vkCmdEndRendering(commandBuffer);
         } else {
-            vkCmdEndRenderPass(depthPrepassCommandBuffer);
+            vkCmdEndRenderPass(commandBuffer);
         }
-    }
-
-    TransitionImage(depthPrepassCommandBuffer, shadowCascadeImage, VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, -1, SHADOW_MAP_CASCADE_COUNT);
-    VK_CHECK(vkEndCommandBuffer(depthPrepassCommandBuffer));
-
-    VkSubmitInfo submitInfo{
-            VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            VK_NULL_HANDLE,
-            0,
-            VK_NULL_HANDLE,
-            VK_NULL_HANDLE,
-            1,
-            &depthPrepassCommandBuffer,
-            1,
-            &depthPrepassSemaphore
     };
 
-    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, depthPrepassFence));
+    if (layeredShadows) {
+        recordPass(target.imageView, framebuffer, SHADOW_MAP_CASCADE_COUNT, 0, layerMask);
+        return;
+    }
+
+    for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+        if (layerMask & 1u << i)
+            recordPass(layers[i].imageView, layers[i].framebuffer, 1, i, 1u << i);
+    }
 }
 
 void VkRenderer::DrawSkybox(const VkCommandBuffer &commandBuffer, EngineStats &stats) const {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipeline);
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, skyboxPipelineLayout, 0, 1, &skyboxDescriptorSet, 0, VK_NULL_HANDLE);
-    const struct {
-        alignas(16) glm::vec3 front;
-        alignas(16) glm::vec3 right;
-        alignas(16) glm::vec3 up;
-    } skyboxPushConstant{
-        camera->front,
-        camera->right,
-        camera->up
-    };
-    vkCmdPushConstants(commandBuffer, skyboxPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::vec4) * 3, &skyboxPushConstant);
+    const SkyboxPushConstants pushConstants{cameraDataAddress, camera->Jitter()};
+    vkCmdPushConstants(commandBuffer, skyboxPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(SkyboxPushConstants), &pushConstants);
     vkCmdDraw(commandBuffer, 6, 1, 0, 0);
     stats.drawCallCount++;
     stats.triangleCount += 12;
 }
 
-void VkRenderer::BeginDraw(const VkCommandBuffer &commandBuffer, const uint32_t imageIndex) const {
-    static constexpr VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, VK_NULL_HANDLE, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
-
-    VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-
-    if (!asyncCompute) {
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &mainDescriptorSet, 0, VK_NULL_HANDLE);
-
-        ComputePushConstants pushConstants{
-                camera->ViewMatrix()
-        };
-
-        vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants),&pushConstants);
-        vkCmdDispatch(commandBuffer, swapChainExtent.width / 32, swapChainExtent.height / 32, 1);
-    }
-
-    VulkanImage swapChainImage{swapChainImages[imageIndex], swapChainImageViews[imageIndex], VK_NULL_HANDLE, {swapChainExtent.width, swapChainExtent.height, 1}, surfaceFormat.format};
-
+// Loading depth keeps what an earlier pass in the same command buffer wrote, e.g. the visibility pass.
+// The render graph has already put the attachments in the layouts the pass expects.
+void VkRenderer::BeginMainPass(const VkCommandBuffer &commandBuffer, const VkAttachmentLoadOp depthLoadOp) const {
     if (dynamicRendering) {
-        TransitionImage(commandBuffer, swapChainImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        TransitionImage(commandBuffer, depthImage, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, 0, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-
-        VkRenderingAttachmentInfo colorAttachment{
-            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-            VK_NULL_HANDLE,
-            swapChainImageViews[imageIndex],
-            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            VK_RESOLVE_MODE_NONE,
-            VK_NULL_HANDLE,
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_ATTACHMENT_LOAD_OP_CLEAR,
-            VK_ATTACHMENT_STORE_OP_STORE,
-            {0.0f, 0.0f, 0.0f, 1.0f}
-        };
+        const std::array<VkRenderingAttachmentInfo, 2> colorAttachments{{
+            {
+                VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                VK_NULL_HANDLE,
+                sceneColorImage.imageView,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                VK_RESOLVE_MODE_NONE,
+                VK_NULL_HANDLE,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_ATTACHMENT_LOAD_OP_CLEAR,
+                VK_ATTACHMENT_STORE_OP_STORE,
+                {0.0f, 0.0f, 0.0f, 1.0f}
+            },
+            // Pixels nothing is drawn to haven't moved
+            {
+                VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                VK_NULL_HANDLE,
+                velocityImage.imageView,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                VK_RESOLVE_MODE_NONE,
+                VK_NULL_HANDLE,
+                VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_ATTACHMENT_LOAD_OP_CLEAR,
+                VK_ATTACHMENT_STORE_OP_STORE,
+                {0.0f, 0.0f, 0.0f, 0.0f}
+            }
+        }};
 
         VkRenderingAttachmentInfo depthAttachment{
             VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
@@ -811,8 +911,9 @@ void VkRenderer::BeginDraw(const VkCommandBuffer &commandBuffer, const uint32_t
             VK_RESOLVE_MODE_NONE,
             VK_NULL_HANDLE,
             VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_ATTACHMENT_LOAD_OP_CLEAR,
-            VK_ATTACHMENT_STORE_OP_STORE,
+            depthLoadOp,
+            // Nothing reads depth after the main pass
+            VK_ATTACHMENT_STORE_OP_DONT_CARE,
             {.depthStencil = {1.0f, 0}}
         };
 
@@ -820,28 +921,29 @@ void VkRenderer::BeginDraw(const VkCommandBuffer &commandBuffer, const uint32_t
             VK_STRUCTURE_TYPE_RENDERING_INFO,
             VK_NULL_HANDLE,
             {},
-            {0, 0, swapChainExtent.width, swapChainExtent.height},
+            {{0, 0}, renderExtent},
             1,
             0,
-            1,
-            &colorAttachment,
+            colorAttachments.size(),
+            colorAttachments.data(),
             &depthAttachment
         };
 
         vkCmdBeginRendering(commandBuffer, &renderingInfo);
     } else {
-        static constexpr std::array<VkClearValue, 2> clearValues{
+        static constexpr std::array<VkClearValue, 3> clearValues{
                 {
                         {.color = {0.0f, 0.0f, 0.0f, 1.0f}},
-                        {.depthStencil = {1.0f, 0}}
+                        {.depthStencil = {1.0f, 0}},
+                        {.color = {0.0f, 0.0f, 0.0f, 0.0f}}
                 }
         };
         VkRenderPassBeginInfo renderPassInfo{
             VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
             VK_NULL_HANDLE,
             renderPass,
-            swapChainFramebuffers[imageIndex],
-            {{0, 0}, swapChainExtent},
+            sceneFramebuffer,
+            {{0, 0}, renderExtent},
             clearValues.size(),
             clearValues.data()
         };
@@ -853,191 +955,536 @@ void VkRenderer::BeginDraw(const VkCommandBuffer &commandBuffer, const uint32_t
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
-void VkRenderer::EndDraw(const VkCommandBuffer &commandBuffer, const uint32_t imageIndex) {
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
-
-    const VulkanImage swapChainImage{swapChainImages[imageIndex], swapChainImageViews[imageIndex], VK_NULL_HANDLE, {swapChainExtent.width, swapChainExtent.height, 1}, surfaceFormat.format};
+void VkRenderer::EndDraw(const VkCommandBuffer &commandBuffer) const {
     if (dynamicRendering) {
         vkCmdEndRendering(commandBuffer);
-        TransitionImage(commandBuffer, swapChainImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
     } else {
         vkCmdEndRenderPass(commandBuffer);
     }
+}
 
-    VK_CHECK(vkEndCommandBuffer(commandBuffer));
+// Resolves the render area and last frame's output into this frame's output at the swap chain's resolution
+void VkRenderer::UpscaleScene(const VkCommandBuffer &commandBuffer) {
+    temporalUpscaler.Resolve(commandBuffer, renderExtent, swapChainExtent);
+}
 
-    mainDrawContext.opaqueSurfaces.clear();
-    mainDrawContext.transparentSurfaces.clear();
-    // drawIndices.clear();
+// Copies the upscaled output onto the swap chain image, converting to its format on the way
+void VkRenderer::PresentScene(const VkCommandBuffer &commandBuffer, const uint32_t imageIndex) const {
+    const VulkanImage target{
+        swapChainImages[imageIndex],
+        swapChainImageViews[imageIndex],
+        VK_NULL_HANDLE,
+        {swapChainExtent.width, swapChainExtent.height, 1},
+        surfaceFormat.format
+    };
+
+    BlitImage(commandBuffer, temporalUpscaler.Output(), target, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
 }
 
-void VkRenderer::Draw(const VkCommandBuffer &commandBuffer, uint32_t imageIndex, EngineStats &stats) {
-    if (useRaytracing)
-    {
-        static constexpr VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, VK_NULL_HANDLE, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+// The UI is drawn at full resolution on top of the upscaled scene
+void VkRenderer::DrawUi(const VkCommandBuffer &commandBuffer, const uint32_t imageIndex) const {
+    if (dynamicRendering) {
+        VkRenderingAttachmentInfo colorAttachment{
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            VK_NULL_HANDLE,
+            swapChainImageViews[imageIndex],
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_RESOLVE_MODE_NONE,
+            VK_NULL_HANDLE,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_ATTACHMENT_LOAD_OP_LOAD,
+            VK_ATTACHMENT_STORE_OP_STORE
+        };
 
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        VkRenderingInfo renderingInfo{
+            VK_STRUCTURE_TYPE_RENDERING_INFO,
+            VK_NULL_HANDLE,
+            {},
+            {{0, 0}, swapChainExtent},
+            1,
+            0,
+            1,
+            &colorAttachment
+        };
 
-        const auto viewInverse = glm::inverse(camera->ViewMatrix());
-        const auto projectionInverse = glm::inverse(camera->ProjectionMatrix());
-        static const glm::vec4 lightPosition{10.0f, 6.0f, 3.0f, 1.0f};
-        static const glm::vec4 lightColor{1.0f, 1.0f, 0.95f, 1.0f};
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    } else {
+        VkRenderPassBeginInfo renderPassInfo{
+            VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            VK_NULL_HANDLE,
+            uiRenderPass,
+            swapChainFramebuffers[imageIndex],
+            {{0, 0}, swapChainExtent}
+        };
 
-        static glm::vec4 pointLightPosition{0.0, 4.0, 0.0, 5.0};
-        static glm::vec4 pointLightColor{1.0f, 0.0f, 0.4f, 1.0f};
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    }
 
-        static float angle = 0.0f;
-        angle += 0.01f;
-        pointLightPosition.x = 5.0f * glm::cos(angle);
+    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
+    EndDraw(commandBuffer);
+}
 
-        TransitionImage(commandBuffer, rayTracing.radianceImage, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-        rayTracing.UpdateDescriptorSets(device, currentFrame);
-        rayTracing.ResetSceneData();
-        rayTracing.AddLight(lightPosition, lightColor, RayTracing::LightType::Directional);
-        // rayTracing.AddLight({0.0, 4.0, 0.0, 10.0}, {0.35f, 0.65f, 0.95f, 1.0f}, RayTracing::LightType::Point);
-        rayTracing.AddLight(pointLightPosition, pointLightColor, RayTracing::LightType::Point);
-        rayTracing.UpdateBuffers(memoryManager);
-        // rayTracing.TransitionAccumulatedImages(commandBuffer, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
-        rayTracing.TraceRay(commandBuffer, currentFrame, viewInverse, projectionInverse, camera->position, swapChainExtent);
-        // rayTracing.AccumulateRadiance(commandBuffer, currentFrame, swapChainExtent);
-        // rayTracing.TransitionAccumulatedImages(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
-        TransitionImage(commandBuffer, rayTracing.radianceImage, VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+// Declares the frame for the render graph. Each pass names what it reads and writes, the graph drops passes whose
+// results go unused, moves light culling to the compute queue when nothing it needs comes from this frame's graphics
+// work and places every barrier in between.
+void VkRenderer::BuildFrameGraph(const uint32_t imageIndex, EngineStats &stats) {
+    static constexpr VkPipelineStageFlags2 depthTestStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+    static constexpr VkAccessFlags2 depthAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    static constexpr VkRenderGraph::Usage shaderStorageRead{VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT};
+
+    // Render passes transition their attachments themselves, the graph only has to match the layouts they start and end in
+    const auto attachmentUsage = [this](const VkPipelineStageFlags2 stage, const VkAccessFlags2 access, const VkImageLayout layout,
+                                        const VkImageLayout renderPassInitialLayout, const VkImageLayout renderPassFinalLayout) {
+        return dynamicRendering ? VkRenderGraph::Usage{stage, access, layout} : VkRenderGraph::Usage{stage, access, renderPassInitialLayout, renderPassFinalLayout};
+    };
 
-        VulkanImage swapChainImage{swapChainImages[imageIndex], swapChainImageViews[imageIndex], VK_NULL_HANDLE, {swapChainExtent.width, swapChainExtent.height, 1}, surfaceFormat.format};
+    const bool rasterizedScene = !useRaytracing && !meshShader;
+    const bool depthBeforeShading = HasDepthBeforeShading();
+
+    const auto swapChain = renderGraph.ImportSwapChainImage(swapChainImages[imageIndex], SWAP_CHAIN_WAIT_STAGE);
+    const auto sceneColor = renderGraph.ImportImage(sceneColorImage, VK_IMAGE_ASPECT_COLOR_BIT, true);
+    const auto velocity = renderGraph.ImportImage(velocityImage, VK_IMAGE_ASPECT_COLOR_BIT, true);
+    // The history alternates between the two images, each carries its layout into the frame after next
+    const auto history = renderGraph.ImportImage(temporalUpscaler.History(), VK_IMAGE_ASPECT_COLOR_BIT);
+    const auto upscaled = renderGraph.ImportImage(temporalUpscaler.Output(), VK_IMAGE_ASPECT_COLOR_BIT);
+    const auto depth = renderGraph.ImportImage(depthImage, VK_IMAGE_ASPECT_DEPTH_BIT, true);
+    const auto shadowCascades = renderGraph.ImportImage(shadowCascadeImage, VK_IMAGE_ASPECT_DEPTH_BIT, false, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    const auto clusterGrid = renderGraph.ImportBuffer(clusterGridBuffer.buffer);
+    const auto lightGrid = renderGraph.ImportBuffer(lightGridBuffer.buffer, dynamicOffsets[SCENE_DYNAMIC_OFFSET_COUNT], true);
+    const auto lightIndices = renderGraph.ImportBuffer(lightIndexBuffer.buffer, dynamicOffsets[SCENE_DYNAMIC_OFFSET_COUNT + 1], true);
+
+    if (rasterizedScene) {
+        drawDataAddress = UploadDrawData();
+        DrawDepthPrepass(shadowCascades, stats);
+    }
 
-        if (dynamicRendering) {
-            TransitionImage(commandBuffer, swapChainImage, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-            TransitionImage(commandBuffer, depthImage, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, 0, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    if (clusterGridDirty) {
+        renderGraph.AddPass(RenderGraphQueue::AsyncCompute, [this](const VkCommandBuffer commandBuffer) {
+            ComputeFrustum(commandBuffer);
+        }).Discard(clusterGrid, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+    }
 
-            VkRenderingAttachmentInfo colorAttachment{
-                VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-                VK_NULL_HANDLE,
-                swapChainImageViews[imageIndex],
-                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                VK_RESOLVE_MODE_NONE,
-                VK_NULL_HANDLE,
-                VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_ATTACHMENT_LOAD_OP_CLEAR,
-                VK_ATTACHMENT_STORE_OP_STORE,
-                {0.0f, 0.0f, 0.0f, 1.0f}
-            };
+    const MeshPushConstants pushConstants{drawDataAddress};
+    const auto depthPassUsage = attachmentUsage(depthTestStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+    VkRenderGraph::Resource visibility{};
+    if (visibilityBuffer && rasterizedScene) {
+        visibility = renderGraph.ImportImage(visibilityImage, VK_IMAGE_ASPECT_COLOR_BIT, true);
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this, pushConstants, &stats](const VkCommandBuffer commandBuffer) {
+            DrawVisibility(commandBuffer, pushConstants, stats);
+        }).Discard(visibility, attachmentUsage(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL))
+          .Discard(depth, depthPassUsage);
+    } else if (mainDepthPrepass && rasterizedScene) {
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this, pushConstants, &stats](const VkCommandBuffer commandBuffer) {
+            DrawMainDepthPrepass(commandBuffer, pushConstants, stats);
+        }).Discard(depth, depthPassUsage);
+    }
 
-            VkRenderingAttachmentInfo depthAttachment{
-                VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-                VK_NULL_HANDLE,
-                depthImage.imageView,
-                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                VK_RESOLVE_MODE_NONE,
-                VK_NULL_HANDLE,
-                VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_ATTACHMENT_LOAD_OP_CLEAR,
-                VK_ATTACHMENT_STORE_OP_STORE,
-                {.depthStencil = {1.0f, 0}}
-            };
+    VkRenderGraph::Resource tileDepth{};
+    LightDepthBounds depthBounds = LightDepthBounds::None;
+    if (depthBeforeShading) {
+        tileDepth = renderGraph.ImportBuffer(tileDepthBuffer.buffer, 0, true);
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this](const VkCommandBuffer commandBuffer) {
+            ReduceTileDepth(commandBuffer);
+        }).Read(depth, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL})
+          .Read(clusterGrid, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT})
+          .Discard(tileDepth, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+
+        // Transparent surfaces are drawn in front of the opaque depth, so they need the clusters before it
+        depthBounds = mainDrawContext.transparentSurfaces.empty() ? LightDepthBounds::NearAndFar : LightDepthBounds::Far;
+    }
 
-            VkRenderingInfo renderingInfo{
-                VK_STRUCTURE_TYPE_RENDERING_INFO,
-                VK_NULL_HANDLE,
-                {},
-                {0, 0, swapChainExtent.width, swapChainExtent.height},
-                1,
-                0,
-                1,
-                &colorAttachment,
-                &depthAttachment
-            };
+    // Reading the tile depth ties culling to the graphics queue, otherwise it overlaps the shadow and depth passes
+    auto lightCulling = renderGraph.AddPass(RenderGraphQueue::AsyncCompute, [this, depthBounds](const VkCommandBuffer commandBuffer) {
+        CullLights(commandBuffer, depthBounds);
+    });
+    lightCulling.Read(clusterGrid, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT})
+                .Discard(lightGrid, {VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT})
+                .Discard(lightIndices, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT});
+
+    if (depthBeforeShading)
+        lightCulling.Read(tileDepth, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT});
+
+    VkRenderGraph::Resource radiance{};
+    if (useRaytracing) {
+        radiance = renderGraph.ImportImage(rayTracing.radianceImage, VK_IMAGE_ASPECT_COLOR_BIT, true, VK_IMAGE_LAYOUT_GENERAL);
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this](const VkCommandBuffer commandBuffer) {
+            TraceRays(commandBuffer);
+        }).Discard(radiance, {VK_PIPELINE_STAGE_2_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL});
+    }
 
-            vkCmdBeginRendering(commandBuffer, &renderingInfo);
-        } else {
-            static constexpr std::array<VkClearValue, 2> clearValues{
-                    {
-                            {.color = {0.0f, 0.0f, 0.0f, 1.0f}},
-                            {.depthStencil = {1.0f, 0}}
-                    }
-            };
-            VkRenderPassBeginInfo renderPassInfo{
-                VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                VK_NULL_HANDLE,
-                renderPass,
-                swapChainFramebuffers[imageIndex],
-                {{0, 0}, swapChainExtent},
-                clearValues.size(),
-                clearValues.data()
-            };
+    auto mainPass = renderGraph.AddPass(RenderGraphQueue::Graphics, [this, &stats](const VkCommandBuffer commandBuffer) {
+        if (meshShader)
+            DrawMesh(commandBuffer, stats);
+        else
+            Draw(commandBuffer, stats);
+    });
 
-            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-        }
+    const auto sceneAttachmentUsage = attachmentUsage(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    mainPass.Discard(sceneColor, sceneAttachmentUsage)
+            .Discard(velocity, sceneAttachmentUsage);
+
+    const auto mainDepthUsage = attachmentUsage(depthTestStages, depthAccess, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                                                VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    if (depthBeforeShading)
+        mainPass.Write(depth, mainDepthUsage);
+    else
+        mainPass.Discard(depth, mainDepthUsage);
 
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    if (useRaytracing) {
+        mainPass.Read(radiance, {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+    } else {
+        mainPass.Read(shadowCascades, {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL})
+                .Read(clusterGrid, shaderStorageRead)
+                .Read(lightGrid, shaderStorageRead)
+                .Read(lightIndices, shaderStorageRead);
+
+        if (visibilityBuffer && rasterizedScene)
+            mainPass.Read(visibility, {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+    }
+
+    static constexpr VkRenderGraph::Usage resolveInput{VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    renderGraph.AddPass(RenderGraphQueue::Graphics, [this](const VkCommandBuffer commandBuffer) {
+        UpscaleScene(commandBuffer);
+    }).Read(sceneColor, resolveInput)
+      .Read(velocity, resolveInput)
+      .Read(history, resolveInput)
+      .Discard(upscaled, {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL});
+
+    // Ends the GPU time the render scale is driven by, before the blit so waiting for the swap chain image doesn't count
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        renderGraph.AddPass(RenderGraphQueue::Graphics, [this](const VkCommandBuffer commandBuffer) {
+            vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestampQueryPool, currentFrame * 2 + 1);
+        }).SideEffect();
+    }
+
+    renderGraph.AddPass(RenderGraphQueue::Graphics, [this, imageIndex](const VkCommandBuffer commandBuffer) {
+        PresentScene(commandBuffer, imageIndex);
+    }).Read(upscaled, {VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL})
+      .Discard(swapChain, {VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL});
 
-        const auto pipeline = metalRoughMaterial.opaquePipeline;
+    renderGraph.AddPass(RenderGraphQueue::Graphics, [this, imageIndex](const VkCommandBuffer commandBuffer) {
+        DrawUi(commandBuffer, imageIndex);
+    }).Write(swapChain, attachmentUsage(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR));
+
+    // Presentation reads the image outside the graph, this keeps the passes writing it alive and leaves the image presentable
+    renderGraph.AddPass(RenderGraphQueue::Graphics, [](VkCommandBuffer) {})
+        .Read(swapChain, {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR})
+        .SideEffect();
+}
+
+// Records the main pass, every path draws into the scene color image with depth cleared or loaded from an earlier pass
+void VkRenderer::Draw(const VkCommandBuffer &commandBuffer, EngineStats &stats) {
+    if (useRaytracing)
+    {
+        BeginMainPass(commandBuffer);
+
+        const auto pipeline = metalRoughMaterial.rayTracedPipeline;
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, 0, 1, &sceneDescriptorSet, 0, VK_NULL_HANDLE);
 
+        const auto projection = camera->UnjitteredProjectionMatrix();
         RtMeshPushConstants pushConstants{
-            {viewport.width, viewport.height}
+            cameraDataAddress,
+            {projection[0][0], projection[1][1], sceneData.jitter.x, sceneData.jitter.y},
+            {static_cast<float>(rayTracing.radianceImage.extent.width), static_cast<float>(rayTracing.radianceImage.extent.height)},
+            {static_cast<float>(renderExtent.width), static_cast<float>(renderExtent.height)}
         };
 
         vkCmdPushConstants(commandBuffer, pipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(RtMeshPushConstants), &pushConstants);
         vkCmdDraw(commandBuffer, 3, 1, 0, 0);
     }
+    else if (visibilityBuffer)
+    {
+        const VkDescriptorSet descriptorSets[] = {sceneDescriptorSet, loadedScene.materialSet, mainDescriptorSet};
+        const MeshPushConstants pushConstants{drawDataAddress};
+
+        // Depth is kept so transparent surfaces are still occluded by opaque ones
+        BeginMainPass(commandBuffer, VK_ATTACHMENT_LOAD_OP_LOAD);
+        DrawSkybox(commandBuffer, stats);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityResolvePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawDataPipelineLayout, 0, 3, descriptorSets, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+        vkCmdPushConstants(commandBuffer, drawDataPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+        stats.drawCallCount++;
+
+        if (!mainDrawContext.transparentSurfaces.empty()) {
+            const VkMaterialPipeline *lastPipeline = nullptr;
+            VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+            // Transparent draws follow the opaque ones in the draw data
+            auto drawIndex = static_cast<uint32_t>(mainDrawContext.opaqueSurfaces.size());
+
+            const auto pipelineLayout = metalRoughMaterial.pipelineLayout;
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+
+            for (const auto &r : std::ranges::reverse_view(mainDrawContext.transparentSurfaces)) {
+                DrawObject(commandBuffer, r, drawIndex++, lastPipeline, lastIndexBuffer);
+                stats.drawCallCount++;
+                stats.triangleCount += r.indexCount / 3;
+            }
+        }
+    }
     else
     {
-        BeginDraw(commandBuffer, imageIndex);
+        const MeshPushConstants pushConstants{drawDataAddress};
+
+        BeginMainPass(commandBuffer, mainDepthPrepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR);
         DrawSkybox(commandBuffer, stats);
 
-        VkMaterialPipeline lastPipeline{};
-        VkMaterialInstance lastMaterialInstance{};
+        const VkMaterialPipeline *lastPipeline = nullptr;
         VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
 
+        // Opaque and transparent pipelines share the layout, so everything but the per-draw data is bound up front
+        const auto pipelineLayout = metalRoughMaterial.pipelineLayout;
+        const VkDescriptorSet descriptorSets[] = {sceneDescriptorSet, loadedScene.materialSet, mainDescriptorSet};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 3, descriptorSets, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+
+        if (mainDepthPrepass) {
+            // Every opaque surface uses the opaque material pipeline, marking it as bound keeps DrawObject on the EQUAL variant
+            const auto &features = metalRoughMaterial.features;
+            BindMaterialPipeline(commandBuffer, *metalRoughMaterial.Pipeline(features.With(AlphaMode::Opaque, true)));
+            lastPipeline = metalRoughMaterial.Pipeline(features);
+        }
+
+        uint32_t drawIndex = 0;
         for (const auto &draw : mainDrawContext.opaqueSurfaces) {
-            DrawObject(commandBuffer, draw, lastPipeline, lastMaterialInstance, lastIndexBuffer);
+            DrawObject(commandBuffer, draw, drawIndex++, lastPipeline, lastIndexBuffer);
             stats.drawCallCount++;
             stats.triangleCount += draw.indexCount / 3;
         }
 
         for (const auto &r : std::ranges::reverse_view(mainDrawContext.transparentSurfaces)) {
-            DrawObject(commandBuffer, r, lastPipeline, lastMaterialInstance, lastIndexBuffer);
+            DrawObject(commandBuffer, r, drawIndex++, lastPipeline, lastIndexBuffer);
             stats.drawCallCount++;
             stats.triangleCount += r.indexCount / 3;
         }
     }
 
-    EndDraw(commandBuffer, imageIndex);
+    EndDraw(commandBuffer);
+}
+
+// Fills the radiance image the ray traced main pass samples
+void VkRenderer::TraceRays(const VkCommandBuffer &commandBuffer) {
+    const auto projectionInverse = glm::inverse(camera->ProjectionMatrix());
+    static const glm::vec4 lightPosition{10.0f, 6.0f, 3.0f, 1.0f};
+    static const glm::vec4 lightColor{1.0f, 1.0f, 0.95f, 1.0f};
+
+    static glm::vec4 pointLightPosition{0.0, 4.0, 0.0, 5.0};
+    static glm::vec4 pointLightColor{1.0f, 0.0f, 0.4f, 1.0f};
+
+    static float angle = 0.0f;
+    angle += 0.01f;
+    pointLightPosition.x = 5.0f * glm::cos(angle);
+
+    rayTracing.UpdateDescriptorSets(device, currentFrame);
+    rayTracing.ResetSceneData();
+    rayTracing.AddLight(lightPosition, lightColor, RayTracing::LightType::Directional);
+    // rayTracing.AddLight({0.0, 4.0, 0.0, 10.0}, {0.35f, 0.65f, 0.95f, 1.0f}, RayTracing::LightType::Point);
+    rayTracing.AddLight(pointLightPosition, pointLightColor, RayTracing::LightType::Point);
+    rayTracing.UpdateBuffers(memoryManager);
+    // rayTracing.TransitionAccumulatedImages(commandBuffer, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    rayTracing.TraceRay(commandBuffer, currentFrame, cameraDataAddress, projectionInverse, camera->position, renderExtent);
+    // rayTracing.AccumulateRadiance(commandBuffer, currentFrame, swapChainExtent);
+    // rayTracing.TransitionAccumulatedImages(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+}
+
+// Position only pass over the opaque surfaces, the forward pass then shades each pixel once with an EQUAL depth test
+void VkRenderer::DrawMainDepthPrepass(const VkCommandBuffer &commandBuffer, const MeshPushConstants &pushConstants, EngineStats &stats) {
+    static constexpr VkClearValue depthClearValue{
+        .depthStencil = {1.0f, 0}
+    };
+
+    if (dynamicRendering) {
+        VkRenderingAttachmentInfo depthAttachment{
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            VK_NULL_HANDLE,
+            depthImage.imageView,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_RESOLVE_MODE_NONE,
+            VK_NULL_HANDLE,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_ATTACHMENT_LOAD_OP_CLEAR,
+            VK_ATTACHMENT_STORE_OP_STORE,
+            depthClearValue
+        };
+
+        VkRenderingInfo renderingInfo{
+            VK_STRUCTURE_TYPE_RENDERING_INFO,
+            VK_NULL_HANDLE,
+            {},
+            {{0, 0}, renderExtent},
+            1,
+            0,
+            0,
+            VK_NULL_HANDLE,
+            &depthAttachment
+        };
+
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    } else {
+        VkRenderPassBeginInfo renderPassInfo{
+            VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            VK_NULL_HANDLE,
+            depthPrepassRenderPass,
+            depthPrepassFramebuffer,
+            {{0, 0}, renderExtent},
+            1,
+            &depthClearValue
+        };
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    const VkDescriptorSet descriptorSets[] = {sceneDescriptorSet, loadedScene.materialSet, mainDescriptorSet};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mainDepthPrepassPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawDataPipelineLayout, 0, 3, descriptorSets, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+    vkCmdPushConstants(commandBuffer, drawDataPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+
+    // Opaque surfaces come first in the draw data, so the draw index lines up with the color pass
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    uint32_t drawIndex = 0;
+    for (const auto &draw : mainDrawContext.opaqueSurfaces) {
+        if (draw.indexBuffer != lastIndexBuffer) {
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+
+        vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, drawIndex++);
+        stats.drawCallCount++;
+    }
+
+    if (dynamicRendering)
+        vkCmdEndRendering(commandBuffer);
+    else
+        vkCmdEndRenderPass(commandBuffer);
+}
+
+// Opaque surfaces only write draw and triangle IDs, materials and lighting are evaluated once per pixel in the resolve.
+// Transparent surfaces are blended on top through the forward pipelines.
+void VkRenderer::DrawVisibility(const VkCommandBuffer &commandBuffer, const MeshPushConstants &pushConstants, EngineStats &stats) {
+    const VkDescriptorSet descriptorSets[] = {sceneDescriptorSet, loadedScene.materialSet, mainDescriptorSet};
+
+    if (dynamicRendering) {
+        VkRenderingAttachmentInfo colorAttachment{
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            VK_NULL_HANDLE,
+            visibilityImage.imageView,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_RESOLVE_MODE_NONE,
+            VK_NULL_HANDLE,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_ATTACHMENT_LOAD_OP_CLEAR,
+            VK_ATTACHMENT_STORE_OP_STORE,
+            {.color = {.uint32 = {UINT32_MAX, UINT32_MAX, 0, 0}}}
+        };
+
+        VkRenderingAttachmentInfo depthAttachment{
+            VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            VK_NULL_HANDLE,
+            depthImage.imageView,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_RESOLVE_MODE_NONE,
+            VK_NULL_HANDLE,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_ATTACHMENT_LOAD_OP_CLEAR,
+            VK_ATTACHMENT_STORE_OP_STORE,
+            {.depthStencil = {1.0f, 0}}
+        };
+
+        VkRenderingInfo renderingInfo{
+            VK_STRUCTURE_TYPE_RENDERING_INFO,
+            VK_NULL_HANDLE,
+            {},
+            {{0, 0}, renderExtent},
+            1,
+            0,
+            1,
+            &colorAttachment,
+            &depthAttachment
+        };
+
+        vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    } else {
+        static constexpr std::array<VkClearValue, 2> clearValues{
+                {
+                        {.color = {.uint32 = {UINT32_MAX, UINT32_MAX, 0, 0}}},
+                        {.depthStencil = {1.0f, 0}}
+                }
+        };
+        VkRenderPassBeginInfo renderPassInfo{
+            VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            VK_NULL_HANDLE,
+            visibilityRenderPass,
+            visibilityFramebuffer,
+            {{0, 0}, renderExtent},
+            clearValues.size(),
+            clearValues.data()
+        };
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawDataPipelineLayout, 0, 3, descriptorSets, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+    vkCmdPushConstants(commandBuffer, drawDataPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+
+    // Every opaque draw shares the one pipeline, so only the index buffer changes between draws
+    VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    uint32_t drawIndex = 0;
+    for (const auto &draw : mainDrawContext.opaqueSurfaces) {
+        if (draw.indexBuffer != lastIndexBuffer) {
+            lastIndexBuffer = draw.indexBuffer;
+            vkCmdBindIndexBuffer(commandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+
+        vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, 0, drawIndex++);
+        stats.drawCallCount++;
+        stats.triangleCount += draw.indexCount / 3;
+    }
+
+    if (dynamicRendering)
+        vkCmdEndRendering(commandBuffer);
+    else
+        vkCmdEndRenderPass(commandBuffer);
 }
 
-void VkRenderer::DrawMesh(const VkCommandBuffer &commandBuffer, const uint32_t imageIndex, EngineStats &stats) {
-    BeginDraw(commandBuffer, imageIndex);
+void VkRenderer::DrawMesh(const VkCommandBuffer &commandBuffer, EngineStats &stats) {
+    BeginMainPass(commandBuffer);
     DrawSkybox(commandBuffer, stats);
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, metalRoughMaterial.opaquePipeline.pipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, metalRoughMaterial.opaquePipeline.layout, 0, 1, &sceneDescriptorSet, 0, VK_NULL_HANDLE);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, metalRoughMaterial.opaquePipeline.layout, 2, 1, &mainDescriptorSet, 0, VK_NULL_HANDLE);
+    const auto *pipeline = metalRoughMaterial.Pipeline(metalRoughMaterial.features);
+    BindMaterialPipeline(commandBuffer, *pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, 1, &sceneDescriptorSet, SCENE_DYNAMIC_OFFSET_COUNT, dynamicOffsets.data());
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 2, 1, &mainDescriptorSet, 2, dynamicOffsets.data() + SCENE_DYNAMIC_OFFSET_COUNT);
 
     MeshShaderPushConstants pushConstants{
         loadedScene.rootNodes[0]->worldTransform,
     };
 
-    FragmentPushConstants fragmentPushConstants{
-        camera->position,
-        {viewport.width, viewport.height},
-        cascadeSplits.vec4
-    };
-
-    // vkCmdPushConstants(commandBuffer, metalRoughMaterial.opaquePipeline.layout, VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshShaderPushConstants), &pushConstants);
-    vkCmdPushConstants(commandBuffer, metalRoughMaterial.opaquePipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(MeshShaderPushConstants), sizeof(FragmentPushConstants), &fragmentPushConstants);
-
     for (size_t i = 0; i < 1; i++)
     {
-        const auto [positionOffset, vertexOffset, primitiveOffset] = meshOffsets[i];
-        pushConstants.meshOffsets = {positionOffset, vertexOffset, primitiveOffset, i};
-        vkCmdPushConstants(commandBuffer, metalRoughMaterial.opaquePipeline.layout, VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshShaderPushConstants), &pushConstants);
+        const auto [positionOffset, vertexOffset, primitiveOffset, meshletOffset] = meshOffsets[i];
+        pushConstants.meshOffsets = {positionOffset, vertexOffset, primitiveOffset, meshletOffset};
+        vkCmdPushConstants(commandBuffer, pipeline->layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshShaderPushConstants), &pushConstants);
 
-        fn_vkCmdDrawMeshTasksEXT(commandBuffer, meshletsStats[i].meshletCount / 32 + 1, 1, 1);
+        // Cluster count is padded to the workgroup size, the task shader picks the LOD cut out of every level
+        fn_vkCmdDrawMeshTasksEXT(commandBuffer, static_cast<uint32_t>(meshletsStats[i].meshletCount / TASK_SHADER_WORKGROUP_SIZE), 1, 1);
     }
 
-    EndDraw(commandBuffer, imageIndex);
+    EndDraw(commandBuffer);
 }
 
 void VkRenderer::DrawIndirect(VkCommandBuffer const &commandBuffer, uint32_t imageIndex, EngineStats &stats) {
@@ -1050,6 +1497,7 @@ void VkRenderer::Shutdown() {
 
     VK_CHECK(vkDeviceWaitIdle(device));
 
+    shaderReloader.Destroy(device);
     loadedScene.Clear(this);
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
     CloseHandle(timelineSemaphoreHandle);
@@ -1060,35 +1508,48 @@ void VkRenderer::Shutdown() {
         vkDestroySemaphore(device, frames[i].renderFinishedSemaphore, nullptr);
         vkDestroySemaphore(device, frames[i].imageAvailableSemaphore, nullptr);
 #endif
-        vkDestroyFence(device, frames[i].inFlightFence, nullptr);
         vkDestroyCommandPool(device, frames[i].commandPool, nullptr);
         frames[i].frameDescriptors.Destroy(device);
     }
 
     if (asyncCompute) {
-        vkDestroySemaphore(device, computeFinishedSemaphore, nullptr);
-        vkDestroyFence(device, computeFinishedFence, nullptr);
+        vkDestroySemaphore(device, computeTimeline, nullptr);
         vkDestroyCommandPool(device, computeCommandPool, nullptr);
     }
 
-    vkDestroySemaphore(device, depthPrepassSemaphore, nullptr);
-    vkDestroyFence(device, depthPrepassFence, nullptr);
+    vkDestroySemaphore(device, graphicsTimeline, nullptr);
+    vkDestroyQueryPool(device, timestampQueryPool, nullptr);
 
     vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
     vkDestroyCommandPool(device, transferCommandPool, nullptr);
 
-    for (const auto &shadowCascade : shadowCascades)
-    {
-        vkDestroyImageView(device, shadowCascade.shadowImageView, nullptr);
+    if (!dynamicRendering) {
+        vkDestroyFramebuffer(device, shadowMapFramebuffer, nullptr);
+        vkDestroyFramebuffer(device, shadowCacheFramebuffer, nullptr);
+    }
+
+    for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+        vkDestroyFramebuffer(device, shadowCascadeLayers[i].framebuffer, nullptr);
+        vkDestroyFramebuffer(device, shadowCacheLayers[i].framebuffer, nullptr);
+        vkDestroyImageView(device, shadowCascadeLayers[i].imageView, nullptr);
+        vkDestroyImageView(device, shadowCacheLayers[i].imageView, nullptr);
+    }
+
+    if (!useRaytracing) {
+        memoryManager.destroyImage(shadowCascadeImage, false);
+        memoryManager.destroyImage(shadowCacheImage, false);
     }
 
     CleanupSwapChain();
+    transientImages.Destroy(device, memoryManager);
+    temporalUpscaler.Destroy(device, memoryManager);
 
     vkDestroySampler(device, textureSamplerLinear, VK_NULL_HANDLE);
     vkDestroySampler(device, textureSamplerNearest, VK_NULL_HANDLE);
 
     // delete memoryManager;
     rayTracing.Destroy(device, memoryManager);
+    frameRing.Destroy(memoryManager);
     memoryManager.Shutdown();
 
     mainDescriptorAllocator.Destroy(device);
@@ -1101,8 +1562,13 @@ void VkRenderer::Shutdown() {
     vkDestroyPipeline(device, shadowMapPipeline, nullptr);
     vkDestroyPipeline(device, computePipeline, nullptr);
     vkDestroyPipeline(device, frustumPipeline, nullptr);
+    vkDestroyPipeline(device, depthReducePipeline, nullptr);
     vkDestroyPipeline(device, skyboxPipeline, nullptr);
+    vkDestroyPipeline(device, visibilityPipeline, nullptr);
+    vkDestroyPipeline(device, visibilityResolvePipeline, nullptr);
+    vkDestroyPipeline(device, mainDepthPrepassPipeline, nullptr);
     vkDestroyPipelineLayout(device, depthPrepassPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, drawDataPipelineLayout, nullptr);
     vkDestroyPipelineLayout(device, computePipelineLayout, nullptr);
     vkDestroyPipelineLayout(device, frustumPipelineLayout, nullptr);
     vkDestroyPipelineLayout(device, skyboxPipelineLayout, nullptr);
@@ -1113,7 +1579,10 @@ void VkRenderer::Shutdown() {
 
     if (!dynamicRendering) {
         vkDestroyRenderPass(device, renderPass, nullptr);
+        vkDestroyRenderPass(device, uiRenderPass, nullptr);
         vkDestroyRenderPass(device, depthPrepassRenderPass, nullptr);
+        vkDestroyRenderPass(device, shadowUpdateRenderPass, nullptr);
+        vkDestroyRenderPass(device, visibilityRenderPass, nullptr);
     }
 
     metalRoughMaterial.clearResources(device);
@@ -1149,36 +1618,34 @@ void VkRenderer::RecreateSwapChain() {
     CleanupSwapChain();
     CreateSwapChain();
     CreateDepthImage();
+    CreateVisibilityImage();
+    CreateSceneColorImage();
+    CreateVelocityImage();
+    CreateHistoryImages();
+    UpdateRenderExtent();
 #else
     if (!dynamicRendering) {
         CleanupSwapChain();
 
         CreateSwapChain();
         CreateDepthImage();
-        CreateFramebuffers();
-        UpdateDescriptorSets();
-
-        viewport.width = static_cast<float>(swapChainExtent.width);
-        viewport.height = static_cast<float>(swapChainExtent.height);
-        scissor.extent = swapChainExtent;
+        CreateVisibilityImage();
+        CreateSceneColorImage();
+        CreateVelocityImage();
+        CreateHistoryImages();
+        UpdateRenderExtent();
     }
 
 #endif
+    // Transient images were recreated under possibly reused handles, the next frame places them again and
+    // rebuilds the framebuffers and descriptor sets that view them
+    renderGraph.Reset();
     framebufferResized = false;
 }
 
 void VkRenderer::ReloadShaders()
 {
-    vkDeviceWaitIdle(device);
-    const auto start = std::chrono::high_resolution_clock::now();
-    printf("Begin reloading shaders\n");
-
-    metalRoughMaterial.clearResources(device);
-    metalRoughMaterial.buildPipelines(this);
-
-    const auto elapsed = std::chrono::high_resolution_clock::now() - start;
-    const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
-    printf("Reloaded shaders in %lldms\n", elapsedMs);
+    shaderReloader.RequestReload(true);
 }
 
 Mesh VkRenderer::CreateMesh(const std::span<VkVertex> vertices, const std::span<uint32_t> indices) {
@@ -1228,50 +1695,163 @@ Mesh VkRenderer::CreateMesh(const std::span<VkVertex> vertices, const std::span<
         });
     };
 
-    memoryManager.useStagingBuffer(stagingBufferMappedTask, stagingBufferUnmappedTask);
+    memoryManager.useStagingBuffer(stagingBufferMappedTask, stagingBufferUnmappedTask);
+
+    return mesh;
+}
+
+void VkRenderer::CreateFromMeshlets(const std::vector<VkVertex> &vertices, const std::vector<uint32_t> &indices) {
+    std::vector<meshopt_Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint8_t> meshletPrimitives;
+    std::vector<MeshletCluster> clusters;
+
+    std::vector<float> vertexPositionData(vertices.size() * 4);
+
+    for (size_t i = 0; i < vertices.size(); i += 2)
+    {
+        if (i + 1 < vertices.size()) [[likely]] {
+            // ReSharper disable CppCStyleCast
+            const auto ymm = _mm256_loadu2_m128((float *) &vertices[i + 1].pos, (float *) &vertices[i].pos);
+            _mm256_storeu_ps(vertexPositionData.data() + i * 4, ymm);
+        }
+        else
+        {
+            const auto xmm = _mm_load_ps((float *) &vertices[i].pos);
+            _mm_storeu_ps(vertexPositionData.data() + i * 4, xmm);
+            // ReSharper restore CppCStyleCast
+        }
+    }
+
+    constexpr float coneWeight = 0.0f;
+    // Builds meshlets out of clusterIndices and appends them, returns the index of the first one
+    const auto appendMeshlets = [&](const std::vector<uint32_t> &clusterIndices) {
+        const auto maxMeshlets = meshopt_buildMeshletsBound(clusterIndices.size(), MAX_MESHLET_VERTICES, MAX_MESHLET_PRIMITIVES);
+
+        std::vector<meshopt_Meshlet> levelMeshlets(maxMeshlets);
+        std::vector<uint32_t> levelVertices(maxMeshlets * MAX_MESHLET_VERTICES);
+        std::vector<uint8_t> levelPrimitives(maxMeshlets * MAX_MESHLET_PRIMITIVES * 3);
+
+        const auto levelCount = meshopt_buildMeshlets(levelMeshlets.data(), levelVertices.data(), levelPrimitives.data(),
+                                                      clusterIndices.data(), clusterIndices.size(), vertexPositionData.data(),
+                                                      vertices.size(), sizeof(glm::vec4), MAX_MESHLET_VERTICES,
+                                                      MAX_MESHLET_PRIMITIVES, coneWeight);
+
+        const auto first = meshlets.size();
+        for (size_t i = 0; i < levelCount; i++) {
+            const auto &[vertex_offset, triangle_offset, vertex_count, triangle_count] = levelMeshlets[i];
+            const auto bounds = meshopt_computeMeshletBounds(&levelVertices[vertex_offset], &levelPrimitives[triangle_offset],
+                                                             triangle_count, vertexPositionData.data(), vertices.size(),
+                                                             sizeof(glm::vec4));
+
+            meshlets.push_back({
+                static_cast<uint32_t>(meshletVertices.size()),
+                static_cast<uint32_t>(meshletPrimitives.size()),
+                vertex_count,
+                triangle_count
+            });
+            meshletVertices.insert(meshletVertices.end(), levelVertices.begin() + vertex_offset, levelVertices.begin() + vertex_offset + vertex_count);
+            meshletPrimitives.insert(meshletPrimitives.end(), levelPrimitives.begin() + triangle_offset, levelPrimitives.begin() + triangle_offset + triangle_count * 3);
+
+            const glm::vec4 sphere{bounds.center[0], bounds.center[1], bounds.center[2], bounds.radius};
+            clusters.push_back({sphere, sphere, 0.0f, FLT_MAX, 0, 0});
+        }
+
+        return first;
+    };
+
+    appendMeshlets(indices);
+
+    // Build the cluster DAG: every level groups neighbouring clusters, simplifies the group as a whole with its
+    // border locked so that it stays watertight against its neighbours, then splits the result back into meshlets
+    const auto meshScale = meshopt_simplifyScale(vertexPositionData.data(), vertices.size(), sizeof(glm::vec4));
+    std::vector<uint32_t> groupIndices;
+    std::vector<uint32_t> simplifiedIndices;
+    size_t levelBegin = 0;
+    size_t levelEnd = meshlets.size();
+    uint32_t level = 0;
+
+    while (levelEnd - levelBegin > 1 && level < MAX_CLUSTER_LEVELS)
+    {
+        for (size_t groupBegin = levelBegin; groupBegin < levelEnd; groupBegin += CLUSTER_GROUP_SIZE)
+        {
+            const auto groupEnd = std::min(groupBegin + CLUSTER_GROUP_SIZE, levelEnd);
+            if (groupEnd - groupBegin < 2)
+                continue;
+
+            groupIndices.clear();
+            float childError = 0.0f;
+            for (auto c = groupBegin; c < groupEnd; c++)
+            {
+                const auto &[vertex_offset, triangle_offset, vertex_count, triangle_count] = meshlets[c];
+                for (uint32_t i = 0; i < triangle_count * 3; i++)
+                    groupIndices.push_back(meshletVertices[vertex_offset + meshletPrimitives[triangle_offset + i]]);
+
+                childError = std::max(childError, clusters[c].error);
+            }
+
+            simplifiedIndices.resize(groupIndices.size());
+            float simplifyError = 0.0f;
+            simplifiedIndices.resize(meshopt_simplify(simplifiedIndices.data(), groupIndices.data(), groupIndices.size(),
+                                                      vertexPositionData.data(), vertices.size(), sizeof(glm::vec4),
+                                                      groupIndices.size() / 6 * 3, FLT_MAX, meshopt_SimplifyLockBorder,
+                                                      &simplifyError));
+
+            // Locked borders can stop the simplifier from making progress, those clusters stay as roots
+            if (simplifiedIndices.empty() || simplifiedIndices.size() * 100 > groupIndices.size() * 85)
+                continue;
+
+            // Bounding sphere of the group, every child and every parent shares it so the cut is consistent
+            glm::vec4 groupBounds = clusters[groupBegin].bounds;
+            for (auto c = groupBegin + 1; c < groupEnd; c++)
+            {
+                const auto &sphere = clusters[c].bounds;
+                const auto offset = glm::vec3(sphere) - glm::vec3(groupBounds);
+                const auto distance = glm::length(offset);
+                if (distance + sphere.w <= groupBounds.w)
+                    continue;
+                if (distance + groupBounds.w <= sphere.w) {
+                    groupBounds = sphere;
+                    continue;
+                }
+
+                const auto radius = (distance + groupBounds.w + sphere.w) * 0.5f;
+                groupBounds = glm::vec4(glm::vec3(groupBounds) + offset * ((radius - groupBounds.w) / distance), radius);
+            }
 
-    return mesh;
-}
+            // Parent error is always larger than the children's so the cut can't select both
+            const auto groupError = childError + simplifyError * meshScale;
 
-void VkRenderer::CreateFromMeshlets(const std::vector<VkVertex> &vertices, const std::vector<uint32_t> &indices) {
-    std::vector<meshopt_Meshlet> meshlets;
-    std::vector<uint32_t> meshletVertices;
-    std::vector<uint8_t> meshletPrimitives;
+            for (auto c = groupBegin; c < groupEnd; c++)
+            {
+                clusters[c].parentBounds = groupBounds;
+                clusters[c].parentError = groupError;
+            }
 
-    const auto maxMeshlets = meshopt_buildMeshletsBound(indices.size(), MAX_MESHLET_VERTICES, MAX_MESHLET_PRIMITIVES);
+            for (auto c = appendMeshlets(simplifiedIndices); c < clusters.size(); c++)
+            {
+                clusters[c].bounds = groupBounds;
+                clusters[c].parentBounds = groupBounds;
+                clusters[c].error = groupError;
+                clusters[c].level = level + 1;
+            }
+        }
 
-    meshlets.resize(maxMeshlets);
-    meshletVertices.resize(maxMeshlets * MAX_MESHLET_VERTICES);
-    meshletPrimitives.resize(maxMeshlets * MAX_MESHLET_PRIMITIVES);
+        if (meshlets.size() == levelEnd)
+            break;
 
-    std::vector<float> vertexPositionData(vertices.size() * 4);
+        levelBegin = levelEnd;
+        levelEnd = meshlets.size();
+        level++;
+    }
 
-    for (size_t i = 0; i < vertices.size(); i += 2)
+    // Pad to the task shader workgroup size so it never has to bounds check, padded clusters are never selected
+    while (meshlets.size() % TASK_SHADER_WORKGROUP_SIZE != 0)
     {
-        if (i + 1 < vertices.size()) [[likely]] {
-            // ReSharper disable CppCStyleCast
-            const auto ymm = _mm256_loadu2_m128((float *) &vertices[i + 1].pos, (float *) &vertices[i].pos);
-            _mm256_storeu_ps(vertexPositionData.data() + i * 4, ymm);
-        }
-        else
-        {
-            const auto xmm = _mm_load_ps((float *) &vertices[i].pos);
-            _mm_storeu_ps(vertexPositionData.data() + i * 4, xmm);
-            // ReSharper restore CppCStyleCast
-        }
+        meshlets.push_back({});
+        clusters.push_back({{}, {}, FLT_MAX, FLT_MAX, 0, 0});
     }
 
-    constexpr float coneWeight = 0.0f;
-    const auto meshletCount = meshopt_buildMeshlets(meshlets.data(), meshletVertices.data(), meshletPrimitives.data(),
-                                              indices.data(), indices.size(), vertexPositionData.data(),
-                                              vertices.size(), sizeof(glm::vec4), MAX_MESHLET_VERTICES,
-                                              MAX_MESHLET_PRIMITIVES, coneWeight);
-
-    const auto &[vertex_offset, triangle_offset, vertex_count, triangle_count] = meshlets[meshletCount - 1];
-    meshletVertices.resize(vertex_offset + vertex_count);
-    meshletPrimitives.resize(triangle_offset + triangle_count * 3);
-    meshlets.resize(meshletCount);
-
     std::vector<uint32_t> meshletPrimitivesU32;
     for (auto &[vertex_offset, triangle_offset, vertex_count, triangle_count] : meshlets) {
         const auto primitiveOffset = static_cast<uint32_t>(meshletPrimitivesU32.size());
@@ -1295,29 +1875,23 @@ void VkRenderer::CreateFromMeshlets(const std::vector<VkVertex> &vertices, const
 
     meshletsStats[meshCount] = {
         .positionCount = static_cast<uint32_t>(vertexPositionData.size()),
-        .meshletCount = static_cast<uint32_t>(meshletCount),
+        .meshletCount = static_cast<uint32_t>(meshlets.size()),
         .verticesCount = static_cast<uint32_t>(meshletVertices.size()),
         .primitiveCount = static_cast<uint32_t>(meshletPrimitivesU32.size())
     };
 
-    loadedMeshlets.resize(meshletCount);
-    vertexPositionsData.resize(vertexPositionsData.size() + vertexPositionData.size());
-    meshletsVerticesData.resize(meshletsVerticesData.size() + meshletVertices.size());
-    meshletsPrimitivesData.resize(meshletsPrimitivesData.size() + meshletPrimitivesU32.size());
-
-    memcpy(loadedMeshlets.data(), meshlets.data(), meshlets.size() * sizeof(meshopt_Meshlet));
-    memcpy(vertexPositionsData.data(), vertexPositionData.data(), vertexPositionData.size() * sizeof(float));
-    memcpy(meshletsVerticesData.data(), meshletVertices.data(), meshletVertices.size() * sizeof(uint32_t));
-    memcpy(meshletsPrimitivesData.data(), meshletPrimitivesU32.data(), meshletPrimitivesU32.size() * sizeof(uint32_t));
+    meshOffsets[meshCount] = {
+        static_cast<uint32_t>(vertexPositionsData.size() / 4),
+        static_cast<uint32_t>(meshletsVerticesData.size()),
+        static_cast<uint32_t>(meshletsPrimitivesData.size()),
+        static_cast<uint32_t>(loadedMeshlets.size())
+    };
 
-    if (meshCount < meshOffsets.size() - 1)
-    {
-        meshOffsets[meshCount + 1] = {
-            static_cast<uint32_t>(vertexPositionData.size() * 4),
-            static_cast<uint32_t>(meshletVertices.size()),
-            static_cast<uint32_t>(meshletPrimitivesU32.size())
-        };
-    }
+    loadedMeshlets.insert(loadedMeshlets.end(), meshlets.begin(), meshlets.end());
+    loadedClusters.insert(loadedClusters.end(), clusters.begin(), clusters.end());
+    vertexPositionsData.insert(vertexPositionsData.end(), vertexPositionData.begin(), vertexPositionData.end());
+    meshletsVerticesData.insert(meshletsVerticesData.end(), meshletVertices.begin(), meshletVertices.end());
+    meshletsPrimitivesData.insert(meshletsPrimitivesData.end(), meshletPrimitivesU32.begin(), meshletPrimitivesU32.end());
 
     // vertexPositionsData[meshCount] = std::move(vertexPositionData);
     // meshletsVerticesData[meshCount] = std::move(meshletVertices);
@@ -1397,15 +1971,13 @@ void VkRenderer::CreateFromMeshlets(const std::vector<VkVertex> &vertices, const
 void VkRenderer::CreateMeshletBuffers()
 {
     // const size_t meshletStatsBytesSize = meshCount * sizeof(meshopt_Meshlet);
-    size_t meshletStatsBytesSize = 0;
-    for (size_t i = 0; i < meshCount; i++)
-    {
-        meshletStatsBytesSize += meshletsStats[i].meshletCount;
-    }
-    meshletStatsBytesSize *= sizeof(meshopt_Meshlet);
+    const size_t meshletStatsBytesSize = loadedMeshlets.size() * sizeof(meshopt_Meshlet);
     const size_t vertexPositionsDataBytesSize = vertexPositionsData.size() * sizeof(float);
     const size_t meshletsVerticesDataBytesSize = meshletsVerticesData.size() * sizeof(uint32_t);
     const size_t meshletsPrimitivesDataBytesSize = meshletsPrimitivesData.size() * sizeof(uint32_t);
+    const size_t clustersBytesSize = loadedClusters.size() * sizeof(MeshletCluster);
+
+    printf("Built %zu LOD clusters for %zu meshes\n", loadedClusters.size(), meshCount);
 
     // for (size_t i = 0; i < meshCount; i++)
     // {
@@ -1418,11 +1990,13 @@ void VkRenderer::CreateMeshletBuffers()
     meshletBuffer = memoryManager.createManagedBuffer({meshletStatsBytesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
     meshletVerticesBuffer = memoryManager.createManagedBuffer({meshletsVerticesDataBytesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
     meshletPrimitivesBuffer = memoryManager.createManagedBuffer({meshletsPrimitivesDataBytesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    clusterBuffer = memoryManager.createManagedBuffer({clustersBytesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
     const auto stagingBufferSize = vertexPositionsDataBytesSize
                                             + meshletStatsBytesSize
                                             + meshletsVerticesDataBytesSize
-                                            + meshletsPrimitivesDataBytesSize;
+                                            + meshletsPrimitivesDataBytesSize
+                                            + clustersBytesSize;
 
     const auto stagingBufferMappedTask = [&](void *data)
     {
@@ -1434,6 +2008,8 @@ void VkRenderer::CreateMeshletBuffers()
         memcpy(memory, meshletsVerticesData.data(), meshletsVerticesDataBytesSize);
         memory += meshletsVerticesDataBytesSize;
         memcpy(memory, meshletsPrimitivesData.data(), meshletsPrimitivesDataBytesSize);
+        memory += meshletsPrimitivesDataBytesSize;
+        memcpy(memory, loadedClusters.data(), clustersBytesSize);
     };
 
     const auto stagingBufferUnmappedTask = [&](auto stagingBuffer)
@@ -1460,11 +2036,17 @@ void VkRenderer::CreateMeshletBuffers()
                 0,
                 meshletsPrimitivesDataBytesSize
             };
+            VkBufferCopy clusterCopyRegion{
+                meshletPrimitivesCopyRegion.srcOffset + meshletsPrimitivesDataBytesSize,
+                0,
+                clustersBytesSize
+            };
             vkCmdCopyBuffer(commandBuffer, stagingBuffer, positionBuffer.buffer, 1, &positionCopyRegion);
             vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshletBuffer.buffer, 1, &meshletCopyRegion);
             vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshletVerticesBuffer.buffer, 1, &meshletVerticesCopyRegion);
             vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshletPrimitivesBuffer.buffer, 1,
                             &meshletPrimitivesCopyRegion);
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer, clusterBuffer.buffer, 1, &clusterCopyRegion);
         });
     };
 
@@ -1520,8 +2102,10 @@ void VkRenderer::PickPhysicalDevice() {
 
     printf("Using device: %256s\n", deviceProperties.deviceName);
 
-    VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT};
-    VkPhysicalDeviceMaintenance3Properties maintenance3Properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_3_PROPERTIES, &meshShaderProperties};
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT};
+    VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT, &descriptorBufferProperties};
+    VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT pipelineLibraryProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT, &meshShaderProperties};
+    VkPhysicalDeviceMaintenance3Properties maintenance3Properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_3_PROPERTIES, &pipelineLibraryProperties};
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR raytracingProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR, &maintenance3Properties};
 
     VkPhysicalDeviceProperties2 deviceProperties2{
@@ -1540,7 +2124,40 @@ void VkRenderer::PickPhysicalDevice() {
 
     !meshShader && printf("Mesh shader not supported or turned off, falling back to VTG rendering\n");
 
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT};
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT, &descriptorBufferFeatures};
+    VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT, &pipelineLibraryFeatures};
+    VkPhysicalDeviceVulkan12Features vulkan12Features{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES, &shaderObjectFeatures};
+    VkPhysicalDeviceFeatures2 deviceFeatures2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &vulkan12Features};
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+    geometryShader = deviceFeatures2.features.geometryShader;
+    visibilityBuffer = visibilityBuffer && geometryShader;
+
+    !geometryShader && printf("Geometry shaders not supported, visibility buffer is off\n");
+
+    layeredShadows = vulkan12Features.shaderOutputLayer;
+
+    !layeredShadows && printf("gl_Layer output from vertex shaders not supported, rendering shadow cascades one pass each\n");
+
+    // Material shader objects are drawn with dynamic rendering only
+    const bool wantedShaderObjects = shaderObjects;
+    shaderObjects = shaderObjects && dynamicRendering && shaderObjectFeatures.shaderObject;
+
+    wantedShaderObjects && !shaderObjects && printf("Shader objects not supported or dynamic rendering is off, using pipelines\n");
+
+    // Without fast linking every link is a full compile, which is what the libraries are there to avoid
+    const bool wantedPipelineLibraries = pipelineLibraries;
+    pipelineLibraries = pipelineLibraries && pipelineLibraryFeatures.graphicsPipelineLibrary && pipelineLibraryProperties.graphicsPipelineLibraryFastLinking;
+
+    wantedPipelineLibraries && !pipelineLibraries && printf("Graphics pipeline libraries not supported or can't be fast linked, using complete pipelines\n");
+
     raytracingCapable = !isIntelIGPU && raytracingProperties.shaderGroupHandleSize > 0;
+
+    // Only the ray tracing pass uses it, and its texture array is written as combined image samplers
+    const bool wantedDescriptorBuffer = descriptorBuffer;
+    descriptorBuffer = descriptorBuffer && raytracingCapable && descriptorBufferFeatures.descriptorBuffer && descriptorBufferProperties.combinedImageSamplerDescriptorSingleArray;
+
+    wantedDescriptorBuffer && !descriptorBuffer && printf("Descriptor buffers not supported or ray tracing is off, using descriptor sets\n");
 }
 
 void VkRenderer::CreateLogicalDevice() {
@@ -1576,11 +2193,14 @@ void VkRenderer::CreateLogicalDevice() {
         .shaderFloat16 = VK_TRUE,
         .descriptorIndexing = VK_TRUE,
         .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingPartiallyBound = VK_TRUE,
         .runtimeDescriptorArray = VK_TRUE,
         .scalarBlockLayout = VK_TRUE,
         .hostQueryReset = VK_TRUE,
         .timelineSemaphore = VK_TRUE,
         .bufferDeviceAddress = VK_TRUE,
+        .shaderOutputLayer = layeredShadows,
     };
 
     VkPhysicalDeviceVulkan13Features vulkan13Features{
@@ -1591,10 +2211,35 @@ void VkRenderer::CreateLogicalDevice() {
         .maintenance4 = VK_TRUE
     };
 
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelineLibraryFeatures{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+        &vulkan13Features,
+        VK_TRUE
+    };
+
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+        &vulkan13Features,
+        VK_TRUE
+    };
+
+    void *optionalFeatures = descriptorBuffer ? static_cast<void *>(&descriptorBufferFeatures) : static_cast<void *>(&vulkan13Features);
+    if (pipelineLibraries)
+    {
+        pipelineLibraryFeatures.pNext = optionalFeatures;
+        optionalFeatures = &pipelineLibraryFeatures;
+    }
+
+    VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures{
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT,
+        optionalFeatures,
+        VK_TRUE
+    };
+
     VkPhysicalDeviceFeatures2 deviceFeatures2{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
-        &vulkan13Features,
-        {.multiDrawIndirect = VK_TRUE, .depthClamp = VK_TRUE, .samplerAnisotropy = VK_TRUE, .shaderInt64 = VK_TRUE, .shaderInt16 = VK_TRUE }
+        shaderObjects ? &shaderObjectFeatures : optionalFeatures,
+        {.geometryShader = geometryShader, .multiDrawIndirect = VK_TRUE, .depthClamp = VK_TRUE, .samplerAnisotropy = VK_TRUE, .shaderInt64 = VK_TRUE, .shaderInt16 = VK_TRUE }
     };
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
@@ -1651,6 +2296,12 @@ void VkRenderer::CreateLogicalDevice() {
 
     vulkan11Features.pNext = raytracingCapable ? (meshShader ? static_cast<void *>(&meshShaderFeatures) : static_cast<void *>(&rayTracingPipelineFeatures)) : VK_NULL_HANDLE;
 
+    std::vector<const char *> enabledExtensions(deviceExtensions, deviceExtensions + arraySize - !raytracingCapable * 4 - !meshShader);
+    if (shaderObjects)
+        enabledExtensions.push_back(VK_EXT_SHADER_OBJECT_EXTENSION_NAME);
+    if (descriptorBuffer)
+        enabledExtensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+
     VkDeviceCreateInfo createInfo{
         VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         &deviceFeatures2,
@@ -1659,8 +2310,8 @@ void VkRenderer::CreateLogicalDevice() {
         queueCreateInfos.data(),
         0,
         VK_NULL_HANDLE,
-        arraySize - !raytracingCapable * 4 - !meshShader,
-        deviceExtensions
+        static_cast<uint32_t>(enabledExtensions.size()),
+        enabledExtensions.data()
     };
 
 #ifndef NDEBUG
@@ -1680,8 +2331,60 @@ void VkRenderer::CreateLogicalDevice() {
     delete[] queuePriorities;
 }
 
+// Written in front of the driver's data in pipeline_cache.bin. Drivers should reject another device's or driver version's
+// data on their own, not all of them do, and none of them can tell a file that was cut short.
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+
+    bool operator==(const PipelineCacheFileHeader &) const = default;
+};
+
+static constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x48435053; // "SPCH"
+static constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+static PipelineCacheFileHeader MakePipelineCacheHeader(const VkPhysicalDeviceProperties &properties, const char *data, const size_t size) {
+    PipelineCacheFileHeader header{
+        PIPELINE_CACHE_MAGIC,
+        PIPELINE_CACHE_VERSION,
+        properties.vendorID,
+        properties.deviceID,
+        properties.driverVersion,
+        {},
+        size,
+        HashFnv1a({data, size})
+    };
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
 void VkRenderer::CreatePipelineCache() {
-    constexpr VkPipelineCacheCreateInfo pipelineCacheInfo{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    VkPipelineCacheCreateInfo pipelineCacheInfo{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+
+    // Reuse the last run's pipelines if they were compiled by this device and driver
+    const auto file = ReadFile<char>("pipeline_cache.bin");
+    if (file.size() >= sizeof(PipelineCacheFileHeader)) {
+        PipelineCacheFileHeader header;
+        memcpy(&header, file.data(), sizeof(PipelineCacheFileHeader));
+
+        const char *data = file.data() + sizeof(PipelineCacheFileHeader);
+        const size_t size = file.size() - sizeof(PipelineCacheFileHeader);
+        const auto expected = MakePipelineCacheHeader(deviceProperties, data, size);
+
+        if (header == expected) {
+            pipelineCacheInfo.initialDataSize = size;
+            pipelineCacheInfo.pInitialData = data;
+        } else {
+            printf("Discarding stale pipeline cache\n");
+        }
+    }
+
     VK_CHECK(vkCreatePipelineCache(device, &pipelineCacheInfo, VK_NULL_HANDLE, &pipelineCache));
 }
 
@@ -1763,7 +2466,7 @@ void VkRenderer::CreateSwapChain() {
             1,
             VK_SAMPLE_COUNT_1_BIT,
             VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
             VK_SHARING_MODE_EXCLUSIVE,
             0,
             VK_NULL_HANDLE,
@@ -1848,68 +2551,80 @@ void VkRenderer::CreateSwapChain() {
 
 void VkRenderer::CreateDepthImage() {
     ImageViewCreateInfo viewCreateInfo{
-        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
         .format = VK_FORMAT_D16_UNORM,
-        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, SHADOW_MAP_CASCADE_COUNT}
+        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1}
     };
 
-    shadowCascadeImage = memoryManager.createUnmanagedImage(
-            {0, VK_FORMAT_D16_UNORM, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}, VK_IMAGE_TILING_OPTIMAL,
-             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+    // Only the tile depth reduction samples depth, without it depth can live in lazily allocated memory
+    const VkImageUsageFlags usage = MayHaveDepthBeforeShading() ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+    transientImages.Add(device, memoryManager, depthImage,
+            {0, VK_FORMAT_D16_UNORM, {swapChainExtent.width, swapChainExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | usage,
              VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
              false, &viewCreateInfo});
+}
 
-    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewCreateInfo.subresourceRange.layerCount = 1;
+void VkRenderer::CreateVisibilityImage() {
+    ImageViewCreateInfo viewCreateInfo{
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R32G32_UINT,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+    };
 
-    depthImage = memoryManager.createUnmanagedImage(
-            {0, VK_FORMAT_D16_UNORM, {swapChainExtent.width, swapChainExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
-             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+    // Outside the visibility buffer path it's never used and shares memory with whatever else is placed there
+    transientImages.Add(device, memoryManager, visibilityImage,
+            {0, VK_FORMAT_R32G32_UINT, {swapChainExtent.width, swapChainExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
              VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
              false, &viewCreateInfo});
+}
 
-    if (!dynamicRendering) {
-        ImmediateSubmit([&](auto &cmd) {
-            TransitionImage(cmd, shadowCascadeImage, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
-                            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT,
-                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-
-            TransitionImage(cmd, depthImage, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
-                            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT,
-                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-                            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-        });
-    }
+// Scene color has the swap chain's format, and the resolution changes with the render scale. Instead of recreating the
+// image, the scene is drawn into its top left corner and the temporal upscaler reads that corner.
+void VkRenderer::CreateSceneColorImage() {
+    ImageViewCreateInfo viewCreateInfo{
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = surfaceFormat.format,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
+    };
 
-    constexpr VkSamplerCreateInfo samplerInfo{
-            VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-            VK_NULL_HANDLE,
-            0,
-            VK_FILTER_LINEAR,
-            VK_FILTER_LINEAR,
-            VK_SAMPLER_MIPMAP_MODE_LINEAR,
-            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-            0.0f,
-            VK_FALSE,
-            1.0f,
-            VK_FALSE,
-            VK_COMPARE_OP_NEVER,
-            0.0f,
-            1.0f,
-            VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
-            VK_FALSE
+    transientImages.Add(device, memoryManager, sceneColorImage,
+            {0, surfaceFormat.format, {swapChainExtent.width, swapChainExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+             VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+             false, &viewCreateInfo});
+}
+
+// Same corner as scene color, only read by the resolve of the same frame
+void VkRenderer::CreateVelocityImage() {
+    ImageViewCreateInfo viewCreateInfo{
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = velocityFormat,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
     };
 
-    VK_CHECK(vkCreateSampler(device, &samplerInfo, VK_NULL_HANDLE, &shadowCascadeImage.sampler));
+    transientImages.Add(device, memoryManager, velocityImage,
+            {0, velocityFormat, {swapChainExtent.width, swapChainExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+             VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+             false, &viewCreateInfo});
+}
+
+// The resolved image is blitted onto the swap chain at full size
+void VkRenderer::CreateHistoryImages() {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, surfaceFormat.format, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) [[unlikely]]
+        throw std::runtime_error("Swap chain format can't be blitted!");
+
+    temporalUpscaler.CreateHistory(memoryManager, swapChainExtent);
 }
 
 void VkRenderer::CreateRenderPass() {
-    VkAttachmentDescription swapChainImageDescription{
+    // Left for the temporal upscaler to sample
+    VkAttachmentDescription sceneColorDescription{
         0,
         surfaceFormat.format,
         msaaSamples,
@@ -1918,14 +2633,28 @@ void VkRenderer::CreateRenderPass() {
         VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         VK_ATTACHMENT_STORE_OP_DONT_CARE,
         VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+
+    // Cleared to no motion, which is what the sky gets wherever nothing else is drawn
+    VkAttachmentDescription velocityDescription{
+        0,
+        velocityFormat,
+        msaaSamples,
+        VK_ATTACHMENT_LOAD_OP_CLEAR,
+        VK_ATTACHMENT_STORE_OP_STORE,
+        VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
     };
 
+    // Without an earlier depth pass the main pass is the only one touching depth, so it never has to leave tile memory
     VkAttachmentDescription mainDepthImageDescription{
         0,
         VK_FORMAT_D16_UNORM,
         msaaSamples,
-        VK_ATTACHMENT_LOAD_OP_LOAD,
+        MayHaveDepthBeforeShading() ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
         VK_ATTACHMENT_STORE_OP_NONE,
         VK_ATTACHMENT_LOAD_OP_DONT_CARE,
         VK_ATTACHMENT_STORE_OP_DONT_CARE,
@@ -1943,13 +2672,18 @@ void VkRenderer::CreateRenderPass() {
         VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
     };
 
+    constexpr std::array<VkAttachmentReference, 2> mainColorAttachmentRefs{
+        colorAttachmentRef,
+        {2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+    };
+
     VkSubpassDescription graphicsSubpass{
         0,
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         0,
         VK_NULL_HANDLE,
-        1,
-        &colorAttachmentRef,
+        mainColorAttachmentRefs.size(),
+        mainColorAttachmentRefs.data(),
         VK_NULL_HANDLE,
         &mainDepthAttachmentRef,
         0,
@@ -1974,7 +2708,7 @@ void VkRenderer::CreateRenderPass() {
             VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
     };
 
-    std::array attachments = {swapChainImageDescription, mainDepthImageDescription};
+    std::array attachments = {sceneColorDescription, mainDepthImageDescription, velocityDescription};
     constexpr std::array dependencies = {computeDependency, mainDepthPrepassDependency};
     const VkRenderPassCreateInfo renderPassInfo{
         VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
@@ -1990,6 +2724,40 @@ void VkRenderer::CreateRenderPass() {
 
     VK_CHECK(vkCreateRenderPass(device, &renderPassInfo, VK_NULL_HANDLE, &renderPass));
 
+    // The UI is drawn over the upscaled scene, which the blit left in TRANSFER_DST
+    const VkAttachmentDescription uiImageDescription{
+        0,
+        surfaceFormat.format,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_ATTACHMENT_LOAD_OP_LOAD,
+        VK_ATTACHMENT_STORE_OP_STORE,
+        VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    };
+
+    const VkSubpassDescription uiSubpass{
+        0,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        0,
+        VK_NULL_HANDLE,
+        1,
+        &colorAttachmentRef
+    };
+
+    const VkRenderPassCreateInfo uiRenderPassInfo{
+        VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &uiImageDescription,
+        1,
+        &uiSubpass
+    };
+
+    VK_CHECK(vkCreateRenderPass(device, &uiRenderPassInfo, VK_NULL_HANDLE, &uiRenderPass));
+
     static constexpr VkAttachmentDescription depthImageDescription{
             0,
             VK_FORMAT_D16_UNORM,
@@ -2002,58 +2770,162 @@ void VkRenderer::CreateRenderPass() {
             VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
     };
 
-    static constexpr VkAttachmentReference depthAttachmentRef{
-            0,
-            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    static constexpr VkAttachmentReference depthAttachmentRef{
+            0,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+
+    static constexpr VkSubpassDescription depthPrepassSubpass{
+        0,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        0,
+        VK_NULL_HANDLE,
+        0,
+        VK_NULL_HANDLE,
+        VK_NULL_HANDLE,
+        &depthAttachmentRef,
+        0,
+        VK_NULL_HANDLE
+    };
+
+    constexpr VkSubpassDependency depthPrepassDependency{
+        VK_SUBPASS_EXTERNAL,
+        0,
+        VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_DEPENDENCY_BY_REGION_BIT
+    };
+
+    constexpr VkSubpassDependency depthPrepassPostDependency{
+            0,
+            VK_SUBPASS_EXTERNAL,
+            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_SHADER_READ_BIT,
+            VK_DEPENDENCY_BY_REGION_BIT
+    };
+
+    static constexpr std::array depthDependencies = {depthPrepassDependency, depthPrepassPostDependency};
+    static constexpr VkRenderPassCreateInfo depthPrepassRenderPassInfo{
+        VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &depthImageDescription,
+        1,
+        &depthPrepassSubpass,
+        depthDependencies.size(),
+        depthDependencies.data()
+    };
+
+    VK_CHECK(vkCreateRenderPass(device, &depthPrepassRenderPassInfo, VK_NULL_HANDLE, &depthPrepassRenderPass));
+
+    // Barriers around cascade updates are recorded explicitly, so no subpass dependencies are needed here
+    static constexpr VkAttachmentDescription shadowUpdateDescription{
+            0,
+            VK_FORMAT_D16_UNORM,
+            msaaSamples,
+            VK_ATTACHMENT_LOAD_OP_LOAD,
+            VK_ATTACHMENT_STORE_OP_STORE,
+            VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+
+    static constexpr VkRenderPassCreateInfo shadowUpdateRenderPassInfo{
+        VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &shadowUpdateDescription,
+        1,
+        &depthPrepassSubpass,
+        0,
+        VK_NULL_HANDLE
+    };
+
+    VK_CHECK(vkCreateRenderPass(device, &shadowUpdateRenderPassInfo, VK_NULL_HANDLE, &shadowUpdateRenderPass));
+
+    static constexpr VkAttachmentDescription visibilityImageDescription{
+        0,
+        VK_FORMAT_R32G32_UINT,
+        msaaSamples,
+        VK_ATTACHMENT_LOAD_OP_CLEAR,
+        VK_ATTACHMENT_STORE_OP_STORE,
+        VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+
+    // Left in the layout the main pass loads it from
+    static constexpr VkAttachmentDescription visibilityDepthDescription{
+        0,
+        VK_FORMAT_D16_UNORM,
+        msaaSamples,
+        VK_ATTACHMENT_LOAD_OP_CLEAR,
+        VK_ATTACHMENT_STORE_OP_STORE,
+        VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+    };
+
+    static constexpr VkAttachmentReference visibilityDepthAttachmentRef{
+        1,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
     };
 
-    static constexpr VkSubpassDescription depthPrepassSubpass{
+    static constexpr VkSubpassDescription visibilitySubpass{
         0,
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         0,
         VK_NULL_HANDLE,
-        0,
-        VK_NULL_HANDLE,
+        1,
+        &colorAttachmentRef,
         VK_NULL_HANDLE,
-        &depthAttachmentRef,
+        &visibilityDepthAttachmentRef,
         0,
         VK_NULL_HANDLE
     };
 
-    constexpr VkSubpassDependency depthPrepassDependency{
+    constexpr VkSubpassDependency visibilityDependency{
         VK_SUBPASS_EXTERNAL,
         0,
-        VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
-        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
         VK_ACCESS_SHADER_READ_BIT,
-        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        VK_DEPENDENCY_BY_REGION_BIT
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
     };
 
-    constexpr VkSubpassDependency depthPrepassPostDependency{
-            0,
-            VK_SUBPASS_EXTERNAL,
-            VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-            VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
-            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-            VK_ACCESS_SHADER_READ_BIT,
-            VK_DEPENDENCY_BY_REGION_BIT
+    constexpr VkSubpassDependency visibilityPostDependency{
+        0,
+        VK_SUBPASS_EXTERNAL,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
     };
 
-    static constexpr std::array depthDependencies = {depthPrepassDependency, depthPrepassPostDependency};
-    static constexpr VkRenderPassCreateInfo depthPrepassRenderPassInfo{
+    static constexpr std::array visibilityAttachments = {visibilityImageDescription, visibilityDepthDescription};
+    static constexpr std::array visibilityDependencies = {visibilityDependency, visibilityPostDependency};
+    static constexpr VkRenderPassCreateInfo visibilityRenderPassInfo{
         VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
         VK_NULL_HANDLE,
         0,
+        visibilityAttachments.size(),
+        visibilityAttachments.data(),
         1,
-        &depthImageDescription,
-        1,
-        &depthPrepassSubpass,
-        depthDependencies.size(),
-        depthDependencies.data()
+        &visibilitySubpass,
+        visibilityDependencies.size(),
+        visibilityDependencies.data()
     };
 
-    VK_CHECK(vkCreateRenderPass(device, &depthPrepassRenderPassInfo, VK_NULL_HANDLE, &depthPrepassRenderPass));
+    VK_CHECK(vkCreateRenderPass(device, &visibilityRenderPassInfo, VK_NULL_HANDLE, &visibilityRenderPass));
 }
 
 void VkRenderer::CreatePipelineLayout() {
@@ -2078,7 +2950,7 @@ void VkRenderer::CreatePipelineLayout() {
     constexpr VkPushConstantRange skyboxPushConstantRange{
         VK_SHADER_STAGE_VERTEX_BIT,
         0,
-        sizeof(glm::vec4) * 3
+        sizeof(SkyboxPushConstants)
     };
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{
@@ -2109,8 +2981,8 @@ void VkRenderer::CreatePipelineLayout() {
     VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, VK_NULL_HANDLE, &skyboxPipelineLayout));
 }
 
-void VkRenderer::CreateGraphicsPipeline() {
-    metalRoughMaterial.buildPipelines(this);
+void VkRenderer::CreateGraphicsPipeline(VkPipelineCompiler &compiler) {
+    metalRoughMaterial.buildPipelines(this, compiler);
     if (useRaytracing) return;
 
     constexpr VkPushConstantRange depthPassPushConstantRange{
@@ -2135,7 +3007,7 @@ void VkRenderer::CreateGraphicsPipeline() {
 
     VkGraphicsPipelineBuilder builder;
     builder.SetPipelineLayout(depthPrepassPipelineLayout);
-    builder.CreateShaderModules(device, "shaders/depth_prepass.vert.spv", "");
+    builder.CreateShaderModules(device, layeredShadows ? "shaders/depth_prepass.vert.spv" : "shaders/depth_prepass_cascade.vert.spv", "");
     builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
     builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
     builder.SetCullingMode(VK_CULL_MODE_FRONT_BIT, VK_FRONT_FACE_CLOCKWISE);
@@ -2158,9 +3030,9 @@ void VkRenderer::CreateGraphicsPipeline() {
     if (dynamicRendering)
         builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
 
-    depthPrepassPipeline = builder.Build(dynamicRendering, device, pipelineCache, depthPrepassRenderPass, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, specializationInfo});
+    builder.Build(compiler, &depthPrepassPipeline, dynamicRendering, depthPrepassRenderPass, {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, specializationInfo});
 
-    builder.DestroyShaderModules(device);
+    builder.DestroyShaderModules(compiler);
 
     builder.Clear();
     builder.SetPipelineLayout(depthPrepassPipelineLayout);
@@ -2175,9 +3047,9 @@ void VkRenderer::CreateGraphicsPipeline() {
         builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
     }
 
-    shadowMapPipeline = builder.Build(dynamicRendering, device, pipelineCache, depthPrepassRenderPass);
+    builder.Build(compiler, &shadowMapPipeline, dynamicRendering, depthPrepassRenderPass);
 
-    builder.DestroyShaderModules(device);
+    builder.DestroyShaderModules(compiler);
 
     builder.Clear();
     builder.SetPipelineLayout(skyboxPipelineLayout);
@@ -2186,25 +3058,99 @@ void VkRenderer::CreateGraphicsPipeline() {
     builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
     builder.SetCullingMode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
     builder.EnableDepthTest(false, VK_COMPARE_OP_LESS);
+    builder.AddVelocityAttachment(velocityFormat);
 
     if (dynamicRendering) {
         builder.SetColorAttachmentFormat(surfaceFormat.format);
         builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
     }
 
-    skyboxPipeline = builder.Build(dynamicRendering, device, pipelineCache, renderPass);
+    builder.Build(compiler, &skyboxPipeline, dynamicRendering, renderPass);
+
+    builder.DestroyShaderModules(compiler);
+
+    if (meshShader) return;
+
+    // The draw data address is needed by the vertex stage to rasterize and by the resolve to refetch triangles
+    constexpr VkPushConstantRange visibilityPushConstantRange{
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            0,
+            sizeof(MeshPushConstants)
+    };
+
+    const std::array visibilityLayouts = {sceneDescriptorSetLayout, metalRoughMaterial.materialLayout, mainDescriptorSetLayout};
+    pipelineLayoutInfo.setLayoutCount = visibilityLayouts.size();
+    pipelineLayoutInfo.pSetLayouts = visibilityLayouts.data();
+    pipelineLayoutInfo.pPushConstantRanges = &visibilityPushConstantRange;
+
+    VK_CHECK(vkCreatePipelineLayout(device, &pipelineLayoutInfo, VK_NULL_HANDLE, &drawDataPipelineLayout));
+
+    // Visibility buffer mode stays off without geometry shaders, so these are never bound
+    if (geometryShader) {
+        builder.Clear();
+        builder.SetPipelineLayout(drawDataPipelineLayout);
+        builder.CreateShaderModules(device, "shaders/visibility.vert.spv", "shaders/visibility.frag.spv");
+        builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+        builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+        builder.EnableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+
+        if (dynamicRendering) {
+            builder.SetColorAttachmentFormat(VK_FORMAT_R32G32_UINT);
+            builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
+        }
+
+        builder.Build(compiler, &visibilityPipeline, dynamicRendering, visibilityRenderPass);
+
+        builder.DestroyShaderModules(compiler);
+
+        // Shades like the opaque material permutation
+        const auto resolveSpecialization = metalRoughMaterial.features.Specialization();
+
+        builder.Clear();
+        builder.SetPipelineLayout(drawDataPipelineLayout);
+        builder.CreateShaderModules(device, "shaders/rtmesh.vert.spv", "shaders/visibility_resolve.frag.spv");
+        builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+        builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+        builder.EnableDepthTest(false, VK_COMPARE_OP_ALWAYS);
+        builder.AddVelocityAttachment(velocityFormat);
+
+        if (dynamicRendering) {
+            builder.SetColorAttachmentFormat(surfaceFormat.format);
+            builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
+        }
+
+        builder.Build(compiler, &visibilityResolvePipeline, dynamicRendering, renderPass, resolveSpecialization.Info(VK_SHADER_STAGE_FRAGMENT_BIT));
+
+        builder.DestroyShaderModules(compiler);
+    }
+
+    // Culling and depth state have to match the opaque material pipeline, otherwise the EQUAL test in the color pass drops fragments
+    builder.Clear();
+    builder.SetPipelineLayout(drawDataPipelineLayout);
+    builder.CreateShaderModules(device, "shaders/main_depth_prepass.vert.spv", "");
+    builder.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.SetPolygonMode(VK_POLYGON_MODE_FILL);
+    builder.SetCullingMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    builder.EnableDepthTest(true, VK_COMPARE_OP_LESS_OR_EQUAL);
+
+    if (dynamicRendering)
+        builder.SetDepthFormat(VK_FORMAT_D16_UNORM);
+
+    builder.Build(compiler, &mainDepthPrepassPipeline, dynamicRendering, depthPrepassRenderPass);
 
-    builder.DestroyShaderModules(device);
+    builder.DestroyShaderModules(compiler);
 }
 
-void VkRenderer::CreateComputePipeline() {
-    auto computeShaderCode = ReadFile<uint32_t>("shaders/light_culling.comp.spv");
+void VkRenderer::CreateComputePipeline(VkPipelineCompiler &compiler) {
+    auto computeShaderCode = RequireShader("shaders/light_culling.comp.spv");
 
     VkShaderModuleCreateInfo computeShaderModuleCreateInfo{
         VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         VK_NULL_HANDLE,
         0,
-        computeShaderCode.size(),
+        computeShaderCode.size() * sizeof(uint32_t),
         computeShaderCode.data()
     };
 
@@ -2232,13 +3178,11 @@ void VkRenderer::CreateComputePipeline() {
         -1
     };
 
-    VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, VK_NULL_HANDLE, &computePipeline));
+    compiler.AddCompute(&computePipeline, pipelineInfo, "shaders/light_culling.comp.spv");
 
-    vkDestroyShaderModule(device, computeShaderModule, VK_NULL_HANDLE);
+    auto frustumShaderCode = RequireShader("shaders/frustum.comp.spv");
 
-    auto frustumShaderCode = ReadFile<uint32_t>("shaders/frustum.comp.spv");
-
-    computeShaderModuleCreateInfo.codeSize = frustumShaderCode.size();
+    computeShaderModuleCreateInfo.codeSize = frustumShaderCode.size() * sizeof(uint32_t);
     computeShaderModuleCreateInfo.pCode = frustumShaderCode.data();
 
     VK_CHECK(vkCreateShaderModule(device, &computeShaderModuleCreateInfo, VK_NULL_HANDLE, &computeShaderModule));
@@ -2248,22 +3192,34 @@ void VkRenderer::CreateComputePipeline() {
     pipelineInfo.stage = computeShaderStageInfo;
     pipelineInfo.layout = frustumPipelineLayout;
 
-    VK_CHECK(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, VK_NULL_HANDLE, &frustumPipeline));
+    compiler.AddCompute(&frustumPipeline, pipelineInfo, "shaders/frustum.comp.spv");
+
+    auto depthReduceShaderCode = RequireShader("shaders/depth_reduce.comp.spv");
+
+    computeShaderModuleCreateInfo.codeSize = depthReduceShaderCode.size() * sizeof(uint32_t);
+    computeShaderModuleCreateInfo.pCode = depthReduceShaderCode.data();
+
+    VK_CHECK(vkCreateShaderModule(device, &computeShaderModuleCreateInfo, VK_NULL_HANDLE, &computeShaderModule));
+
+    computeShaderStageInfo.module = computeShaderModule;
+
+    // Shares the light culling layout, it only needs the main set
+    pipelineInfo.stage = computeShaderStageInfo;
+    pipelineInfo.layout = computePipelineLayout;
 
-    vkDestroyShaderModule(device, computeShaderModule, VK_NULL_HANDLE);
+    compiler.AddCompute(&depthReducePipeline, pipelineInfo, "shaders/depth_reduce.comp.spv");
 }
 
 void VkRenderer::CreateFramebuffers() {
     swapChainFramebuffers.resize(swapChainImageViews.size());
     for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-        std::array attachments = {swapChainImageViews[i], depthImage.imageView};
         VkFramebufferCreateInfo framebufferInfo{
             VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
             VK_NULL_HANDLE,
             0,
-            renderPass,
-            attachments.size(),
-            attachments.data(),
+            uiRenderPass,
+            1,
+            &swapChainImageViews[i],
             swapChainExtent.width,
             swapChainExtent.height,
             1
@@ -2271,6 +3227,21 @@ void VkRenderer::CreateFramebuffers() {
         VK_CHECK(vkCreateFramebuffer(device, &framebufferInfo, VK_NULL_HANDLE, &swapChainFramebuffers[i]));
     }
 
+    const std::array sceneAttachments = {sceneColorImage.imageView, depthImage.imageView, velocityImage.imageView};
+    const VkFramebufferCreateInfo sceneFramebufferInfo{
+        VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        renderPass,
+        sceneAttachments.size(),
+        sceneAttachments.data(),
+        swapChainExtent.width,
+        swapChainExtent.height,
+        1
+    };
+
+    VK_CHECK(vkCreateFramebuffer(device, &sceneFramebufferInfo, VK_NULL_HANDLE, &sceneFramebuffer));
+
     VkFramebufferCreateInfo depthPrepassFramebufferInfo{
         VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
         VK_NULL_HANDLE,
@@ -2284,6 +3255,21 @@ void VkRenderer::CreateFramebuffers() {
     };
 
     VK_CHECK(vkCreateFramebuffer(device, &depthPrepassFramebufferInfo, VK_NULL_HANDLE, &depthPrepassFramebuffer));
+
+    const std::array visibilityAttachments = {visibilityImage.imageView, depthImage.imageView};
+    const VkFramebufferCreateInfo visibilityFramebufferInfo{
+        VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        VK_NULL_HANDLE,
+        0,
+        visibilityRenderPass,
+        visibilityAttachments.size(),
+        visibilityAttachments.data(),
+        swapChainExtent.width,
+        swapChainExtent.height,
+        1
+    };
+
+    VK_CHECK(vkCreateFramebuffer(device, &visibilityFramebufferInfo, VK_NULL_HANDLE, &visibilityFramebuffer));
 }
 
 void VkRenderer::CreateCommandPool() {
@@ -2323,16 +3309,14 @@ void VkRenderer::CreateCommandBuffers() {
             1
     };
 
-    VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &depthPrepassCommandBuffer));
-
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         allocInfo.commandPool = frames[i].commandPool;
         VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &frames[i].commandBuffer));
-    }
 
-    if (asyncCompute) {
-        allocInfo.commandPool = computeCommandPool;
-        VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &computeCommandBuffer));
+        if (asyncCompute) {
+            allocInfo.commandPool = computeCommandPool;
+            VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &frames[i].computeCommandBuffer));
+        }
     }
 }
 
@@ -2380,19 +3364,31 @@ void VkRenderer::CreateSyncObjects() {
 #endif
     VkSemaphoreCreateInfo semaphoreInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
 
-    static constexpr VkFenceCreateInfo fenceInfo{
-        VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    static constexpr VkSemaphoreTypeCreateInfo timelineTypeInfo{
+        VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
         VK_NULL_HANDLE,
-        VK_FENCE_CREATE_SIGNALED_BIT
+        VK_SEMAPHORE_TYPE_TIMELINE,
+        0
     };
 
-    if (asyncCompute) {
-        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, VK_NULL_HANDLE, &computeFinishedSemaphore));
-        VK_CHECK(vkCreateFence(device, &fenceInfo, VK_NULL_HANDLE, &computeFinishedFence));
-    }
+    const VkSemaphoreCreateInfo timelineInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &timelineTypeInfo};
+
+    VK_CHECK(vkCreateSemaphore(device, &timelineInfo, VK_NULL_HANDLE, &graphicsTimeline));
+    if (asyncCompute)
+        VK_CHECK(vkCreateSemaphore(device, &timelineInfo, VK_NULL_HANDLE, &computeTimeline));
+
+    // Start and end of every frame slot's GPU work. Without timestamps on the graphics queue the render scale stays put.
+    if (deviceProperties.limits.timestampComputeAndGraphics) {
+        const VkQueryPoolCreateInfo queryPoolInfo{
+            VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            VK_NULL_HANDLE,
+            0,
+            VK_QUERY_TYPE_TIMESTAMP,
+            MAX_FRAMES_IN_FLIGHT * 2
+        };
 
-    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, VK_NULL_HANDLE, &depthPrepassSemaphore));
-    VK_CHECK(vkCreateFence(device, &fenceInfo, VK_NULL_HANDLE, &depthPrepassFence));
+        VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, VK_NULL_HANDLE, &timestampQueryPool));
+    }
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
     semaphoreInfo.pNext = &semaphoreTypeCreateInfo;
@@ -2400,21 +3396,21 @@ void VkRenderer::CreateSyncObjects() {
     semaphoreHandleInfo.semaphore = timelineSemaphore;
     VK_CHECK(fn_vkGetSemaphoreWin32HandleKHR(device, &semaphoreHandleInfo, &timelineSemaphoreHandle));
     ThrowIfFailed(d3dDevice->OpenSharedHandle(timelineSemaphoreHandle, __uuidof(ID3D12Fence), &sharedFence));
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 #else
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, VK_NULL_HANDLE, &frames[i].imageAvailableSemaphore));
         VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, VK_NULL_HANDLE, &frames[i].renderFinishedSemaphore));
-#endif
-        VK_CHECK(vkCreateFence(device, &fenceInfo, VK_NULL_HANDLE, &frames[i].inFlightFence));
     }
+#endif
 }
 
 void VkRenderer::CreateDescriptors() {
     static constexpr DescriptorAllocator::PoolSizeRatio sizes[] = {
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 4},
         {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2},
     };
 
     mainDescriptorAllocator.InitPool(device, 10, sizes);
@@ -2422,7 +3418,10 @@ void VkRenderer::CreateDescriptors() {
     DescriptorLayoutBuilder builder;
     builder.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
     builder.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-    builder.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    builder.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    builder.AddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    builder.AddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+    builder.AddBinding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
     mainDescriptorSetLayout = builder.Build(device);
 
     builder.Clear();
@@ -2433,6 +3432,8 @@ void VkRenderer::CreateDescriptors() {
 
     VkDescriptorSetLayout layouts[] = {mainDescriptorSetLayout};
     mainDescriptorSet = mainDescriptorAllocator.Allocate(device, layouts);
+    layouts[0] = frustumDescriptorSetLayout;
+    frustumDescriptorSet = mainDescriptorAllocator.Allocate(device, layouts);
     if (useRaytracing)
     {
         builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
@@ -2443,10 +3444,10 @@ void VkRenderer::CreateDescriptors() {
     }
     else
     {
-        builder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT);
-        builder.AddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        builder.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        builder.AddBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT | VK_SHADER_STAGE_FRAGMENT_BIT);
         builder.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-        builder.AddBinding(3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT);
+        builder.AddBinding(3, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_MESH_BIT_EXT | (meshShader ? VK_SHADER_STAGE_TASK_BIT_EXT : 0));
 
         if (meshShader) {
             builder.AddBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
@@ -2454,9 +3455,16 @@ void VkRenderer::CreateDescriptors() {
             builder.AddBinding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
             builder.AddBinding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_MESH_BIT_EXT);
             builder.AddBinding(8, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+            builder.AddBinding(9, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_TASK_BIT_EXT);
+        } else {
+            builder.AddBinding(11, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
         }
 
-        sceneDescriptorSetLayout = builder.Build(device, VK_NULL_HANDLE, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT);
+        // Declared either way so the scene set always takes SCENE_DYNAMIC_OFFSET_COUNT offsets, only the task shader reads it
+        builder.AddBinding(10, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, meshShader ? VK_SHADER_STAGE_TASK_BIT_EXT : 0);
+
+        // Dynamic uniform buffers can't live in an update-after-bind layout, the set is only rewritten while idle
+        sceneDescriptorSetLayout = builder.Build(device);
 
         builder.Clear();
         builder.AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
@@ -2602,38 +3610,65 @@ VkExtent2D VkRenderer::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabili
 
 void VkRenderer::CleanupSwapChain()
 {
-    for (const auto &f: swapChainFramebuffers) {
-        vkDestroyFramebuffer(device, f, nullptr);
-    }
+    DestroyFramebuffers();
 
     for (const auto &imageView: swapChainImageViews) {
         vkDestroyImageView(device, imageView, nullptr);
     }
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
-    memoryManager.destroyImage(shadowCascadeImage, false);
-    memoryManager.destroyImage(depthImage, false);
     for (int i = 0; i < swapChainImages.size(); i++) {
         memoryManager.destroyExternalImageMemory(swapChainImages[i], swapChainMemory[i]);
     }
 #else
-    vkDestroyFramebuffer(device, depthPrepassFramebuffer, nullptr);
-    memoryManager.destroyImage(shadowCascadeImage, false);
-    memoryManager.destroyImage(depthImage, false);
     vkDestroySwapchainKHR(device, swapChain, nullptr);
 #endif
 }
 
+// Handles are cleared, the framebuffers may be destroyed again before they're recreated
+void VkRenderer::DestroyFramebuffers() {
+    for (auto &f: swapChainFramebuffers) {
+        vkDestroyFramebuffer(device, f, nullptr);
+        f = VK_NULL_HANDLE;
+    }
+
+    vkDestroyFramebuffer(device, sceneFramebuffer, nullptr);
+    vkDestroyFramebuffer(device, depthPrepassFramebuffer, nullptr);
+    vkDestroyFramebuffer(device, visibilityFramebuffer, nullptr);
+    sceneFramebuffer = VK_NULL_HANDLE;
+    depthPrepassFramebuffer = VK_NULL_HANDLE;
+    visibilityFramebuffer = VK_NULL_HANDLE;
+}
+
 void VkRenderer::SavePipelineCache() const {
     size_t size;
     vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
 
-    std::vector<char> data(size);
-    vkGetPipelineCacheData(device, pipelineCache, &size, data.data());
+    std::vector<char> data(sizeof(PipelineCacheFileHeader) + size);
+    vkGetPipelineCacheData(device, pipelineCache, &size, data.data() + sizeof(PipelineCacheFileHeader));
+
+    const auto header = MakePipelineCacheHeader(deviceProperties, data.data() + sizeof(PipelineCacheFileHeader), size);
+    memcpy(data.data(), &header, sizeof(PipelineCacheFileHeader));
 
-    WriteFile("pipeline_cache.bin", data.data(), static_cast<std::streamsize>(size));
+    WriteFile("pipeline_cache.bin", data.data(), static_cast<std::streamsize>(sizeof(PipelineCacheFileHeader) + size));
 }
 
+void VkRenderer::WaitForTimeline(VkSemaphore semaphore, const uint64_t value) const {
+    const VkSemaphoreWaitInfo waitInfo{
+        VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        VK_NULL_HANDLE,
+        0,
+        1,
+        &semaphore,
+        &value
+    };
+
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
+
+// Splits are recomputed every frame, each cascade's matrix only when its CASCADE_UPDATE_INTERVALS slot comes up.
+// Fitting a bounding sphere keeps the extent constant under rotation and snapping its center to whole texels in light
+// space keeps edges from shimmering, it also keeps the matrix bit for bit identical until the camera moves a texel.
 void VkRenderer::UpdateCascades() {
     const float nearClip = camera->nearPlane;
     const float farClip = camera->farPlane;
@@ -2645,6 +3680,13 @@ void VkRenderer::UpdateCascades() {
     const float range = maxZ - minZ;
     const float ratio = maxZ / minZ;
 
+    const auto inv = inverse(camera->UnjitteredProjectionMatrix() * camera->ViewMatrix());
+    const glm::vec3 lightDir = glm::normalize(glm::vec3{1.0f, -4.0f, 1.0f});
+    const auto lightRotation = lookAt(glm::vec3(0.0f), lightDir, camera->worldUp);
+    const auto inverseLightRotation = inverse(lightRotation);
+
+    cascadeUpdateMask = 0;
+
     float lastSplitDist = 0.0;
     for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
         constexpr float cascadeSplitLambda = 0.95f;
@@ -2654,6 +3696,12 @@ void VkRenderer::UpdateCascades() {
         float d = cascadeSplitLambda * (log - uniform) + uniform;
 
         float splitDist = (d - nearClip) / clipRange;
+        cascadeSplits.arr[i] = -d;
+
+        if (cascadeFrameIndex % CASCADE_UPDATE_INTERVALS[i] != 0) {
+            lastSplitDist = splitDist;
+            continue;
+        }
 
         glm::vec3 corners[]{
                 glm::vec3(-1.0f, 1.0f, 0.0f),
@@ -2665,7 +3713,6 @@ void VkRenderer::UpdateCascades() {
                 glm::vec3( 1.0f,-1.0f, 1.0f),
                 glm::vec3(-1.0f,-1.0f, 1.0f),
         };
-        auto inv = inverse(camera->ProjectionMatrix() * camera->ViewMatrix());
 
         for (auto &corner : corners) {
             auto invCorner = inv * glm::vec4(corner, 1.0f);
@@ -2685,38 +3732,71 @@ void VkRenderer::UpdateCascades() {
         frustumCenter /= 8.0f;
 
         float radius = 0.0f;
+        float cameraDistance = 0.0f;
         for (auto &corner : corners) {
             float distance = length(corner - frustumCenter);
             radius = std::max(radius, distance);
+            cameraDistance = std::max(cameraDistance, length(corner - camera->position));
         }
 
+        // Turning the camera by up to LATE_LATCH_MAX_ANGLE moves no point of the slice further than this
+        radius += 2.0f * cameraDistance * std::sin(LATE_LATCH_MAX_ANGLE * 0.5f);
         radius = std::ceil(radius * 16.0f) / 16.0f;
 
+        const float texelSize = 2.0f * radius / static_cast<float>(SHADOW_MAP_SIZE);
+        const auto lightSpaceCenter = glm::floor(glm::vec3(lightRotation * glm::vec4(frustumCenter, 1.0f)) / texelSize) * texelSize;
+        frustumCenter = glm::vec3(inverseLightRotation * glm::vec4(lightSpaceCenter, 1.0f));
+
         auto maxExtents = glm::vec3(radius);
         auto minExtents = -maxExtents;
 
-        const glm::vec3 lightDir = glm::normalize(glm::vec3{1.0f, -4.0f, 1.0f});
         auto lightView = lookAt(frustumCenter - lightDir * maxExtents.z, frustumCenter, camera->worldUp);
         auto lightOrtho = glm::ortho(minExtents.x, maxExtents.x, minExtents.y, maxExtents.y, minExtents.z, maxExtents.z);
 
         lightOrtho[1][1] *= -1.0f;
 
-        cascadeSplits.arr[i] = -d;
-        cascadeViewProjections[i] = lightOrtho * lightView;
+        const auto viewProjection = lightOrtho * lightView;
+        if (viewProjection != cascadeViewProjections[i]) {
+            cascadeViewProjections[i] = viewProjection;
+            staticCascadeCacheMask &= ~(1u << i);
+        }
 
+        cascadeUpdateMask |= 1u << i;
         lastSplitDist = splitDist;
     }
 
-    memoryManager.copyToBuffer(cascadeViewProjectionBuffer, cascadeViewProjections.data(), sizeof(glm::mat4) * SHADOW_MAP_CASCADE_COUNT);
+    cascadeFrameIndex++;
 }
 
 void VkRenderer::UpdateScene() {
     const auto view = camera->ViewMatrix();
     const auto proj = camera->ProjectionMatrix();
 
-    sceneData.worldMatrix = proj * view;
-    memoryManager.copyToBuffer(sceneDataBuffer, &sceneData, sizeof(SceneData));
-    memoryManager.copyToBuffer(viewMatrix, &view, sizeof(glm::mat4));
+    if (!useRaytracing)
+        UpdateCascades();
+
+    // FOV, aspect ratio and clip plane changes all go through a projection rebuild
+    if (camera->ProjectionVersion() != clusterGridVersion) {
+        clusterGridVersion = camera->ProjectionVersion();
+        clusterGridDirty = true;
+    }
+
+    recordedView = view;
+    sceneData.viewportSize = {viewport.width, viewport.height};
+    sceneData.cascadeSplits = cascadeSplits.vec4;
+    sceneData.jitter = {camera->Jitter(), 0.0f, 0.0f};
+
+    // The camera itself is only written by LatchCamera, everything recorded in between refers to these slots
+    const auto cameraDataOffset = frameRing.Allocate(sizeof(CameraData), reinterpret_cast<void **>(&latchedCamera));
+    cameraDataAddress = frameRing.deviceAddress + cameraDataOffset;
+    // Pixels per unit of error at distance 1, follows the viewport as the render scale changes
+    const ClusterLodData lodData{
+        std::abs(proj[1][1]) * viewport.height * 0.5f,
+        lodErrorThreshold
+    };
+    dynamicOffsets = {frameRing.Allocate(sizeof(SceneData), reinterpret_cast<void **>(&latchedSceneData)), frameRing.Push(cascadeViewProjections),
+                      frameRing.Allocate(sizeof(glm::mat4), reinterpret_cast<void **>(&latchedView)), frameRing.Push(lodData),
+                      static_cast<uint32_t>(lightGridStride * currentFrame), static_cast<uint32_t>(lightIndexStride * currentFrame)};
 
     if (!meshShader)
         loadedScene.Draw(glm::mat4{1.f}, mainDrawContext);
@@ -2728,7 +3808,61 @@ void VkRenderer::UpdateScene() {
         rayTracing.BuildBLAS(this, mainDrawContext.opaqueSurfaces);
         rayTracing.BuildTLAS(this, mainDrawContext.opaqueSurfaces);
     }
-    // UpdateCascades();
+}
+
+// Cursor movement that came in while the frame was recorded still makes it in. The rotation is limited to LATE_LATCH_MAX_ANGLE
+// from the recorded camera, which the shadow cascades were fitted with room for, the rest shows up a frame later. Keyboard
+// movement was already applied before recording, so the position stays the same.
+void VkRenderer::LatchCamera() {
+    // Only the cursor is read, pumping events here would run every window callback in the middle of a frame
+    double xpos, ypos;
+    glfwGetCursorPos(glfwWindow, &xpos, &ypos);
+    camera->ProcessCursorPosition(xpos, ypos);
+
+    const glm::quat recorded = glm::quat_cast(glm::mat3(recordedView));
+    glm::quat latest = glm::quat_cast(glm::mat3(camera->ViewMatrix()));
+    const float cosHalfAngle = glm::dot(recorded, latest);
+    if (cosHalfAngle < 0.0f)
+        latest = -latest;
+
+    if (const float angle = 2.0f * std::acos(std::min(std::abs(cosHalfAngle), 1.0f)); angle > LATE_LATCH_MAX_ANGLE)
+        latest = glm::slerp(recorded, latest, LATE_LATCH_MAX_ANGLE / angle);
+
+    const glm::mat3 rotation = glm::mat3_cast(latest);
+    glm::mat4 view{rotation};
+    view[3] = glm::vec4(rotation * -camera->position, 1.0f);
+
+    // Nothing moved before the first frame
+    const auto unjitteredWorldMatrix = camera->UnjitteredProjectionMatrix() * view;
+    if (frameNumber <= 1) {
+        previousWorldMatrix = unjitteredWorldMatrix;
+        previousView = view;
+    }
+
+    sceneData.worldMatrix = camera->ProjectionMatrix() * view;
+    sceneData.cameraPosition = glm::vec4(camera->position, 1.f);
+    sceneData.previousWorldMatrix = previousWorldMatrix;
+
+    // The view rotation's rows are right, up and the negated front
+    const auto basis = glm::transpose(rotation);
+    const auto previousBasis = glm::transpose(glm::mat3(previousView));
+    const auto inverseView = glm::inverse(view);
+    *latchedCamera = {
+        view,
+        inverseView,
+        previousWorldMatrix * inverseView,
+        glm::vec4(-basis[2], 0.0f),
+        glm::vec4(basis[0], 0.0f),
+        glm::vec4(basis[1], 0.0f),
+        glm::vec4(-previousBasis[2], 0.0f),
+        glm::vec4(previousBasis[0], 0.0f),
+        glm::vec4(previousBasis[1], 0.0f)
+    };
+    *latchedSceneData = sceneData;
+    *latchedView = view;
+
+    previousWorldMatrix = unjitteredWorldMatrix;
+    previousView = view;
 }
 
 #ifndef NDEBUG
@@ -2759,32 +3893,33 @@ void VkRenderer::DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtils
 }
 #endif
 
-constexpr int multiplier = 16 * 9 * 6;
-
 void VkRenderer::CreateRandomLights() {
-    totalLights.lightCount = MAX_LIGHTS;
+    lights.resize(MAX_LIGHTS);
 
     std::random_device rd;
     std::mt19937 gen(rd());
 
     std::uniform_real_distribution disXZ(-15.f, 15.f);
     std::uniform_real_distribution disY(0.5f, 7.f);
+    std::uniform_real_distribution disRadius(0.5f, 2.f);
 
     std::uniform_real_distribution disColor(0.f, 1.f);
 
-    for (size_t i = 0; i < totalLights.lightCount; i++) {
-        // totalLights.lights[i].position = {20.0f, 20.0f, 0.0f, 10.f};
-        // totalLights.lights[i].color = {1.0f, 1.0f, 1.0f, 1.0f};
-        totalLights.lights[i].position = {disXZ(gen), disY(gen), disXZ(gen), 10.f};
-        totalLights.lights[i].color = {disColor(gen), disColor(gen), disColor(gen), 1.0f};
+    for (auto &light : lights) {
+        light.position = {disXZ(gen), disY(gen), disXZ(gen), disRadius(gen)};
+        light.color = {disColor(gen), disColor(gen), disColor(gen), 1.0f};
     }
 
+    // The shader sees a light count padded to 16 bytes followed by the lights
+    const VkDeviceSize lightBufferSize = sizeof(glm::uvec4) + sizeof(Light) * lights.size();
     lightBuffer = memoryManager.createManagedBuffer(
-            {sizeof(Light), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            {lightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
              VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
     const auto mappedMemoryTask = [&](auto *stagingBuffer) {
-        memcpy(stagingBuffer, &totalLights, sizeof(Light));
+        const glm::uvec4 lightCount{static_cast<uint32_t>(lights.size()), 0, 0, 0};
+        memcpy(stagingBuffer, &lightCount, sizeof(lightCount));
+        memcpy(static_cast<char *>(stagingBuffer) + sizeof(lightCount), lights.data(), sizeof(Light) * lights.size());
     };
 
     const auto unmappedMemoryTask = [&](auto buf) {
@@ -2792,7 +3927,7 @@ void VkRenderer::CreateRandomLights() {
             VkBufferCopy copyRegion{
                 0,
                 0,
-                sizeof(Light)
+                lightBufferSize
             };
 
             vkCmdCopyBuffer(cmd, buf, lightBuffer.buffer, 1, &copyRegion);
@@ -2801,37 +3936,72 @@ void VkRenderer::CreateRandomLights() {
 
     memoryManager.useStagingBuffer(mappedMemoryTask, unmappedMemoryTask);
 
-    visibleLightBuffer = memoryManager.createManagedBuffer({sizeof(LightVisibility) * multiplier,
-                                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                                                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
-                                                             VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0,
-                                                             VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-                                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    clusterGridBuffer = memoryManager.createManagedBuffer({sizeof(ClusterGridHeader) + sizeof(ClusterAABB) * CLUSTER_COUNT,
+                                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0,
+                                                           VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
-    lightCountUniform = memoryManager.createManagedBuffer({sizeof(uint16_t) * MAX_LIGHTS_VISIBLE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                                            0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    const auto alignment = deviceProperties.limits.minStorageBufferOffsetAlignment;
+    lightGridStride = (sizeof(LightGridHeader) + sizeof(glm::uvec2) * CLUSTER_COUNT + alignment - 1) & ~(alignment - 1);
+    lightIndexStride = (sizeof(uint32_t) * MAX_LIGHT_INDICES + alignment - 1) & ~(alignment - 1);
+
+    lightGridBuffer = memoryManager.createManagedBuffer({lightGridStride * MAX_FRAMES_IN_FLIGHT,
+                                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0,
+                                                         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
-    viewMatrix = memoryManager.createManagedBuffer({sizeof(glm::mat4), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                                        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VMA_MEMORY_USAGE_AUTO,
-                                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT});
+    lightIndexBuffer = memoryManager.createManagedBuffer({lightIndexStride * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                          0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
 
+    tileDepthBuffer = memoryManager.createManagedBuffer({sizeof(glm::uvec2) * CLUSTER_X * CLUSTER_Y, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                                         0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+
+    // Nothing is lit until the first culling pass runs
     TransferSubmit([&](auto &cmd) {
-        vkCmdFillBuffer(cmd, visibleLightBuffer.buffer, 0, sizeof(LightVisibility) * multiplier, 0);
+        vkCmdFillBuffer(cmd, lightGridBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
     });
 }
 
+// Places the transient images by their lifetimes in this frame's graph, then creates everything that views them
+void VkRenderer::AllocateTransientImages() {
+    transientImages.Allocate(device, memoryManager, renderGraph.TransientLifetimes());
+    transientImageSettings = TransientPassSettings();
+
+    if (!dynamicRendering)
+        CreateFramebuffers();
+
+    UpdateDescriptorSets();
+}
+
+void VkRenderer::ResetTransientImages() {
+    WaitForTimeline(graphicsTimeline, frameNumber - 1);
+    DestroyFramebuffers();
+    transientImages.Reset(device, memoryManager);
+    renderGraph.Reset();
+}
+
 void VkRenderer::UpdateDescriptorSets() {
     DescriptorWriter writer;
-    writer.WriteBuffer(0, lightBuffer.buffer, 0, sizeof(Light), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.WriteBuffer(1, visibleLightBuffer.buffer, 0, sizeof(LightVisibility) * multiplier, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.WriteBuffer(2, lightCountUniform.buffer, 0, sizeof(uint16_t) * MAX_LIGHTS_VISIBLE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(0, lightBuffer.buffer, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(1, clusterGridBuffer.buffer, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.WriteBuffer(2, lightGridBuffer.buffer, 0, sizeof(LightGridHeader) + sizeof(glm::uvec2) * CLUSTER_COUNT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+    writer.WriteBuffer(3, lightIndexBuffer.buffer, 0, sizeof(uint32_t) * MAX_LIGHT_INDICES, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC);
+    writer.WriteBuffer(4, tileDepthBuffer.buffer, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    // Depth can only be sampled when it's kept past the main pass
+    if (MayHaveDepthBeforeShading())
+        writer.WriteImage(5, depthImage.imageView, textureSamplerNearest, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.UpdateSet(device, mainDescriptorSet);
     writer.Clear();
+    writer.WriteBuffer(0, clusterGridBuffer.buffer, 0, VK_WHOLE_SIZE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.UpdateSet(device, frustumDescriptorSet);
+    writer.Clear();
     if (useRaytracing)
     {
         writer.WriteImage(0, rayTracing.radianceImage.imageView, rayTracing.radianceImage.sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-        writer.WriteImage(1, rayTracing.accumulatedImages[currentFrame].imageView, rayTracing.accumulatedImages[currentFrame].sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.WriteImage(1, rayTracing.accumulatedImages[currentFrame & 1].imageView, rayTracing.accumulatedImages[currentFrame & 1].sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     }
     else
     {
@@ -2839,10 +4009,11 @@ void VkRenderer::UpdateDescriptorSets() {
         writer.UpdateSet(device, skyboxDescriptorSet);
 
         writer.Clear();
-        writer.WriteBuffer(0, sceneDataBuffer.buffer, 0, sizeof(SceneData), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        writer.WriteBuffer(1, cascadeViewProjectionBuffer.buffer, 0, sizeof(glm::mat4) * SHADOW_MAP_CASCADE_COUNT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.WriteBuffer(0, frameRing.buffer.buffer, 0, sizeof(SceneData), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        writer.WriteBuffer(1, frameRing.buffer.buffer, 0, sizeof(glm::mat4) * SHADOW_MAP_CASCADE_COUNT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
         writer.WriteImage(2, shadowCascadeImage.imageView, shadowCascadeImage.sampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-        writer.WriteBuffer(3, viewMatrix.buffer, 0, sizeof(glm::mat4), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.WriteBuffer(3, frameRing.buffer.buffer, 0, sizeof(glm::mat4), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+        writer.WriteBuffer(10, frameRing.buffer.buffer, 0, sizeof(ClusterLodData), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
 
         if (meshShader) {
             size_t maxPositionCount = 0, maxMeshletCount = 0, maxVerticesCount = 0, maxPrimitiveCount = 0;
@@ -2858,31 +4029,91 @@ void VkRenderer::UpdateDescriptorSets() {
             writer.WriteBuffer(6, meshletVerticesBuffer.buffer, 0, sizeof(uint32_t) * maxVerticesCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
             writer.WriteBuffer(7, meshletPrimitivesBuffer.buffer, 0, sizeof(uint32_t) * maxPrimitiveCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
             // writer.WriteBuffer(8, VK_NULL_HANDLE, 0, 0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE); // TODO: fill this later
+            writer.WriteBuffer(9, clusterBuffer.buffer, 0, sizeof(MeshletCluster) * maxMeshletCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        } else {
+            writer.WriteImage(11, visibilityImage.imageView, textureSamplerNearest, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
         }
     }
 
     writer.UpdateSet(device, sceneDescriptorSet);
+
+    temporalUpscaler.UpdateDescriptorSets(device, sceneColorImage, velocityImage);
 }
 
-void VkRenderer::ComputeFrustum() {
-    std::array layouts = {frustumDescriptorSetLayout};
-    auto frustumDescriptorSet = mainDescriptorAllocator.Allocate(device, layouts);
+// Viewport, scissor and the cluster grid follow the render scale, the targets stay at the swap chain's size
+void VkRenderer::UpdateRenderExtent() {
+    renderExtent = renderScale.Apply(swapChainExtent);
+    viewport = {0.0f, 0.0f, static_cast<float>(renderExtent.width), static_cast<float>(renderExtent.height), 0.0f, 1.0f};
+    scissor = {{0, 0}, renderExtent};
+    clusterGridDirty = true;
+}
 
-    DescriptorWriter writer;
-    writer.WriteBuffer(0, visibleLightBuffer.buffer, 0, sizeof(LightVisibility) * multiplier, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.UpdateSet(device, frustumDescriptorSet);
+// Milliseconds between the two timestamps of the frame that last used this slot, once per frame that wrote them
+std::optional<float> VkRenderer::ReadGpuTime() {
+    if (!(timestampSlotsWritten & 1u << currentFrame))
+        return std::nullopt;
+
+    timestampSlotsWritten &= ~(1u << currentFrame);
 
-    FrustumPushConstants pushConstants {
-        inverse(camera->ProjectionMatrix()),
-        {swapChainExtent.width, swapChainExtent.height}
+    std::array<uint64_t, 2> timestamps{};
+    if (vkGetQueryPoolResults(device, timestampQueryPool, currentFrame * 2, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        return std::nullopt;
+
+    return static_cast<float>(timestamps[1] - timestamps[0]) * deviceProperties.limits.timestampPeriod / 1e6f;
+}
+
+// Rebuilds the view space cluster bounds, only needed when the projection or the viewport changes
+void VkRenderer::ComputeFrustum(const VkCommandBuffer &commandBuffer) const {
+    const FrustumPushConstants pushConstants {
+        inverse(camera->UnjitteredProjectionMatrix()),
+        {renderExtent.width, renderExtent.height},
+        {camera->nearPlane, camera->farPlane}
     };
 
-    ImmediateSubmit([&](auto &cmd) {
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, frustumPipeline);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, frustumPipelineLayout, 0, 1, &frustumDescriptorSet, 0, VK_NULL_HANDLE);
-        vkCmdPushConstants(cmd, frustumPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumPushConstants), &pushConstants);
-        vkCmdDispatch(cmd, 16, 9, 24);
-    });
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, frustumPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, frustumPipelineLayout, 0, 1, &frustumDescriptorSet, 0, VK_NULL_HANDLE);
+    vkCmdPushConstants(commandBuffer, frustumPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+}
+
+// Builds the per-cluster offset/count lists into the shared light index buffer
+void VkRenderer::CullLights(const VkCommandBuffer &commandBuffer, const LightDepthBounds depthBounds) const {
+    // Only the index counter needs resetting, every cluster rewrites its own offset/count pair
+    vkCmdFillBuffer(commandBuffer, lightGridBuffer.buffer, dynamicOffsets[SCENE_DYNAMIC_OFFSET_COUNT], sizeof(uint32_t), 0);
+
+    GlobalBarrier(commandBuffer, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &mainDescriptorSet, 2, dynamicOffsets.data() + SCENE_DYNAMIC_OFFSET_COUNT);
+
+    const ComputePushConstants pushConstants{
+        cameraDataAddress,
+        depthBounds
+    };
+
+    vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+}
+
+// The depth prepass and the visibility pass both finish depth before anything is shaded
+bool VkRenderer::HasDepthBeforeShading() const {
+    return MayHaveDepthBeforeShading() && (visibilityBuffer || mainDepthPrepass);
+}
+
+bool VkRenderer::MayHaveDepthBeforeShading() const {
+    return !useRaytracing && !meshShader;
+}
+
+uint8_t VkRenderer::TransientPassSettings() const {
+    return visibilityBuffer | mainDepthPrepass << 1;
+}
+
+// Min/max depth under each screen tile, light culling clamps its clusters to it
+void VkRenderer::ReduceTileDepth(const VkCommandBuffer &commandBuffer) const {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthReducePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &mainDescriptorSet, 2, dynamicOffsets.data() + SCENE_DYNAMIC_OFFSET_COUNT);
+    vkCmdDispatch(commandBuffer, CLUSTER_X, CLUSTER_Y, 1);
 }
 
 void VkRenderer::CreateSkybox() {
@@ -2895,44 +4126,121 @@ void VkRenderer::CreateSkybox() {
     ktxTexture_Destroy(skyboxTexture);
 }
 
+// The shadow map doesn't depend on the swap chain, keeping it alive across resizes also keeps the cached cascades valid
 void VkRenderer::CreateShadowCascades() {
-    cascadeViewProjectionBuffer = memoryManager.createManagedBuffer({sizeof(glm::mat4) * SHADOW_MAP_CASCADE_COUNT,
-                                                                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-                                                                      VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-                                                                      VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-                                                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT});
+    ImageViewCreateInfo viewCreateInfo{
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = VK_FORMAT_D16_UNORM,
+        .subresourceRange = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, SHADOW_MAP_CASCADE_COUNT}
+    };
 
-    for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
-        VkImageViewCreateInfo imageViewCreateInfo{
-                VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-                VK_NULL_HANDLE,
-                0,
-                shadowCascadeImage.image,
-                VK_IMAGE_VIEW_TYPE_2D_ARRAY,
-                VK_FORMAT_D16_UNORM,
-                {
-                        VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
-                        VK_COMPONENT_SWIZZLE_IDENTITY
-                },
-                {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1}
-        };
+    shadowCascadeImage = memoryManager.createUnmanagedImage(
+            {0, VK_FORMAT_D16_UNORM, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+             VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+             false, &viewCreateInfo});
+
+    shadowCacheImage = memoryManager.createUnmanagedImage(
+            {0, VK_FORMAT_D16_UNORM, {SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1}, VK_IMAGE_TILING_OPTIMAL,
+             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+             VK_IMAGE_LAYOUT_UNDEFINED, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+             false, &viewCreateInfo});
+
+    // Layouts both images are left in between cascade updates
+    ImmediateSubmit([&](auto &cmd) {
+        TransitionImage(cmd, shadowCascadeImage, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
+                        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+        TransitionImage(cmd, shadowCacheImage, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
+                        VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    });
+
+    staticCascadeCacheMask = 0;
+    dynamicCascadeMask = 0;
+
+    constexpr VkSamplerCreateInfo samplerInfo{
+            VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            VK_NULL_HANDLE,
+            0,
+            VK_FILTER_LINEAR,
+            VK_FILTER_LINEAR,
+            VK_SAMPLER_MIPMAP_MODE_LINEAR,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            0.0f,
+            VK_FALSE,
+            1.0f,
+            VK_FALSE,
+            VK_COMPARE_OP_NEVER,
+            0.0f,
+            1.0f,
+            VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+            VK_FALSE
+    };
 
-        VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, VK_NULL_HANDLE, &shadowCascades[i].shadowImageView));
+    VK_CHECK(vkCreateSampler(device, &samplerInfo, VK_NULL_HANDLE, &shadowCascadeImage.sampler));
 
+    if (layeredShadows) {
         if (!dynamicRendering) {
             VkFramebufferCreateInfo framebufferCreateInfo{
                 VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
                 VK_NULL_HANDLE,
                 0,
-                depthPrepassRenderPass,
+                shadowUpdateRenderPass,
                 1,
-                &shadowCascades[i].shadowImageView,
+                &shadowCascadeImage.imageView,
                 SHADOW_MAP_SIZE,
                 SHADOW_MAP_SIZE,
-                1
+                SHADOW_MAP_CASCADE_COUNT
             };
 
-            VK_CHECK(vkCreateFramebuffer(device, &framebufferCreateInfo, VK_NULL_HANDLE, &shadowCascades[i].shadowMapFramebuffer));
+            VK_CHECK(vkCreateFramebuffer(device, &framebufferCreateInfo, VK_NULL_HANDLE, &shadowMapFramebuffer));
+
+            framebufferCreateInfo.pAttachments = &shadowCacheImage.imageView;
+            VK_CHECK(vkCreateFramebuffer(device, &framebufferCreateInfo, VK_NULL_HANDLE, &shadowCacheFramebuffer));
         }
+        return;
     }
+
+    const auto createLayers = [&](const VulkanImage &image, std::array<ShadowLayer, SHADOW_MAP_CASCADE_COUNT> &layers) {
+        for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+            const VkImageViewCreateInfo imageViewCreateInfo{
+                    VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                    VK_NULL_HANDLE,
+                    0,
+                    image.image,
+                    VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+                    VK_FORMAT_D16_UNORM,
+                    {
+                            VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+                            VK_COMPONENT_SWIZZLE_IDENTITY
+                    },
+                    {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1}
+            };
+
+            VK_CHECK(vkCreateImageView(device, &imageViewCreateInfo, VK_NULL_HANDLE, &layers[i].imageView));
+
+            if (!dynamicRendering) {
+                const VkFramebufferCreateInfo framebufferCreateInfo{
+                    VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                    VK_NULL_HANDLE,
+                    0,
+                    shadowUpdateRenderPass,
+                    1,
+                    &layers[i].imageView,
+                    SHADOW_MAP_SIZE,
+                    SHADOW_MAP_SIZE,
+                    1
+                };
+
+                VK_CHECK(vkCreateFramebuffer(device, &framebufferCreateInfo, VK_NULL_HANDLE, &layers[i].framebuffer));
+            }
+        }
+    };
+
+    createLayers(shadowCascadeImage, shadowCascadeLayers);
+    createLayers(shadowCacheImage, shadowCacheLayers);
 }
@@ -23,23 +23,34 @@ using Microsoft::WRL::ComPtr;
 #include <vector>
 #include <detail/type_half.hpp>
 
+#include "common/frame_pacer.h"
 #include "engine/camera.h"
 #include "engine/objects/material.h"
 #include "engine/objects/render_object.h"
 #include "vk/memory/vk_memory.h"
+#include "vk/memory/vk_ring_buffer.h"
+#include "vk/memory/vk_transient_image_pool.h"
 #include "vk/vk_descriptor_layout.h"
+#include "vk/vk_pipeline_compiler.h"
+#include "vk/vk_render_graph.h"
+#include "vk/vk_render_scale.h"
+#include "vk/vk_shader_reloader.h"
+#include "vk/vk_temporal_upscaler.h"
 #include "engine/objects/gltf.h"
 
 // #define USE_DXGI_SWAPCHAIN
 
 static constexpr uint32_t SHADOW_MAP_CASCADE_COUNT = 4;
 static constexpr uint32_t SHADOW_MAP_SIZE = 4096;
+// Frames between refits of each cascade, far cascades cover more of the scene per texel and can lag behind the camera
+static constexpr std::array<uint32_t, SHADOW_MAP_CASCADE_COUNT> CASCADE_UPDATE_INTERVALS{1, 1, 2, 4};
+// Radians the camera may turn between recording and submission, the cascades are fitted with this much room around them
+static constexpr float LATE_LATCH_MAX_ANGLE = 0.035f;
 
 struct EngineStats;
 struct MeshAsset;
 static bool isVkRunning = false;
 
-constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 using hvec4 = glm::vec<4, glm::detail::hdata>;
 
 extern PFN_vkCmdDrawMeshTasksEXT fn_vkCmdDrawMeshTasksEXT;
@@ -69,47 +80,128 @@ struct FrameData {
     VkSemaphore imageAvailableSemaphore{};
     VkSemaphore renderFinishedSemaphore{};
 #endif
-    VkFence inFlightFence{};
 
     VkCommandPool commandPool{};
     VkCommandBuffer commandBuffer{};
+    VkCommandBuffer computeCommandBuffer{};
 
     DescriptorAllocator frameDescriptors;
 };
 
+// Written once per frame into the frame ring buffer
 struct SceneData {
     glm::mat4 worldMatrix;
+    glm::vec4 cameraPosition;
+    alignas(16) glm::ivec2 viewportSize;
+    alignas(16) glm::vec4 cascadeSplits;
+    // Unjittered, motion vectors are measured against it
+    glm::mat4 previousWorldMatrix;
+    glm::vec4 jitter; // xy = NDC offset of this frame's projection
 };
 
-struct DepthPassPushConstants {
+// Camera rotation for what takes it through a buffer reference instead of the scene set. Written with the scene data
+// right before the frame is submitted, so every pass reads the same latched camera.
+struct CameraData {
+    glm::mat4 view;
+    glm::mat4 inverseView;
+    // View space to the previous frame's unjittered clip space
+    glm::mat4 reprojection;
+    glm::vec4 front;
+    glm::vec4 right;
+    glm::vec4 up;
+    glm::vec4 previousFront;
+    glm::vec4 previousRight;
+    glm::vec4 previousUp;
+};
+
+// Per-draw data, fetched in mesh.vert through the draw index passed as the first instance.
+// The visibility buffer resolve also uses it to refetch the triangle behind each pixel.
+struct DrawData {
+    glm::mat4 worldMatrix;
     VkDeviceAddress vertexBufferDeviceAddress;
+    VkDeviceAddress indexBufferDeviceAddress;
+    uint32_t materialIndex;
+    uint32_t firstIndex;
+    uint32_t padding[2];
+};
+
+struct DepthPassPushConstants {
+    VkDeviceAddress drawDataBufferDeviceAddress;
+    VkDeviceAddress shadowInstanceBufferDeviceAddress;
+};
+
+// Routes one instance of a draw to one cascade layer of the shadow map
+struct ShadowInstance {
+    uint32_t drawIndex;
     uint32_t cascadeIndex;
 };
 
-#define MAX_LIGHTS 32
-#define MAX_LIGHTS_VISIBLE 256
+#define MAX_LIGHTS 10240
+// Cluster grid, must match tiled_shading.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+// Shared by all clusters, most of them only touch a handful of lights
+#define MAX_LIGHT_INDICES (CLUSTER_COUNT * 64)
 
 struct Light {
-    uint32_t lightCount;
-    alignas(8) struct {
-        glm::vec4 position;
-        glm::vec4 color;
-    } lights[MAX_LIGHTS];
+    glm::vec4 position; // xyz = position, w = radius
+    glm::vec4 color; // xyz = color, w = intensity
+};
+
+// View space bounds of one cluster, written by frustum.comp whenever the projection changes
+struct ClusterAABB {
+    glm::vec4 minPoint;
+    glm::vec4 maxPoint;
+};
+
+struct ClusterGridHeader {
+    glm::vec4 sliceParams; // x = scale, y = bias for log(depth) -> slice, z = near, w = far
+    glm::vec4 tileSize; // xy = pixels per cluster
+    glm::vec4 depthParams; // depth buffer value -> view space z, taken from the inverse projection
 };
 
-struct LightVisibility {
-    glm::vec4 minPoints;
-    glm::vec4 maxPoints;
-    uint16_t indices[MAX_LIGHTS_VISIBLE];
+// Rewritten by light_culling.comp every frame, followed by one offset/count pair per cluster
+struct LightGridHeader {
+    uint32_t lightIndexCount;
+    alignas(16) glm::vec4 viewDepthRow; // third row of the view matrix the lights were culled with
+};
+
+// How much of the per-tile depth range light culling may trust
+enum class LightDepthBounds : uint32_t {
+    None,
+    // Transparent surfaces can sit in front of the opaque depth, only clusters behind it are dropped
+    Far,
+    NearAndFar
 };
 
 struct ComputePushConstants {
-    alignas(16) glm::mat4 viewMatrix;
+    VkDeviceAddress camera;
+    LightDepthBounds depthBounds;
 };
 
 struct FrustumPushConstants {
-    alignas(16) glm::mat4 viewMatrix;
+    alignas(16) glm::mat4 inverseProjection;
     alignas(16) glm::ivec2 viewportSize;
+    glm::vec2 clipPlanes;
+};
+
+// One entry per meshlet, parallel to loadedMeshlets. A cluster is drawn when its own error is small enough on screen
+// but its parent's isn't, which gives a consistent cut through the simplification DAG.
+struct MeshletCluster {
+    glm::vec4 bounds; // xyz = center, w = radius (object space)
+    glm::vec4 parentBounds;
+    float error;
+    float parentError;
+    uint32_t level;
+    uint32_t padding;
+};
+
+struct ClusterLodData {
+    float projectionScale;
+    float errorThreshold;
 };
 
 // TODO: Replace error handling with a dialog box
@@ -120,22 +212,29 @@ public:
 // #else
     // explicit VkRenderer(GLFWwindow *window, Camera *camera, bool dynamicRendering = true, bool asyncCompute = true, bool meshShader = false);
     VkRenderer() = default;
-    void Initialize(GLFWwindow *, Camera *, bool dynamicRendering = true, bool asyncCompute = true, bool meshShader = false);
+    void Initialize(GLFWwindow *, Camera *, bool dynamicRendering = true, bool asyncCompute = true, bool meshShader = false, bool shaderObjects = false, bool pipelineLibraries = false, bool descriptorBuffer = false);
 // #endif
     ~VkRenderer();
     VkRenderer(const VkRenderer &) = delete;
     VkRenderer &operator=(const VkRenderer &) = delete;
     VkRenderer &operator=(VkRenderer &&) = delete;
 
+    // 0 for no limit
     uint16_t GetFPSLimit() const;
     void SetFPSLimit(uint16_t fps);
+    // 1 for the lowest latency, up to MAX_FRAMES_IN_FLIGHT for CPU/GPU overlap. Applied at the start of the next frame.
+    uint32_t GetFramesInFlight() const;
+    void SetFramesInFlight(uint32_t count);
 
+    // Waits for the next frame's resources and its slot in the frame limiter, input is sampled after this returns
+    void WaitForFrame(EngineStats &stats);
     void Render(EngineStats &stats);
-    void Draw(const VkCommandBuffer &commandBuffer, uint32_t imageIndex, EngineStats &stats);
-    void DrawMesh(const VkCommandBuffer &commandBuffer, uint32_t imageIndex, EngineStats &stats);
+    void Draw(const VkCommandBuffer &commandBuffer, EngineStats &stats);
+    void DrawMesh(const VkCommandBuffer &commandBuffer, EngineStats &stats);
     void DrawIndirect(const VkCommandBuffer &commandBuffer, uint32_t imageIndex, EngineStats &stats);
     void Shutdown();
     void RecreateSwapChain();
+    // Rebuilds every pipeline in the background, whether its shaders changed or not
     void ReloadShaders();
 
     Mesh CreateMesh(std::span<VkVertex> vertices, std::span<uint32_t> indices);
@@ -247,11 +346,24 @@ public:
         bool isIntegratedGPU : 1{};
         bool meshShader : 1{};
         bool allowTearing : 1{};
-        bool isShaderInvalidated: 1{};
 
         // offset: 2
 
         bool useRaytracing: 1{};
+        // Rasterize draw/triangle IDs only and shade opaque surfaces in a full screen resolve
+        bool visibilityBuffer: 1{};
+        // Lay down main view depth first so the forward pass only shades visible fragments
+        bool mainDepthPrepass: 1{};
+        // Bind material permutations as VK_EXT_shader_object shaders and dynamic state instead of pipelines
+        bool shaderObjects: 1{};
+        // Link material permutations from VK_EXT_graphics_pipeline_library parts compiled once each
+        bool pipelineLibraries: 1{};
+        // Write the ray tracing pass descriptors into a VK_EXT_descriptor_buffer instead of pool allocated sets
+        bool descriptorBuffer: 1{};
+        // The visibility pass writes gl_PrimitiveID, which needs the geometryShader feature
+        bool geometryShader: 1{};
+        // Casters pick their cascade with gl_Layer in one pass, which needs shaderOutputLayer
+        bool layeredShadows: 1{};
     };
     int32_t cascadeIndex = 0;
 
@@ -268,6 +380,12 @@ public:
 
     VkViewport viewport{};
     VkRect2D scissor{};
+    // Part of the swap chain sized targets the scene is rendered to, viewport and scissor cover it
+    VkExtent2D renderExtent{};
+    VkRenderScale renderScale{};
+    FramePacer framePacer{};
+    VkTemporalUpscaler temporalUpscaler{};
+    VkShaderReloader shaderReloader{};
 
 #if defined(_WIN32) && defined(USE_DXGI_SWAPCHAIN)
     ComPtr<ID3D12Device> d3dDevice;
@@ -300,6 +418,9 @@ public:
     // VkSwapchainKHR swapChain{};
     VkSurfaceFormatKHR surfaceFormat{};
     VkRenderPass renderPass{};
+    // Draws the UI over the upscaled scene, framebuffers in swapChainFramebuffers
+    VkRenderPass uiRenderPass{};
+    VkFramebuffer sceneFramebuffer{};
 
     VkMemoryManager memoryManager;
 
@@ -307,8 +428,21 @@ public:
     VkDeviceSize maxMemoryAllocationSize{};
     VkPhysicalDeviceMemoryProperties memoryProperties{};
 
+    // Scene color, velocity, depth, visibility and radiance images only hold data within a frame and are placed by the graph's lifetimes
+    VkTransientImagePool transientImages{};
+    // Settings the current placement was made for, see TransientPassSettings
+    uint8_t transientImageSettings{};
     VulkanImage depthImage{};
     VulkanImage shadowCascadeImage{};
+    // Static casters only, copied into shadowCascadeImage before dynamic casters are drawn on top
+    VulkanImage shadowCacheImage{};
+    // x = draw index, y = primitive ID, cleared to UINT32_MAX
+    VulkanImage visibilityImage{};
+    // Main pass output at renderExtent, upscaled onto the swap chain
+    VulkanImage sceneColorImage{};
+    // Screen space motion of every pixel of sceneColorImage since the previous frame, in UV units
+    VulkanImage velocityImage{};
+    static constexpr VkFormat velocityFormat = VK_FORMAT_R16G16_SFLOAT;
 
     DescriptorAllocator mainDescriptorAllocator{};
     VkDescriptorSet mainDescriptorSet{};
@@ -316,18 +450,35 @@ public:
     VkDescriptorSetLayout sceneDescriptorSetLayout{};
 
     VkDescriptorSet sceneDescriptorSet{};
-    VulkanBuffer sceneDataBuffer{};
+    // Scene data (binding 0), cascade matrices (binding 1), view matrix (binding 3) and cluster LOD data (binding 10) are
+    // dynamic uniform buffers in frameRing
+    // Scene set offsets (scene data, cascades, view, cluster LOD) followed by the main set's light grid and light index slices
+    static constexpr uint32_t SCENE_DYNAMIC_OFFSET_COUNT = 4;
+    std::array<uint32_t, SCENE_DYNAMIC_OFFSET_COUNT + 2> dynamicOffsets{};
+    VkRingBuffer frameRing{};
+    // This frame's DrawData array in frameRing, shared by the shadow, depth, visibility and forward passes
+    VkDeviceAddress drawDataAddress{};
+    // This frame's camera slots in frameRing, left empty until LatchCamera fills them
+    SceneData *latchedSceneData{};
+    glm::mat4 *latchedView{};
+    CameraData *latchedCamera{};
+    VkDeviceAddress cameraDataAddress{};
 
     VkPipeline depthPrepassPipeline{};
     VkPipelineLayout depthPrepassPipelineLayout{};
     VkRenderPass depthPrepassRenderPass{};
     VkFramebuffer depthPrepassFramebuffer{};
-    VkSemaphore depthPrepassSemaphore{};
-    VkFence depthPrepassFence{};
-    VkCommandBuffer depthPrepassCommandBuffer{};
 
     VkPipeline shadowMapPipeline{};
 
+    VkPipeline visibilityPipeline{};
+    VkPipeline visibilityResolvePipeline{};
+    VkPipeline mainDepthPrepassPipeline{};
+    // Scene, material and main sets with the draw data address visible to vertex and fragment stages
+    VkPipelineLayout drawDataPipelineLayout{};
+    VkRenderPass visibilityRenderPass{};
+    VkFramebuffer visibilityFramebuffer{};
+
     VkPipeline skyboxPipeline{};
     VkPipelineLayout skyboxPipelineLayout{};
     VkDescriptorSetLayout skyboxDescriptorSetLayout{};
@@ -336,15 +487,27 @@ public:
     VkPipeline computePipeline{};
     VkPipelineLayout computePipelineLayout{};
 
+    VkPipeline depthReducePipeline{};
+
     VkPipeline frustumPipeline{};
     VkPipelineLayout frustumPipelineLayout{};
     VkDescriptorSetLayout frustumDescriptorSetLayout{};
-
-    VkSemaphore computeFinishedSemaphore{};
-    VkFence computeFinishedFence{};
-    VkCommandBuffer computeCommandBuffer{};
+    VkDescriptorSet frustumDescriptorSet{};
+
+    // Frame N's graphics and compute batches signal N on their queue's timeline
+    VkSemaphore graphicsTimeline{};
+    VkSemaphore computeTimeline{};
+    uint64_t frameNumber = 0;
+    uint32_t framesInFlight = 2;
+    uint32_t requestedFramesInFlight = 2;
+    // Two timestamps per frame slot, null when the device can't time the graphics queue
+    VkQueryPool timestampQueryPool{};
+    // One bit per frame slot whose timestamps haven't been read back yet
+    uint32_t timestampSlotsWritten{};
 
     std::array<FrameData, MAX_FRAMES_IN_FLIGHT> frames;
+    // Declared from scratch every frame, keeps each resource's last use across frames
+    VkRenderGraph renderGraph{};
     VkCommandPool graphicsCommandPool{};
     VkCommandPool transferCommandPool{};
     VkCommandPool computeCommandPool{};
@@ -361,9 +524,14 @@ public:
     VulkanImage skyboxImage{};
 
     VulkanBuffer lightBuffer{};
-    VulkanBuffer visibleLightBuffer{};
-    VulkanBuffer lightCountUniform{};
-    VulkanBuffer viewMatrix{};
+    VulkanBuffer clusterGridBuffer{};
+    // One slice per frame in flight, so culling for the next frame never waits on this frame's shading
+    VulkanBuffer lightGridBuffer{};
+    VulkanBuffer lightIndexBuffer{};
+    VkDeviceSize lightGridStride{};
+    VkDeviceSize lightIndexStride{};
+    // Raw min/max depth per screen tile, reduced from the depth buffer when depth is laid down before shading
+    VulkanBuffer tileDepthBuffer{};
 
     RayTracing rayTracing{};
 
@@ -375,17 +543,37 @@ public:
     VkDrawContext mainDrawContext{};
     LoadedGLTF loadedScene{};
     SceneData sceneData{};
-
-    Light totalLights{};
-
-    struct ShadowCascade {
-        VkImageView shadowImageView;
-        VkFramebuffer shadowMapFramebuffer;
+    // Camera the frame was recorded with, the latched one may only turn LATE_LATCH_MAX_ANGLE away from it
+    glm::mat4 recordedView{};
+    // Last frame's latched camera
+    glm::mat4 previousView{};
+    glm::mat4 previousWorldMatrix{};
+
+    std::vector<Light> lights{};
+    // Camera projection the cluster grid was last built for
+    uint32_t clusterGridVersion{};
+    bool clusterGridDirty{true};
+
+    // Every cascade layer in one framebuffer, casters pick their layer with gl_Layer
+    VkFramebuffer shadowMapFramebuffer{};
+    VkFramebuffer shadowCacheFramebuffer{};
+
+    // One cascade layer as its own render target, for the pass per cascade taken without layeredShadows
+    struct ShadowLayer {
+        VkImageView imageView;
+        VkFramebuffer framebuffer;
     };
 
-    std::array<ShadowCascade, SHADOW_MAP_CASCADE_COUNT> shadowCascades{};
-    VulkanBuffer cascadeViewProjectionBuffer{};
+    std::array<ShadowLayer, SHADOW_MAP_CASCADE_COUNT> shadowCascadeLayers{};
+    std::array<ShadowLayer, SHADOW_MAP_CASCADE_COUNT> shadowCacheLayers{};
+    // Loads and keeps depth so individual cascade layers can be refreshed
+    VkRenderPass shadowUpdateRenderPass{};
     std::array<glm::mat4, SHADOW_MAP_CASCADE_COUNT> cascadeViewProjections{};
+    uint64_t cascadeFrameIndex{};
+    // One bit per cascade: refit this frame, static cache matches the current matrix, layer holds dynamic casters
+    uint32_t cascadeUpdateMask{};
+    uint32_t staticCascadeCacheMask{};
+    uint32_t dynamicCascadeMask{};
     union
     {
         std::array<float, SHADOW_MAP_CASCADE_COUNT> arr;
@@ -417,11 +605,14 @@ public:
     std::vector<uint32_t> meshletsVerticesData;
     std::vector<uint32_t> meshletsPrimitivesData;
 
+    std::vector<MeshletCluster> loadedClusters;
+
     struct MeshOffsets
     {
         uint32_t positionOffset;
         uint32_t vertexOffset;
         uint32_t primitiveOffset;
+        uint32_t meshletOffset;
     };
     std::vector<MeshOffsets> meshOffsets;
     // struct LoadedMeshlet
@@ -437,13 +628,15 @@ public:
     VulkanBuffer meshletBuffer{};
     VulkanBuffer meshletVerticesBuffer{};
     VulkanBuffer meshletPrimitivesBuffer{};
+    VulkanBuffer clusterBuffer{};
+    // Screen space error in pixels below which a cluster is considered good enough
+    float lodErrorThreshold = 1.0f;
     // std::vector<VulkanBuffer> positionBuffers{};
     // std::vector<VulkanBuffer> meshletBuffers{};
     // std::vector<VulkanBuffer> meshletVerticesBuffers{};
     // std::vector<VulkanBuffer> meshletPrimitivesBuffers{};
 
 private:
-    uint16_t fpsLimit = 60;
 #ifndef NDEBUG
     static constexpr std::array<const char *, 1> validationLayers = {
             "VK_LAYER_KHRONOS_validation"
@@ -469,8 +662,8 @@ private:
     inline void CreateSwapChain();
     inline void CreateRenderPass();
     inline void CreatePipelineLayout();
-    inline void CreateGraphicsPipeline();
-    inline void CreateComputePipeline();
+    inline void CreateGraphicsPipeline(VkPipelineCompiler &compiler);
+    inline void CreateComputePipeline(VkPipelineCompiler &compiler);
     inline void CreateFramebuffers();
     inline void CreateCommandPool();
     inline void CreateCommandBuffers();
@@ -485,23 +678,53 @@ private:
     inline static VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);
     [[nodiscard]] inline VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) const;
     inline void CleanupSwapChain();
+    inline void DestroyFramebuffers();
 
     inline void SavePipelineCache() const;
 
-    inline void UpdateScene();
+    inline void WaitForTimeline(VkSemaphore semaphore, uint64_t value) const;
 
-    inline void DrawObject(const VkCommandBuffer &commandBuffer, const VkRenderObject &draw, VkMaterialPipeline &lastPipeline, VkMaterialInstance &lastMaterialInstance, VkBuffer &lastIndexBuffer);
-    inline void DrawDepthPrepass(/*const std::vector<size_t> &drawIndices*/);
+    inline void UpdateScene();
+    inline void LatchCamera();
+
+    inline VkDeviceAddress UploadDrawData();
+    inline void DrawObject(const VkCommandBuffer &commandBuffer, const VkRenderObject &draw, uint32_t drawIndex, const VkMaterialPipeline *&lastPipeline, VkBuffer &lastIndexBuffer);
+    inline void BindMaterialPipeline(const VkCommandBuffer &commandBuffer, const VkMaterialPipeline &pipeline) const;
+    inline void BuildFrameGraph(uint32_t imageIndex, EngineStats &stats);
+    inline void DrawDepthPrepass(VkRenderGraph::Resource shadowCascades, EngineStats &stats);
+    inline void RecordShadowCasters(const VkCommandBuffer &commandBuffer, const VulkanImage &target, VkFramebuffer framebuffer, const std::array<ShadowLayer, SHADOW_MAP_CASCADE_COUNT> &layers, uint32_t layerMask, uint32_t clearMask, bool dynamicCasters, EngineStats &stats);
+    inline void DrawMainDepthPrepass(const VkCommandBuffer &commandBuffer, const MeshPushConstants &pushConstants, EngineStats &stats);
+    inline void DrawVisibility(const VkCommandBuffer &commandBuffer, const MeshPushConstants &pushConstants, EngineStats &stats);
+    inline void TraceRays(const VkCommandBuffer &commandBuffer);
     inline void DrawSkybox(const VkCommandBuffer &commandBuffer, EngineStats &stats) const;
-    inline void BeginDraw(const VkCommandBuffer &commandBuffer, uint32_t imageIndex) const;
-    inline void EndDraw(const VkCommandBuffer &commandBuffer, uint32_t imageIndex);
-
-    inline void ComputeFrustum();
+    inline void BeginMainPass(const VkCommandBuffer &commandBuffer, VkAttachmentLoadOp depthLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR) const;
+    inline void EndDraw(const VkCommandBuffer &commandBuffer) const;
+    inline void UpscaleScene(const VkCommandBuffer &commandBuffer);
+    inline void PresentScene(const VkCommandBuffer &commandBuffer, uint32_t imageIndex) const;
+    inline void DrawUi(const VkCommandBuffer &commandBuffer, uint32_t imageIndex) const;
+
+    inline void ComputeFrustum(const VkCommandBuffer &commandBuffer) const;
+    inline void CullLights(const VkCommandBuffer &commandBuffer, LightDepthBounds depthBounds = LightDepthBounds::None) const;
+    inline void ReduceTileDepth(const VkCommandBuffer &commandBuffer) const;
+    [[nodiscard]] inline bool HasDepthBeforeShading() const;
+    // The visibility buffer and the depth prepass are toggled at runtime, whatever is created once has to allow for both
+    [[nodiscard]] inline bool MayHaveDepthBeforeShading() const;
+    // Runtime settings that change which passes run, and with them the transient image lifetimes
+    [[nodiscard]] inline uint8_t TransientPassSettings() const;
 
     inline void CreateSkybox();
     inline void CreateShadowCascades();
 
     inline void CreateDepthImage();
+    inline void CreateVisibilityImage();
+    inline void CreateSceneColorImage();
+    inline void CreateVelocityImage();
+    inline void CreateHistoryImages();
+    inline void UpdateRenderExtent();
+    [[nodiscard]] inline std::optional<float> ReadGpuTime();
+    inline void AllocateTransientImages();
+    // Drops the placement once the frames using it have finished, the next AllocateTransientImages places them again
+    inline void ResetTransientImages();
 
     inline void UpdateDescriptorSets();
 